@@ -0,0 +1,454 @@
+// 채팅 서버 부하 생성기 / 지연 벤치마크
+// 수천 개의 연결을 열어 등록, 로그인, 방 입장을 마친 뒤 목표 속도로 메시지를 보내고
+// 메시지에 넣은 송신 시각으로 방송 지연(p50/p99/p999)과 처리량을 잰다.
+// --server를 주면 서버를 직접 띄우고 --workers 목록마다 한 번씩 돌려
+// 워커 수에 따른 처리량 변화를 비교한다. 결과는 한 줄에 JSON 하나씩 출력한다.
+// --metrics-port를 주면 서버 계측 값으로 전달 메시지당 쓰기 호출 수도 구한다.
+// --io-backend qt,epoll로 두 소켓 백엔드의 연결당 메모리와 메시지당 깨어남 수를 비교한다.
+// --nodes n이면 서버를 n개 프로세스로 묶어 띄우고 클라이언트를 노드마다 번갈아 붙여
+// 방 메시지가 노드 간 링크를 건너는 비용을 잰다 (계측 값과 메모리는 노드 0 기준).
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include "loadgen.h"
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+struct RunOptions {
+    LoadSettings load;
+    int threads = 1;
+    int connectRate = 2000;       // 초당 새 연결 수
+    double messageRate = 1000;    // 전체 초당 메시지 수
+    int setupTimeoutSecs = 60;
+    int warmupSecs = 2;
+    int durationSecs = 10;
+    qint64 serverPid = 0;         // 메모리를 읽을 서버 프로세스 (0이면 생략)
+    quint16 metricsPort = 0;      // 서버 계측 엔드포인트 (0이면 생략)
+};
+
+// /proc/<pid>/status 의 VmRSS, VmHWM (KiB)
+bool serverMemory(qint64 pid, qint64& rssKiB, qint64& peakKiB) {
+    QFile status(QString("/proc/%1/status").arg(pid));
+    if (pid <= 0 || !status.open(QIODevice::ReadOnly)) return false;
+
+    rssKiB = peakKiB = 0;
+    for (const QByteArray& line : status.readAll().split('\n')) {
+        QList<QByteArray> parts = line.simplified().split(' ');
+        if (parts.size() < 2) continue;
+        if (parts.at(0) == "VmRSS:") rssKiB = parts.at(1).toLongLong();
+        else if (parts.at(0) == "VmHWM:") peakKiB = parts.at(1).toLongLong();
+    }
+    return true;
+}
+
+// 서버의 /metrics를 읽어 이름별(레이블 무시) 합계를 만든다
+bool scrapeMetrics(const QString& host, quint16 port, QHash<QByteArray, double>& values) {
+    values.clear();
+    if (port == 0) return false;
+
+    QTcpSocket socket;
+    socket.connectToHost(host, port);
+    if (!socket.waitForConnected(1000)) return false;
+    socket.write("GET /metrics HTTP/1.0\r\n\r\n");
+    while (socket.state() == QAbstractSocket::ConnectedState && socket.waitForReadyRead(2000)) {}
+    QByteArray response = socket.readAll();
+
+    int body = response.indexOf("\r\n\r\n");
+    if (!response.startsWith("HTTP/1.0 200") || body < 0) return false;
+    for (const QByteArray& line : response.mid(body + 4).split('\n')) {
+        if (line.isEmpty() || line.startsWith('#')) continue;
+        int space = line.lastIndexOf(' ');
+        int brace = line.indexOf('{');
+        QByteArray name = line.left(brace >= 0 && brace < space ? brace : space);
+        values[name] += line.mid(space + 1).toDouble();
+    }
+    return true;
+}
+
+void pumpEvents(int ms) {
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < ms) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 20);
+        QThread::msleep(5);
+    }
+}
+
+// 연결 수가 기본 파일 디스크립터 한도(1024)를 넘으므로 최대치로 올린다.
+// 직접 띄우는 서버도 이 한도를 물려받는다.
+void raiseFileLimit() {
+#ifdef Q_OS_UNIX
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+bool waitForServer(const QString& host, quint16 port, int timeoutMs) {
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < timeoutMs) {
+        QTcpSocket probe;
+        probe.connectToHost(host, port);
+        if (probe.waitForConnected(200)) {
+            probe.abort();
+            return true;
+        }
+        QThread::msleep(100);
+    }
+    return false;
+}
+
+QJsonObject runOnce(const RunOptions& options) {
+    LoadShared shared;
+    shared.phase.storeRelease(LoadShared::Setup);
+
+    // 클라이언트를 스레드에 고르게 나눈다
+    QVector<QThread*> threads;
+    QVector<LoadWorker*> workers;
+    int clients = options.load.clients;
+    int threadCount = qBound(1, options.threads, clients);
+    for (int i = 0; i < threadCount; ++i) {
+        int first = clients * i / threadCount;
+        int count = clients * (i + 1) / threadCount - first;
+
+        LoadWorker *worker = new LoadWorker(options.load, &shared, first, count);
+        QThread *thread = new QThread;
+        thread->setObjectName(QString("bench-%1").arg(i));
+        worker->moveToThread(thread);
+        thread->start();
+
+        int connectRate = qMax(1, options.connectRate / threadCount);
+        QMetaObject::invokeMethod(worker, [worker, connectRate]() { worker->start(connectRate); },
+                                  Qt::QueuedConnection);
+        threads.append(thread);
+        workers.append(worker);
+    }
+
+    // 모두 방에 들어가거나 실패할 때까지 기다린다
+    QElapsedTimer setupTimer;
+    setupTimer.start();
+    while (shared.ready.loadAcquire() + shared.failed.loadAcquire() < clients
+           && setupTimer.elapsed() < qint64(options.setupTimeoutSecs) * 1000) {
+        pumpEvents(50);
+    }
+    qint64 setupMs = setupTimer.elapsed();
+
+    double perThread = options.messageRate / threadCount;
+    for (LoadWorker *worker : workers) {
+        QMetaObject::invokeMethod(worker, [worker, perThread]() { worker->setRate(perThread); },
+                                  Qt::QueuedConnection);
+    }
+
+    shared.phase.storeRelease(LoadShared::Warmup);
+    pumpEvents(options.warmupSecs * 1000);
+
+    qint64 rssBefore = 0, peakBefore = 0;
+    serverMemory(options.serverPid, rssBefore, peakBefore);
+    QHash<QByteArray, double> metricsBefore;
+    bool haveMetrics = scrapeMetrics(options.load.host, options.metricsPort, metricsBefore);
+
+    QElapsedTimer measureTimer;
+    measureTimer.start();
+    shared.phase.storeRelease(LoadShared::Measure);
+    pumpEvents(options.durationSecs * 1000);
+    shared.phase.storeRelease(LoadShared::Stopped);
+    double seconds = measureTimer.nsecsElapsed() / 1e9;
+
+    qint64 rss = 0, peak = 0;
+    bool haveMemory = serverMemory(options.serverPid, rss, peak);
+    QHash<QByteArray, double> metricsAfter;
+    haveMetrics = haveMetrics && scrapeMetrics(options.load.host, options.metricsPort, metricsAfter);
+
+    for (int i = 0; i < threadCount; ++i) {
+        LoadWorker *worker = workers.at(i);
+        QMetaObject::invokeMethod(worker, [worker]() { worker->stop(); }, Qt::BlockingQueuedConnection);
+        threads.at(i)->quit();
+        threads.at(i)->wait();
+    }
+
+    LatencyHistogram latency;
+    quint64 sent = 0, received = 0, expected = 0, errors = 0;
+    for (LoadWorker *worker : workers) {
+        latency.merge(worker->latency());
+        sent += worker->sentMessages();
+        received += worker->receivedMessages();
+        expected += worker->expectedDeliveries();
+        errors += worker->errorCount();
+    }
+    qDeleteAll(workers);
+    qDeleteAll(threads);
+
+    QJsonObject result;
+    result["clients"] = clients;
+    result["ready_clients"] = shared.ready.loadAcquire();
+    result["failed_clients"] = shared.failed.loadAcquire();
+    result["rooms"] = options.load.rooms;
+    result["threads"] = threadCount;
+    result["encoding"] = options.load.cbor ? "cbor" : "json";
+    result["compression"] = options.load.compress;
+    result["message_bytes"] = options.load.messageSize;
+    result["setup_ms"] = setupMs;
+    result["target_rate"] = options.messageRate;
+    result["duration_s"] = seconds;
+    result["sent"] = double(sent);
+    result["received"] = double(received);
+    result["expected_deliveries"] = double(expected);
+    result["send_rate"] = sent / seconds;
+    result["delivery_rate"] = received / seconds;
+    result["delivery_ratio"] = expected ? double(received) / double(expected) : 0.0;
+    result["errors"] = double(errors);
+
+    QJsonObject latencyUs;
+    latencyUs["p50"] = latency.percentile(50);
+    latencyUs["p99"] = latency.percentile(99);
+    latencyUs["p999"] = latency.percentile(99.9);
+    latencyUs["max"] = latency.max();
+    latencyUs["samples"] = double(latency.count());
+    result["latency_us"] = latencyUs;
+
+    if (haveMemory) {
+        QJsonObject memory;
+        memory["rss_kib"] = rss;
+        memory["peak_kib"] = peak;
+        memory["rss_growth_kib"] = rss - rssBefore;
+        memory["rss_per_client_bytes"] = clients ? double(rss) * 1024 / clients : 0.0;
+        result["server_memory"] = memory;
+    }
+    if (haveMetrics) {
+        // 측정 구간 동안 서버가 한 쓰기 호출과 내보낸 프레임
+        double writes = metricsAfter.value("chat_outbound_write_calls_total")
+                        - metricsBefore.value("chat_outbound_write_calls_total");
+        double frames = metricsAfter.value("chat_outbound_frames_total")
+                        - metricsBefore.value("chat_outbound_frames_total");
+        double bytes = metricsAfter.value("chat_outbound_bytes_total")
+                       - metricsBefore.value("chat_outbound_bytes_total");
+        QJsonObject server;
+        server["write_calls"] = writes;
+        server["frames"] = frames;
+        server["bytes"] = bytes;
+        server["write_calls_per_frame"] = frames > 0 ? writes / frames : 0.0;
+        server["write_calls_per_delivered_message"] = received ? writes / double(received) : 0.0;
+        result["server_writes"] = server;
+
+        // 소켓 때문에 서버 이벤트 루프가 깨어난 횟수 (백엔드 비교용)
+        double wakeups = metricsAfter.value("chat_io_wakeups_total") - metricsBefore.value("chat_io_wakeups_total");
+        double handled = metricsAfter.value("chat_message_duration_seconds_count")
+                         - metricsBefore.value("chat_message_duration_seconds_count");
+        QJsonObject io;
+        io["wakeups"] = wakeups;
+        io["messages_handled"] = handled;
+        io["wakeups_per_handled_message"] = handled > 0 ? wakeups / handled : 0.0;
+        io["wakeups_per_delivered_message"] = received ? wakeups / double(received) : 0.0;
+        result["server_io"] = io;
+
+        // 노드 0이 노드 간 링크로 주고받은 양 (보낸 메시지마다 링크를 몇 번 건넜는지)
+        double linkFrames = metricsAfter.value("chat_federation_frames_total")
+                            - metricsBefore.value("chat_federation_frames_total");
+        double linkBytes = metricsAfter.value("chat_federation_bytes_total")
+                           - metricsBefore.value("chat_federation_bytes_total");
+        if (linkFrames > 0) {
+            QJsonObject federation;
+            federation["node0_link_frames"] = linkFrames;
+            federation["node0_link_bytes"] = linkBytes;
+            federation["node0_link_frames_per_sent_message"] = sent ? linkFrames / double(sent) : 0.0;
+            federation["dropped_frames"] = metricsAfter.value("chat_federation_dropped_frames_total")
+                                           - metricsBefore.value("chat_federation_dropped_frames_total");
+            result["server_federation"] = federation;
+        }
+
+        // 압축에 쓴 CPU와 아낀 바이트 (방송 한 번의 압축을 모든 수신자가 나눠 쓴다)
+        double compressed = metricsAfter.value("chat_compressed_frames_total")
+                            - metricsBefore.value("chat_compressed_frames_total");
+        double bytesIn = metricsAfter.value("chat_compression_bytes_in_total")
+                         - metricsBefore.value("chat_compression_bytes_in_total");
+        double bytesOut = metricsAfter.value("chat_compression_bytes_out_total")
+                          - metricsBefore.value("chat_compression_bytes_out_total");
+        double cpuSeconds = metricsAfter.value("chat_compression_seconds_total")
+                            - metricsBefore.value("chat_compression_seconds_total");
+        double saved = metricsAfter.value("chat_compression_saved_bytes_total")
+                       - metricsBefore.value("chat_compression_saved_bytes_total");
+        if (bytesIn > 0) {
+            QJsonObject compression;
+            compression["compressed_encodings"] = compressed;
+            compression["bytes_in"] = bytesIn;
+            compression["bytes_out"] = bytesOut;
+            compression["ratio"] = bytesOut / bytesIn;
+            compression["cpu_seconds"] = cpuSeconds;
+            compression["egress_bytes_saved"] = saved;
+            compression["egress_saved_ratio"] = bytes + saved > 0 ? saved / (bytes + saved) : 0.0;
+            compression["cpu_us_per_kib_saved"] = saved > 0 ? cpuSeconds * 1e6 / (saved / 1024) : 0.0;
+            compression["cpu_us_per_delivered_message"] = received ? cpuSeconds * 1e6 / double(received) : 0.0;
+            result["server_compression"] = compression;
+        }
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    raiseFileLimit();
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption hostOption("host", "Server address (localhost only)", "host", "127.0.0.1");
+    QCommandLineOption portOption("port", "Server port", "port", "12345");
+    QCommandLineOption clientsOption("clients", "Number of connections", "n", "1000");
+    QCommandLineOption roomsOption("rooms", "Number of rooms the clients are spread over", "n", "10");
+    QCommandLineOption rateOption("rate", "Target messages per second (all clients)", "n", "1000");
+    QCommandLineOption sizeOption("message-size", "Chat message size in bytes", "bytes", "64");
+    QCommandLineOption durationOption("duration", "Measured seconds", "secs", "10");
+    QCommandLineOption warmupOption("warmup", "Warm-up seconds before measuring", "secs", "2");
+    QCommandLineOption threadsOption("threads", "Load generator threads", "n",
+                                     QString::number(qMax(1, QThread::idealThreadCount() / 2)));
+    QCommandLineOption connectRateOption("connect-rate", "New connections per second", "n", "2000");
+    QCommandLineOption jsonOption("json", "Use the JSON encoding instead of CBOR");
+    QCommandLineOption compressOption("compress", "Negotiate frame compression (compare against a run without it)");
+    QCommandLineOption serverOption("server", "chat_server binary to launch for each run", "path");
+    QCommandLineOption serverArgsOption("server-args", "Extra arguments for the launched server", "args");
+    QCommandLineOption workersOption("workers", "Comma separated --workers values to sweep (needs --server)",
+                                     "list");
+    QCommandLineOption metricsPortOption("metrics-port", "Server metrics port (launched servers get it passed)",
+                                         "port", "0");
+    QCommandLineOption backendOption("io-backend", "Comma separated server --io-backend values to compare "
+                                     "(qt, epoll; needs --server)", "list");
+    QCommandLineOption nodesOption("nodes", "Launch this many federated server processes on ports port, port+1, ... "
+                                   "(node links on port+100, ...; needs --server)", "n", "1");
+    QCommandLineOption pidOption("server-pid", "PID of an already running server (for memory figures)", "pid");
+    parser.addOption(hostOption);
+    parser.addOption(portOption);
+    parser.addOption(clientsOption);
+    parser.addOption(roomsOption);
+    parser.addOption(rateOption);
+    parser.addOption(sizeOption);
+    parser.addOption(durationOption);
+    parser.addOption(warmupOption);
+    parser.addOption(threadsOption);
+    parser.addOption(connectRateOption);
+    parser.addOption(jsonOption);
+    parser.addOption(compressOption);
+    parser.addOption(serverOption);
+    parser.addOption(serverArgsOption);
+    parser.addOption(workersOption);
+    parser.addOption(backendOption);
+    parser.addOption(nodesOption);
+    parser.addOption(pidOption);
+    parser.addOption(metricsPortOption);
+    parser.process(app);
+
+    RunOptions options;
+    options.load.host = parser.value(hostOption);
+    options.load.port = quint16(parser.value(portOption).toUInt());
+    options.load.clients = qMax(1, parser.value(clientsOption).toInt());
+    options.load.rooms = qMax(1, parser.value(roomsOption).toInt());
+    options.load.messageSize = qMax(32, parser.value(sizeOption).toInt());
+    options.load.cbor = !parser.isSet(jsonOption);
+    options.load.compress = parser.isSet(compressOption);
+    options.load.nodes = qBound(1, parser.value(nodesOption).toInt(), 64);
+    options.threads = qMax(1, parser.value(threadsOption).toInt());
+    options.connectRate = qMax(1, parser.value(connectRateOption).toInt());
+    options.messageRate = qMax(0.0, parser.value(rateOption).toDouble());
+    options.warmupSecs = qMax(0, parser.value(warmupOption).toInt());
+    options.durationSecs = qMax(1, parser.value(durationOption).toInt());
+    options.serverPid = parser.value(pidOption).toLongLong();
+    options.metricsPort = quint16(parser.value(metricsPortOption).toUInt());
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QString server = parser.value(serverOption);
+    QStringList sweep = parser.value(workersOption).split(',', QString::SkipEmptyParts);
+    QStringList backends = parser.value(backendOption).split(',', QString::SkipEmptyParts);
+    if ((!sweep.isEmpty() || !backends.isEmpty() || options.load.nodes > 1) && server.isEmpty()) {
+        err << "--workers, --io-backend and --nodes need --server to launch the server for each run\n";
+        return 1;
+    }
+    if (sweep.isEmpty()) sweep << QString();
+    if (backends.isEmpty()) backends << QString();
+
+    for (const QString& backend : backends) {
+        for (const QString& workers : sweep) {
+            // 이전 실행의 사용자와 겹치지 않도록 실행마다 접두어를 바꾼다
+            options.load.userPrefix = QString("bench%1_").arg(QDateTime::currentMSecsSinceEpoch());
+
+            // 노드마다 채팅 포트와 링크 포트를 달리 주고, 노드 목록은 모두 같게 준다
+            QStringList nodeList;
+            for (int node = 0; node < options.load.nodes; ++node) {
+                nodeList << QString("%1=127.0.0.1:%2").arg(node).arg(options.load.port + 100 + node);
+            }
+
+            QVector<QProcess*> processes;
+            bool started = true;
+            for (int node = 0; node < options.load.nodes && !server.isEmpty(); ++node) {
+                // 벤치 부하가 수신 한도나 과부하 차단에 걸리지 않게 끄고 시작한다 (--server-args가 뒤에 와서 이긴다)
+                QStringList args;
+                args << "--rate-limits" << "off" << "--overload-lag-ms" << "0" << "--overload-queue-mb" << "0";
+                args << parser.value(serverArgsOption).split(' ', QString::SkipEmptyParts);
+                if (!backend.isEmpty()) args << "--io-backend" << backend;
+                if (!workers.isEmpty()) args << "--workers" << workers;
+                if (options.metricsPort != 0 && node == 0) {
+                    args << "--metrics-port" << QString::number(options.metricsPort);
+                }
+                if (options.load.nodes > 1) {
+                    args << "--port" << QString::number(options.load.port + node)
+                         << "--nodes" << nodeList.join(',') << "--node-id" << QString::number(node);
+                }
+                // 서버 로그가 터미널 출력 비용으로 결과를 흐리지 않도록 버린다
+                QProcess *process = new QProcess;
+                process->setStandardOutputFile(QProcess::nullDevice());
+                process->setStandardErrorFile(QProcess::nullDevice());
+                process->start(server, args);
+                processes.append(process);
+                if (!process->waitForStarted(5000)
+                    || !waitForServer(options.load.host, quint16(options.load.port + node), 10000)) {
+                    err << "Failed to start " << server << " (node " << node << ")\n";
+                    started = false;
+                    break;
+                }
+            }
+            if (!processes.isEmpty()) options.serverPid = processes.first()->processId();
+
+            QJsonObject result;
+            if (started) {
+                // 노드 간 링크가 모두 이어질 시간을 준다
+                if (options.load.nodes > 1) pumpEvents(1500);
+                result = runOnce(options);
+                if (!backend.isEmpty()) result["server_io_backend"] = backend;
+                if (!workers.isEmpty()) result["server_workers"] = workers.toInt();
+                if (options.load.nodes > 1) result["server_nodes"] = options.load.nodes;
+                out << QJsonDocument(result).toJson(QJsonDocument::Compact) << "\n";
+                out.flush();
+            }
+
+            for (QProcess *process : processes) {
+                process->terminate();
+            }
+            for (QProcess *process : processes) {
+                if (!process->waitForFinished(5000)) {
+                    process->kill();
+                    process->waitForFinished();
+                }
+            }
+            qDeleteAll(processes);
+            if (!started) return 1;
+        }
+    }
+    return 0;
+}
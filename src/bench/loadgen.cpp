@@ -0,0 +1,299 @@
+#include "loadgen.h"
+#include <QtAlgorithms>
+#include <chrono>
+#include <cmath>
+
+namespace {
+    const int kConnectTickMs = 10;
+    const int kSendTickMs = 5;
+    const QLatin1String kBenchTag("BENCH ");
+}
+
+qint64 monotonicNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const int LatencyHistogram::kSubBits;
+const int LatencyHistogram::kMaxExponent;
+
+LatencyHistogram::LatencyHistogram()
+    : counts((kMaxExponent - kSubBits + 2) << kSubBits, 0) {}
+
+int LatencyHistogram::bucketFor(qint64 micros) {
+    const qint64 subCount = qint64(1) << kSubBits;
+    if (micros < subCount) return int(qMax<qint64>(0, micros));
+
+    // 최상위 비트로 옥타브를, 그 아래 kSubBits 비트로 칸을 정한다
+    int exponent = 63 - qCountLeadingZeroBits(quint64(micros));
+    exponent = qMin(exponent, kMaxExponent);
+    int shift = exponent - kSubBits;
+    qint64 sub = (micros >> shift) - subCount;
+    sub = qMin(sub, subCount - 1);
+    return int(((shift + 1) << kSubBits) + sub);
+}
+
+qint64 LatencyHistogram::valueFor(int bucket) {
+    const int subCount = 1 << kSubBits;
+    if (bucket < subCount) return bucket;
+    int shift = (bucket >> kSubBits) - 1;
+    qint64 sub = bucket & (subCount - 1);
+    // 칸의 가운데 값
+    return ((subCount + sub) << shift) + ((qint64(1) << shift) >> 1);
+}
+
+void LatencyHistogram::record(qint64 micros) {
+    ++counts[bucketFor(micros)];
+    ++total;
+    maxValue = qMax(maxValue, micros);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (int i = 0; i < counts.size(); ++i) {
+        counts[i] += other.counts.at(i);
+    }
+    total += other.total;
+    maxValue = qMax(maxValue, other.maxValue);
+}
+
+qint64 LatencyHistogram::percentile(double p) const {
+    if (total == 0) return 0;
+    quint64 target = quint64(std::ceil(p / 100.0 * double(total)));
+    target = qBound<quint64>(1, target, total);
+
+    quint64 seen = 0;
+    for (int i = 0; i < counts.size(); ++i) {
+        seen += counts.at(i);
+        if (seen >= target) return qMin(valueFor(i), maxValue);
+    }
+    return maxValue;
+}
+
+LoadWorker::LoadWorker(const LoadSettings& settings, LoadShared *shared, int firstClient, int clientCount,
+                       QObject *parent)
+    : QObject(parent), settings(settings), shared(shared), firstClient(firstClient) {
+    clients.reserve(clientCount);
+    for (int i = 0; i < clientCount; ++i) {
+        Client *client = new Client;
+        client->index = firstClient + i;
+        client->room = client->index % qMax(1, settings.rooms);
+        client->username = QString("%1%2").arg(settings.userPrefix).arg(client->index);
+        client->joinedText = client->username + " has joined the room";
+        clients.append(client);
+    }
+}
+
+LoadWorker::~LoadWorker() {
+    qDeleteAll(clients);
+}
+
+void LoadWorker::start(int connectsPerSecond) {
+    // 접속 폭주로 listen 백로그가 넘치지 않도록 나눠서 연결한다
+    connectsPerTick = qMax(1, connectsPerSecond * kConnectTickMs / 1000);
+    connectTimer = new QTimer(this);
+    connect(connectTimer, &QTimer::timeout, this, &LoadWorker::connectNext);
+    connectTimer->start(kConnectTickMs);
+
+    sendTimer = new QTimer(this);
+    sendTimer->setTimerType(Qt::PreciseTimer);
+    connect(sendTimer, &QTimer::timeout, this, &LoadWorker::sendTick);
+}
+
+void LoadWorker::connectNext() {
+    for (int n = 0; n < connectsPerTick && nextConnect < clients.size(); ++n, ++nextConnect) {
+        Client *client = clients.at(nextConnect);
+        client->socket = new QTcpSocket(this);
+        client->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+        connect(client->socket, &QTcpSocket::connected, this, [this, client]() {
+            client->state = Handshaking;
+            quint8 features = settings.cbor ? quint8(Protocol::FeatureCbor) : quint8(0);
+            if (settings.compress) {
+                features |= Protocol::FeatureCompression;
+                client->decoder.setAcceptCompressed(true);
+            }
+            client->socket->write(Protocol::helloPacket(features));
+        });
+        connect(client->socket, &QTcpSocket::readyRead, this, [this, client]() {
+            readFrom(*client);
+        });
+        connect(client->socket, &QTcpSocket::disconnected, this, [this, client]() {
+            if (client->state != Failed && shared->phase.loadAcquire() != LoadShared::Stopped) {
+                fail(*client);
+            }
+        });
+        connect(client->socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error),
+                this, [this, client](QAbstractSocket::SocketError) {
+            if (client->state == Connecting) fail(*client);
+        });
+
+        client->socket->connectToHost(settings.host, quint16(settings.port + client->index % settings.nodes));
+    }
+    if (nextConnect >= clients.size()) {
+        connectTimer->stop();
+    }
+}
+
+void LoadWorker::readFrom(Client& client) {
+    FrameDecoder::Mode before = client.decoder.mode();
+    QList<QByteArray> frames;
+    if (!client.decoder.feed(client.socket->readAll(), frames)) {
+        fail(client);
+        return;
+    }
+
+    if (before == FrameDecoder::Detect && client.decoder.mode() != FrameDecoder::Detect) {
+        client.format = Protocol::wireFormat(client.decoder.mode(), client.decoder.peerFeatures());
+        client.compressed = client.decoder.peerFeatures() & Protocol::FeatureCompression;
+        client.state = Registering;
+
+        QCborMap credentials;
+        credentials[QLatin1String("username")] = client.username;
+        credentials[QLatin1String("password")] = QLatin1String("bench");
+        send(client, MessageType::Register, credentials);
+    }
+
+    for (const QByteArray& frame : frames) {
+        MessageType type;
+        QCborMap fields;
+        if (Protocol::decodeMessage(client.format, frame, type, fields)) {
+            handleMessage(client, type, fields);
+        }
+    }
+}
+
+void LoadWorker::handleMessage(Client& client, MessageType type, const QCborMap& fields) {
+    switch (client.state) {
+    case Registering:
+        // 이미 있는 사용자(이전 실행)여도 그대로 로그인한다
+        if (type == MessageType::RegistrationSuccess || type == MessageType::Error) {
+            QCborMap credentials;
+            credentials[QLatin1String("username")] = client.username;
+            credentials[QLatin1String("password")] = QLatin1String("bench");
+            send(client, MessageType::Login, credentials);
+            client.state = LoggingIn;
+        }
+        break;
+    case LoggingIn:
+        if (type == MessageType::LoginSuccess) {
+            // 방이 이미 있으면 오류가 오지만 입장은 그대로 된다
+            QCborMap room;
+            room[QLatin1String("room")] = QString("bench-room-%1").arg(client.room);
+            send(client, MessageType::CreateRoom, room);
+            send(client, MessageType::JoinRoom, room);
+            client.state = Joining;
+        } else if (type == MessageType::Error) {
+            fail(client);
+        }
+        break;
+    case Joining:
+        if (type == MessageType::Message
+            && fields.value(QLatin1String("text")).toString() == client.joinedText) {
+            client.state = Ready;
+            readyClients.append(client.index - firstClient);
+            shared->ready.ref();
+        }
+        break;
+    case Ready:
+        if (type == MessageType::Message) {
+            QString text = fields.value(QLatin1String("text")).toString();
+            if (!text.startsWith(kBenchTag)) break;
+            if (shared->phase.loadAcquire() != LoadShared::Measure) break;
+
+            // "BENCH <보낸 시각 ns> ..."
+            int end = text.indexOf(QLatin1Char(' '), kBenchTag.size());
+            qint64 sentAt = text.midRef(kBenchTag.size(), end - kBenchTag.size()).toLongLong();
+            histogram.record((monotonicNanos() - sentAt) / 1000);
+            ++received;
+        } else if (type == MessageType::Error) {
+            ++errors;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void LoadWorker::send(Client& client, MessageType type, const QCborMap& fields) {
+    QByteArray frame = Protocol::encodeMessage(client.format, type, fields);
+    if (client.compressed) frame = Protocol::compressFrame(frame, Protocol::kDefaultCompressThreshold);
+    client.socket->write(frame);
+}
+
+void LoadWorker::fail(Client& client) {
+    if (client.state == Ready) {
+        readyClients.removeOne(client.index - firstClient);
+        shared->ready.deref();
+    }
+    client.state = Failed;
+    shared->failed.ref();
+}
+
+void LoadWorker::setRate(double messagesPerSecond) {
+    rate = messagesPerSecond;
+    budget = 0;
+    lastTickNs = monotonicNanos();
+    if (rate > 0) sendTimer->start(kSendTickMs);
+    else sendTimer->stop();
+}
+
+int LoadWorker::roomSize(int room) const {
+    int rooms = qMax(1, settings.rooms);
+    return settings.clients / rooms + (room < settings.clients % rooms ? 1 : 0);
+}
+
+void LoadWorker::sendTick() {
+    int phase = shared->phase.loadAcquire();
+    if (phase != LoadShared::Warmup && phase != LoadShared::Measure) return;
+    if (readyClients.isEmpty()) return;
+
+    // 타이머가 늦게 깨도 목표 속도를 지키도록 지난 시간만큼 몫을 쌓는다
+    qint64 now = monotonicNanos();
+    budget += rate * double(now - lastTickNs) / 1e9;
+    lastTickNs = now;
+
+    if (padding.isEmpty()) {
+        // 한 글자 반복은 압축률을 부풀리므로 단어를 섞어 평범한 채팅 문장처럼 채운다
+        static const char *const words[] = {
+            "the", "build", "is", "green", "again", "after", "lunch", "can", "someone", "review",
+            "my", "patch", "for", "the", "login", "timeout", "meeting", "moved", "to", "3pm",
+            "thanks", "ok", "sounds", "good", "deploying", "now", "rollback", "looks", "fine", "here"
+        };
+        const int wordCount = int(sizeof(words) / sizeof(words[0]));
+        int length = qMax(0, settings.messageSize - 32);
+        quint32 seed = quint32(firstClient) * 2654435761u + 1;
+        while (padding.size() < length) {
+            seed = seed * 1103515245u + 12345u;
+            padding += QLatin1String(words[(seed >> 16) % wordCount]);
+            padding += QLatin1Char(' ');
+        }
+        padding.truncate(length);
+    }
+
+    while (budget >= 1.0) {
+        budget -= 1.0;
+        nextSender = (nextSender + 1) % readyClients.size();
+        Client& client = *clients.at(readyClients.at(nextSender));
+
+        QCborMap message;
+        message[QLatin1String("text")] = kBenchTag + QString::number(monotonicNanos())
+                                         + QLatin1Char(' ') + padding;
+        send(client, MessageType::Message, message);
+
+        if (phase == LoadShared::Measure) {
+            ++sent;
+            expected += quint64(roomSize(client.room));
+        }
+    }
+}
+
+void LoadWorker::stop() {
+    if (connectTimer) connectTimer->stop();
+    if (sendTimer) sendTimer->stop();
+    for (Client *client : clients) {
+        if (client->socket) {
+            client->socket->disconnect(this);
+            client->socket->abort();
+        }
+    }
+}
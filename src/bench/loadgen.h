@@ -0,0 +1,137 @@
+#pragma once
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QString>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QVector>
+#include <QCborMap>
+#include "protocol.h"
+
+// 로그 선형 지연 히스토그램 (마이크로초, 옥타브당 128칸이라 오차 1% 미만)
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(qint64 micros);
+    void merge(const LatencyHistogram& other);
+    // p는 0~100
+    qint64 percentile(double p) const;
+    quint64 count() const { return total; }
+    qint64 max() const { return maxValue; }
+
+private:
+    static const int kSubBits = 7;
+    static const int kMaxExponent = 40;
+
+    static int bucketFor(qint64 micros);
+    static qint64 valueFor(int bucket);
+
+    QVector<quint64> counts;
+    quint64 total = 0;
+    qint64 maxValue = 0;
+};
+
+// 모든 부하 스레드가 함께 보는 설정과 진행 단계
+struct LoadSettings {
+    QString host = "127.0.0.1";
+    quint16 port = 12345;
+    int nodes = 1;                 // 페더레이션 노드 수 (클라이언트를 port, port+1, ...에 번갈아 붙인다)
+    int clients = 1000;
+    int rooms = 10;
+    int messageSize = 64;          // 채팅 본문 바이트 수 (타임스탬프 포함)
+    bool cbor = true;
+    bool compress = false;         // 압축(FeatureCompression)을 협상한다
+    QString userPrefix;            // 실행마다 다른 사용자 이름을 쓰기 위한 접두어
+};
+
+struct LoadShared {
+    enum Phase {
+        Setup,    // 접속, 등록, 로그인, 방 입장
+        Warmup,   // 보내지만 집계하지 않는다
+        Measure,  // 집계 구간
+        Stopped
+    };
+
+    QAtomicInt phase;
+    QAtomicInt ready;    // 방 입장까지 끝난 클라이언트
+    QAtomicInt failed;   // 접속/로그인 실패
+};
+
+// 부하 스레드 하나. 자기 이벤트 루프에서 맡은 클라이언트 연결을 모두 돌린다.
+class LoadWorker : public QObject {
+    Q_OBJECT
+
+public:
+    LoadWorker(const LoadSettings& settings, LoadShared *shared, int firstClient, int clientCount,
+               QObject *parent = nullptr);
+    ~LoadWorker();
+
+    // 아래 세 함수는 워커 스레드에서 호출된다 (invokeMethod)
+    void start(int connectsPerSecond);
+    void setRate(double messagesPerSecond);
+    void stop();
+
+    // 스레드가 끝난 뒤에 읽는다
+    const LatencyHistogram& latency() const { return histogram; }
+    quint64 sentMessages() const { return sent; }
+    quint64 receivedMessages() const { return received; }
+    quint64 expectedDeliveries() const { return expected; }
+    quint64 errorCount() const { return errors; }
+
+private:
+    enum State {
+        Connecting,
+        Handshaking,
+        Registering,
+        LoggingIn,
+        Joining,
+        Ready,
+        Failed
+    };
+
+    struct Client {
+        QTcpSocket *socket = nullptr;
+        FrameDecoder decoder;
+        Protocol::WireFormat format = Protocol::WireFormat::LegacyJson;
+        bool compressed = false;   // 서버가 압축을 받아들였다
+        State state = Connecting;
+        int index = 0;
+        int room = 0;
+        QString username;
+        QString joinedText;   // 방 입장 알림으로 준비 완료를 확인한다
+    };
+
+    void connectNext();
+    void readFrom(Client& client);
+    void handleMessage(Client& client, MessageType type, const QCborMap& fields);
+    void send(Client& client, MessageType type, const QCborMap& fields = QCborMap());
+    void fail(Client& client);
+    void sendTick();
+    int roomSize(int room) const;
+
+    LoadSettings settings;
+    LoadShared *shared;
+    int firstClient;
+    QVector<Client*> clients;
+    QVector<int> readyClients;      // 보낼 수 있는 클라이언트 (clients 인덱스)
+    int nextConnect = 0;
+    int nextSender = 0;
+    int connectsPerTick = 1;
+    QTimer *connectTimer = nullptr;
+    QTimer *sendTimer = nullptr;
+    double rate = 0;                // 이 스레드의 초당 메시지 수
+    double budget = 0;
+    qint64 lastTickNs = 0;
+    QString padding;
+
+    LatencyHistogram histogram;
+    quint64 sent = 0;
+    quint64 received = 0;
+    quint64 expected = 0;
+    quint64 errors = 0;
+};
+
+// 모든 스레드가 같은 기준으로 쓰는 단조 시계 (나노초)
+qint64 monotonicNanos();
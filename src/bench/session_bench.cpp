@@ -0,0 +1,141 @@
+// 세션 테이블 마이크로 벤치마크
+// 1) 유휴 연결 하나가 차지하는 메모리
+// 2) 채팅 메시지 하나를 방 참가자 목록까지 라우팅하는 비용
+// 을 기존 QMap 기반 구조와 세션/ID 기반 구조에 대해 측정한다.
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QTextStream>
+#include <QVector>
+#include <unistd.h>
+#include "clientconnection.h"
+#include "chatdirectory.h"
+
+namespace {
+
+struct LegacyUser {
+    QString username;
+    QString password;
+    QString currentRoom;
+};
+
+struct LegacyRoom {
+    QString name;
+    QSet<QTcpSocket*> participants;
+};
+
+qint64 residentBytes() {
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly)) return 0;
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.size() > 1 ? fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+}
+
+// 가짜 소켓 포인터 (역참조하지 않는다)
+QTcpSocket* fakeSocket(int i) {
+    return reinterpret_cast<QTcpSocket*>(quintptr(i + 1) * 64);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption connectionsOption("connections", "Number of idle connections", "n", "100000");
+    QCommandLineOption roomsOption("rooms", "Number of rooms", "n", "1000");
+    QCommandLineOption messagesOption("messages", "Number of routed messages", "n", "1000000");
+    parser.addOption(connectionsOption);
+    parser.addOption(roomsOption);
+    parser.addOption(messagesOption);
+    parser.process(app);
+
+    const int connectionCount = qMax(1, parser.value(connectionsOption).toInt());
+    const int roomCount = qMax(1, parser.value(roomsOption).toInt());
+    const int messageCount = qMax(1, parser.value(messagesOption).toInt());
+
+    QTextStream out(stdout);
+    out << "connections=" << connectionCount << " rooms=" << roomCount
+        << " messages=" << messageCount << "\n";
+
+    // 공통: 사용자와 방 이름
+    QVector<QString> usernames;
+    QVector<QString> roomNames;
+    usernames.reserve(connectionCount);
+    for (int i = 0; i < connectionCount; ++i) usernames.append(QString("user%1").arg(i));
+    for (int i = 0; i < roomCount; ++i) roomNames.append(QString("room%1").arg(i));
+
+    // ---- 기존 구조: QMap 세 개 ----
+    qint64 before = residentBytes();
+    QMap<QTcpSocket*, QString> activeUsers;
+    QMap<QString, LegacyUser> registeredUsers;
+    QMap<QString, LegacyRoom> chatRooms;
+    for (const QString& name : roomNames) chatRooms[name].name = name;
+    for (int i = 0; i < connectionCount; ++i) {
+        LegacyUser user;
+        user.username = usernames[i];
+        user.currentRoom = roomNames[i % roomCount];
+        registeredUsers[usernames[i]] = user;
+        activeUsers[fakeSocket(i)] = usernames[i];
+        chatRooms[user.currentRoom].participants.insert(fakeSocket(i));
+    }
+    qint64 legacyBytes = residentBytes() - before;
+
+    quintptr sink = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int m = 0; m < messageCount; ++m) {
+        QTcpSocket *socket = fakeSocket(m % connectionCount);
+        if (!activeUsers.contains(socket)) continue;
+        QString username = activeUsers[socket];
+        QString room = registeredUsers[username].currentRoom;
+        if (!chatRooms.contains(room)) continue;
+        for (QTcpSocket *member : chatRooms[room].participants) {
+            sink += quintptr(member);
+        }
+    }
+    qint64 legacyNs = timer.nsecsElapsed();
+
+    // ---- 세션 구조: 연결에 붙은 세션 + ID 인덱스 배열 ----
+    before = residentBytes();
+    OutboundLimits limits;
+    ChatDirectory directory;
+    QVector<ChatRoom*> rooms;
+    for (const QString& name : roomNames) rooms.append(directory.createRoom(name, QString()));
+    RoomMembers members;
+    QVector<ClientConnection*> connections;
+    connections.reserve(connectionCount);
+    for (int i = 0; i < connectionCount; ++i) {
+        ClientConnection *connection = new ClientConnection(limits);
+        connection->session.userId = quint32(i);
+        connection->session.username = usernames[i];
+        members.join(connection, rooms[i % roomCount]);
+        connections.append(connection);
+    }
+    qint64 sessionBytes = residentBytes() - before;
+
+    timer.restart();
+    for (int m = 0; m < messageCount; ++m) {
+        const Session& session = connections[m % connectionCount]->session;
+        if (!session.isLoggedIn() || !session.room) continue;
+        for (ClientConnection *member : members.members(session.room->id)) {
+            sink += quintptr(member->format);
+        }
+    }
+    qint64 sessionNs = timer.nsecsElapsed();
+
+    out << "legacy.bytes_per_connection=" << legacyBytes / connectionCount << "\n"
+        << "legacy.ns_per_message=" << legacyNs / messageCount << "\n"
+        << "session.sizeof_connection=" << sizeof(ClientConnection) << "\n"
+        << "session.bytes_per_connection=" << sessionBytes / connectionCount << "\n"
+        << "session.ns_per_message=" << sessionNs / messageCount << "\n"
+        << "sink=" << sink << "\n";
+
+    qDeleteAll(connections);
+    return 0;
+}
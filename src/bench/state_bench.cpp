@@ -0,0 +1,87 @@
+// 상태 복구 벤치마크
+// 사용자 수별로 서버 시작(복구) 시간을 잰다.
+// 1) WAL만 있을 때 전부 다시 적용하는 경우
+// 2) 스냅샷 + 그 뒤에 쌓인 WAL 꼬리만 적용하는 경우
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include "chatdirectory.h"
+#include "statestore.h"
+
+namespace {
+
+// 빈 디렉토리에 WAL 레코드를 count개 쓰고 한 번만 내린다
+void writeUsers(const QString& path, int from, int count) {
+    StateConfig config;
+    config.directory = path;
+    ChatDirectory directory;
+    StateStore store(config);
+    store.open(&directory);
+
+    quint64 seq = 0;
+    for (int i = from; i < from + count; ++i) {
+        seq = store.append(StateStore::RegisterUser, QString("user%1").arg(i), QString("password%1").arg(i));
+    }
+    store.sync(seq);
+}
+
+RecoveryStats recover(const QString& path, bool takeSnapshot) {
+    StateConfig config;
+    config.directory = path;
+    ChatDirectory directory;
+    StateStore store(config);
+    store.open(&directory);
+    directory.setJournal(&store);
+    if (takeSnapshot) store.snapshotNow();
+    return store.recoveryStats();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption usersOption("users", "Comma separated user counts", "list", "1000,10000,100000,500000");
+    QCommandLineOption tailOption("tail-percent", "WAL tail written after the snapshot (% of users)", "n", "10");
+    parser.addOption(usersOption);
+    parser.addOption(tailOption);
+    parser.process(app);
+
+    const int tailPercent = qBound(0, parser.value(tailOption).toInt(), 100);
+    QTextStream out(stdout);
+
+    for (const QString& value : parser.value(usersOption).split(',', QString::SkipEmptyParts)) {
+        const int users = qMax(1, value.toInt());
+        const int tail = users * tailPercent / 100;
+        QTemporaryDir dir;
+        if (!dir.isValid()) return 1;
+
+        // WAL만으로 복구 (복구가 끝나면 스냅샷을 찍어 다음 단계를 준비한다)
+        writeUsers(dir.path(), 0, users);
+        RecoveryStats walOnly = recover(dir.path(), true);
+        qint64 snapshotBytes = QFileInfo(dir.path() + "/snapshot.bin").size();
+
+        // 스냅샷 + 꼬리
+        writeUsers(dir.path(), users, tail);
+        RecoveryStats withSnapshot = recover(dir.path(), false);
+
+        out << "users=" << users
+            << " wal_only.ms=" << walOnly.totalMs
+            << " wal_only.replayed=" << walOnly.replayedRecords
+            << " snapshot.bytes=" << snapshotBytes
+            << " snapshot.load_ms=" << withSnapshot.snapshotMs
+            << " snapshot.tail_records=" << withSnapshot.replayedRecords
+            << " snapshot.tail_ms=" << withSnapshot.replayMs
+            << " snapshot.total_ms=" << withSnapshot.totalMs
+            << " recovered_users=" << withSnapshot.users << "\n";
+        out.flush();
+    }
+    return 0;
+}
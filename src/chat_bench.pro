@@ -0,0 +1,22 @@
+QT += core network
+QT -= gui
+
+TARGET = chat_bench
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# 빌드 디렉토리 설정
+DESTDIR = $$PWD/build/bench
+OBJECTS_DIR = $$PWD/build/bench/chat/.obj
+MOC_DIR = $$PWD/build/bench/chat/.moc
+
+INCLUDEPATH += $$PWD/common $$PWD/bench
+
+SOURCES += \
+    bench/chat_bench.cpp \
+    bench/loadgen.cpp \
+    common/protocol.cpp
+
+HEADERS += \
+    bench/loadgen.h \
+    common/protocol.h
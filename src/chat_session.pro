@@ -0,0 +1,29 @@
+QT += core network concurrent
+QT -= gui
+
+# 화면 없는 채팅 클라이언트 라이브러리 (봇, 통합 테스트용)
+# chat_client도 같은 소스를 쓴다
+TEMPLATE = lib
+TARGET = chat_session
+CONFIG += c++11 staticlib
+
+# 빌드 디렉토리 설정
+DESTDIR = $$PWD/build/lib
+OBJECTS_DIR = $$PWD/build/lib/session/.obj
+MOC_DIR = $$PWD/build/lib/session/.moc
+
+INCLUDEPATH += $$PWD/common $$PWD/client
+
+SOURCES += \
+    client/chatsession.cpp \
+    client/downloadjob.cpp \
+    client/filetransfer.cpp \
+    client/uploadjob.cpp \
+    common/protocol.cpp
+
+HEADERS += \
+    client/chatsession.h \
+    client/downloadjob.h \
+    client/filetransfer.h \
+    client/uploadjob.h \
+    common/protocol.h
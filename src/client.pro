@@ -1,4 +1,4 @@
-QT += core network widgets
+QT += core network widgets concurrent
 CONFIG += c++11
 
 TARGET = chat_client
@@ -9,9 +9,23 @@ DESTDIR = $$PWD/build/client
 OBJECTS_DIR = $$PWD/build/client/.obj
 MOC_DIR = $$PWD/build/client/.moc
 
+INCLUDEPATH += $$PWD/common
+
 SOURCES += \
     client/main.cpp \
-    client/client.cpp
+    client/client.cpp \
+    client/chatmodel.cpp \
+    client/chatsession.cpp \
+    client/downloadjob.cpp \
+    client/filetransfer.cpp \
+    client/uploadjob.cpp \
+    common/protocol.cpp
 
 HEADERS += \
-    client/client.h
\ No newline at end of file
+    client/client.h \
+    client/chatmodel.h \
+    client/chatsession.h \
+    client/downloadjob.h \
+    client/filetransfer.h \
+    client/uploadjob.h \
+    common/protocol.h
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "chatmodel.h"
+#include <QDateTime>
+
+const int ChatModel::kDefaultCapacity;
+const int ChatModel::kFlushIntervalMs;
+
+ChatModel::ChatModel(int capacity, QObject *parent)
+    : QAbstractListModel(parent), capacity(qMax(1, capacity)), ring(this->capacity) {
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(kFlushIntervalMs);
+    connect(&flushTimer, &QTimer::timeout, this, &ChatModel::flush);
+}
+
+int ChatModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : count;
+}
+
+QVariant ChatModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= count) return QVariant();
+    const ChatLine& line = ring.at(slot(index.row()));
+
+    // 화면에 보이는 행만 여기를 거치므로 문자열은 그때 만든다
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (line.kind) {
+        case ChatLine::Chat:
+            return line.sender.isEmpty() ? line.text : QString("%1: %2").arg(line.sender, line.text);
+        case ChatLine::File:
+            return QString("%1 shared a file: %2").arg(line.sender, line.text);
+        case ChatLine::Notice:
+            return line.text;
+        }
+        break;
+    case Qt::ToolTipRole:
+        // 한 줄로 잘린 긴 메시지는 툴팁으로 본다
+        if (line.time > 0) {
+            return QDateTime::fromMSecsSinceEpoch(line.time).toString("yyyy-MM-dd hh:mm:ss")
+                   + '\n' + line.text;
+        }
+        return line.text;
+    default:
+        break;
+    }
+    return QVariant();
+}
+
+void ChatModel::append(const ChatLine& line) {
+    pending.append(line);
+    // 뷰가 따라오지 못해도 대기 줄이 버퍼 크기의 두 배를 넘지 않게 한다
+    if (pending.size() >= 2 * capacity) {
+        pending.remove(0, pending.size() - capacity);
+    }
+    if (!flushTimer.isActive()) flushTimer.start();
+}
+
+void ChatModel::appendNotice(const QString& text) {
+    ChatLine line;
+    line.text = text;
+    append(line);
+}
+
+void ChatModel::flush() {
+    flushTimer.stop();
+    if (pending.isEmpty()) return;
+
+    // 한 번에 버퍼보다 많이 왔으면 최신 capacity줄만 남는다
+    int skip = qMax(0, pending.size() - capacity);
+    int n = pending.size() - skip;
+
+    // 자리가 모자라면 가장 오래된 줄부터 밀어낸다
+    int overflow = count + n - capacity;
+    if (overflow > 0) {
+        beginRemoveRows(QModelIndex(), 0, overflow - 1);
+        for (int i = 0; i < overflow; ++i) {
+            ring[slot(i)] = ChatLine();
+        }
+        head = slot(overflow);
+        count -= overflow;
+        endRemoveRows();
+    }
+
+    beginInsertRows(QModelIndex(), count, count + n - 1);
+    for (int i = 0; i < n; ++i) {
+        ring[slot(count + i)] = pending.at(skip + i);
+    }
+    count += n;
+    endInsertRows();
+
+    pending.clear();
+    emit flushed();
+}
+
+int ChatModel::prepend(const QVector<ChatLine>& older) {
+    // 새 줄을 밀어내면서까지 과거를 채우지는 않는다
+    int n = qMin(older.size(), capacity - count - pending.size());
+    if (n <= 0) return 0;
+
+    beginInsertRows(QModelIndex(), 0, n - 1);
+    head = (head - n + capacity) % capacity;
+    int first = older.size() - n;  // 가장 최근 쪽 n줄
+    for (int i = 0; i < n; ++i) {
+        ring[slot(i)] = older.at(first + i);
+    }
+    count += n;
+    endInsertRows();
+    return n;
+}
+
+void ChatModel::clear() {
+    flushTimer.stop();
+    pending.clear();
+    beginResetModel();
+    ring.fill(ChatLine());
+    head = 0;
+    count = 0;
+    endResetModel();
+}
+
+quint64 ChatModel::oldestSeq() const {
+    for (int row = 0; row < count; ++row) {
+        const ChatLine& line = ring.at(slot(row));
+        if (line.seq > 0) return line.seq;
+    }
+    return 0;
+}
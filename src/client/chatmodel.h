@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+#include "chatsession.h"
+
+// 채팅 창 모델
+// 최대 capacity줄을 담는 원형 버퍼라서 오래 켜 두어도 메모리가 늘지 않는다.
+// 새 줄은 바로 넣지 않고 모았다가 kFlushIntervalMs마다 한 번에 끼워 넣으므로
+// 초당 수천 줄이 와도 뷰는 프레임당 한 번만 행 변경을 받는다.
+class ChatModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    static const int kDefaultCapacity = 5000;
+    static const int kFlushIntervalMs = 16;   // 약 60Hz
+
+    explicit ChatModel(int capacity = kDefaultCapacity, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+    // 다음 flush에 맨 뒤로 들어간다
+    void append(const ChatLine& line);
+    void appendNotice(const QString& text);
+    // 더 오래된 기록(오래된 것부터)을 맨 앞에 바로 넣는다. 빈자리만큼만 넣고 넣은 줄 수를 돌려준다.
+    int prepend(const QVector<ChatLine>& older);
+    void clear();
+    // 모아 둔 줄을 지금 넣는다
+    void flush();
+
+    // 가진 줄 가운데 가장 오래된 메시지 번호 (없으면 0)
+    quint64 oldestSeq() const;
+    bool isFull() const { return count == capacity; }
+
+signals:
+    // 모아 둔 줄을 넣은 뒤 (뷰가 맨 아래를 따라갈지 정한다)
+    void flushed();
+
+private:
+    int slot(int row) const { return (head + row) % capacity; }
+
+    int capacity;
+    QVector<ChatLine> ring;
+    int head = 0;               // 0번 행의 위치
+    int count = 0;
+    QVector<ChatLine> pending;  // 다음 flush를 기다리는 줄
+    QTimer flushTimer;
+};
@@ -0,0 +1,923 @@
+#include "chatsession.h"
+#include "downloadjob.h"
+#include "uploadjob.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QRandomGenerator>
+#include <QUrl>
+#include <QtConcurrent>
+
+const int ChatSession::kRecentSeqs;
+
+ChatSession::ChatSession(const Options& options, QObject *parent)
+    : QObject(parent), options(options) {
+    connectTimer.setSingleShot(true);
+    connect(&connectTimer, &QTimer::timeout, this, [this]() {
+        if (sessionState == Connecting) connectFailed("Connection timed out");
+    });
+    reconnectTimer.setSingleShot(true);
+    connect(&reconnectTimer, &QTimer::timeout, this, &ChatSession::connectToServer);
+}
+
+ChatSession::~ChatSession() {
+    // 받던 파일은 진행 파일을 남겨 다음에 이어 받는다
+    for (DownloadJob *job : downloads) {
+        job->disconnect(this);
+        job->abort();
+    }
+}
+
+void ChatSession::connectToServer() {
+    if (socket) return;
+    closing = false;
+    reconnectTimer.stop();
+
+    decoder = FrameDecoder();
+    // 서버 핸드셰이크 바로 뒤에 압축 프레임이 같은 읽기로 올 수 있으므로 미리 받도록 해 둔다
+    decoder.setAcceptCompressed(options.compression);
+    format = Protocol::WireFormat::LegacyJson;
+    compressThreshold = 0;
+    sessionState = Connecting;
+    // 다시 접속한 서버는 기능이 다를 수 있으므로 파일 전송 방식을 새로 정한다
+    fileTransferReady = false;
+
+    socket = new QTcpSocket(this);
+    connect(socket, &QTcpSocket::connected, this, &ChatSession::onConnected);
+    connect(socket, &QTcpSocket::readyRead, this, &ChatSession::readFromServer);
+    connect(socket, &QTcpSocket::disconnected, this, [this]() {
+        if (sessionState == Disconnected) return;
+        sessionState = Disconnected;
+        awaitingResume = false;
+        socket->deleteLater();
+        socket = nullptr;
+        emit notice("Disconnected from chat server");
+        emit disconnected();
+        scheduleReconnect();
+    });
+    connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error),
+            this, [this](QAbstractSocket::SocketError) {
+        if (sessionState == Connecting) connectFailed(socket->errorString());
+    });
+
+    socket->connectToHost(options.host, options.port);
+    connectTimer.start(options.connectTimeoutMs);
+}
+
+void ChatSession::disconnectFromServer() {
+    closing = true;
+    if (sessionState == Reconnecting) {
+        reconnectTimer.stop();
+        sessionState = Disconnected;
+        pendingMessages.clear();
+    }
+    if (socket) socket->disconnectFromHost();
+}
+
+void ChatSession::scheduleReconnect() {
+    if (closing || !options.autoReconnect) {
+        pendingMessages.clear();
+        return;
+    }
+    // 서버가 다시 뜰 때 클라이언트가 한꺼번에 몰리지 않도록 대기 시간을 흔든다
+    int ceiling = options.reconnectMaxMs;
+    if (reconnectAttempt < 16) {
+        ceiling = int(qMin<qint64>(ceiling, qint64(options.reconnectMinMs) << reconnectAttempt));
+    }
+    int delay = ceiling / 2 + QRandomGenerator::global()->bounded(ceiling / 2 + 1);
+    ++reconnectAttempt;
+    sessionState = Reconnecting;
+    reconnectTimer.start(delay);
+    emit reconnecting(reconnectAttempt, delay);
+}
+
+void ChatSession::connectFailed(const QString& error) {
+    connectTimer.stop();
+    sessionState = Disconnected;
+    socket->disconnect(this);
+    socket->abort();
+    socket->deleteLater();
+    socket = nullptr;
+    emit connectionFailed(error);
+    scheduleReconnect();
+    // 채팅 서버가 없어도 FTP로는 파일을 주고받을 수 있다 (다시 접속할 거면 핸드셰이크를 보고 정한다)
+    if (sessionState == Disconnected) setupFileTransfer();
+}
+
+void ChatSession::onConnected() {
+    connectTimer.stop();
+    sessionState = Handshaking;
+    emit notice("Connected to chat server");
+
+    quint8 features = Protocol::FeatureRoomDeltas | Protocol::FeatureFileChannel | Protocol::FeatureHeartbeat
+                      | Protocol::FeatureResume | Protocol::FeatureMultiRoom;
+    if (options.cbor) features |= Protocol::FeatureCbor;
+    if (options.compression) features |= Protocol::FeatureCompression;
+    // 프레임 프로토콜 핸드셰이크. 구버전 서버는 이를 무시하고 JSON으로 응답한다
+    socket->write(Protocol::helloPacket(features));
+    // 응답이 없는 서버면 FTP로 파일을 주고받는다 (그 사이 끊겨 다시 접속했으면 새 연결이 정한다)
+    QTcpSocket *current = socket;
+    QTimer::singleShot(1000, this, [this, current]() {
+        if (socket == current && sessionState == Handshaking) setupFileTransfer();
+    });
+    emit connected();
+}
+
+void ChatSession::readFromServer() {
+    FrameDecoder::Mode before = decoder.mode();
+    QList<QByteArray> frames;
+    if (!decoder.feed(socket->readAll(), frames)) {
+        emit notice("Protocol error: " + decoder.errorString());
+        socket->abort();
+        return;
+    }
+
+    if (before == FrameDecoder::Detect && decoder.mode() != FrameDecoder::Detect) {
+        completeHandshake();
+    }
+
+    for (const QByteArray& frame : frames) {
+        processServerMessage(frame);
+    }
+}
+
+void ChatSession::completeHandshake() {
+    format = Protocol::wireFormat(decoder.mode(), decoder.peerFeatures());
+    compressThreshold = (decoder.peerFeatures() & Protocol::FeatureCompression)
+                        ? Protocol::kDefaultCompressThreshold : 0;
+    sessionState = Connected;
+    reconnectAttempt = 0;
+    multiRoom = decoder.peerFeatures() & Protocol::FeatureMultiRoom;
+    setupFileTransfer();
+
+    // 가지고 있는 목록 버전을 알려 바뀐 부분만 받는다
+    if (decoder.peerFeatures() & Protocol::FeatureRoomDeltas) {
+        requestRoomList();
+    }
+
+    if (!resumeToken.isEmpty() && (decoder.peerFeatures() & Protocol::FeatureResume)) {
+        // 모아 둔 요청은 세션을 이어 받은 뒤에 보낸다 (applyResumed)
+        QCborMap seqs;
+        for (auto it = seqWindows.constBegin(); it != seqWindows.constEnd(); ++it) {
+            seqs[it.key()] = qint64(it.value().lastSeq);
+        }
+        QCborMap request;
+        request[QLatin1String("token")] = QString::fromLatin1(resumeToken);
+        // 여러 방을 모르는 서버는 현재 방의 lastSeq만 본다
+        request[QLatin1String("lastSeq")] = qint64(seqWindows.value(joinedRoom).lastSeq);
+        request[QLatin1String("seqs")] = seqs;
+        awaitingResume = true;
+        transmit(MessageType::Resume, request);
+        return;
+    }
+    restoreSession();
+    flushPending();
+}
+
+void ChatSession::restoreSession() {
+    // 이어 받을 수 없으면 기억해 둔 계정으로 다시 로그인하고 있던 방들에 들어간다
+    resumeToken.clear();
+    if (!loggedInOnce) return;
+    QCborMap login;
+    login[QLatin1String("username")] = loginUsername;
+    login[QLatin1String("password")] = loginPassword;
+    transmit(MessageType::Login, login);
+    // 현재 방을 마지막에 들어가야 서버의 기본 방이 된다
+    QStringList order = joinedRooms;
+    if (order.removeOne(joinedRoom)) order.append(joinedRoom);
+    for (const QString& room : order) {
+        QCborMap join;
+        join[QLatin1String("room")] = room;
+        transmit(MessageType::JoinRoom, join);
+    }
+    for (const QString& room : order) {
+        resetSeqs(room);
+        emit resumed(room, false);
+    }
+}
+
+void ChatSession::applyResumed(const QCborMap& reply) {
+    awaitingResume = false;
+    if (!reply[QLatin1String("ok")].toBool()) {
+        emit notice("Session expired, logging in again");
+        restoreSession();
+    } else {
+        QString room = reply[QLatin1String("room")].toString();
+        QStringList rooms;
+        for (const QCborValue& name : reply[QLatin1String("rooms")].toArray()) {
+            rooms.append(name.toString());
+        }
+        if (rooms.isEmpty() && !room.isEmpty()) rooms.append(room);  // 여러 방을 모르는 서버
+        if (!rooms.contains(joinedRoom)) joinedRoom = room;
+        setSubscriptions(rooms);
+
+        // 놓친 만큼을 보관하고 있지 않았던 방은 입장할 때처럼 최근 기록부터 다시 받는다
+        QSet<QString> backfilled;
+        if (reply.contains(QLatin1String("backfilled"))) {
+            for (const QCborValue& name : reply[QLatin1String("backfilled")].toArray()) {
+                backfilled.insert(name.toString());
+            }
+        } else if (!reply[QLatin1String("complete")].toBool()) {
+            backfilled.insert(room);
+        }
+        for (const QString& name : rooms) {
+            if (backfilled.contains(name)) resetSeqs(name);
+            emit resumed(name, !backfilled.contains(name));
+        }
+    }
+    flushPending();
+}
+
+void ChatSession::flushPending() {
+    // 연결되기 전(이나 끊겨 있는 동안) 부른 요청을 순서대로 보낸다
+    QList<QPair<MessageType, QCborMap> > pending;
+    pending.swap(pendingMessages);
+    for (const auto& message : pending) {
+        transmit(message.first, message.second);
+    }
+}
+
+void ChatSession::send(MessageType type, const QCborMap& fields) {
+    if (sessionState != Connected || awaitingResume) {
+        if (pendingMessages.size() >= options.maxPendingMessages) {
+            pendingMessages.removeFirst();
+        }
+        pendingMessages.append(qMakePair(type, fields));
+        return;
+    }
+    transmit(type, fields);
+}
+
+void ChatSession::transmit(MessageType type, const QCborMap& fields) {
+    QByteArray frame = Protocol::encodeMessage(format, type, fields);
+    socket->write(compressThreshold > 0 ? Protocol::compressFrame(frame, compressThreshold) : frame);
+}
+
+void ChatSession::registerUser(const QString& username, const QString& password) {
+    QCborMap request;
+    request[QLatin1String("username")] = username;
+    request[QLatin1String("password")] = password;
+    send(MessageType::Register, request);
+}
+
+void ChatSession::login(const QString& username, const QString& password) {
+    loginUsername = username;
+    loginPassword = password;
+    // 서버는 로그인하면 들어가 있던 방을 모두 떠나고 공개 방에 넣는다 (LoginSuccess)
+    seqWindows.clear();
+    joinedRoom.clear();
+    setSubscriptions(QStringList());
+    QCborMap request;
+    request[QLatin1String("username")] = username;
+    request[QLatin1String("password")] = password;
+    send(MessageType::Login, request);
+}
+
+void ChatSession::createRoom(const QString& name, const QString& password) {
+    QCborMap request;
+    request[QLatin1String("room")] = name;
+    if (!password.isEmpty()) request[QLatin1String("password")] = password;
+    send(MessageType::CreateRoom, request);
+}
+
+void ChatSession::joinRoom(const QString& name) {
+    QCborMap request;
+    request[QLatin1String("room")] = name;
+    // 이미 구독한 방이면 서버는 기록을 다시 보내므로 처음 들어갈 때처럼 받는다
+    joinedRoom = name;
+    resetSeqs(name);
+    QStringList rooms = hasMultiRoom() ? joinedRooms : QStringList();  // 구버전 서버는 이전 방을 떠난다
+    if (!rooms.contains(name)) rooms.append(name);
+    setSubscriptions(rooms);
+    send(MessageType::JoinRoom, request);
+}
+
+void ChatSession::leaveRoom(const QString& name) {
+    if (!joinedRooms.contains(name)) return;
+    if (!hasMultiRoom()) {
+        emit notice("This server keeps one room per connection");
+        return;
+    }
+    QCborMap request;
+    request[QLatin1String("room")] = name;
+    send(MessageType::LeaveRoom, request);
+
+    // 서버처럼 남은 방 중 마지막에 들어간 방이 현재 방이 된다
+    seqWindows.remove(name);
+    QStringList rooms = joinedRooms;
+    rooms.removeOne(name);
+    if (joinedRoom == name) joinedRoom = rooms.isEmpty() ? QString() : rooms.last();
+    setSubscriptions(rooms);
+}
+
+void ChatSession::selectRoom(const QString& name) {
+    if (!joinedRooms.contains(name)) return;
+    joinedRoom = name;
+    if (fileChannel && catalogRoom != name) requestFileCatalog();
+}
+
+void ChatSession::setSubscriptions(const QStringList& rooms) {
+    if (rooms == joinedRooms) return;
+    joinedRooms = rooms;
+    emit subscriptionsChanged(joinedRooms);
+}
+
+void ChatSession::tagRoom(QCborMap& request, const QString& room) const {
+    QString name = room.isEmpty() ? joinedRoom : room;
+    if (!name.isEmpty()) request[QLatin1String("room")] = name;
+}
+
+QStringList ChatSession::messageRooms(const QCborMap& msg) const {
+    QStringList names;
+    QCborValue rooms = msg.value(QLatin1String("rooms"));
+    if (rooms.isArray()) {
+        for (const QCborValue& name : rooms.toArray()) {
+            if (joinedRooms.contains(name.toString())) names.append(name.toString());
+        }
+        return names;
+    }
+    // 방 이름이 없으면 한 방만 구독하는 구버전 서버다
+    QString room = msg.value(QLatin1String("room")).toString();
+    if (room.isEmpty()) {
+        names.append(joinedRoom);
+    } else if (joinedRooms.contains(room) || !hasMultiRoom()) {
+        names.append(room);  // 떠난 방에 이미 보내진 메시지는 버린다
+    }
+    return names;
+}
+
+bool ChatSession::acceptSeq(const QString& room, quint64 seq) {
+    // 번호가 없는 안내는 거르지 않는다
+    if (seq == 0) return true;
+    SeqWindow& window = seqWindows[room];
+    if (window.recent.contains(seq)) return false;
+    window.recent.insert(seq);
+    window.order.append(seq);
+    if (window.order.size() > kRecentSeqs) {
+        window.recent.remove(window.order.takeFirst());
+    }
+    window.lastSeq = qMax(window.lastSeq, seq);
+    return true;
+}
+
+void ChatSession::resetSeqs(const QString& room) {
+    seqWindows.remove(room);
+}
+
+void ChatSession::sendMessage(const QString& text, const QString& room) {
+    QCborMap request;
+    request[QLatin1String("text")] = text;
+    tagRoom(request, room);
+    send(MessageType::Message, request);
+}
+
+void ChatSession::requestHistory(quint64 beforeSeq, int limit, const QString& room) {
+    QCborMap request;
+    request[QLatin1String("beforeSeq")] = qint64(beforeSeq);
+    request[QLatin1String("limit")] = limit;
+    tagRoom(request, room);
+    send(MessageType::HistoryRequest, request);
+}
+
+void ChatSession::processServerMessage(const QByteArray& data) {
+    MessageType type;
+    QCborMap msg;
+    if (!Protocol::decodeMessage(format, data, type, msg)) return;
+
+    switch (type) {
+    case MessageType::Message: {
+        ChatLine line;
+        line.kind = ChatLine::Chat;
+        line.seq = quint64(msg[QLatin1String("seq")].toInteger());
+        line.time = msg[QLatin1String("time")].toInteger();
+        line.sender = msg[QLatin1String("sender")].toString();
+        line.text = msg[QLatin1String("text")].toString();
+        // 여러 방에 한 번에 보낸 안내는 방마다 한 줄씩 보인다
+        for (const QString& room : messageRooms(msg)) {
+            if (!acceptSeq(room, line.seq)) continue;
+            line.room = room;
+            emit messageReceived(line);
+        }
+        break;
+    }
+    case MessageType::FileAvailable: {
+        QStringList rooms = messageRooms(msg);
+        if (rooms.isEmpty() || !acceptSeq(rooms.first(), quint64(msg[QLatin1String("seq")].toInteger()))) break;
+        QString filename = msg[QLatin1String("filename")].toString();
+        if (fileChannel) {
+            // 목록은 fileCatalogDelta로 바뀐다
+            ChatLine line;
+            line.kind = ChatLine::File;
+            line.room = rooms.first();
+            line.seq = quint64(msg[QLatin1String("seq")].toInteger());
+            line.time = msg[QLatin1String("time")].toInteger();
+            line.sender = msg[QLatin1String("uploader")].toString();
+            line.text = filename;
+            emit messageReceived(line);
+        } else if (!files.contains(filename)) {
+            ChatFile file;
+            file.name = filename;
+            files.insert(filename, file);
+            emit fileChanged(file);
+        }
+        break;
+    }
+    case MessageType::FileCatalog:
+        applyFileCatalog(msg);
+        break;
+    case MessageType::FileCatalogDelta:
+        applyFileCatalogDelta(msg);
+        break;
+    case MessageType::FileTicket:
+        startFileTransfer(msg);
+        break;
+    case MessageType::Error:
+        emit serverError(msg[QLatin1String("message")].toString());
+        break;
+    case MessageType::RegistrationSuccess:
+        emit registered();
+        break;
+    case MessageType::LoginSuccess:
+        // 서버가 이어 받기를 모르면 토큰이 없다
+        resumeToken = msg[QLatin1String("token")].toString().toLatin1();
+        loggedInOnce = true;
+        {
+            // 로그인하면서 들어간 공개 방. 로그인 뒤에 보낸 입장 요청이 이미 목록에 있을 수 있다.
+            QString room = msg[QLatin1String("room")].toString();
+            if (!room.isEmpty() && !joinedRooms.contains(room) && (hasMultiRoom() || joinedRooms.isEmpty())) {
+                resetSeqs(room);
+                if (joinedRoom.isEmpty()) joinedRoom = room;
+                setSubscriptions(QStringList(joinedRooms) << room);
+            }
+        }
+        emit loggedIn();
+        break;
+    case MessageType::Resumed:
+        applyResumed(msg);
+        break;
+    case MessageType::RoomList:
+        applyRoomList(msg[QLatin1String("rooms")].toArray());
+        roomListEpoch = msg[QLatin1String("epoch")].toInteger();
+        roomListVersion = quint64(msg[QLatin1String("version")].toInteger());
+        break;
+    case MessageType::RoomListDelta:
+        applyRoomListDelta(msg);
+        break;
+    case MessageType::FileUploaded:
+        emit notice("New file available: " + msg[QLatin1String("filename")].toString());
+        if (networkManager) updateFtpFileList();  // 파일 리스트 업데이트
+        break;
+    case MessageType::HistoryBatch:
+        applyHistoryBatch(msg);
+        break;
+    case MessageType::Ping:
+        // 조용히 있어도 서버가 연결을 끊지 않도록 바로 답한다 (이어 받는 중에도)
+        transmit(MessageType::Pong);
+        break;
+    default:
+        break;
+    }
+}
+
+void ChatSession::applyHistoryBatch(const QCborMap& batch) {
+    // 이전 대화 (오래된 것부터)
+    QString room = batch[QLatin1String("room")].toString();
+    if (joinedRoom.isEmpty() && !room.isEmpty() && !hasMultiRoom()) {
+        // 구버전 서버는 로그인 응답에 공개 방 이름이 없어 입장 기록으로 안다
+        joinedRoom = room;
+        setSubscriptions(QStringList(room));
+    }
+    QStringList rooms = messageRooms(batch);
+    if (rooms.isEmpty()) return;  // 떠난 방의 기록
+    SeqWindow& window = seqWindows[rooms.first()];
+    QVector<ChatLine> lines;
+    for (const QCborValue& value : batch[QLatin1String("messages")].toArray()) {
+        QCborMap item = value.toMap();
+        ChatLine line;
+        line.seq = quint64(item[QLatin1String("seq")].toInteger());
+        line.time = item[QLatin1String("time")].toInteger();
+        line.room = rooms.first();
+        window.lastSeq = qMax(window.lastSeq, line.seq);
+        if (Protocol::typeFromName(item[QLatin1String("kind")].toString()) == MessageType::FileAvailable) {
+            line.kind = ChatLine::File;
+            line.sender = item[QLatin1String("uploader")].toString();
+            line.text = item[QLatin1String("filename")].toString();
+        } else {
+            line.kind = ChatLine::Chat;
+            line.sender = item[QLatin1String("sender")].toString();
+            line.text = item[QLatin1String("text")].toString();
+        }
+        lines.append(line);
+    }
+    emit historyReceived(rooms.first(), lines, batch[QLatin1String("hasMore")].toBool());
+}
+
+void ChatSession::requestRoomList() {
+    QCborMap request;
+    request[QLatin1String("epoch")] = roomListEpoch;
+    request[QLatin1String("version")] = qint64(roomListVersion);
+    send(MessageType::RoomListRequest, request);
+}
+
+void ChatSession::applyRoomList(const QCborArray& list) {
+    // 전체 목록도 달라진 항목만 알린다 (화면의 선택이 유지되도록)
+    QSet<QString> names;
+    for (const QCborValue& room : list) {
+        names.insert(room.toString());
+    }
+    QSet<QString> removed = rooms;
+    removed.subtract(names);
+    for (const QString& name : removed) {
+        rooms.remove(name);
+        emit roomRemoved(name);
+    }
+    for (const QString& name : names) {
+        if (rooms.contains(name)) continue;
+        rooms.insert(name);
+        emit roomAdded(name);
+    }
+}
+
+void ChatSession::applyRoomListDelta(const QCborMap& delta) {
+    qint64 epoch = delta[QLatin1String("epoch")].toInteger();
+    quint64 from = quint64(delta[QLatin1String("from")].toInteger());
+    if (epoch != roomListEpoch || from != roomListVersion) {
+        requestRoomList();  // 중간 변경을 놓쳤다
+        return;
+    }
+
+    for (const QCborValue& room : delta[QLatin1String("removed")].toArray()) {
+        if (rooms.remove(room.toString())) emit roomRemoved(room.toString());
+    }
+    for (const QCborValue& room : delta[QLatin1String("added")].toArray()) {
+        QString name = room.toString();
+        if (rooms.contains(name)) continue;
+        rooms.insert(name);
+        emit roomAdded(name);
+    }
+    roomListVersion = quint64(delta[QLatin1String("version")].toInteger());
+}
+
+ChatFile ChatSession::fileFromCbor(const QCborMap& entry) {
+    ChatFile file;
+    file.name = entry[QLatin1String("filename")].toString();
+    file.size = entry[QLatin1String("size")].toInteger();
+    file.hash = entry[QLatin1String("hash")].toString().toLatin1();
+    file.uploader = entry[QLatin1String("uploader")].toString();
+    file.time = entry[QLatin1String("time")].toInteger();
+    return file;
+}
+
+void ChatSession::requestFileCatalog() {
+    // 다른 방의 목록을 보고 있었으면 전체 목록을 받는다
+    bool sameRoom = catalogRoom == joinedRoom;
+    QCborMap request;
+    request[QLatin1String("epoch")] = sameRoom ? catalogEpoch : 0;
+    request[QLatin1String("version")] = sameRoom ? qint64(catalogVersion) : 0;
+    tagRoom(request);
+    send(MessageType::FileCatalogRequest, request);
+}
+
+void ChatSession::applyFileCatalog(const QCborMap& catalog) {
+    // 방에 들어갈 때 한 번 받는 전체 목록 (서버가 이름순으로 보낸다)
+    QString room = catalog[QLatin1String("room")].toString();
+    if (!joinedRoom.isEmpty() && room != joinedRoom) return;  // 그 사이 다른 방을 골랐다
+    catalogRoom = room;
+    catalogEpoch = catalog[QLatin1String("epoch")].toInteger();
+    catalogVersion = quint64(catalog[QLatin1String("version")].toInteger());
+
+    files.clear();
+    QList<ChatFile> list;
+    for (const QCborValue& entry : catalog[QLatin1String("files")].toArray()) {
+        ChatFile file = fileFromCbor(entry.toMap());
+        files.insert(file.name, file);
+        list.append(file);
+    }
+    emit filesReset(list);
+}
+
+void ChatSession::applyFileCatalogDelta(const QCborMap& delta) {
+    if (delta[QLatin1String("room")].toString() != catalogRoom) return;  // 떠난 방의 변경
+    qint64 epoch = delta[QLatin1String("epoch")].toInteger();
+    quint64 from = quint64(delta[QLatin1String("from")].toInteger());
+    quint64 version = quint64(delta[QLatin1String("version")].toInteger());
+    if (epoch == catalogEpoch && version <= catalogVersion) return;  // 이미 반영한 변경
+    if (epoch != catalogEpoch || from != catalogVersion) {
+        requestFileCatalog();  // 중간 변경을 놓쳤다
+        return;
+    }
+
+    for (const QCborValue& name : delta[QLatin1String("removed")].toArray()) {
+        if (files.remove(name.toString())) emit fileRemoved(name.toString());
+    }
+    for (const QCborValue& entry : delta[QLatin1String("added")].toArray()) {
+        ChatFile file = fileFromCbor(entry.toMap());
+        files.insert(file.name, file);
+        emit fileChanged(file);
+    }
+    catalogVersion = version;
+}
+
+void ChatSession::setupFileTransfer() {
+    if (fileTransferReady) return;
+    fileTransferReady = true;
+
+    bool wasFileChannel = fileChannel;
+    fileChannel = decoder.peerFeatures() & Protocol::FeatureFileChannel;
+    if (fileChannel) {
+        // FTP로 돌아가 있었으면 그만두고 (목록을 FTP 리스팅으로 덮어쓰지 않도록) 파일 채널로 옮긴다
+        if (networkManager) {
+            for (QNetworkReply *reply : ftpTransfers.values()) {
+                reply->abort();
+            }
+            networkManager->deleteLater();
+            networkManager = nullptr;
+        }
+        // 파일 목록은 방에 들어갈 때 서버가 보내 주고 이후에는 변경분만 온다
+        if (!wasFileChannel) emit notice("Using the server file channel");
+        return;
+    }
+    startFtp();
+}
+
+void ChatSession::setFtpCredentials(const QString& host, const QString& username, const QString& password) {
+    options.ftpHost = host;
+    options.ftpUsername = username;
+    options.ftpPassword = password;
+    if (fileTransferReady && !fileChannel && !networkManager) startFtp();
+}
+
+void ChatSession::startFtp() {
+    if (options.ftpUsername.isEmpty() || options.ftpPassword.isEmpty()) {
+        emit ftpCredentialsNeeded();
+        return;
+    }
+    if (!networkManager) networkManager = new QNetworkAccessManager(this);
+    // 주기적으로 다시 읽지 않고 시작할 때와 업로드 알림을 받을 때만 목록을 읽는다
+    updateFtpFileList();
+}
+
+void ChatSession::updateFtpFileList() {
+    QUrl url(QString("ftp://%1/").arg(options.ftpHost));
+    url.setUserName(options.ftpUsername);
+    url.setPassword(options.ftpPassword);
+
+    QNetworkReply *reply = networkManager->get(QNetworkRequest(url));
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError) return;
+
+        files.clear();
+        QList<ChatFile> list;
+        for (const QString& line : QString::fromUtf8(reply->readAll()).split("\n", QString::SkipEmptyParts)) {
+            // FTP 리스팅에서 파일 이름만 추출
+            ChatFile file;
+            file.name = line.trimmed();
+            if (file.name.isEmpty()) continue;
+            files.insert(file.name, file);
+            list.append(file);
+        }
+        emit filesReset(list);
+    });
+}
+
+void ChatSession::upload(const QString& localPath) {
+    if (fileChannel) {
+        startUpload(localPath);
+    } else if (networkManager) {
+        ftpUpload(localPath);
+    } else {
+        emit notice("File transfer is not available");
+    }
+}
+
+void ChatSession::download(const QString& filename, const QString& savePath) {
+    if (fileChannel) {
+        if (downloads.contains(filename) || pendingDownloads.contains(filename)) {
+            emit notice("Already downloading: " + filename);
+            return;
+        }
+        pendingDownloads.insert(filename, savePath);
+        requestFileTicket(filename, "download");
+        emit notice("Downloading: " + filename);
+    } else if (networkManager) {
+        ftpDownload(filename, savePath);
+    } else {
+        emit notice("File transfer is not available");
+    }
+}
+
+void ChatSession::removeFile(const QString& filename) {
+    if (!fileChannel) {
+        emit notice("Removing files needs the server file channel");
+        return;
+    }
+    QCborMap request;
+    request[QLatin1String("filename")] = filename;
+    tagRoom(request);
+    send(MessageType::FileRemove, request);
+}
+
+void ChatSession::cancelTransfers() {
+    // 작업은 finished를 보내며 스스로 목록에서 빠진다
+    pendingDownloads.clear();
+    for (UploadJob *job : uploads.values()) {
+        job->abort();
+    }
+    for (DownloadJob *job : downloads.values()) {
+        job->abort();
+    }
+    for (QNetworkReply *reply : ftpTransfers.values()) {
+        reply->abort();
+    }
+}
+
+void ChatSession::requestFileTicket(const QString& filename, const QString& direction) {
+    QCborMap request;
+    request[QLatin1String("filename")] = filename;
+    request[QLatin1String("direction")] = direction;
+    tagRoom(request, catalogRoom);
+    send(MessageType::FileTicketRequest, request);
+}
+
+void ChatSession::startUpload(const QString& localPath) {
+    QString filename = QFileInfo(localPath).fileName();
+    if (uploads.contains(filename)) {
+        emit notice("Already uploading: " + filename);
+        return;
+    }
+    // 해시를 구하는 동안 다른 방을 골라도 올리기 시작한 방에 올린다
+    QString room = joinedRoom;
+
+    // 해시를 먼저 구해 서버에 없는 조각만 올린다
+    UploadJob *job = new UploadJob(options.host, localPath, this);
+    job->setConnections(options.uploadConnections);
+    uploads.insert(filename, job);
+
+    connect(job, &UploadJob::ticketNeeded, this, [this, job, filename, room]() {
+        const FileDigest& digest = job->digest();
+        QCborArray chunks;
+        for (const QByteArray& chunk : digest.chunks) {
+            chunks.append(QString::fromLatin1(chunk));
+        }
+        QCborMap request;
+        request[QLatin1String("filename")] = filename;
+        request[QLatin1String("direction")] = "upload";
+        request[QLatin1String("size")] = digest.size;
+        request[QLatin1String("hash")] = QString::fromLatin1(digest.hash);
+        request[QLatin1String("chunks")] = chunks;
+        tagRoom(request, room);
+        send(MessageType::FileTicketRequest, request);
+    });
+    connect(job, &UploadJob::progress, this, [this, filename](qint64 done, qint64 total) {
+        emit transferProgress(filename, true, done, total);
+    });
+    // 업로드 알림은 서버가 파일을 다 받은 뒤 직접 방에 보낸다
+    connect(job, &UploadJob::finished, this, [this, job, filename](bool ok, const QString& error) {
+        uploads.remove(filename);
+        job->deleteLater();
+        emit transferFinished(filename, true, ok, error);
+    });
+
+    emit notice("Uploading: " + localPath);
+    emit transferStarted(filename, true);
+    job->start();
+}
+
+void ChatSession::startFileTransfer(const QCborMap& ticket) {
+    QString filename = ticket[QLatin1String("filename")].toString();
+    bool upload = ticket[QLatin1String("direction")].toString() == QLatin1String("upload");
+    quint16 port = quint16(ticket[QLatin1String("port")].toInteger());
+    QByteArray ticketId = ticket[QLatin1String("ticket")].toString().toLatin1();
+
+    // 업로드는 해시를 보낸 작업이 기다리고 있다 (서버에 없는 조각 목록이 함께 온다)
+    if (upload) {
+        UploadJob *job = uploads.value(filename);
+        if (!job) return;  // 요청하지 않은 티켓
+        QVector<int> missing;
+        for (const QCborValue& index : ticket[QLatin1String("missing")].toArray()) {
+            missing.append(int(index.toInteger()));
+        }
+        job->setTicket(port, ticketId, missing);
+        return;
+    }
+
+    // 티켓이 만료되어 다시 받은 것이면 멈춰 있던 다운로드에 넘긴다
+    if (downloads.contains(filename)) {
+        downloads.value(filename)->setTicket(ticketId);
+        return;
+    }
+
+    QString localPath = pendingDownloads.take(filename);
+    if (localPath.isEmpty()) return;  // 요청하지 않은 티켓
+
+    // 다운로드는 여러 연결로 나눠 받고, 끊기면 받은 곳부터 이어 받는다
+    DownloadJob *job = new DownloadJob(options.host, port, ticketId, localPath,
+                                       ticket[QLatin1String("size")].toInteger(), files.value(filename).hash, this);
+    job->setConnections(options.downloadConnections, options.downloadSegmentBytes);
+    downloads.insert(filename, job);
+    connect(job, &DownloadJob::progress, this, [this, filename](qint64 done, qint64 total) {
+        emit transferProgress(filename, false, done, total);
+    });
+    connect(job, &DownloadJob::ticketNeeded, this, [this, filename]() {
+        requestFileTicket(filename, "download");
+    });
+    connect(job, &DownloadJob::finished, this, [this, job, filename](bool ok, const QString& error) {
+        downloads.remove(filename);
+        job->deleteLater();
+        emit transferFinished(filename, false, ok, error);
+    });
+    emit transferStarted(filename, false);
+    job->start();
+}
+
+void ChatSession::ftpUpload(const QString& localPath) {
+    QFile *file = new QFile(localPath);
+    if (!file->open(QIODevice::ReadOnly)) {
+        emit notice("Failed to open file: " + localPath);
+        delete file;
+        return;
+    }
+
+    QString filename = QFileInfo(localPath).fileName();
+    QString room = joinedRoom;
+    QUrl url(QString("ftp://%1/%2").arg(options.ftpHost, filename));
+    url.setUserName(options.ftpUsername);
+    url.setPassword(options.ftpPassword);
+    QNetworkReply *reply = networkManager->put(QNetworkRequest(url), file);
+    file->setParent(reply);
+    ftpTransfers.insert(reply);
+
+    connect(reply, &QNetworkReply::uploadProgress, this, [this, filename](qint64 done, qint64 total) {
+        emit transferProgress(filename, true, done, total);
+    });
+    connect(reply, &QNetworkReply::finished, this, [this, reply, filename, localPath, room]() {
+        ftpTransfers.remove(reply);
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError) {
+            emit transferFinished(filename, true, false, reply->errorString());
+            return;
+        }
+        emit transferFinished(filename, true, true, QString());
+
+        // 채팅 서버에 파일 업로드 알림 전송 (다른 사용자가 같은 파일인지 알 수 있도록 내용 해시를 붙인다)
+        QFutureWatcher<FileDigest> *watcher = new QFutureWatcher<FileDigest>(this);
+        connect(watcher, &QFutureWatcher<FileDigest>::finished, this, [this, watcher, filename, room]() {
+            watcher->deleteLater();
+            QCborMap notification;
+            notification[QLatin1String("filename")] = filename;
+            if (watcher->result().size >= 0) {
+                notification[QLatin1String("hash")] = QString::fromLatin1(watcher->result().hash);
+            }
+            tagRoom(notification, room);
+            send(MessageType::FileUploaded, notification);
+        });
+        watcher->setFuture(QtConcurrent::run(&UploadJob::digestFile, localPath));
+
+        updateFtpFileList();
+    });
+
+    emit notice("Uploading: " + localPath);
+    emit transferStarted(filename, true);
+}
+
+void ChatSession::ftpDownload(const QString& filename, const QString& savePath) {
+    QFile *file = new QFile(savePath);
+    if (!file->open(QIODevice::WriteOnly)) {
+        emit notice("Failed to create file: " + savePath);
+        delete file;
+        return;
+    }
+
+    QUrl url(QString("ftp://%1/%2").arg(options.ftpHost, filename));
+    url.setUserName(options.ftpUsername);
+    url.setPassword(options.ftpPassword);
+    QNetworkReply *reply = networkManager->get(QNetworkRequest(url));
+    file->setParent(reply);
+    ftpTransfers.insert(reply);
+
+    connect(reply, &QNetworkReply::readyRead, this, [reply, file]() {
+        file->write(reply->readAll());
+    });
+    connect(reply, &QNetworkReply::downloadProgress, this, [this, filename](qint64 done, qint64 total) {
+        emit transferProgress(filename, false, done, total);
+    });
+    connect(reply, &QNetworkReply::finished, this, [this, reply, file, filename]() {
+        ftpTransfers.remove(reply);
+        reply->deleteLater();
+        file->close();
+        // 중간에 끊긴 파일을 완성된 것처럼 남기지 않는다
+        if (reply->error() != QNetworkReply::NoError) {
+            file->remove();
+            emit transferFinished(filename, false, false, reply->errorString());
+            return;
+        }
+        emit transferFinished(filename, false, true, QString());
+    });
+
+    emit notice("Downloading: " + filename);
+    emit transferStarted(filename, false);
+}
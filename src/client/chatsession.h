@@ -0,0 +1,246 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QCborArray>
+#include <QCborMap>
+#include <QHash>
+#include <QList>
+#include <QMetaType>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QVector>
+#include "protocol.h"
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class DownloadJob;
+class UploadJob;
+
+// 채팅 창의 한 줄
+struct ChatLine {
+    enum Kind {
+        Chat,    // 사용자 메시지
+        File,    // 파일 공유 알림
+        Notice   // 클라이언트가 띄우는 안내 (seq 없음)
+    };
+
+    Kind kind = Notice;
+    QString room;          // 메시지가 온 방 (비어 있으면 현재 방)
+    quint64 seq = 0;       // 방 안의 메시지 번호 (0이면 없음)
+    qint64 time = 0;       // 서버 시각 (ms)
+    QString sender;
+    QString text;
+};
+
+// 방 파일 목록의 한 항목 (FTP 목록이면 이름만 있다)
+struct ChatFile {
+    QString name;
+    qint64 size = -1;
+    QByteArray hash;
+    QString uploader;
+    qint64 time = 0;
+};
+
+Q_DECLARE_METATYPE(ChatLine)
+Q_DECLARE_METATYPE(ChatFile)
+
+// 화면 없이 돌아가는 채팅 연결 하나
+// 소켓, 핸드셰이크, 메시지 처리, 방/파일 목록 동기화, 파일 전송을 모두 맡고 결과는 시그널로만 알린다.
+// 막히는 호출이나 대화상자가 없으므로 한 프로세스에서 봇 수천 개나 통합 테스트를 돌릴 수 있다.
+// 요청은 응답을 기다리지 않고 바로 보낸다. 핸드셰이크 전에 부른 요청은 순서대로 모아 두었다가 보내고,
+// 서버는 한 연결의 메시지를 받은 순서대로 처리하므로 login → joinRoom → sendMessage를 연달아 불러도 된다.
+// 연결이 끊기면 대기 시간을 늘려 가며 다시 접속하고, 로그인 때 받은 토큰으로 세션을 이어 받아
+// 놓친 방 메시지만 받는다. 끊겨 있는 동안 부른 요청은 이어 받은 뒤에 보낸다.
+// 서버가 여러 방 구독을 알리면 joinRoom은 방을 더하고 leaveRoom으로 뺀다. 방 메시지는 방 이름과 함께 오고,
+// 방을 가리지 않는 요청(파일 등)은 selectRoom으로 고른 현재 방에 간다.
+class ChatSession : public QObject {
+    Q_OBJECT
+
+public:
+    struct Options {
+        QString host = "127.0.0.1";
+        quint16 port = 12345;
+        bool cbor = true;                  // false면 JSON으로 협상 (디버깅용)
+        bool compression = true;           // 압축 협상
+        int connectTimeoutMs = 3000;
+        int uploadConnections = 4;
+        int downloadConnections = 4;
+        qint64 downloadSegmentBytes = 8 * 1024 * 1024;
+        // 서버 파일 채널이 없을 때 쓰는 FTP (비어 있으면 ftpCredentialsNeeded를 보낸다)
+        QString ftpHost = "127.0.0.1";
+        QString ftpUsername;
+        QString ftpPassword;
+        // 끊기면 다시 접속한다. 대기는 실패할 때마다 두 배로 늘리되 [절반, 전체] 사이에서 무작위로 고른다.
+        bool autoReconnect = true;
+        int reconnectMinMs = 500;
+        int reconnectMaxMs = 30000;
+        int maxPendingMessages = 1000;     // 끊겨 있는 동안 모아 두는 요청 수 (넘으면 오래된 것부터 버린다)
+    };
+
+    enum State {
+        Disconnected,
+        Reconnecting,      // 다시 접속하기를 기다린다
+        Connecting,
+        Handshaking,
+        Connected
+    };
+
+    explicit ChatSession(const Options& options, QObject *parent = nullptr);
+    ~ChatSession();
+
+    void connectToServer();
+    void disconnectFromServer();
+    State state() const { return sessionState; }
+
+    // 요청 (응답은 시그널로 온다)
+    void registerUser(const QString& username, const QString& password);
+    void login(const QString& username, const QString& password);
+    void createRoom(const QString& name, const QString& password = QString());
+    void joinRoom(const QString& name);
+    void leaveRoom(const QString& name);
+    // 현재 방을 바꾼다 (이미 구독한 방). 파일 목록이 그 방의 것으로 바뀐다.
+    void selectRoom(const QString& name);
+    // room이 비어 있으면 현재 방
+    void sendMessage(const QString& text, const QString& room = QString());
+    void requestHistory(quint64 beforeSeq, int limit, const QString& room = QString());
+
+    QString currentRoom() const { return joinedRoom; }
+    QStringList subscribedRooms() const { return joinedRooms; }
+    // 서버가 한 연결로 여러 방을 구독하게 해 준다 (아니면 joinRoom이 이전 방을 떠난다)
+    bool hasMultiRoom() const { return multiRoom; }
+
+    // 파일 전송. 핸드셰이크 결과에 따라 서버 파일 채널이나 FTP를 쓴다.
+    bool fileTransferAvailable() const { return fileChannel || networkManager; }
+    bool hasFileChannel() const { return fileChannel; }
+    void setFtpCredentials(const QString& host, const QString& username, const QString& password);
+    void upload(const QString& localPath);
+    void download(const QString& filename, const QString& savePath);
+    void removeFile(const QString& filename);
+    void cancelTransfers();
+    ChatFile file(const QString& name) const { return files.value(name); }
+
+signals:
+    void connected();
+    void disconnected();
+    void connectionFailed(const QString& error);
+    // delayMs 뒤에 attempt번째로 다시 접속한다
+    void reconnecting(int attempt, int delayMs);
+    // 다시 접속해 방 하나의 세션을 되살렸다. complete가 false면 (토큰이 만료되어 다시 로그인한 경우 포함)
+    // 놓친 메시지 대신 입장할 때처럼 최근 기록(historyReceived)이 온다.
+    void resumed(const QString& room, bool complete);
+    void notice(const QString& text);            // 사람에게 보여 줄 안내
+    void serverError(const QString& message);
+    void registered();
+    void loggedIn();
+    // 구독한 방 목록이 바뀌었다 (로그인, 입장, 퇴장, 이어 받기)
+    void subscriptionsChanged(const QStringList& rooms);
+
+    void messageReceived(const ChatLine& line);
+    // 방에 들어갈 때나 requestHistory의 응답 (오래된 것부터)
+    void historyReceived(const QString& room, const QVector<ChatLine>& lines, bool hasMore);
+
+    void roomAdded(const QString& name);
+    void roomRemoved(const QString& name);
+
+    void filesReset(const QList<ChatFile>& files);  // 방에 들어가 받은 전체 목록 (이름순)
+    void fileChanged(const ChatFile& file);      // 추가되었거나 내용이 바뀌었다
+    void fileRemoved(const QString& name);
+
+    // 서버 파일 채널이 없고 FTP 계정도 없다. setFtpCredentials로 답한다.
+    void ftpCredentialsNeeded();
+    void transferStarted(const QString& name, bool upload);
+    void transferProgress(const QString& name, bool upload, qint64 done, qint64 total);
+    void transferFinished(const QString& name, bool upload, bool ok, const QString& error);
+
+private:
+    void onConnected();
+    void readFromServer();
+    void completeHandshake();
+    void processServerMessage(const QByteArray& data);
+    void send(MessageType type, const QCborMap& fields = QCborMap());
+    void transmit(MessageType type, const QCborMap& fields = QCborMap());
+    void flushPending();
+    void connectFailed(const QString& error);
+    void scheduleReconnect();
+    void restoreSession();
+    void applyResumed(const QCborMap& reply);
+    // 방 메시지 번호를 기록한다. 이미 받은 번호면 false (이어 받기와 실시간 전달이 겹친 경우)
+    bool acceptSeq(const QString& room, quint64 seq);
+    void resetSeqs(const QString& room);
+    void setSubscriptions(const QStringList& rooms);
+    // 방을 가리지 않는 요청에 현재 방을 붙인다 (구버전 서버는 모르는 필드를 무시한다)
+    void tagRoom(QCborMap& request, const QString& room = QString()) const;
+    // 방 메시지가 온 방들. 여러 방에 한 번에 보낸 안내는 방마다 한 줄씩 보인다.
+    QStringList messageRooms(const QCborMap& msg) const;
+    void setupFileTransfer();
+    void startFtp();
+
+    void requestRoomList();
+    void applyRoomList(const QCborArray& rooms);
+    void applyRoomListDelta(const QCborMap& delta);
+    void applyHistoryBatch(const QCborMap& batch);
+    void requestFileCatalog();
+    void applyFileCatalog(const QCborMap& catalog);
+    void applyFileCatalogDelta(const QCborMap& delta);
+    static ChatFile fileFromCbor(const QCborMap& entry);
+
+    void requestFileTicket(const QString& filename, const QString& direction);
+    void startFileTransfer(const QCborMap& ticket);
+    void startUpload(const QString& localPath);
+    void ftpUpload(const QString& localPath);
+    void ftpDownload(const QString& filename, const QString& savePath);
+    void updateFtpFileList();
+
+    Options options;
+    State sessionState = Disconnected;
+    QTcpSocket *socket = nullptr;
+    QTimer connectTimer;
+    FrameDecoder decoder;
+    Protocol::WireFormat format = Protocol::WireFormat::LegacyJson;  // 합의된 전송 형식
+    int compressThreshold = 0;         // 서버가 압축을 받아들였을 때만 0보다 크다
+    QList<QPair<MessageType, QCborMap> > pendingMessages;  // 연결(과 이어 받기)이 끝나기 전에 부른 요청
+
+    // 방마다 받은 메시지 번호
+    struct SeqWindow {
+        quint64 lastSeq = 0;           // 받은 가장 큰 메시지 번호
+        QSet<quint64> recent;
+        QList<quint64> order;          // recent에 넣은 순서
+    };
+
+    // 재접속과 세션 이어 받기
+    static const int kRecentSeqs = 512;   // 방마다 중복을 거르려고 기억하는 최근 메시지 번호 수
+    QTimer reconnectTimer;
+    int reconnectAttempt = 0;
+    bool closing = false;              // disconnectFromServer로 끊었다 (다시 접속하지 않는다)
+    bool awaitingResume = false;       // resumed 응답을 기다리는 동안 요청을 모아 둔다
+    QByteArray resumeToken;            // 로그인 때 받은 토큰 (서버가 이어 받기를 모르면 비어 있다)
+    QString loginUsername;             // 토큰이 만료되었을 때 다시 로그인한다
+    QString loginPassword;
+    bool loggedInOnce = false;
+    QHash<QString, SeqWindow> seqWindows;
+
+    QSet<QString> rooms;
+    qint64 roomListEpoch = 0;          // 방 목록을 받은 서버 실행
+    quint64 roomListVersion = 0;       // 가지고 있는 방 목록 버전 (재접속 때 서버에 알린다)
+    QString joinedRoom;                // 현재 방
+    QStringList joinedRooms;           // 구독한 방 (들어간 순서)
+    bool multiRoom = false;            // 마지막으로 접속한 서버가 여러 방 구독을 알렸다 (재접속 중에도 유지)
+
+    // 파일 전송: 서버가 파일 채널을 알리면 그것을 쓰고, 아니면 FTP로 돌아간다
+    bool fileTransferReady = false;
+    bool fileChannel = false;
+    QNetworkAccessManager *networkManager = nullptr;
+    QSet<QNetworkReply*> ftpTransfers;         // 진행 중인 FTP 올리기/받기
+    QHash<QString, UploadJob*> uploads;        // 진행 중인 업로드 (티켓을 기다리는 것 포함)
+    QHash<QString, QString> pendingDownloads;  // 파일 이름 -> 저장할 경로
+    QHash<QString, DownloadJob*> downloads;    // 진행 중인 다운로드 (티켓 갱신용)
+    QHash<QString, ChatFile> files;            // 현재 방의 파일 목록
+    QString catalogRoom;                       // 파일 목록을 받은 방
+    qint64 catalogEpoch = 0;
+    quint64 catalogVersion = 0;                // 가지고 있는 파일 목록 버전
+};
@@ -1,12 +1,14 @@
 #include "client.h"
-#include <QNetworkRequest>
-#include <QNetworkReply>
+#include <QDateTime>
+#include <QScrollBar>
+#include <QStatusBar>
 
 
 ChatClient::ChatClient(QWidget *parent) : QMainWindow(parent) {
     setupUI();
-    connectToServer();
-    setupFtpClient();
+    setupSession();
+    // 파일 전송 방식은 서버 핸드셰이크를 보고 정한다
+    session->connectToServer();
 }
 
 void ChatClient::setupUI() {
@@ -40,8 +42,12 @@ void ChatClient::setupUI() {
     roomLayout->addWidget(createRoomButton);
     roomLayout->addWidget(joinRoomButton);
 
-    chatArea = new QTextEdit(this);
-    chatArea->setReadOnly(true);
+    // 방 탭은 구독이 바뀔 때 만들고 닫으면 방을 떠난다
+    QSettings settings("config.ini", QSettings::IniFormat);
+    scrollback = settings.value("chat/scrollback", ChatModel::kDefaultCapacity).toInt();
+    roomTabs = new QTabWidget(this);
+    roomTabs->setTabsClosable(true);
+    roomTabs->setDocumentMode(true);
 
     QHBoxLayout *messageLayout = new QHBoxLayout();
     messageInput = new QLineEdit(this);
@@ -55,16 +61,18 @@ void ChatClient::setupUI() {
     
     QPushButton *uploadButton = new QPushButton("Upload File", this);
     QPushButton *downloadButton = new QPushButton("Download File", this);
+    QPushButton *removeButton = new QPushButton("Remove File", this);
     
     fileLayout->addWidget(fileList);
     QVBoxLayout *fileButtonLayout = new QVBoxLayout();
     fileButtonLayout->addWidget(uploadButton);
     fileButtonLayout->addWidget(downloadButton);
+    fileButtonLayout->addWidget(removeButton);
     fileLayout->addLayout(fileButtonLayout);
 
     mainLayout->addLayout(authLayout);
     mainLayout->addLayout(roomLayout);
-    mainLayout->addWidget(chatArea);
+    mainLayout->addWidget(roomTabs);
     mainLayout->addLayout(messageLayout);
     mainLayout->addLayout(fileLayout);
 
@@ -77,159 +85,221 @@ void ChatClient::setupUI() {
     connect(sendButton, &QPushButton::clicked, this, &ChatClient::sendMessage);
     connect(uploadButton, &QPushButton::clicked, this, &ChatClient::uploadFile);
     connect(downloadButton, &QPushButton::clicked, this, &ChatClient::downloadFile);
+    connect(removeButton, &QPushButton::clicked, this, &ChatClient::removeFile);
     connect(messageInput, &QLineEdit::returnPressed, this, &ChatClient::sendMessage);
-}
-
-
 
-void ChatClient::connectToServer() {
-    socket = new QTcpSocket(this);
-
-    connect(socket, &QTcpSocket::connected, [this]() {
-        chatArea->append("Connected to chat server");
+    // 고른 탭이 현재 방이 되어 파일 목록이 그 방의 것으로 바뀐다
+    connect(roomTabs, &QTabWidget::currentChanged, this, [this](int) {
+        RoomView *room = currentView();
+        if (room && room->name != session->currentRoom()) session->selectRoom(room->name);
     });
-
-    connect(socket, &QTcpSocket::disconnected, [this]() {
-        chatArea->append("Disconnected from chat server");
+    connect(roomTabs, &QTabWidget::tabCloseRequested, this, [this](int index) {
+        for (RoomView *room : roomViews) {
+            if (room->view == roomTabs->widget(index)) {
+                session->leaveRoom(room->name);  // 구독이 바뀌면 탭이 닫힌다
+                return;
+            }
+        }
     });
+}
 
-    connect(socket, &QTcpSocket::readyRead, [this]() {
-        QByteArray data = socket->readAll();
-        processServerMessage(data);
+ChatClient::RoomView* ChatClient::roomView(const QString& name) {
+    RoomView *room = roomViews.value(name);
+    if (room) return room;
+
+    room = new RoomView;
+    room->name = name;
+    room->view = new QListView(roomTabs);
+    room->model = new ChatModel(scrollback, room->view);
+    roomViews.insert(name, room);
+
+    // 보이는 행만 그리도록 모든 행을 한 줄 높이로 두고, 행 배치도 나눠서 한다
+    QListView *view = room->view;
+    view->setModel(room->model);
+    view->setUniformItemSizes(true);
+    view->setLayoutMode(QListView::Batched);
+    view->setSelectionMode(QAbstractItemView::NoSelection);
+    view->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    view->setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    view->setTextElideMode(Qt::ElideRight);
+
+    // 연결은 뷰가 지워질 때 함께 끊긴다
+    connect(room->model, &ChatModel::flushed, view, [room]() {
+        if (room->followTail) room->view->scrollToBottom();
+    });
+    // 위쪽 줄이 밀려나도 읽던 줄이 화면에서 움직이지 않게 한다
+    connect(room->model, &QAbstractItemModel::rowsRemoved, view, [room](const QModelIndex&, int first, int last) {
+        if (room->followTail || first != 0) return;
+        QScrollBar *bar = room->view->verticalScrollBar();
+        bar->setValue(bar->value() - (last + 1) * room->view->sizeHintForRow(0));
     });
+    // 맨 위에 닿으면 더 오래된 기록을 받아 온다
+    connect(view->verticalScrollBar(), &QScrollBar::valueChanged, view, [this, room](int value) {
+        QScrollBar *bar = room->view->verticalScrollBar();
+        room->followTail = value >= bar->maximum();
+        if (value == bar->minimum() && bar->maximum() > bar->minimum()) requestOlderHistory(room);
+    });
+
+    roomTabs->addTab(view, name.isEmpty() ? QString("Chat") : name);
+    return room;
+}
 
-    socket->connectToHost("127.0.0.1", 12345);
-    if (!socket->waitForConnected(3000)) {
-        QMessageBox::critical(this, "Error", "Could not connect to chat server");
+ChatClient::RoomView* ChatClient::currentView() const {
+    QWidget *page = roomTabs->currentWidget();
+    for (RoomView *room : roomViews) {
+        if (room->view == page) return room;
     }
+    return nullptr;
 }
 
-void ChatClient::setupFtpClient() {
-    // 설정 파일 읽기
-    progressDialog = nullptr;
+void ChatClient::removeRoomView(RoomView *room) {
+    roomViews.remove(room->name);
+    roomTabs->removeTab(roomTabs->indexOf(room->view));
+    delete room->view;
+    delete room;
+}
 
-    QFileInfo configFile("config.ini");
-    QSettings settings("config.ini", QSettings::IniFormat);
-    
-    if (configFile.exists()) {
-        // 설정 파일이 있으면 읽기
-        ftpHost = settings.value("ftp/host", "127.0.0.1").toString();
-        ftpUsername = settings.value("ftp/username", "").toString();
-        ftpPassword = settings.value("ftp/password", "").toString();
+void ChatClient::syncRoomTabs(const QStringList& rooms) {
+    for (RoomView *room : roomViews.values()) {
+        if (!rooms.contains(room->name)) removeRoomView(room);
     }
-    
-    if (!configFile.exists() || ftpUsername.isEmpty() || ftpPassword.isEmpty()) {
-        bool ok;
-        
-        // FTP 호스트 입력
-        ftpHost = QInputDialog::getText(this, "FTP Setup", 
-            "Enter FTP host:", QLineEdit::Normal, "127.0.0.1", &ok);
-        if (!ok) {
-            ftpHost = "127.0.0.1";  // 취소하면 기본값 사용
-        }
-        
-        // FTP 사용자 이름 입력
-        ftpUsername = QInputDialog::getText(this, "FTP Setup", 
-            "Enter FTP username:", QLineEdit::Normal, "", &ok);
-        if (!ok || ftpUsername.isEmpty()) {
-            QMessageBox::warning(this, "Warning", "FTP username is required");
+    for (const QString& name : rooms) {
+        roomView(name);
+    }
+}
+
+void ChatClient::resetRoomView(RoomView *room) {
+    room->model->clear();
+    room->followTail = true;
+    room->historyHasMore = false;
+    room->historyLoading = false;
+}
+
+void ChatClient::showNotice(const QString& text) {
+    // 탭이 없으면 (로그인 전) 상태 표시줄에 띄운다
+    RoomView *room = currentView();
+    if (room) room->model->appendNotice(text);
+    else statusBar()->showMessage(text, 5000);
+}
+
+void ChatClient::setupSession() {
+    // 디버깅 시 config.ini의 protocol/encoding=json 으로 CBOR 협상을,
+    // protocol/compression=false 로 압축 협상을 끌 수 있다
+    QSettings settings("config.ini", QSettings::IniFormat);
+    ChatSession::Options options;
+    options.host = settings.value("server/host", options.host).toString();
+    options.port = quint16(settings.value("server/port", options.port).toUInt());
+    options.cbor = settings.value("protocol/encoding", "cbor").toString() != "json";
+    options.compression = settings.value("protocol/compression", true).toBool();
+    options.uploadConnections = settings.value("upload/connections", 4).toInt();
+    options.downloadConnections = settings.value("download/connections", 4).toInt();
+    options.downloadSegmentBytes = settings.value("download/segmentMb", 8).toLongLong() * 1024 * 1024;
+    options.ftpHost = settings.value("ftp/host", options.ftpHost).toString();
+    options.ftpUsername = settings.value("ftp/username", "").toString();
+    options.ftpPassword = settings.value("ftp/password", "").toString();
+    options.autoReconnect = settings.value("server/autoReconnect", true).toBool();
+    options.reconnectMaxMs = settings.value("server/reconnectMaxMs", options.reconnectMaxMs).toInt();
+    session = new ChatSession(options, this);
+
+    connect(session, &ChatSession::notice, this, &ChatClient::showNotice);
+    connect(session, &ChatSession::messageReceived, this, [this](const ChatLine& line) {
+        roomView(line.room)->model->append(line);
+    });
+    connect(session, &ChatSession::historyReceived, this, &ChatClient::applyHistory);
+    connect(session, &ChatSession::subscriptionsChanged, this, &ChatClient::syncRoomTabs);
+    // 세션이 알아서 다시 접속하므로 대화상자 대신 안내만 띄운다
+    connect(session, &ChatSession::connectionFailed, this, [this](const QString& error) {
+        showNotice("Could not connect to chat server: " + error);
+    });
+    connect(session, &ChatSession::reconnecting, this, [this](int attempt, int delayMs) {
+        showNotice(QString("Reconnecting in %1 s (attempt %2)")
+                   .arg(delayMs / 1000.0, 0, 'f', 1).arg(attempt));
+    });
+    connect(session, &ChatSession::resumed, this, [this](const QString& name, bool complete) {
+        RoomView *room = roomView(name);
+        if (complete) {
+            room->model->appendNotice("Session resumed");
             return;
         }
-        
-        // FTP 비밀번호 입력
-        ftpPassword = QInputDialog::getText(this, "FTP Setup",
-            "Enter FTP password:", QLineEdit::Password, "", &ok);
-        if (!ok || ftpPassword.isEmpty()) {
-            QMessageBox::warning(this, "Warning", "FTP password is required");
-            return;
+        // 놓친 메시지를 모두 받을 수 없으면 입장할 때처럼 최근 기록부터 다시 채운다
+        resetRoomView(room);
+        room->model->appendNotice("Reconnected; some messages may have been missed");
+    });
+    connect(session, &ChatSession::serverError, this, [this](const QString& message) {
+        // 어느 방의 기록 요청이 실패했는지 모르므로 모두 다시 요청할 수 있게 한다
+        for (RoomView *room : roomViews) {
+            room->historyLoading = false;
         }
-        
-        // 입력받은 설정 저장
-        settings.setValue("ftp/host", ftpHost);
-        settings.setValue("ftp/username", ftpUsername);
-        settings.setValue("ftp/password", ftpPassword);
-    }
-    
-    
-    networkManager = new QNetworkAccessManager(this);
-    connect(networkManager, &QNetworkAccessManager::finished, this, &ChatClient::onFtpReplyFinished);
-
-    // 주기적으로 파일 리스트 업데이트
-    fileListTimer = new QTimer(this);
-    connect(fileListTimer, &QTimer::timeout, this, &ChatClient::updateFileList);
-    QTimer::singleShot(1000, this, [this]() {
-        fileListTimer->start(5000);
-        updateFileList();
+        QMessageBox::warning(this, "Error", message);
     });
-}
 
-void ChatClient::updateFileList() {
-    
-    QUrl url(QString("ftp://%1/").arg(ftpHost));
-    url.setUserName(ftpUsername);
-    url.setPassword(ftpPassword);
-    
-    QNetworkRequest request(url);
-    QNetworkReply *reply = networkManager->get(request);
-    
-    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
-        if (reply->error() == QNetworkReply::NoError) {
-            QString listing = QString::fromUtf8(reply->readAll());
-            QStringList files = listing.split("\n", QString::SkipEmptyParts);
-            
-            fileList->clear();
-            for (const QString &file : files) {
-                // FTP 리스팅에서 파일 이름만 추출
-                QString fileName = file.trimmed();
-                if (!fileName.isEmpty()) {
-                    fileList->addItem(fileName);
-                }
-            }
+    connect(session, &ChatSession::roomAdded, this, &ChatClient::insertRoom);
+    connect(session, &ChatSession::roomRemoved, this, [this](const QString& name) {
+        int index = roomList->findText(name);
+        if (index >= 0) roomList->removeItem(index);
+    });
+
+    connect(session, &ChatSession::filesReset, this, [this](const QList<ChatFile>& files) {
+        fileList->clear();
+        for (const ChatFile& file : files) {
+            setFileItem(file);
         }
-        reply->deleteLater();
+    });
+    connect(session, &ChatSession::fileChanged, this, &ChatClient::setFileItem);
+    connect(session, &ChatSession::fileRemoved, this, [this](const QString& name) {
+        qDeleteAll(fileList->findItems(name, Qt::MatchExactly));
+    });
+
+    connect(session, &ChatSession::ftpCredentialsNeeded, this, &ChatClient::askFtpCredentials);
+    connect(session, &ChatSession::transferStarted, this, &ChatClient::showTransfer);
+    connect(session, &ChatSession::transferProgress, this,
+            [this](const QString&, bool, qint64 done, qint64 total) {
+        updateDataTransferProgress(done, total);
+    });
+    connect(session, &ChatSession::transferFinished, this,
+            [this](const QString&, bool upload, bool ok, const QString& error) {
+        finishTransfer(upload, ok, error);
     });
 }
 
-void ChatClient::uploadFile() {
-    QString fileName = QFileDialog::getOpenFileName(this, "Select File to Upload");
-    if (fileName.isEmpty()) return;
+void ChatClient::askFtpCredentials() {
+    QSettings settings("config.ini", QSettings::IniFormat);
+    bool ok;
 
-    QFile *file = new QFile(fileName);
-    if (!file->open(QIODevice::ReadOnly)) {
-        chatArea->append("Failed to open file: " + fileName);
-        delete file;
+    // FTP 호스트 입력
+    QString host = QInputDialog::getText(this, "FTP Setup",
+        "Enter FTP host:", QLineEdit::Normal, "127.0.0.1", &ok);
+    if (!ok) {
+        host = "127.0.0.1";  // 취소하면 기본값 사용
+    }
+
+    // FTP 사용자 이름 입력
+    QString username = QInputDialog::getText(this, "FTP Setup",
+        "Enter FTP username:", QLineEdit::Normal, "", &ok);
+    if (!ok || username.isEmpty()) {
+        QMessageBox::warning(this, "Warning", "FTP username is required");
         return;
     }
 
-    // FTP URL 생성
-    QUrl url(QString("ftp://%1/%2").arg(ftpHost, QFileInfo(fileName).fileName()));
-    url.setUserName(ftpUsername);
-    url.setPassword(ftpPassword);
-    // QNetworkRequest 생성
-    QNetworkRequest request(url);
-    QNetworkReply *reply = networkManager->put(request, file);
-
-    // 업로드 진행 상태 추적
-    connect(reply, &QNetworkReply::uploadProgress, this, &ChatClient::updateDataTransferProgress);
-
-    // 업로드 완료 후 처리
-    connect(reply, &QNetworkReply::finished, [this, reply, file, fileName]() {
-        reply->deleteLater();
-        file->close();
-        file->deleteLater();
-        chatArea->append("Upload complete!");
-
-        // 채팅 서버에 파일 업로드 알림 전송
-        QJsonObject fileMsg;
-        fileMsg["type"] = "fileUploaded";
-        fileMsg["filename"] = QFileInfo(fileName).fileName();
-        sendJsonMessage(fileMsg);
-
-        // 파일 리스트 업데이트
-        updateFileList();
-    });
+    // FTP 비밀번호 입력
+    QString password = QInputDialog::getText(this, "FTP Setup",
+        "Enter FTP password:", QLineEdit::Password, "", &ok);
+    if (!ok || password.isEmpty()) {
+        QMessageBox::warning(this, "Warning", "FTP password is required");
+        return;
+    }
 
-    chatArea->append("Uploading: " + fileName);;
+    // 입력받은 설정 저장
+    settings.setValue("ftp/host", host);
+    settings.setValue("ftp/username", username);
+    settings.setValue("ftp/password", password);
+    session->setFtpCredentials(host, username, password);
+}
+
+void ChatClient::uploadFile() {
+    QString fileName = QFileDialog::getOpenFileName(this, "Select File to Upload");
+    if (fileName.isEmpty()) return;
+    session->upload(fileName);
 }
 
 void ChatClient::downloadFile() {
@@ -240,96 +310,57 @@ void ChatClient::downloadFile() {
 
     QString fileName = fileList->currentItem()->text();
     QString saveFileName = QFileDialog::getSaveFileName(this, "Save File As", fileName);
-
     if (saveFileName.isEmpty()) return;
+    session->download(fileName, saveFileName);
+}
 
-    // FTP URL 생성
-    QUrl url(QString("ftp://%1/%2").arg(ftpHost, fileName));
-    url.setUserName(ftpUsername);
-    url.setPassword(ftpPassword);
-
-    // QNetworkRequest 생성
-    QNetworkRequest request(url);
-
-    // 다운로드 시작
-    QNetworkReply *reply = networkManager->get(request);
-
-    // 다운로드 진행 상태 추적
-    QFile *file = new QFile(saveFileName);
-    if (!file->open(QIODevice::WriteOnly)) {
-        chatArea->append("Failed to create file: " + saveFileName);
-        delete file;
+void ChatClient::removeFile() {
+    if (!fileList->currentItem()) {
+        QMessageBox::warning(this, "Error", "Please select a file to remove");
         return;
     }
-
-    connect(reply, &QNetworkReply::readyRead, [reply, file]() {
-        file->write(reply->readAll());
-    });
-
-    connect(reply, &QNetworkReply::finished, this, [reply, file, this]() {
-        file->close();
-        file->deleteLater();
-        reply->deleteLater();
-        chatArea->append("Download complete!");
-    });
-
-    chatArea->append("Downloading: " + fileName);
+    session->removeFile(fileList->currentItem()->text());
 }
 
-void ChatClient::onFtpReplyFinished(QNetworkReply *reply) {
-    if (reply->error() != QNetworkReply::NoError) {
-        
-    }
-
-    reply->deleteLater();
+void ChatClient::showTransfer(const QString& name, bool upload) {
+    if (progressDialog) return;  // 한 번에 하나만 보여 준다
+    progressDialog = new QProgressDialog((upload ? "Uploading " : "Downloading ") + name, "Cancel", 0, 100, this);
+    progressDialog->setMinimumDuration(500);
+    connect(progressDialog, &QProgressDialog::canceled, session, &ChatSession::cancelTransfers);
+}
 
+void ChatClient::finishTransfer(bool upload, bool ok, const QString& error) {
     if (progressDialog) {
         progressDialog->hide();
-        delete progressDialog;
+        progressDialog->deleteLater();
         progressDialog = nullptr;
     }
+    if (ok) showNotice(upload ? "Upload complete!" : "Download complete!");
+    else showNotice((upload ? "Upload failed: " : "Download failed: ") + error);
 }
 
 void ChatClient::updateDataTransferProgress(qint64 done, qint64 total) {
-    if (progressDialog) {
-        progressDialog->setValue(done * 100 / total);
+    if (progressDialog && total > 0) {
+        progressDialog->setValue(int(done * 100 / total));
     }
 }
 
 void ChatClient::handleLogin() {
-    QJsonObject loginMsg;
-    loginMsg["type"] = "login";
-    loginMsg["username"] = usernameInput->text();
-    loginMsg["password"] = passwordInput->text();
-    
-    sendJsonMessage(loginMsg);
+    session->login(usernameInput->text(), passwordInput->text());
 }
 
 void ChatClient::handleRegistration() {
-    QJsonObject regMsg;
-    regMsg["type"] = "register";
-    regMsg["username"] = usernameInput->text();
-    regMsg["password"] = passwordInput->text();
-    
-    sendJsonMessage(regMsg);
+    session->registerUser(usernameInput->text(), passwordInput->text());
 }
 
 void ChatClient::handleCreateRoom() {
     QString roomName = QInputDialog::getText(this, "Create Room", "Room name:");
     if (!roomName.isEmpty()) {
-        QJsonObject createMsg;
-        createMsg["type"] = "createRoom";
-        createMsg["room"] = roomName;
-        
         bool ok;
         QString password = QInputDialog::getText(this, "Room Password", 
             "Password (leave empty for public room):", 
             QLineEdit::Password, "", &ok);
-        if (ok && !password.isEmpty()) {
-            createMsg["password"] = password;
-        }
-        
-        sendJsonMessage(createMsg);
+        session->createRoom(roomName, ok ? password : QString());
     }
 }
 
@@ -338,63 +369,80 @@ void ChatClient::handleJoinRoom() {
         QMessageBox::warning(this, "Error", "Please select a room");
         return;
     }
-    
-    QJsonObject joinMsg;
-    joinMsg["type"] = "joinRoom";
-    joinMsg["room"] = roomList->currentText();
-    
-    sendJsonMessage(joinMsg);
+
+    QString name = roomList->currentText();
+    RoomView *room = roomViews.value(name);
+    if (room && session->hasMultiRoom()) {
+        // 이미 구독한 방은 탭만 고른다
+        roomTabs->setCurrentWidget(room->view);
+        return;
+    }
+
+    // 새 방의 기록은 입장 직후 historyBatch로 온다
+    if (room) resetRoomView(room);
+    session->joinRoom(name);
+    roomTabs->setCurrentWidget(roomView(name)->view);
 }
 
 void ChatClient::sendMessage() {
     QString text = messageInput->text();
     if (text.isEmpty()) return;
-    
-    QJsonObject chatMsg;
-    chatMsg["type"] = "message";
-    chatMsg["text"] = text;
-    
-    sendJsonMessage(chatMsg);
+
+    RoomView *room = currentView();
+    session->sendMessage(text, room ? room->name : QString());
     messageInput->clear();
 }
 
+void ChatClient::applyHistory(const QString& name, const QVector<ChatLine>& lines, bool hasMore) {
+    RoomView *room = roomView(name);
+    room->historyHasMore = hasMore;
 
+    if (!room->historyLoading) {
+        // 입장 직후 받는 최근 기록은 새 메시지처럼 뒤에 붙인다
+        for (const ChatLine& line : lines) {
+            room->model->append(line);
+        }
+        return;
+    }
 
+    // 위로 스크롤해 받은 기록은 앞에 넣고, 보던 줄이 그 자리에 머물도록 넣은 만큼 내린다
+    room->historyLoading = false;
+    QScrollBar *bar = room->view->verticalScrollBar();
+    int value = bar->value();
+    int added = room->model->prepend(lines);
+    if (added < lines.size()) room->historyHasMore = false;  // 버퍼가 가득 찼다
+    if (added > 0) bar->setValue(value + added * room->view->sizeHintForRow(0));
+}
 
+void ChatClient::requestOlderHistory(RoomView *room) {
+    if (room->historyLoading || !room->historyHasMore || room->model->isFull()) return;
+    quint64 oldest = room->model->oldestSeq();
+    if (oldest == 0) return;
 
-void ChatClient::processServerMessage(const QByteArray& data) {
-    QJsonDocument doc = QJsonDocument::fromJson(data);
-    if (!doc.isObject()) return;
-    
-    QJsonObject msg = doc.object();
-    QString type = msg["type"].toString();
-    
-    if (type == "message") {
-        QString sender = msg["sender"].toString();
-        QString text = msg["text"].toString();
-        chatArea->append(QString("%1: %2").arg(sender, text));
-    }
-    else if (type == "fileAvailable") {
-        QString filename = msg["filename"].toString();
-        fileList->addItem(filename);
-    }
-    else if (type == "error") {
-        QMessageBox::warning(this, "Error", msg["message"].toString());
-    }
-    else if (type == "roomList") {
-        roomList->clear();
-        for (const auto& room : msg["rooms"].toArray()) {
-            roomList->addItem(room.toString());
-        }
-    }
-    else if (type == "fileUploaded") {
-        QString filename = msg["filename"].toString();
-        chatArea->append("New file available: " + filename);
-        updateFileList();  // 파일 리스트 업데이트
+    room->historyLoading = true;
+    session->requestHistory(oldest, 100, room->name);
+}
+
+void ChatClient::insertRoom(const QString& name) {
+    // 서버와 같은 이름순 위치에 넣는다
+    int low = 0;
+    int high = roomList->count();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (roomList->itemText(mid) < name) low = mid + 1;
+        else high = mid;
     }
+    if (low < roomList->count() && roomList->itemText(low) == name) return;
+    roomList->insertItem(low, name);
 }
 
-void ChatClient::sendJsonMessage(const QJsonObject& message) {
-    QJsonDocument doc(message);
-    socket->write(doc.toJson());
+void ChatClient::setFileItem(const ChatFile& file) {
+    QList<QListWidgetItem*> found = fileList->findItems(file.name, Qt::MatchExactly);
+    QListWidgetItem *item = found.isEmpty() ? new QListWidgetItem(file.name, fileList) : found.first();
+    if (file.size < 0) return;  // FTP 목록은 이름만 안다
+    item->setToolTip(QString("%1 bytes, uploaded by %2 at %3\nSHA-256 %4")
+                     .arg(file.size)
+                     .arg(file.uploader)
+                     .arg(QDateTime::fromMSecsSinceEpoch(file.time).toString())
+                     .arg(QString::fromLatin1(file.hash)));
 }
@@ -1,29 +1,28 @@
 #pragma once
 #include <QMainWindow>
-#include <QTcpSocket>
 #include <QLineEdit>
-#include <QTextEdit>
+#include <QListView>
 #include <QComboBox>
 #include <QListWidget>
 #include <QPushButton>
-#include <QDialog>
 #include <QLabel>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QFileDialog>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QJsonArray>
-#include <QNetworkAccessManager>
 #include <QProgressDialog>
-#include <QTimer>
 #include <QSettings>
 #include <QInputDialog>
 #include <QString>
 #include <QMessageBox>
 #include <QFileInfo>
-#include <QFile>
+#include <QHash>
+#include <QTabWidget>
+#include <QVector>
+#include "chatsession.h"
+#include "chatmodel.h"
 
+// 채팅 창. 연결과 프로토콜은 ChatSession이 맡고 여기서는 위젯만 다룬다.
+// 구독한 방마다 탭이 하나씩 있고, 모든 방이 연결 하나를 같이 쓴다.
 class ChatClient : public QMainWindow {
     Q_OBJECT
 public:
@@ -36,39 +35,52 @@ private slots:
     void handleCreateRoom();
     void handleJoinRoom();
     void sendMessage();
-    void processServerMessage(const QByteArray& data);
-    
 
     // 파일 전송 관련 슬롯
     void uploadFile();
     void downloadFile();
+    void removeFile();
     void updateDataTransferProgress(qint64 done, qint64 total);
-    void onFtpReplyFinished(QNetworkReply *reply);
-    void updateFileList();
 
 private:
     // UI 컴포넌트
     QLineEdit *usernameInput;
     QLineEdit *passwordInput;
     QComboBox *roomList;
-    QTextEdit *chatArea;
+    QTabWidget *roomTabs;
     QLineEdit *messageInput;
     QListWidget *fileList;
+    QProgressDialog *progressDialog = nullptr;
 
-    // 네트워크 컴포넌트
-    QTcpSocket *socket;
-    QNetworkAccessManager *networkManager;
-    QProgressDialog *progressDialog;
-    QTimer *fileListTimer;
+    // 방 탭 하나
+    struct RoomView {
+        QString name;                      // 비어 있으면 방 이름을 알리지 않는 구버전 서버의 방
+        QListView *view = nullptr;         // 탭 페이지 (모델을 가진다)
+        ChatModel *model = nullptr;
+        bool followTail = true;            // 맨 아래를 보고 있으면 새 메시지를 따라 내려간다
+        bool historyHasMore = false;       // 서버에 더 오래된 기록이 있다
+        bool historyLoading = false;       // 위로 스크롤해 요청한 기록을 기다리는 중
+    };
+
+    ChatSession *session;
+    QHash<QString, RoomView*> roomViews;   // 방 이름 → 탭
+    int scrollback = ChatModel::kDefaultCapacity;
 
-    //FTP 설정
-    QString ftpHost;
-    QString ftpUsername;
-    QString ftpPassword;
     // 초기화 함수
     void setupUI();
-    void setupFtpClient();  
-    void connectToServer();
-    void sendJsonMessage(const QJsonObject& message);
+    void setupSession();
+    void askFtpCredentials();
+    void insertRoom(const QString& name);
+    void setFileItem(const ChatFile& file);
+    // 방의 탭 (없으면 만든다)
+    RoomView* roomView(const QString& name);
+    RoomView* currentView() const;
+    void removeRoomView(RoomView *room);
+    void syncRoomTabs(const QStringList& rooms);
+    void resetRoomView(RoomView *room);
+    void showNotice(const QString& text);
+    void applyHistory(const QString& room, const QVector<ChatLine>& lines, bool hasMore);
+    void requestOlderHistory(RoomView *room);
+    void showTransfer(const QString& name, bool upload);
+    void finishTransfer(bool upload, bool ok, const QString& error);
 };
-
@@ -0,0 +1,257 @@
+#include "downloadjob.h"
+#include "filetransfer.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QtConcurrent>
+
+const int DownloadJob::kMaxAttempts;
+const int DownloadJob::kSaveIntervalMs;
+
+namespace {
+    QByteArray hashFile(const QString& path) {
+        QFile file(path);
+        QCryptographicHash hasher(QCryptographicHash::Sha256);
+        if (!file.open(QIODevice::ReadOnly) || !hasher.addData(&file)) return QByteArray();
+        return hasher.result().toHex();
+    }
+}
+
+DownloadJob::DownloadJob(const QString& host, quint16 port, const QByteArray& ticket, const QString& savePath,
+                         qint64 size, const QByteArray& hash, QObject *parent)
+    : QObject(parent), host(host), port(port), ticket(ticket), targetPath(savePath), size(size),
+      expectedHash(hash) {
+    connect(&saveTimer, &QTimer::timeout, this, [this]() {
+        if (dirty) saveProgress();
+    });
+    connect(&hashWatcher, &QFutureWatcher<QByteArray>::finished, this, &DownloadJob::verified);
+}
+
+void DownloadJob::setConnections(int count, qint64 segmentBytes) {
+    connections = qMax(1, count);
+    minSegmentBytes = qMax<qint64>(1, segmentBytes);
+}
+
+void DownloadJob::start() {
+    // 같은 파일을 같은 자리에 받다 멈춘 적이 있으면 거기서 이어 간다
+    if (!loadProgress()) {
+        planSegments();
+        QFile part(partPath());
+        if (!part.open(QIODevice::WriteOnly | QIODevice::Truncate) || !part.resize(size)) {
+            fail("Cannot create " + partPath());
+            return;
+        }
+        saveProgress();
+    }
+
+    reportProgress();
+    saveTimer.start(kSaveIntervalMs);
+    bool pending = false;
+    for (int i = 0; i < segments.size(); ++i) {
+        if (!segments[i].complete()) {
+            startSegment(i);
+            pending = true;
+        }
+    }
+    if (!pending) verify();
+}
+
+void DownloadJob::abort() {
+    if (done) return;
+    // 받은 부분과 진행 파일은 남겨 두어 다음에 이어 받는다
+    for (Segment& segment : segments) {
+        if (segment.transfer) {
+            segment.transfer->disconnect(this);
+            segment.transfer->abort();
+            segment.transfer->deleteLater();
+            segment.transfer = nullptr;
+        }
+    }
+    saveProgress();
+    fail("Cancelled");
+}
+
+void DownloadJob::setTicket(const QByteArray& newTicket) {
+    ticket = newTicket;
+    ticketRequested = false;
+    for (int i = 0; i < segments.size(); ++i) {
+        if (segments[i].waitingTicket) {
+            segments[i].waitingTicket = false;
+            startSegment(i);
+        }
+    }
+}
+
+bool DownloadJob::loadProgress() {
+    QFile file(progressPath());
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    QJsonObject state = QJsonDocument::fromJson(file.readAll()).object();
+
+    // 서버의 파일이 바뀌었으면 처음부터 받는다
+    if (qint64(state.value("size").toDouble(-1)) != size
+        || state.value("hash").toString().toLatin1() != expectedHash
+        || QFile(partPath()).size() != size) {
+        return false;
+    }
+
+    QVector<Segment> loaded;
+    for (const QJsonValue& value : state.value("segments").toArray()) {
+        QJsonArray range = value.toArray();
+        Segment segment;
+        segment.start = qint64(range.at(0).toDouble());
+        segment.end = qint64(range.at(1).toDouble());
+        segment.done = qBound<qint64>(0, qint64(range.at(2).toDouble()), segment.end - segment.start);
+        loaded.append(segment);
+    }
+    if (loaded.isEmpty() && size > 0) return false;
+    segments = loaded;
+    return true;
+}
+
+void DownloadJob::saveProgress() {
+    QJsonArray ranges;
+    for (const Segment& segment : segments) {
+        ranges.append(QJsonArray{double(segment.start), double(segment.end), double(segment.done)});
+    }
+    QJsonObject state;
+    state.insert("size", double(size));
+    state.insert("hash", QString::fromLatin1(expectedHash));
+    state.insert("segments", ranges);
+
+    QSaveFile file(progressPath());
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QJsonDocument(state).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+    dirty = false;
+}
+
+void DownloadJob::planSegments() {
+    // 작은 파일은 연결 하나로, 큰 파일은 최소 크기 이상의 구간으로 고르게 나눈다
+    segments.clear();
+    if (size <= 0) return;
+    int count = int(qBound<qint64>(1, size / minSegmentBytes, connections));
+    qint64 step = (size + count - 1) / count;
+    for (qint64 offset = 0; offset < size; offset += step) {
+        Segment segment;
+        segment.start = offset;
+        segment.end = qMin(size, offset + step);
+        segments.append(segment);
+    }
+}
+
+void DownloadJob::startSegment(int index) {
+    if (done) return;
+    Segment& segment = segments[index];
+    segment.base = segment.done;
+
+    // 각 구간은 남은 범위만 요청하고 .part의 자기 위치에 바로 쓴다
+    FileTransfer *transfer = new FileTransfer(FileTransfer::Download, host, port, ticket, partPath(), this);
+    transfer->setRange(segment.start + segment.done, segment.end - segment.start - segment.done);
+    segment.transfer = transfer;
+    connect(transfer, &FileTransfer::progress, this, [this, index](qint64 received, qint64) {
+        Segment& current = segments[index];
+        current.done = current.base + received;
+        dirty = true;
+        reportProgress();
+    });
+    connect(transfer, &FileTransfer::finished, this, [this, index](bool ok, const QString& error) {
+        segmentFinished(index, ok, error);
+    });
+    transfer->start();
+}
+
+void DownloadJob::segmentFinished(int index, bool ok, const QString& error) {
+    Segment& segment = segments[index];
+    segment.transfer->deleteLater();
+    segment.transfer = nullptr;
+    if (done) return;
+
+    if (ok && segment.complete()) {
+        saveProgress();
+        for (const Segment& other : segments) {
+            if (!other.complete()) return;
+        }
+        verify();
+        return;
+    }
+
+    // 티켓이 만료되었으면 새 티켓을 받을 때까지 멈춘다
+    if (error.contains("ticket")) {
+        segment.waitingTicket = true;
+        if (!ticketRequested) {
+            ticketRequested = true;
+            emit ticketNeeded();
+        }
+        return;
+    }
+
+    // 진척이 있었으면 새로 센다. 같은 구간이 계속 실패하면 포기하되 받은 부분은 남긴다.
+    segment.attempts = segment.done > segment.base ? 1 : segment.attempts + 1;
+    if (segment.attempts > kMaxAttempts) {
+        saveProgress();
+        fail(error);
+        return;
+    }
+    QTimer::singleShot(500 << segment.attempts, this, [this, index]() { startSegment(index); });
+}
+
+void DownloadJob::reportProgress() {
+    qint64 received = 0;
+    for (const Segment& segment : segments) {
+        received += segment.done;
+    }
+    emit progress(received, size);
+}
+
+void DownloadJob::verify() {
+    saveTimer.stop();
+    if (size == 0) {
+        QFile part(partPath());
+        part.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    }
+    if (expectedHash.isEmpty()) {
+        verified();
+        return;
+    }
+    // 큰 파일의 해시는 UI를 멈추지 않도록 다른 스레드에서 계산한다
+    hashWatcher.setFuture(QtConcurrent::run(hashFile, partPath()));
+}
+
+void DownloadJob::verified() {
+    if (done) return;
+    if (!expectedHash.isEmpty() && hashWatcher.result() != expectedHash) {
+        // 어느 구간이 틀렸는지 알 수 없으므로 다음에는 처음부터 받는다
+        QFile::remove(partPath());
+        QFile::remove(progressPath());
+        fail("Checksum mismatch");
+        return;
+    }
+
+    QFile::remove(targetPath);
+    if (!QFile::rename(partPath(), targetPath)) {
+        fail("Cannot rename " + partPath());
+        return;
+    }
+    QFile::remove(progressPath());
+    done = true;
+    emit finished(true, QString());
+}
+
+void DownloadJob::fail(const QString& error) {
+    if (done) return;
+    done = true;
+    saveTimer.stop();
+    for (Segment& segment : segments) {
+        if (segment.transfer) {
+            segment.transfer->disconnect(this);
+            segment.transfer->abort();
+            segment.transfer->deleteLater();
+            segment.transfer = nullptr;
+        }
+    }
+    emit finished(false, error);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QFutureWatcher>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+class FileTransfer;
+
+// 큰 파일을 여러 구간으로 나눠 동시에 받는 다운로드
+// <저장 경로>.part를 파일 크기만큼 미리 늘려 두고 구간마다 자기 위치에 쓴다.
+// 구간별 진행은 <저장 경로>.part.progress에 남겨 두어 끊기거나 프로그램이 죽어도 이어 받는다.
+// 다 받으면 SHA-256을 확인한 뒤에야 원래 이름으로 바꾼다.
+class DownloadJob : public QObject {
+    Q_OBJECT
+
+public:
+    static const int kMaxAttempts = 5;        // 구간 하나를 다시 시도하는 횟수
+    static const int kSaveIntervalMs = 1000;  // 진행 파일을 쓰는 주기
+
+    DownloadJob(const QString& host, quint16 port, const QByteArray& ticket, const QString& savePath,
+                qint64 size, const QByteArray& hash, QObject *parent = nullptr);
+
+    // 동시 연결 수와 구간 최소 크기 (start 전에 정한다)
+    void setConnections(int count, qint64 minSegmentBytes);
+    void start();
+    void abort();
+    // ticketNeeded에 대한 응답. 멈춘 구간을 새 티켓으로 다시 시작한다.
+    void setTicket(const QByteArray& ticket);
+
+    QString savePath() const { return targetPath; }
+
+signals:
+    void progress(qint64 done, qint64 total);
+    // 티켓이 만료되어 새 티켓이 필요하다
+    void ticketNeeded();
+    void finished(bool ok, const QString& error);
+
+private:
+    struct Segment {
+        qint64 start = 0;
+        qint64 end = 0;
+        qint64 done = 0;                   // 받아서 파일에 쓴 바이트
+        qint64 base = 0;                   // 이번 시도를 시작할 때의 done
+        int attempts = 0;
+        bool waitingTicket = false;
+        FileTransfer *transfer = nullptr;
+
+        bool complete() const { return start + done >= end; }
+    };
+
+    QString partPath() const { return targetPath + ".part"; }
+    QString progressPath() const { return targetPath + ".part.progress"; }
+
+    bool loadProgress();
+    void saveProgress();
+    void planSegments();
+    void startSegment(int index);
+    void segmentFinished(int index, bool ok, const QString& error);
+    void reportProgress();
+    void verify();
+    void verified();
+    void fail(const QString& error);
+
+    QString host;
+    quint16 port;
+    QByteArray ticket;
+    QString targetPath;
+    qint64 size;
+    QByteArray expectedHash;               // 비어 있으면 확인하지 않는다
+    int connections = 4;
+    qint64 minSegmentBytes = 8 * 1024 * 1024;
+
+    QVector<Segment> segments;
+    QTimer saveTimer;
+    bool dirty = false;
+    bool ticketRequested = false;
+    bool done = false;
+    QFutureWatcher<QByteArray> hashWatcher;
+};
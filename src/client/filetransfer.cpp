@@ -0,0 +1,139 @@
+#include "filetransfer.h"
+#include "protocol.h"
+
+const qint64 FileTransfer::kMaxInFlight;
+
+FileTransfer::FileTransfer(Direction direction, const QString& host, quint16 port, const QByteArray& ticket,
+                           const QString& localPath, QObject *parent)
+    : QObject(parent), transferDirection(direction), host(host), port(port), ticket(ticket), file(localPath) {
+    connect(&socket, &QTcpSocket::connected, this, &FileTransfer::onConnected);
+    connect(&socket, &QTcpSocket::readyRead, this, &FileTransfer::onReadyRead);
+    connect(&socket, &QTcpSocket::bytesWritten, this, &FileTransfer::sendMore);
+    connect(&socket, &QTcpSocket::disconnected, this, [this]() {
+        // 다운로드는 받은 길이로, 업로드는 DONE 응답으로 끝을 판단한다
+        if (transferDirection == Download && headerDone && transferred >= total) complete(true);
+        else complete(false, "Connection closed");
+    });
+    connect(&socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error),
+            this, [this](QAbstractSocket::SocketError error) {
+        if (error != QAbstractSocket::RemoteHostClosedError) complete(false, socket.errorString());
+    });
+}
+
+void FileTransfer::setRange(qint64 rangeOffset, qint64 rangeLength) {
+    offset = qMax<qint64>(0, rangeOffset);
+    length = qMax<qint64>(0, rangeLength);
+}
+
+void FileTransfer::start() {
+    bool opened;
+    if (transferDirection == Commit) {
+        opened = true;
+    } else if (transferDirection == Upload) {
+        opened = file.open(QIODevice::ReadOnly);
+    } else if (offset == 0 && length == 0) {
+        opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    } else {
+        // 구간 다운로드는 다른 구간을 지우지 않도록 기존 파일에 덮어쓴다.
+        // 버퍼 없이 써서 진행 기록이 실제로 쓴 데이터보다 앞서지 않게 한다.
+        opened = file.open(QIODevice::ReadWrite | QIODevice::Unbuffered) && file.seek(offset);
+    }
+    if (!opened) {
+        complete(false, "Cannot open " + file.fileName());
+        return;
+    }
+    socket.connectToHost(host, port);
+}
+
+void FileTransfer::abort() {
+    complete(false, "Cancelled");
+}
+
+void FileTransfer::onConnected() {
+    QByteArray request = QByteArray(Protocol::kFileChannelMagic) + ' ' + ticket + ' ';
+    if (transferDirection == Commit) {
+        request += Protocol::kFileChannelCommit;
+    } else {
+        request += QByteArray::number(offset) + ' ' + QByteArray::number(length);
+    }
+    socket.write(request + '\n');
+}
+
+void FileTransfer::onReadyRead() {
+    if (done) return;
+
+    if (transferDirection == Download && headerDone) {
+        QByteArray data = socket.read(total - transferred);
+        if (file.write(data) != data.size()) {
+            complete(false, "Write failed: " + file.errorString());
+            return;
+        }
+        transferred += data.size();
+        emit progress(transferred, total);
+        if (transferred >= total) complete(true);
+        return;
+    }
+
+    // "OK ...", "DONE ...", "ERR ..." 응답 줄
+    while (!done && socket.canReadLine()) {
+        QByteArray reply = socket.readLine().trimmed();
+        if (reply.startsWith("ERR ")) {
+            complete(false, QString::fromUtf8(reply.mid(4)));
+            return;
+        }
+        if (reply.startsWith("DONE ") && transferDirection != Download) {
+            complete(true);
+            return;
+        }
+        if (!reply.startsWith("OK ") || headerDone || transferDirection == Commit) {
+            complete(false, "Unexpected reply from server");
+            return;
+        }
+
+        headerDone = true;
+        qint64 value = reply.mid(3).toLongLong();
+        if (transferDirection == Upload) {
+            // 서버가 이미 받아 둔 만큼 건너뛴다
+            total = length > 0 ? length : file.size() - offset;
+            transferred = qMin(value, total);
+            file.seek(offset + transferred);
+            emit progress(transferred, total);
+            sendMore();
+        } else {
+            qint64 end = length > 0 ? qMin(value, offset + length) : value;
+            total = qMax<qint64>(0, end - offset);
+            emit progress(0, total);
+            if (total == 0) {
+                complete(true);
+                return;
+            }
+            onReadyRead();  // 응답 줄 뒤에 붙어 온 본문
+            return;
+        }
+    }
+}
+
+void FileTransfer::sendMore() {
+    if (done || transferDirection != Upload || !headerDone) return;
+
+    // 소켓 버퍼에는 일정량만 올려 두어 큰 파일도 메모리에 다 읽지 않는다
+    while (transferred < total && socket.bytesToWrite() < kMaxInFlight) {
+        QByteArray chunk = file.read(qMin<qint64>(64 * 1024, total - transferred));
+        if (chunk.isEmpty()) {
+            complete(false, "Read failed: " + file.errorString());
+            return;
+        }
+        socket.write(chunk);
+        transferred += chunk.size();
+    }
+    emit progress(transferred - socket.bytesToWrite(), total);
+}
+
+void FileTransfer::complete(bool ok, const QString& error) {
+    if (done) return;
+    done = true;
+    file.close();
+    socket.disconnect(this);
+    socket.abort();
+    emit finished(ok, error);
+}
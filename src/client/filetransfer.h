@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QObject>
+#include <QFile>
+#include <QString>
+#include <QTcpSocket>
+
+// 서버 파일 채널로 파일 하나(또는 그 일부)를 올리거나 받는다
+// 채팅 연결에서 받은 티켓을 보내고, 업로드는 서버가 알려 준 위치부터 이어서 보낸다.
+class FileTransfer : public QObject {
+    Q_OBJECT
+
+public:
+    enum Direction {
+        Upload,
+        Download,
+        Commit     // 조각 업로드를 마치고 서버에 파일을 합치게 한다 (파일을 열지 않는다)
+    };
+
+    static const qint64 kMaxInFlight = 256 * 1024;  // 소켓 버퍼에 올려 두는 최대 업로드 바이트
+
+    FileTransfer(Direction direction, const QString& host, quint16 port, const QByteArray& ticket,
+                 const QString& localPath, QObject *parent = nullptr);
+
+    // 옮길 구간 (length 0이면 끝까지). start 전에 정한다.
+    void setRange(qint64 offset, qint64 length);
+    void start();
+    void abort();
+
+    Direction direction() const { return transferDirection; }
+    QString localPath() const { return file.fileName(); }
+
+signals:
+    void progress(qint64 done, qint64 total);
+    void finished(bool ok, const QString& error);
+
+private:
+    void onConnected();
+    void onReadyRead();
+    void sendMore();
+    void complete(bool ok, const QString& error = QString());
+
+    Direction transferDirection;
+    QString host;
+    quint16 port;
+    QByteArray ticket;
+    QTcpSocket socket;
+    QFile file;
+    bool headerDone = false;
+    bool done = false;
+    qint64 offset = 0;
+    qint64 length = 0;
+    qint64 transferred = 0;    // 이번 구간에서 옮긴 바이트 (업로드는 이어 받은 부분 포함)
+    qint64 total = 0;          // 옮겨야 할 전체 바이트
+};
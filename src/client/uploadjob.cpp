@@ -0,0 +1,190 @@
+#include "uploadjob.h"
+#include "filetransfer.h"
+#include "protocol.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QTimer>
+#include <QtConcurrent>
+
+const int UploadJob::kMaxAttempts;
+
+namespace {
+    qint64 chunkLength(qint64 size, int index) {
+        return qMin(Protocol::kFileChunkBytes, size - qint64(index) * Protocol::kFileChunkBytes);
+    }
+}
+
+FileDigest UploadJob::digestFile(const QString& path) {
+    // 파일을 한 번만 읽으며 전체 해시와 조각 해시를 함께 계산한다
+    FileDigest digest;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return digest;
+
+    QCryptographicHash whole(QCryptographicHash::Sha256);
+    QCryptographicHash chunk(QCryptographicHash::Sha256);
+    qint64 inChunk = 0;
+    qint64 size = 0;
+    for (;;) {
+        QByteArray data = file.read(qMin<qint64>(1024 * 1024, Protocol::kFileChunkBytes - inChunk));
+        if (data.isEmpty()) break;
+        whole.addData(data);
+        chunk.addData(data);
+        inChunk += data.size();
+        size += data.size();
+        if (inChunk == Protocol::kFileChunkBytes) {
+            digest.chunks.append(chunk.result().toHex());
+            chunk.reset();
+            inChunk = 0;
+        }
+    }
+    if (file.error() != QFileDevice::NoError) return digest;
+    if (inChunk > 0) digest.chunks.append(chunk.result().toHex());
+    digest.hash = whole.result().toHex();
+    digest.size = size;
+    return digest;
+}
+
+UploadJob::UploadJob(const QString& host, const QString& localPath, QObject *parent)
+    : QObject(parent), host(host), path(localPath) {
+    connect(&hashWatcher, &QFutureWatcher<FileDigest>::finished, this, &UploadJob::hashed);
+}
+
+void UploadJob::start() {
+    // 수 GB 파일도 UI가 멈추지 않도록 다른 스레드에서 해시한다
+    hashWatcher.setFuture(QtConcurrent::run(&UploadJob::digestFile, path));
+}
+
+void UploadJob::abort() {
+    stopTransfers();
+    fail("Cancelled");
+}
+
+void UploadJob::hashed() {
+    if (done) return;
+    fileDigest = hashWatcher.result();
+    if (fileDigest.size < 0) {
+        fail("Cannot read " + path);
+        return;
+    }
+    waitingTicket = true;
+    emit ticketNeeded();
+}
+
+void UploadJob::setTicket(quint16 ticketPort, const QByteArray& newTicket, const QVector<int>& missing) {
+    if (done) return;
+    port = ticketPort;
+    ticket = newTicket;
+    waitingTicket = false;
+
+    // 서버가 알려 준 목록이 기준이다. 끊겼던 업로드도 여기서 받은 조각을 건너뛴다.
+    stopTransfers();
+    queue.clear();
+    retrying.clear();  // 기다리던 재시도는 새 목록에 다시 들어 있다
+    attempts.fill(0, fileDigest.chunks.size());
+    confirmed = fileDigest.size;
+    for (int index : missing) {
+        if (index < 0 || index >= fileDigest.chunks.size()) continue;
+        queue.append(index);
+        confirmed -= chunkLength(fileDigest.size, index);
+    }
+    reportProgress();
+    startNext();
+}
+
+void UploadJob::startNext() {
+    while (active.size() < connections && !queue.isEmpty()) {
+        int index = queue.takeFirst();
+        FileTransfer *transfer = new FileTransfer(FileTransfer::Upload, host, port, ticket, path, this);
+        transfer->setRange(qint64(index) * Protocol::kFileChunkBytes, chunkLength(fileDigest.size, index));
+        active.insert(transfer, 0);
+        connect(transfer, &FileTransfer::progress, this, [this, transfer](qint64 sent, qint64) {
+            active[transfer] = sent;
+            reportProgress();
+        });
+        connect(transfer, &FileTransfer::finished, this, [this, transfer, index](bool ok, const QString& error) {
+            chunkFinished(transfer, index, ok, error);
+        });
+        transfer->start();
+    }
+    // 재시도를 기다리는 조각이 있으면 아직 합치지 않는다
+    if (queue.isEmpty() && active.isEmpty() && retrying.isEmpty() && !waitingTicket) {
+        commit();
+    }
+}
+
+void UploadJob::chunkFinished(FileTransfer *transfer, int index, bool ok, const QString& error) {
+    active.remove(transfer);
+    transfer->deleteLater();
+    if (done) return;
+
+    if (ok && index < 0) {
+        done = true;
+        emit finished(true, QString());
+        return;
+    }
+    if (ok) {
+        confirmed += chunkLength(fileDigest.size, index);
+        reportProgress();
+        startNext();
+        return;
+    }
+
+    // 티켓이 만료되었으면 새 티켓과 함께 아직 없는 조각 목록을 다시 받는다
+    if (error.contains("ticket")) {
+        if (!waitingTicket) {
+            waitingTicket = true;
+            stopTransfers();
+            emit ticketNeeded();
+        }
+        return;
+    }
+    if (index < 0) {
+        fail(error);
+        return;
+    }
+    if (++attempts[index] > kMaxAttempts) {
+        fail(error);
+        return;
+    }
+    retrying.insert(index);
+    QTimer::singleShot(500 << attempts[index], this, [this, index]() {
+        // 그 사이 새 티켓을 받았으면 조각은 새 목록에서 다시 보낸다
+        if (!retrying.remove(index) || done || waitingTicket || queue.contains(index)) return;
+        queue.prepend(index);
+        startNext();
+    });
+}
+
+void UploadJob::commit() {
+    // 모든 조각이 서버에 있으면 파일로 합치게 한다 (이미 있던 파일이면 조각 없이 바로 여기로 온다)
+    FileTransfer *transfer = new FileTransfer(FileTransfer::Commit, host, port, ticket, QString(), this);
+    active.insert(transfer, 0);
+    connect(transfer, &FileTransfer::finished, this, [this, transfer](bool ok, const QString& error) {
+        chunkFinished(transfer, -1, ok, error);
+    });
+    transfer->start();
+}
+
+void UploadJob::reportProgress() {
+    qint64 sent = confirmed;
+    for (qint64 bytes : active) {
+        sent += bytes;
+    }
+    emit progress(qMin(sent, fileDigest.size), fileDigest.size);
+}
+
+void UploadJob::stopTransfers() {
+    for (FileTransfer *transfer : active.keys()) {
+        transfer->disconnect(this);
+        transfer->abort();
+        transfer->deleteLater();
+    }
+    active.clear();
+}
+
+void UploadJob::fail(const QString& error) {
+    if (done) return;
+    done = true;
+    stopTransfers();
+    emit finished(false, error);
+}
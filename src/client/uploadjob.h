@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+class FileTransfer;
+
+// 파일 해시 (전체와 kFileChunkBytes 조각별 SHA-256 hex)
+struct FileDigest {
+    qint64 size = -1;             // 읽지 못하면 -1
+    QByteArray hash;
+    QVector<QByteArray> chunks;
+};
+
+// 내용 해시로 중복을 걸러 내는 조각 업로드
+// 다른 스레드에서 파일을 조각별로 해시한 뒤 티켓을 요청하고, 서버가 없다고 답한 조각만
+// 여러 연결로 나눠 올린다. 서버는 해시가 맞는 조각을 보관하므로, 끊긴 업로드는 다시 시작하면
+// 확인된 조각 뒤부터 이어지고 이미 누군가 올린 파일은 조각을 하나도 보내지 않는다.
+class UploadJob : public QObject {
+    Q_OBJECT
+
+public:
+    static const int kMaxAttempts = 5;  // 조각 하나를 다시 시도하는 횟수
+
+    UploadJob(const QString& host, const QString& localPath, QObject *parent = nullptr);
+
+    // 파일을 한 번 읽어 전체 해시와 조각 해시를 구한다 (어느 스레드에서나 호출할 수 있다)
+    static FileDigest digestFile(const QString& path);
+
+    void setConnections(int count) { connections = qMax(1, count); }
+    // 해시를 계산하고 끝나면 ticketNeeded를 보낸다
+    void start();
+    void abort();
+    // 티켓 응답. missing은 서버에 없는 조각 번호.
+    void setTicket(quint16 port, const QByteArray& ticket, const QVector<int>& missing);
+
+    QString localPath() const { return path; }
+    const FileDigest& digest() const { return fileDigest; }
+
+signals:
+    void progress(qint64 done, qint64 total);
+    // 해시가 준비되었거나 티켓이 만료되어 (다시) 티켓이 필요하다
+    void ticketNeeded();
+    void finished(bool ok, const QString& error);
+
+private:
+    void hashed();
+    void startNext();
+    void chunkFinished(FileTransfer *transfer, int index, bool ok, const QString& error);
+    void commit();
+    void reportProgress();
+    void fail(const QString& error);
+    void stopTransfers();
+
+    QString host;
+    QString path;
+    int connections = 4;
+    quint16 port = 0;
+    QByteArray ticket;
+
+    FileDigest fileDigest;
+    QFutureWatcher<FileDigest> hashWatcher;
+    QVector<int> queue;                        // 아직 보내지 않은 조각
+    QVector<int> attempts;                     // 조각별 실패 횟수
+    QHash<FileTransfer*, qint64> active;       // 보내는 중인 조각과 그 진행 바이트
+    QSet<int> retrying;                        // 실패해 다시 보내기를 기다리는 조각
+    qint64 confirmed = 0;                      // 서버가 가진 것이 확인된 바이트
+    bool waitingTicket = false;
+    bool done = false;
+};
@@ -0,0 +1,331 @@
+#include "protocol.h"
+#include <QtEndian>
+#include <QCborArray>
+#include <QCborValue>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QHash>
+#include <QElapsedTimer>
+#include <cstring>
+
+namespace {
+    // MessageType 값 순서와 같아야 한다
+    const char *const kTypeNames[] = {
+        "",
+        "register",
+        "login",
+        "createRoom",
+        "joinRoom",
+        "message",
+        "fileUploaded",
+        "registrationSuccess",
+        "loginSuccess",
+        "roomList",
+        "fileAvailable",
+        "error",
+        "history",
+        "historyBatch",
+        "roomListRequest",
+        "roomListDelta",
+        "fileTicketRequest",
+        "fileTicket",
+        "fileCatalogRequest",
+        "fileCatalog",
+        "fileCatalogDelta",
+        "fileRemove",
+        "ping",
+        "pong",
+        "resume",
+        "resumed",
+        "leaveRoom"
+    };
+    static_assert(sizeof(kTypeNames) / sizeof(kTypeNames[0]) == std::size_t(MessageType::Count),
+                  "kTypeNames must match MessageType");
+
+    const QLatin1String kTypeKey("type");
+}
+
+QByteArray Protocol::helloPacket(quint8 features) {
+    QByteArray packet(kMagic, kMagicSize);
+    packet.append(char(kVersion));
+    packet.append(char(features));
+    return packet;
+}
+
+QByteArray Protocol::encodeFrame(const QByteArray& payload) {
+    QByteArray frame;
+    frame.reserve(kLengthPrefixSize + payload.size());
+    frame.resize(kLengthPrefixSize);
+    qToBigEndian<quint32>(quint32(payload.size()), reinterpret_cast<uchar*>(frame.data()));
+    frame.append(payload);
+    return frame;
+}
+
+QByteArray Protocol::compressFrame(const QByteArray& frame, int threshold, CompressionStats *stats) {
+    int payloadSize = frame.size() - kLengthPrefixSize;
+    if (threshold <= 0 || payloadSize < threshold) return frame;
+
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray packed = qCompress(reinterpret_cast<const uchar*>(frame.constData() + kLengthPrefixSize),
+                                  payloadSize, kCompressionLevel);
+    qint64 nanos = timer.nsecsElapsed();
+
+    // 줄지 않으면 (이미 압축된 데이터 등) 원본을 보낸다
+    bool smaller = !packed.isEmpty() && packed.size() < payloadSize;
+    if (stats) {
+        stats->bytesIn += payloadSize;
+        stats->bytesOut += smaller ? packed.size() : payloadSize;
+        stats->nanos += nanos;
+        stats->frames += smaller ? 1 : 0;
+    }
+    if (!smaller) return frame;
+
+    QByteArray result;
+    result.reserve(kLengthPrefixSize + packed.size());
+    result.resize(kLengthPrefixSize);
+    qToBigEndian<quint32>(quint32(packed.size()) | kCompressedFlag, reinterpret_cast<uchar*>(result.data()));
+    result.append(packed);
+    return result;
+}
+
+QString Protocol::typeName(MessageType type) {
+    int index = int(type);
+    if (index <= 0 || index >= int(MessageType::Count)) return QString();
+    return QString::fromLatin1(kTypeNames[index]);
+}
+
+MessageType Protocol::typeFromName(const QString& name) {
+    static const QHash<QString, MessageType> types = []() {
+        QHash<QString, MessageType> table;
+        for (int i = 1; i < int(MessageType::Count); ++i) {
+            table.insert(QString::fromLatin1(kTypeNames[i]), MessageType(i));
+        }
+        return table;
+    }();
+    return types.value(name, MessageType::Unknown);
+}
+
+QByteArray Protocol::encodeMessage(WireFormat format, MessageType type, const QCborMap& fields) {
+    if (format == WireFormat::FramedCbor) {
+        QCborArray message;
+        message.append(int(type));
+        message.append(fields);
+        return encodeFrame(QCborValue(message).toCbor());
+    }
+
+    QJsonObject object = fields.toJsonObject();
+    object.insert(kTypeKey, typeName(type));
+    QByteArray json = QJsonDocument(object).toJson(QJsonDocument::Compact);
+    return format == WireFormat::FramedJson ? encodeFrame(json) : json;
+}
+
+bool Protocol::decodeMessage(WireFormat format, const QByteArray& payload,
+                             MessageType& type, QCborMap& fields) {
+    if (format == WireFormat::FramedCbor) {
+        QCborArray message = QCborValue::fromCbor(payload).toArray();
+        if (message.size() != 2 || !message.at(0).isInteger() || !message.at(1).isMap()) {
+            return false;
+        }
+        qint64 tag = message.at(0).toInteger();
+        type = (tag > 0 && tag < int(MessageType::Count)) ? MessageType(tag) : MessageType::Unknown;
+        fields = message.at(1).toMap();
+        return true;
+    }
+
+    QJsonDocument doc = QJsonDocument::fromJson(payload);
+    if (!doc.isObject()) return false;
+
+    QJsonObject object = doc.object();
+    type = typeFromName(object.take(kTypeKey).toString());
+    fields = QCborMap::fromJsonObject(object);
+    return true;
+}
+
+Protocol::WireFormat Protocol::wireFormat(FrameDecoder::Mode mode, quint8 features) {
+    if (mode != FrameDecoder::Framed) return WireFormat::LegacyJson;
+    return (features & FeatureCbor) ? WireFormat::FramedCbor : WireFormat::FramedJson;
+}
+
+WireMessage::WireMessage(MessageType type, const QCborMap& fields)
+    : messageType(type), fields(fields) {}
+
+QByteArray WireMessage::bytes(Protocol::WireFormat format) {
+    QByteArray& cached = encoded[int(format)];
+    if (cached.isEmpty()) {
+        cached = Protocol::encodeMessage(format, messageType, fields);
+    }
+    return cached;
+}
+
+QByteArray WireMessage::compressedBytes(Protocol::WireFormat format, int threshold,
+                                        Protocol::CompressionStats *stats) {
+    // Legacy 스트림에는 프레임이 없어 압축 플래그를 실을 수 없다
+    if (format == Protocol::WireFormat::LegacyJson) return bytes(format);
+    QByteArray& cached = compressed[int(format)];
+    if (cached.isEmpty()) {
+        cached = Protocol::compressFrame(bytes(format), threshold, stats);
+    }
+    return cached;
+}
+
+FrameDecoder::FrameDecoder(Mode mode, int maxFrameSize)
+    : currentMode(mode), maxFrameSize(maxFrameSize) {}
+
+bool FrameDecoder::feed(const QByteArray& data, QList<QByteArray>& frames) {
+    bool ok;
+    if (currentMode == Framed && buffer.isEmpty()) {
+        // 모아 둔 조각이 없으면 받은 바이트(워커가 같이 쓰는 읽기 버퍼일 수 있다)에서 프레임을 바로 꺼내
+        // 프레임마다 한 번만 복사하고, 끝의 덜 온 프레임만 버퍼에 옮긴다
+        int consumed = 0;
+        ok = extractFrames(data.constData(), data.size(), consumed, frames);
+        if (ok && consumed < data.size()) {
+            buffer = QByteArray(data.constData() + consumed, data.size() - consumed);
+        }
+    } else {
+        buffer.append(data);
+
+        if (currentMode == Detect && !detect()) {
+            return true;  // 핸드셰이크 판단에 바이트가 더 필요함
+        }
+
+        if (currentMode == Framed) {
+            int consumed = 0;
+            ok = extractFrames(buffer.constData(), buffer.size(), consumed, frames);
+            buffer.remove(0, consumed);
+        } else {
+            ok = extractJsonDocuments(frames);
+        }
+        if (buffer.isEmpty()) {
+            buffer = QByteArray();  // 유휴 연결이 수신 버퍼 메모리를 붙잡지 않도록
+        }
+    }
+    if (!ok) {
+        buffer.clear();
+        scanPos = 0;
+        docStart = -1;
+        depth = 0;
+        inString = false;
+        escaped = false;
+    }
+    return ok;
+}
+
+bool FrameDecoder::detect() {
+    int n = qMin(buffer.size(), Protocol::kMagicSize);
+    if (std::memcmp(buffer.constData(), Protocol::kMagic, n) != 0) {
+        // 매직이 아니면 핸드셰이크를 모르는 상대
+        currentMode = Legacy;
+        return true;
+    }
+    if (buffer.size() < Protocol::kHelloSize) return false;
+
+    helloVersion = quint8(buffer.at(Protocol::kMagicSize));
+    helloFeatures = quint8(buffer.at(Protocol::kMagicSize + 1));
+    buffer.remove(0, Protocol::kHelloSize);
+    currentMode = Framed;
+    return true;
+}
+
+bool FrameDecoder::extractFrames(const char *data, int size, int& consumed, QList<QByteArray>& frames) {
+    int pos = 0;
+    bool ok = true;
+
+    while (size - pos >= Protocol::kLengthPrefixSize) {
+        const uchar *p = reinterpret_cast<const uchar*>(data + pos);
+        quint32 prefix = qFromBigEndian<quint32>(p);
+        bool isCompressed = (prefix & Protocol::kCompressedFlag) != 0;
+        quint32 length = prefix & ~Protocol::kCompressedFlag;
+        if (isCompressed && !acceptCompressed) {
+            lastError = QStringLiteral("Compressed frame without negotiation");
+            ok = false;
+            break;
+        }
+        if (length > quint32(maxFrameSize)) {
+            lastError = QString("Frame too large (%1 bytes)").arg(length);
+            ok = false;
+            break;
+        }
+        if (size - pos - Protocol::kLengthPrefixSize < int(length)) break;
+
+        const char *payload = data + pos + Protocol::kLengthPrefixSize;
+        pos += Protocol::kLengthPrefixSize + int(length);
+        // 압축 프레임은 풀어 낸 결과만 남기므로 원본을 복사하지 않는다
+        if (!isCompressed) {
+            frames.append(QByteArray(payload, int(length)));
+        } else if (!inflate(QByteArray::fromRawData(payload, int(length)), frames)) {
+            ok = false;
+            break;
+        }
+    }
+
+    consumed = pos;
+    return ok;
+}
+
+bool FrameDecoder::inflate(const QByteArray& payload, QList<QByteArray>& frames) {
+    // 풀기 전에 qCompress 머리의 원본 크기를 확인해 작은 프레임이 거대하게 부풀지 않게 한다
+    if (payload.size() < 4) {
+        lastError = QStringLiteral("Truncated compressed frame");
+        return false;
+    }
+    quint32 original = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(payload.constData()));
+    if (original > quint32(maxFrameSize)) {
+        lastError = QString("Frame too large (%1 bytes)").arg(original);
+        return false;
+    }
+    QByteArray plain = qUncompress(payload);
+    if (plain.isEmpty() || quint32(plain.size()) != original) {
+        lastError = QStringLiteral("Corrupt compressed frame");
+        return false;
+    }
+    frames.append(plain);
+    return true;
+}
+
+bool FrameDecoder::extractJsonDocuments(QList<QByteArray>& frames) {
+    // 최상위 객체의 중괄호 짝을 세어 문서 경계를 찾는다 (문자열 내부는 무시)
+    const char *p = buffer.constData();
+    int consumed = 0;
+
+    for (int i = scanPos; i < buffer.size(); ++i) {
+        char c = p[i];
+        if (docStart < 0) {
+            if (c == '{') {
+                docStart = i;
+                depth = 1;
+            } else {
+                consumed = i + 1;  // 문서 사이의 공백은 버린다
+            }
+            continue;
+        }
+
+        if (inString) {
+            if (escaped) escaped = false;
+            else if (c == '\\') escaped = true;
+            else if (c == '"') inString = false;
+            continue;
+        }
+
+        if (c == '"') {
+            inString = true;
+        } else if (c == '{' || c == '[') {
+            ++depth;
+        } else if ((c == '}' || c == ']') && --depth == 0) {
+            frames.append(buffer.mid(docStart, i + 1 - docStart));
+            docStart = -1;
+            consumed = i + 1;
+        }
+    }
+
+    buffer.remove(0, consumed);
+    scanPos = buffer.size();
+    if (docStart >= 0) {
+        docStart -= consumed;
+        if (buffer.size() - docStart > maxFrameSize) {
+            lastError = QString("JSON document exceeds %1 bytes").arg(maxFrameSize);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QCborMap>
+
+// 메시지 타입 태그 (CBOR 인코딩에서는 "type" 문자열 대신 이 값을 보낸다)
+enum class MessageType : quint8 {
+    Unknown = 0,
+    Register,
+    Login,
+    CreateRoom,
+    JoinRoom,
+    Message,
+    FileUploaded,
+    RegistrationSuccess,
+    LoginSuccess,
+    RoomList,
+    FileAvailable,
+    Error,
+    HistoryRequest,
+    HistoryBatch,
+    RoomListRequest,
+    RoomListDelta,
+    FileTicketRequest,
+    FileTicket,
+    FileCatalogRequest,
+    FileCatalog,
+    FileCatalogDelta,
+    FileRemove,
+    Ping,
+    Pong,
+    Resume,
+    Resumed,
+    LeaveRoom,
+    Count
+};
+
+// 와이어 프로토콜
+// 연결 직후 양쪽이 "QTCH" + 버전 + 기능 플래그(6바이트)를 교환하면
+// 이후 모든 메시지는 [4바이트 big-endian 길이][페이로드] 프레임으로 전송된다.
+// 서버는 클라이언트가 요청한 기능 중 지원하는 것만 응답에 담아 돌려준다.
+// 핸드셰이크를 모르는 상대와는 기존 JSON 스트림(Legacy)으로 동작한다.
+namespace Protocol {
+    const char kMagic[] = "QTCH";
+    const int kMagicSize = 4;
+    const quint8 kVersion = 1;
+    const int kHelloSize = kMagicSize + 2;
+    const int kLengthPrefixSize = 4;
+    const int kDefaultMaxFrameSize = 1024 * 1024;  // 프레임 최대 크기 (1 MiB)
+    const int kHandshakeTimeoutMs = 300;           // 서버가 핸드셰이크를 기다리는 시간
+
+    // 핸드셰이크 기능 플래그
+    enum Feature : quint8 {
+        FeatureCbor = 0x01,       // 페이로드를 [타입 태그, 필드 맵] CBOR 배열로 인코딩
+        FeatureRoomDeltas = 0x02,  // 방 목록을 버전과 추가/삭제 변경분으로 주고받는다
+        FeatureFileChannel = 0x04, // 서버 자체 파일 전송 채널 (없으면 클라이언트는 FTP를 쓴다)
+        FeatureCompression = 0x08, // 임계값보다 큰 프레임을 zlib(qCompress)으로 압축해 보낼 수 있다
+        FeatureHeartbeat = 0x10,   // 서버의 ping에 pong으로 답한다 (조용한 연결을 살아 있는지 확인)
+        FeatureResume = 0x20,      // 끊긴 세션을 로그인 때 받은 토큰으로 이어 받고 놓친 메시지만 받는다
+        FeatureMultiRoom = 0x40    // 연결 하나로 여러 방을 구독한다 (joinRoom이 이전 방을 떠나지 않는다)
+    };
+
+    // 압축 프레임
+    // 길이 접두의 최상위 비트가 켜져 있으면 페이로드는 qCompress 결과다
+    // ([4바이트 big-endian 원본 크기][zlib 스트림]). 나머지 31비트가 압축된 길이다.
+    // 프레임마다 독립적으로 압축하므로 방송은 한 번 압축한 바이트를 모든 수신자가 공유한다.
+    const quint32 kCompressedFlag = 0x80000000u;
+    const int kDefaultCompressThreshold = 512;     // 이보다 작은 페이로드는 압축하지 않는다
+    const int kCompressionLevel = 6;
+
+    // 파일 전송 채널 (채팅과 다른 포트)
+    // 클라이언트는 채팅 연결에서 받은 티켓으로 "QTCF <ticket> <offset> <length>\n"을 보낸다.
+    // 업로드: 서버가 "OK <offset부터 이미 받은 바이트>\n"으로 답하면 그 뒤부터 보내고,
+    //         다 받으면 "DONE <크기>\n"을 받는다.
+    // 다운로드: "OK <파일 크기>\n" 다음에 [offset, offset+length) 바이트가 온다 (length 0이면 끝까지).
+    // 실패하면 "ERR <이유>\n" 후 연결이 닫힌다.
+    // 조각 업로드 티켓(티켓 요청에 hash와 chunks를 담은 경우)은 요청 하나가 조각 하나다.
+    // offset은 kFileChunkBytes의 배수, length는 그 조각의 길이이고, 서버는 조각 해시를 확인한다.
+    // 조각을 다 올리면 "QTCF <ticket> COMMIT\n"으로 파일을 합치게 하고 "DONE <크기>\n"을 받는다.
+    const char kFileChannelMagic[] = "QTCF";
+    const char kFileChannelCommit[] = "COMMIT";
+    const int kFileChannelMaxLine = 256;
+    const qint64 kFileChunkBytes = 4 * 1024 * 1024;
+
+    // 하트비트
+    // FeatureHeartbeat를 합의한 연결은 서버가 한동안 아무것도 받지 못하면 ping을 보내고,
+    // 클라이언트는 바로 pong으로 답한다. 무엇이든 받으면 살아 있는 것으로 본다.
+    // 어느 쪽이 보낸 ping이든 받은 쪽은 pong으로 답한다.
+
+    // 세션 이어 받기
+    // FeatureResume를 합의한 연결은 loginSuccess에 token을 받는다. 연결이 끊긴 뒤 정해진 시간 안에
+    // 새 연결에서 로그인 대신 resume {token, lastSeq}를 보내면 같은 사용자로 마지막 방에 다시 들어가고,
+    // resumed {ok, room, complete} 다음에 lastSeq 뒤의 방 메시지만 다시 받는다.
+    // 서버가 그만큼 보관하고 있지 않으면 complete가 false이고 입장할 때처럼 최근 기록을 받는다.
+    // ok가 false면 토큰이 만료된 것이므로 다시 로그인한다.
+    // 다시 받은 메시지와 실시간 메시지가 겹칠 수 있으므로 클라이언트는 seq로 중복을 거른다.
+    // 여러 방을 구독한 세션은 seqs {방 이름: lastSeq}도 보내고, 구독한 방에 모두 다시 들어간다.
+    // resumed의 rooms는 다시 들어간 방, backfilled는 그중 최근 기록을 대신 받는 방이다.
+
+    // 여러 방 구독
+    // FeatureMultiRoom을 합의한 연결은 joinRoom으로 구독을 더하고 leaveRoom {room}으로 뺀다.
+    // 방에 보내는 요청(message, fileUploaded, historyRequest, 파일 요청)은 room으로 방을 고르고,
+    // 없으면 마지막으로 들어간 방으로 간다. 서버가 보내는 방 메시지에는 모두 room이 붙는다.
+    // 여러 방에 함께 가는 안내(접속 종료 등)는 room 대신 rooms 배열을 담아 연결마다 한 번만 보낸다.
+    // loginSuccess의 room은 로그인하면서 들어간 기본 방이다.
+
+    // 방 파일 목록은 채팅 연결로 서버가 밀어 준다.
+    // 방에 들어가면 fileCatalog {room, epoch, version, files} 스냅샷을 한 번 받고,
+    // 이후에는 fileCatalogDelta {room, epoch, from, version, added, removed}만 받는다.
+    // from이 가진 버전과 다르면 중간 변경을 놓친 것이므로 fileCatalogRequest로 다시 받는다.
+
+    // 연결에서 합의된 전송 형식
+    enum class WireFormat {
+        LegacyJson,  // 프레임 없는 JSON 스트림
+        FramedJson,  // 프레임 + 압축(Compact) JSON
+        FramedCbor   // 프레임 + CBOR
+    };
+    const int kWireFormatCount = 3;
+
+    QByteArray helloPacket(quint8 features);
+    QByteArray encodeFrame(const QByteArray& payload);
+
+    // 압축에 든 비용 (벤치마크와 메트릭용)
+    struct CompressionStats {
+        qint64 bytesIn = 0;     // 압축을 시도한 페이로드 바이트
+        qint64 bytesOut = 0;    // 실제로 보낸 페이로드 바이트
+        qint64 nanos = 0;       // 압축에 쓴 시간
+        int frames = 0;         // 압축해 보낸 프레임 수
+    };
+    // 프레임을 압축 프레임으로 바꾼다. 페이로드가 threshold보다 작거나 줄지 않으면 그대로 돌려준다.
+    QByteArray compressFrame(const QByteArray& frame, int threshold, CompressionStats *stats = nullptr);
+
+    QString typeName(MessageType type);
+    MessageType typeFromName(const QString& name);
+
+    // 메시지를 형식에 맞는 전송 바이트(프레임 포함)로 만든다
+    QByteArray encodeMessage(WireFormat format, MessageType type, const QCborMap& fields);
+    // 프레임 페이로드를 타입과 필드로 풀어낸다
+    bool decodeMessage(WireFormat format, const QByteArray& payload,
+                       MessageType& type, QCborMap& fields);
+}
+
+// 연결별 수신 버퍼
+// 소켓에서 읽은 바이트를 누적하고, 완성된 프레임(또는 Legacy 모드의 JSON 문서)을
+// 한 번에 모두 꺼낸다. TCP가 메시지를 합치거나 쪼개도 손실되지 않는다.
+class FrameDecoder {
+public:
+    enum Mode {
+        Detect,  // 첫 바이트로 핸드셰이크 여부를 판단하는 중
+        Framed,  // 길이 접두 프레임
+        Legacy   // 구버전 상대: 연속된 JSON 객체 스트림
+    };
+
+    explicit FrameDecoder(Mode mode = Detect, int maxFrameSize = Protocol::kDefaultMaxFrameSize);
+
+    // 수신 데이터를 추가하고 완성된 프레임을 frames 뒤에 붙인다.
+    // 프레임 크기 초과 등 복구할 수 없는 오류면 false를 반환한다.
+    bool feed(const QByteArray& data, QList<QByteArray>& frames);
+
+    Mode mode() const { return currentMode; }
+    void setMode(Mode mode) { currentMode = mode; }
+    void setMaxFrameSize(int size) { maxFrameSize = size; }
+    // FeatureCompression이 합의된 뒤에만 압축 프레임을 받는다
+    void setAcceptCompressed(bool accept) { acceptCompressed = accept; }
+    quint8 peerVersion() const { return helloVersion; }
+    quint8 peerFeatures() const { return helloFeatures; }
+    int bufferedBytes() const { return buffer.size(); }
+    QString errorString() const { return lastError; }
+
+private:
+    bool detect();
+    // data에서 완성된 프레임을 꺼내고 쓴 바이트 수를 consumed에 담는다
+    bool extractFrames(const char *data, int size, int& consumed, QList<QByteArray>& frames);
+    bool extractJsonDocuments(QList<QByteArray>& frames);
+    bool inflate(const QByteArray& payload, QList<QByteArray>& frames);
+
+    Mode currentMode;
+    int maxFrameSize;
+    bool acceptCompressed = false;
+    QByteArray buffer;
+    quint8 helloVersion = 0;
+    quint8 helloFeatures = 0;
+    QString lastError;
+
+    // Legacy 모드 스캔 상태 (이미 검사한 바이트를 다시 보지 않기 위함)
+    int scanPos = 0;
+    int docStart = -1;
+    int depth = 0;
+    bool inString = false;
+    bool escaped = false;
+};
+
+namespace Protocol {
+    // 핸드셰이크 결과로부터 전송 형식을 결정한다
+    WireFormat wireFormat(FrameDecoder::Mode mode, quint8 features);
+}
+
+// 하나의 메시지를 전송 형식별로 한 번씩만 인코딩해 여러 연결에 재사용한다
+class WireMessage {
+public:
+    WireMessage() : messageType(MessageType::Unknown) {}
+    WireMessage(MessageType type, const QCborMap& fields);
+
+    MessageType type() const { return messageType; }
+    QByteArray bytes(Protocol::WireFormat format);
+    // 압축을 합의한 연결용 바이트. 형식별로 한 번만 압축하고, 실제로 압축한 호출만 stats에 더한다.
+    QByteArray compressedBytes(Protocol::WireFormat format, int threshold,
+                               Protocol::CompressionStats *stats = nullptr);
+
+private:
+    MessageType messageType;
+    QCborMap fields;
+    QByteArray encoded[Protocol::kWireFormatCount];
+    QByteArray compressed[Protocol::kWireFormatCount];
+};
@@ -1,4 +1,4 @@
-QT += core network
+QT += core network concurrent
 QT -= gui
 
 TARGET = chat_server
@@ -10,12 +10,56 @@ DESTDIR = $$PWD/build/server
 OBJECTS_DIR = $$PWD/build/server/.obj
 MOC_DIR = $$PWD/build/server/.moc
 
+INCLUDEPATH += $$PWD/common
+
 SOURCES += \
     server/main.cpp \
-    server/server.cpp
+    server/server.cpp \
+    server/chatworker.cpp \
+    server/chatdirectory.cpp \
+    server/outboundqueue.cpp \
+    server/clientconnection.cpp \
+    server/historystore.cpp \
+    server/statestore.cpp \
+    server/metrics.cpp \
+    server/logger.cpp \
+    server/filestore.cpp \
+    server/filetransfer.cpp \
+    server/ratelimit.cpp \
+    server/timerwheel.cpp \
+    server/transport.cpp \
+    server/federation.cpp \
+    server/sessionregistry.cpp \
+    server/replayring.cpp \
+    common/protocol.cpp
 
 HEADERS += \
-    server/server.h
+    server/server.h \
+    server/chatworker.h \
+    server/chatdirectory.h \
+    server/mailbox.h \
+    server/outboundqueue.h \
+    server/clientconnection.h \
+    server/historystore.h \
+    server/statestore.h \
+    server/metrics.h \
+    server/logger.h \
+    server/filestore.h \
+    server/filetransfer.h \
+    server/ratelimit.h \
+    server/timerwheel.h \
+    server/transport.h \
+    server/federation.h \
+    server/sessionregistry.h \
+    server/replayring.h \
+    server/serverconfig.h \
+    common/protocol.h
+
+# epoll 백엔드 (Linux 전용)
+linux {
+    SOURCES += server/epollbackend.cpp
+    HEADERS += server/epollbackend.h
+}
 
 # client 관련 파일들 명시적으로 제외
 INCLUDEPATH -= client
\ No newline at end of file
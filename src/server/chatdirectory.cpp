@@ -0,0 +1,222 @@
+#include "chatdirectory.h"
+#include "statestore.h"
+#include <QDateTime>
+#include <algorithm>
+
+const quint32 ChatDirectory::kInvalidId;
+const int ChatDirectory::kMaxRoomChanges;
+
+ChatDirectory::ChatDirectory() : listEpoch(QDateTime::currentMSecsSinceEpoch()) {
+    defaultRoom = createRoom("Public", QString());
+}
+
+ChatDirectory::~ChatDirectory() {
+    qDeleteAll(rooms);
+}
+
+ChatDirectory::Result ChatDirectory::registerUser(const QString& username, const QString& password) {
+    quint64 seq = 0;
+    {
+        // WAL 순서가 ID 부여 순서와 같도록 잠금 안에서 기록한다
+        QWriteLocker locker(&userLock);
+        if (userIds.contains(username)) return AlreadyExists;
+        if (journal) {
+            seq = journal->append(StateStore::RegisterUser, username, password);
+            if (seq == 0) return StorageFailed;
+        }
+
+        User newUser;
+        newUser.username = username;
+        newUser.password = password;
+        userIds.insert(username, quint32(users.size()));
+        users.append(newUser);
+    }
+
+    // 응답하기 전에 디스크에 내린다 (잠금 밖이라 다른 등록과 fsync를 나눠 쓴다)
+    syncJournal(seq);
+    return Ok;
+}
+
+quint32 ChatDirectory::authenticate(const QString& username, const QString& password) const {
+    QReadLocker locker(&userLock);
+    quint32 id = userIds.value(username, kInvalidId);
+    if (id == kInvalidId || users.at(int(id)).password != password) return kInvalidId;
+    return id;
+}
+
+QString ChatDirectory::username(quint32 userId) const {
+    QReadLocker locker(&userLock);
+    return userId < quint32(users.size()) ? users.at(int(userId)).username : QString();
+}
+
+int ChatDirectory::userCount() const {
+    QReadLocker locker(&userLock);
+    return users.size();
+}
+
+bool ChatDirectory::findUser(const QString& username, QString *password) const {
+    QReadLocker locker(&userLock);
+    quint32 id = userIds.value(username, kInvalidId);
+    if (id == kInvalidId) return false;
+    if (password) *password = users.at(int(id)).password;
+    return true;
+}
+
+ChatDirectory::Result ChatDirectory::storeUser(const QString& username, const QString& password) {
+    quint64 seq = 0;
+    {
+        QWriteLocker locker(&userLock);
+        quint32 id = userIds.value(username, kInvalidId);
+        if (id != kInvalidId && users.at(int(id)).password == password) return Ok;
+        if (journal) {
+            seq = journal->append(id == kInvalidId ? StateStore::RegisterUser : StateStore::UpdateUser,
+                                  username, password);
+            if (seq == 0) return StorageFailed;
+        }
+
+        if (id == kInvalidId) {
+            User newUser;
+            newUser.username = username;
+            newUser.password = password;
+            userIds.insert(username, quint32(users.size()));
+            users.append(newUser);
+        } else {
+            users[int(id)].password = password;
+        }
+    }
+
+    syncJournal(seq);
+    return Ok;
+}
+
+QVector<User> ChatDirectory::allUsers() const {
+    QReadLocker locker(&userLock);
+    return users;  // 암시적 공유라 여기서는 복사하지 않는다
+}
+
+ChatRoom* ChatDirectory::createRoom(const QString& name, const QString& password, Result *result) {
+    ChatRoom *room = nullptr;
+    quint64 seq = 0;
+    {
+        QWriteLocker locker(&roomLock);
+        if (roomsByName.contains(name)) {
+            if (result) *result = AlreadyExists;
+            return nullptr;
+        }
+        if (journal) {
+            seq = journal->append(StateStore::CreateRoom, name, password);
+            if (seq == 0) {
+                if (result) *result = StorageFailed;
+                return nullptr;
+            }
+        }
+
+        room = new ChatRoom(quint32(rooms.size()), name, password);
+        rooms.append(room);
+        roomsByName.insert(name, room);
+
+        RoomListChange change = { listVersion.loadAcquire() + 1, true, name };
+        if (roomChanges.size() >= kMaxRoomChanges) {
+            roomChanges.remove(0, roomChanges.size() / 2);
+        }
+        roomChanges.append(change);
+        listVersion.storeRelease(change.version);
+    }
+
+    syncJournal(seq);
+    if (result) *result = Ok;
+    return room;
+}
+
+void ChatDirectory::syncJournal(quint64 seq) {
+    // fsync가 실패하면 레코드가 디스크에 남았는지 알 수 없어 되돌릴 수도 없다.
+    // 다른 클라이언트에 이미 보인 목록과 디스크가 어긋난 채로 계속하지 않고 멈춘다 (재시작하면 WAL로 복구한다).
+    if (journal && !journal->sync(seq)) {
+        qFatal("Cannot sync the state WAL (record %llu); stopping", static_cast<unsigned long long>(seq));
+    }
+}
+
+ChatRoom* ChatDirectory::findRoom(const QString& name) const {
+    QReadLocker locker(&roomLock);
+    return roomsByName.value(name, nullptr);
+}
+
+QString ChatDirectory::roomPassword(const ChatRoom* room) const {
+    QReadLocker locker(&roomLock);
+    return room->password;
+}
+
+ChatDirectory::Result ChatDirectory::setRoomPassword(ChatRoom* room, const QString& password) {
+    quint64 seq = 0;
+    {
+        QWriteLocker locker(&roomLock);
+        if (room->password == password) return Ok;
+        if (journal) {
+            seq = journal->append(StateStore::SetRoomPassword, room->name, password);
+            if (seq == 0) return StorageFailed;
+        }
+        room->password = password;
+    }
+
+    syncJournal(seq);
+    return Ok;
+}
+
+QStringList ChatDirectory::roomNames() const {
+    quint64 version;
+    return roomNames(version);
+}
+
+QStringList ChatDirectory::roomNames(quint64& version) const {
+    QReadLocker locker(&roomLock);
+    version = listVersion.loadAcquire();
+    QStringList names;
+    names.reserve(rooms.size());
+    for (ChatRoom *room : rooms) {
+        names.append(room->name);
+    }
+    // 클라이언트에는 지금까지처럼 이름순으로 보여 준다
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+bool ChatDirectory::roomChangesSince(quint64 version, QVector<RoomListChange>& changes) const {
+    QReadLocker locker(&roomLock);
+    quint64 current = listVersion.loadAcquire();
+    if (version > current) return false;
+    if (version == current) return true;
+    if (roomChanges.isEmpty() || roomChanges.first().version > version + 1) return false;
+
+    // 버전은 1씩 오르므로 위치를 바로 계산한다
+    int start = int(version + 1 - roomChanges.first().version);
+    for (int i = start; i < roomChanges.size(); ++i) {
+        changes.append(roomChanges.at(i));
+    }
+    return true;
+}
+
+QVector<ChatRoom*> ChatDirectory::allRooms() const {
+    QReadLocker locker(&roomLock);
+    return rooms;
+}
+
+void ChatDirectory::reserveUsers(int count) {
+    QWriteLocker locker(&userLock);
+    users.reserve(count);
+    userIds.reserve(count);
+}
+
+DirectoryState ChatDirectory::capture() const {
+    // 두 잠금을 함께 잡는 동안에는 등록/방 생성이 WAL에 끼어들 수 없다
+    QReadLocker userLocker(&userLock);
+    QReadLocker roomLocker(&roomLock);
+
+    DirectoryState state;
+    state.users = users;  // 암시적 공유라 여기서는 복사하지 않는다
+    state.rooms.reserve(rooms.size());
+    for (ChatRoom *room : rooms) {
+        state.rooms.append(qMakePair(room->name, room->password));
+    }
+    state.seq = journal ? journal->rotate() : 0;
+    return state;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QHash>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "replayring.h"
+
+class RoomLog;
+class StateStore;
+
+class ChatRoom {
+public:
+    quint32 id = 0;                       // 방 ID (0부터 조밀하게 부여)
+    QString name;                         // 방 이름
+    QString password;                     // 방 비밀번호 (다른 노드가 바꿀 수 있어 roomPassword로 읽는다)
+    QAtomicInteger<quint64> workerMask;   // 이 방에 로컬 참가자가 있는 워커 비트
+    QAtomicInteger<quint64> nodeMask;     // 이 노드가 소유한 방을 구독한 다른 노드 비트 (페더레이션)
+    QAtomicInteger<quint64> lastSeq;      // 마지막으로 부여한 메시지 번호
+    QAtomicPointer<RoomLog> historyLog;   // 메시지 기록 (기록을 끄면 nullptr)
+    QAtomicInt memberCount;               // 모든 워커의 참가자 수 (계측, 소유 노드 구독)
+    ReplayRing replay;                    // 세션 이어 받기용 최근 메시지
+
+    ChatRoom() {} // 기본 생성자
+    ChatRoom(quint32 roomId, const QString &roomName, const QString &roomPassword)
+        : id(roomId), name(roomName), password(roomPassword) {}
+};
+
+class User {
+public:
+    QString username;  // 사용자 이름
+    QString password;  // 사용자 비밀번호
+};
+
+// 방 목록 변경 하나 (version은 이 변경을 적용한 뒤의 목록 버전)
+struct RoomListChange {
+    quint64 version;
+    bool added;
+    QString name;
+};
+
+// 스냅샷용으로 복사한 목록
+struct DirectoryState {
+    QVector<User> users;                       // 사용자 ID 순
+    QVector<QPair<QString, QString> > rooms;   // 방 ID 순 (이름, 비밀번호)
+    quint64 seq = 0;                           // 이 상태에 포함된 마지막 WAL 번호
+};
+
+// 모든 워커가 공유하는 사용자/방 목록
+// 사용자와 방은 조밀한 정수 ID를 받고 이름은 해시로 찾는다.
+// 등록, 로그인, 방 생성/입장 때만 잠금을 잡는다. 방 객체는 서버가 끝날 때까지
+// 유지되므로 워커는 ChatRoom 포인터를 잠금 없이 들고 있을 수 있다.
+class ChatDirectory {
+public:
+    static const quint32 kInvalidId = 0xffffffffu;
+
+    enum Result {
+        Ok,
+        AlreadyExists,
+        StorageFailed   // WAL에 기록하지 못함 (목록은 바뀌지 않았다)
+    };
+
+    ChatDirectory();
+    ~ChatDirectory();
+
+    // 설정하면 이후의 등록/방 생성을 WAL에 남긴다 (복구가 끝난 뒤 한 번)
+    // 기록한 레코드를 디스크에 내리지 못하면 서버를 멈춘다.
+    void setJournal(StateStore *store) { journal = store; }
+
+    Result registerUser(const QString& username, const QString& password);
+    // 성공하면 사용자 ID, 실패하면 kInvalidId
+    quint32 authenticate(const QString& username, const QString& password) const;
+    QString username(quint32 userId) const;
+    int userCount() const;
+    // 있으면 비밀번호를 담고 true
+    bool findUser(const QString& username, QString *password) const;
+    // 다른 노드에서 정한 사용자를 반영한다. 없으면 등록하고, 있으면 비밀번호를 바꾼다.
+    Result storeUser(const QString& username, const QString& password);
+    QVector<User> allUsers() const;
+
+    // 실패하면 nullptr이고 이유는 result에 담는다
+    ChatRoom* createRoom(const QString& name, const QString& password, Result *result = nullptr);
+    ChatRoom* findRoom(const QString& name) const;
+    QString roomPassword(const ChatRoom* room) const;
+    // 다른 노드에서 정한 비밀번호로 바꾼다
+    Result setRoomPassword(ChatRoom* room, const QString& password);
+    ChatRoom* publicRoom() const { return defaultRoom; }
+    QStringList roomNames() const;
+    QVector<ChatRoom*> allRooms() const;
+
+    // 방 목록 버전. 방이 생기거나 없어질 때마다 1씩 오른다.
+    // epoch는 서버 실행마다 달라서 재시작 전의 버전과 구별된다.
+    qint64 roomListEpoch() const { return listEpoch; }
+    quint64 roomListVersion() const { return listVersion.loadAcquire(); }
+    // 이름순 목록과 그 버전을 함께 읽는다
+    QStringList roomNames(quint64& version) const;
+    // version 이후의 변경을 순서대로 담는다. 너무 오래되어 남아 있지 않으면 false.
+    bool roomChangesSince(quint64 version, QVector<RoomListChange>& changes) const;
+
+    // 복구할 때 사용자 수를 미리 알려 재해시를 피한다
+    void reserveUsers(int count);
+    // 일관된 시점의 목록을 복사한다. 그 사이 WAL은 새 파일로 넘어간다.
+    DirectoryState capture() const;
+
+private:
+    void syncJournal(quint64 seq);
+
+    mutable QReadWriteLock userLock;
+    mutable QReadWriteLock roomLock;
+    QVector<User> users;                   // 사용자 ID → 사용자
+    QHash<QString, quint32> userIds;       // 이름 → 사용자 ID
+    QVector<ChatRoom*> rooms;              // 방 ID → 방
+    QHash<QString, ChatRoom*> roomsByName; // 이름 → 방
+    ChatRoom *defaultRoom;
+    StateStore *journal = nullptr;
+
+    static const int kMaxRoomChanges = 1024;  // 보관하는 최근 변경 수
+    const qint64 listEpoch;
+    QAtomicInteger<quint64> listVersion;
+    QVector<RoomListChange> roomChanges;      // 최근 변경 (roomLock으로 보호)
+
+    Q_DISABLE_COPY(ChatDirectory)
+};
@@ -0,0 +1,1459 @@
+#include "chatworker.h"
+#include <QCborArray>
+#include <QCborValue>
+#include <QDateTime>
+#include <QTimer>
+#include <limits>
+#include "logger.h"
+#ifdef Q_OS_LINUX
+#include "epollbackend.h"
+#endif
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <cerrno>
+#endif
+
+const qint64 ChatWorker::kSocketWriteBudget;
+const int ChatWorker::kLagProbeMs;
+const int ChatWorker::kMaxWriteBatch;
+const int ChatWorker::kWheelTickMs;
+const int ChatWorker::kSweepBatch;
+
+namespace {
+    // 요청한 클라이언트가 기다리는 응답은 일괄 쓰기를 기다리지 않는다
+    bool isUrgent(MessageType type) {
+        return type == MessageType::Error || type == MessageType::RegistrationSuccess
+            || type == MessageType::LoginSuccess || type == MessageType::Resumed;
+    }
+
+    // writev를 여러 번 나눠 해야 할 때 작은 세그먼트가 따로 나가지 않도록 막아 둔다
+    void setCork(qintptr descriptor, bool on) {
+#ifdef Q_OS_LINUX
+        int value = on ? 1 : 0;
+        ::setsockopt(int(descriptor), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#else
+        Q_UNUSED(descriptor);
+        Q_UNUSED(on);
+#endif
+    }
+}
+
+ChatWorker::ChatWorker(int index, const ServerConfig& config, ChatDirectory *directory,
+                       HistoryStore *history, FileStore *files, QObject *parent)
+    : QObject(parent), workerIndex(index), config(config), directory(directory), history(history),
+      files(files), wheel(kWheelTickMs), pingMessage(MessageType::Ping, QCborMap()) {
+    uptime.start();
+}
+
+ChatWorker::~ChatWorker() {
+    for (ClientConnection *connection : connections) {
+        connection->transport->release();
+        delete connection;
+    }
+}
+
+void ChatWorker::start() {
+    // 타이머가 예정보다 늦게 깨어난 만큼이 이벤트 루프가 밀린 시간이다
+    QTimer *lagTimer = new QTimer(this);
+    lagTimer->setTimerType(Qt::PreciseTimer);
+    connect(lagTimer, &QTimer::timeout, this, &ChatWorker::probeLoopLag);
+    lagClock.start();
+    lagTimer->start(kLagProbeMs);
+
+#ifdef Q_OS_LINUX
+    if (config.ioBackend == IoBackend::Epoll) {
+        poller = new EpollPoller(this, this);
+        if (!poller->isValid()) {
+            CHAT_LOG(Warning, Server) << "Worker" << workerIndex << "falls back to the Qt socket backend";
+            delete poller;
+            poller = nullptr;
+        }
+    }
+#endif
+
+    // 연결마다 타이머를 두지 않고 휠 하나를 틱마다 돌린다
+    QTimer *wheelTimer = new QTimer(this);
+    connect(wheelTimer, &QTimer::timeout, this, &ChatWorker::sweepTimeouts);
+    wheelTimer->start(kWheelTickMs);
+}
+
+void ChatWorker::probeLoopLag() {
+    qint64 elapsedUs = lagClock.nsecsElapsed() / 1000;
+    lagClock.restart();
+    qint64 lagUs = elapsedUs - qint64(kLagProbeMs) * 1000;
+    metrics.recordLoopLag(lagUs);
+
+    if (overload) {
+        qint64 queued = 0;
+        for (ClientConnection *connection : connections) {
+            queued += connection->outbound.queuedBytes();
+        }
+        overload->report(workerIndex, qMax<qint64>(0, lagUs), queued);
+    }
+}
+
+void ChatWorker::sweepTimeouts() {
+    sweepScheduled = false;
+    nowMs = uptime.elapsed();
+    wheel.advance(nowMs);
+
+    // 한꺼번에 많이 만료되어도 이벤트 루프를 오래 붙잡지 않도록 나눠서 본다
+    for (int i = 0; i < kSweepBatch; ++i) {
+        TimerNode *node = wheel.takeDue();
+        if (!node) return;
+        checkTimeouts(*static_cast<ClientConnection*>(node->owner));
+    }
+    if (wheel.hasDue()) {
+        sweepScheduled = true;
+        QMetaObject::invokeMethod(this, [this]() {
+            if (sweepScheduled) sweepTimeouts();
+        }, Qt::QueuedConnection);
+    }
+}
+
+bool ChatWorker::hasPendingWrite(const ClientConnection& connection) const {
+    return !connection.outbound.isEmpty() || connection.transport->bytesToWrite() > 0;
+}
+
+void ChatWorker::checkTimeouts(ClientConnection& connection) {
+    // 이미 끊는 중이면 곧 handleDisconnection이 온다
+    if (connection.evicted) return;
+
+    // 핸드셰이크가 오지 않으면 기존 JSON 클라이언트로 간주하고 방 목록을 보낸다
+    if (connection.decoder.mode() == FrameDecoder::Detect
+        && nowMs - connection.connectedMs >= Protocol::kHandshakeTimeoutMs) {
+        connection.decoder.setMode(FrameDecoder::Legacy);
+        completeHandshake(connection);
+    }
+
+    const TimeoutConfig& limits = config.timeouts;
+    bool heartbeat = connection.features & Protocol::FeatureHeartbeat;
+    TimeoutKind expired = TimeoutKind::Count;
+    if (limits.loginDeadlineMs > 0 && !connection.session.isLoggedIn()
+        && nowMs - connection.connectedMs >= limits.loginDeadlineMs) {
+        expired = TimeoutKind::LoginDeadline;
+    } else if (heartbeat && limits.idleTimeoutMs > 0 && nowMs - connection.lastInboundMs >= limits.idleTimeoutMs) {
+        expired = TimeoutKind::Idle;
+    } else if (limits.writeStallMs > 0 && hasPendingWrite(connection)
+               && nowMs - connection.lastWriteMs >= limits.writeStallMs) {
+        expired = TimeoutKind::WriteStall;
+    }
+
+    if (expired != TimeoutKind::Count) {
+        static const char *const reasons[] = { "idle", "login deadline", "write stall" };
+        metrics.recordTimeout(expired);
+        CHAT_LOG(Info, Connection) << "Closing connection on worker" << workerIndex << "-" << reasons[int(expired)]
+                                   << (connection.session.isLoggedIn() ? connection.session.username : QString());
+        // transportClosed가 바로 와서 connection을 지운다
+        connection.transport->abort();
+        return;
+    }
+
+    // 조용해진 연결에는 ping을 한 번 보내고 응답(무엇이든)을 기다린다
+    if (heartbeat && limits.heartbeatIntervalMs > 0 && connection.lastPingMs < connection.lastInboundMs
+        && nowMs - connection.lastInboundMs >= limits.heartbeatIntervalMs) {
+        connection.lastPingMs = nowMs;
+        metrics.recordPing();
+        sendToClient(connection, pingMessage);
+    }
+    scheduleTimeouts(connection);
+}
+
+void ChatWorker::scheduleTimeouts(ClientConnection& connection) {
+    // 활동할 때마다 휠을 건드리지 않고, 가장 이른 기한에 다시 꺼내 그때의 시각으로 판단한다
+    const TimeoutConfig& limits = config.timeouts;
+    const qint64 kNever = std::numeric_limits<qint64>::max();
+    qint64 next = kNever;
+    if (connection.decoder.mode() == FrameDecoder::Detect) {
+        next = connection.connectedMs + Protocol::kHandshakeTimeoutMs;
+    }
+    if (limits.loginDeadlineMs > 0 && !connection.session.isLoggedIn()) {
+        next = qMin(next, connection.connectedMs + limits.loginDeadlineMs);
+    }
+    if (connection.features & Protocol::FeatureHeartbeat) {
+        if (limits.idleTimeoutMs > 0) next = qMin(next, connection.lastInboundMs + limits.idleTimeoutMs);
+        if (limits.heartbeatIntervalMs > 0 && connection.lastPingMs < connection.lastInboundMs) {
+            next = qMin(next, connection.lastInboundMs + limits.heartbeatIntervalMs);
+        }
+    }
+    // 송신 정체는 언제 시작될지 모르므로 그 주기로 살펴본다
+    if (limits.writeStallMs > 0) {
+        next = qMin(next, (hasPendingWrite(connection) ? connection.lastWriteMs : nowMs) + limits.writeStallMs);
+    }
+
+    if (next == kNever) {
+        wheel.cancel(&connection.timer);
+        return;
+    }
+    wheel.schedule(&connection.timer, nowMs, next - nowMs);
+}
+
+void ChatWorker::addConnection(qintptr socketDescriptor) {
+    nowMs = uptime.elapsed();
+    ClientConnection *connection = new ClientConnection(config.outbound);
+    connection->transport = openTransport(socketDescriptor, connection);
+    if (!connection->transport) {
+        delete connection;
+        CHAT_LOG(Warning, Connection) << "Failed to set socket descriptor";
+        return;
+    }
+
+    connection->id = ++nextConnectionId;
+    connection->typeBuckets.resize(config.rateLimits.bucketCount());
+    connection->timer.owner = connection;
+    connection->connectedMs = connection->lastInboundMs = connection->lastWriteMs = nowMs;
+    connections.insert(connection->id, connection);
+    metrics.connectionOpened();
+
+    // 핸드셰이크 기한도 휠에 건다 (오지 않으면 기존 JSON 클라이언트로 간주한다)
+    scheduleTimeouts(*connection);
+    CHAT_LOG(Debug, Connection) << "New client connected on worker" << workerIndex;
+}
+
+ClientTransport* ChatWorker::openTransport(qintptr socketDescriptor, ClientConnection *connection) {
+#ifdef Q_OS_LINUX
+    if (poller) {
+        return poller->add(int(socketDescriptor), connection);
+    }
+#endif
+
+    QTcpSocket *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return nullptr;
+    }
+    // 프레임은 직접 모아서 쓰므로 Nagle 지연은 끈다
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    // 하트비트를 모르는 클라이언트의 반열림 연결은 커널 keepalive에 맡긴다
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    return new QtTransport(socket, connection, this);
+}
+
+void ChatWorker::transportRead(ClientConnection& connection, const QByteArray& data) {
+    readFromClient(connection, data);
+}
+
+void ChatWorker::transportWritten(ClientConnection& connection) {
+    connection.lastWriteMs = nowMs;
+    flushOutbound(connection);
+}
+
+void ChatWorker::transportClosed(ClientConnection& connection) {
+    handleDisconnection(&connection);
+}
+
+void ChatWorker::post(const RoomDelivery& delivery) {
+    if (mailbox.push(delivery)) {
+        QMetaObject::invokeMethod(this, [this]() { drainMailbox(); }, Qt::QueuedConnection);
+    }
+}
+
+void ChatWorker::drainMailbox() {
+    mailbox.drain([this](RoomDelivery& delivery) {
+        if (!delivery.rooms.isEmpty()) {
+            deliverLocal(delivery.rooms, delivery.message);
+        } else {
+            deliverLocal(delivery.room, delivery.message);
+        }
+    });
+}
+
+void ChatWorker::readFromClient(ClientConnection& connection, const QByteArray& data) {
+    connection.lastInboundMs = nowMs;
+    FrameDecoder::Mode before = connection.decoder.mode();
+    QList<QByteArray> frames;
+    if (!connection.decoder.feed(data, frames)) {
+        metrics.recordDecodeError();
+        CHAT_LOG(Info, Connection) << "Protocol error:" << connection.decoder.errorString();
+        connection.transport->abort();
+        return;
+    }
+
+    if (before == FrameDecoder::Detect && connection.decoder.mode() != FrameDecoder::Detect) {
+        completeHandshake(connection);
+    }
+
+    // 이번에 읽은 바이트로 완성된 메시지를 한꺼번에 처리
+    for (const QByteArray& frame : frames) {
+        processMessage(connection, frame);
+    }
+}
+
+void ChatWorker::completeHandshake(ClientConnection& connection) {
+    FrameDecoder& decoder = connection.decoder;
+    if (decoder.mode() == FrameDecoder::Framed) {
+        quint8 supported = Protocol::FeatureRoomDeltas;
+        if (files) supported |= Protocol::FeatureFileChannel;
+        if (config.binaryEncoding) supported |= Protocol::FeatureCbor;
+        if (config.compressThreshold > 0) supported |= Protocol::FeatureCompression;
+        if (config.timeouts.heartbeatIntervalMs > 0) supported |= Protocol::FeatureHeartbeat;
+        if (sessions) supported |= Protocol::FeatureResume;
+        supported |= Protocol::FeatureMultiRoom;
+        quint8 accepted = decoder.peerFeatures() & supported;
+        connection.format = Protocol::wireFormat(decoder.mode(), accepted);
+        connection.features = accepted;
+        connection.decoder.setAcceptCompressed(accepted & Protocol::FeatureCompression);
+        connection.transport->write(Protocol::helloPacket(accepted));
+        // 하트비트를 합의했으면 ping 시각이 생긴다
+        scheduleTimeouts(connection);
+    } else {
+        connection.format = Protocol::WireFormat::LegacyJson;
+    }
+
+    // 변경분을 아는 클라이언트는 자기가 가진 버전을 먼저 알려 온다 (roomListRequest)
+    if (!(connection.features & Protocol::FeatureRoomDeltas)) {
+        sendRoomList(connection);
+    }
+}
+
+ChatWorker::MessageHandler ChatWorker::handlerFor(MessageType type) {
+    // 메시지 타입 태그로 바로 찾는 처리 함수 표
+    struct HandlerTable {
+        MessageHandler entries[int(MessageType::Count)];
+
+        HandlerTable() {
+            for (MessageHandler& entry : entries) entry = nullptr;
+            entries[int(MessageType::Register)] = &ChatWorker::handleRegistration;
+            entries[int(MessageType::Login)] = &ChatWorker::handleLogin;
+            entries[int(MessageType::CreateRoom)] = &ChatWorker::handleCreateRoom;
+            entries[int(MessageType::JoinRoom)] = &ChatWorker::handleJoinRoom;
+            entries[int(MessageType::LeaveRoom)] = &ChatWorker::handleLeaveRoom;
+            entries[int(MessageType::Message)] = &ChatWorker::handleChatMessage;
+            entries[int(MessageType::FileUploaded)] = &ChatWorker::handleFileUploadNotification;
+            entries[int(MessageType::HistoryRequest)] = &ChatWorker::handleHistoryRequest;
+            entries[int(MessageType::RoomListRequest)] = &ChatWorker::handleRoomListRequest;
+            entries[int(MessageType::FileTicketRequest)] = &ChatWorker::handleFileTicketRequest;
+            entries[int(MessageType::FileCatalogRequest)] = &ChatWorker::handleFileCatalogRequest;
+            entries[int(MessageType::FileRemove)] = &ChatWorker::handleFileRemove;
+            entries[int(MessageType::Ping)] = &ChatWorker::handlePing;
+            entries[int(MessageType::Pong)] = &ChatWorker::handlePong;
+            entries[int(MessageType::Resume)] = &ChatWorker::handleResume;
+        }
+    };
+    static const HandlerTable table;
+    return table.entries[int(type)];
+}
+
+void ChatWorker::processMessage(ClientConnection& connection, const QByteArray& data) {
+    QElapsedTimer timer;
+    timer.start();
+
+    MessageType type;
+    QCborMap msg;
+    if (!Protocol::decodeMessage(connection.format, data, type, msg)) {
+        metrics.recordDecodeError();
+        return;
+    }
+    if (!admit(connection, type)) {
+        return;
+    }
+
+    MessageHandler handler = handlerFor(type);
+    if (!handler) {
+        metrics.recordUnhandled();
+        return;
+    }
+    (this->*handler)(connection, msg);
+    metrics.recordMessage(type, timer.nsecsElapsed());
+}
+
+bool ChatWorker::admit(ClientConnection& connection, MessageType type) {
+    qint64 now = uptime.elapsed();
+    const RateLimitConfig& limits = config.rateLimits;
+    int bucket = limits.bucketFor(type);
+
+    bool allowed = connection.connectionBucket.take(limits.connection, now)
+        && (bucket < 0 || connection.typeBuckets[bucket].take(limits.perType[int(type)], now));
+    bool shed = false;
+    if (allowed && type == MessageType::Message && overload && overload->atLeast(OverloadMonitor::ThrottleChat)) {
+        // 과부하 중에는 채팅을 훨씬 낮은 한도로 줄인다
+        shed = !connection.throttleBucket.take(config.overload.throttledChat, now);
+        allowed = !shed;
+    }
+
+    if (allowed) {
+        connection.limitNotified = false;
+        return true;
+    }
+
+    metrics.recordRateLimited(type);
+    if (shed) overload->recordShed(OverloadMonitor::ShedChat);
+    // 한도를 넘는 동안 오류는 한 번만 보낸다 (오류 응답이 또 다른 폭주가 되지 않도록)
+    if (!connection.limitNotified) {
+        connection.limitNotified = true;
+        sendError(connection, shed ? "Server is busy, slow down" : "Rate limit exceeded");
+        CHAT_LOG(Info, Connection) << "Rate limited" << Protocol::typeName(type) << "on worker" << workerIndex
+                                   << (connection.session.isLoggedIn() ? connection.session.username : QString());
+    }
+    return false;
+}
+
+void ChatWorker::handleRegistration(ClientConnection& connection, const QCborMap& data) {
+    if (overload && overload->atLeast(OverloadMonitor::RejectRegistrations)) {
+        // 과부하 때는 급하지 않은 가입(디렉터리 쓰기 + WAL 기록)부터 미룬다
+        overload->recordShed(OverloadMonitor::ShedRegistration);
+        sendError(connection, "Server is busy, please register later");
+        return;
+    }
+
+    QString username = data[QLatin1String("username")].toString();
+    QString password = data[QLatin1String("password")].toString();
+
+    if (username.isEmpty() || password.isEmpty()) {
+        sendError(connection, "Invalid username or password");
+        return;
+    }
+
+    ChatDirectory::Result result = directory->registerUser(username, password);
+    if (result == ChatDirectory::AlreadyExists) {
+        sendError(connection, "Username already exists");
+        return;
+    }
+    if (result == ChatDirectory::StorageFailed) {
+        sendError(connection, "Registration failed, please try again later");
+        return;
+    }
+
+    sendToClient(connection, MessageType::RegistrationSuccess);
+    if (federation) {
+        federation->userRegistered(username, password);
+    }
+
+    CHAT_LOG(Info, Session) << "New user registered:" << username;
+}
+
+void ChatWorker::handleLogin(ClientConnection& connection, const QCborMap& data) {
+    QString username = data[QLatin1String("username")].toString();
+    QString password = data[QLatin1String("password")].toString();
+
+    quint32 userId = directory->authenticate(username, password);
+    if (userId == ChatDirectory::kInvalidId) {
+        sendError(connection, "Invalid username or password");
+        return;
+    }
+
+    if (connection.session.isLoggedIn()) {
+        leaveAllRooms(connection);
+    }
+    connection.session.userId = userId;
+    connection.session.username = directory->username(userId);
+
+    QCborMap reply;
+    reply[QLatin1String("room")] = directory->publicRoom()->name;
+    if (connection.features & Protocol::FeatureResume) {
+        // 다시 로그인하면 이전 토큰은 버린다
+        if (!connection.session.resumeToken.isEmpty()) {
+            sessions->revoke(connection.session.resumeToken);
+        }
+        connection.session.resumeToken = sessions->issue(userId, directory->publicRoom(), workerIndex, connection.id);
+        reply[QLatin1String("token")] = QString::fromLatin1(connection.session.resumeToken);
+    }
+    sendToClient(connection, MessageType::LoginSuccess, reply);
+
+    joinLocalRoom(connection, directory->publicRoom());
+    sendHistory(connection, directory->publicRoom(), HistoryStore::kNoSeq, config.history.backfillCount);
+
+    CHAT_LOG(Info, Session) << username << "logged in";
+}
+
+void ChatWorker::handleCreateRoom(ClientConnection& connection, const QCborMap& data) {
+    if (!connection.session.isLoggedIn()) {
+        sendError(connection, "You must be logged in");
+        return;
+    }
+
+    QString roomName = data[QLatin1String("room")].toString();
+    if (roomName.isEmpty()) {
+        sendError(connection, "Invalid room name");
+        return;
+    }
+
+    ChatDirectory::Result result;
+    ChatRoom *room = directory->createRoom(roomName, data[QLatin1String("password")].toString(), &result);
+    if (!room) {
+        sendError(connection, result == ChatDirectory::AlreadyExists
+                  ? "Room already exists" : "Failed to create room, please try again later");
+        return;
+    }
+    if (history) {
+        history->attach(room);
+    }
+    if (federation) {
+        federation->roomCreated(room);
+    }
+
+    broadcastRoomList();
+
+    CHAT_LOG(Info, Room) << "New room created:" << roomName;
+}
+
+void ChatWorker::handleJoinRoom(ClientConnection& connection, const QCborMap& data) {
+    if (!connection.session.isLoggedIn()) {
+        sendError(connection, "You must be logged in");
+        return;
+    }
+
+    QString roomName = data[QLatin1String("room")].toString();
+    ChatRoom *room = directory->findRoom(roomName);
+    if (!room) {
+        sendError(connection, "Room does not exist");
+        return;
+    }
+
+    QString password = directory->roomPassword(room);
+    if (!password.isEmpty() && data[QLatin1String("password")].toString() != password) {
+        sendError(connection, "Invalid room password");
+        return;
+    }
+
+    Session& session = connection.session;
+    bool subscribed = session.isSubscribed(room);
+    if (subscribed) {
+        // 이미 구독 중이면 기본 방만 바꾸고 입장할 때처럼 기록과 파일 목록을 다시 보낸다
+        session.room = room;
+    } else {
+        if (!(connection.features & Protocol::FeatureMultiRoom)) {
+            // 방 하나만 아는 클라이언트는 이전 방에서 옮겨 간다
+            if (session.room) leaveLocalRoom(connection, session.room);
+        } else if (session.rooms.size() >= config.maxRoomsPerConnection) {
+            sendError(connection, "Too many rooms");
+            return;
+        }
+        joinLocalRoom(connection, room);
+    }
+    saveSubscriptions(connection);
+
+    // 입장 알림보다 먼저 이전 대화를 보낸다
+    sendHistory(connection, room, HistoryStore::kNoSeq, config.history.backfillCount);
+    // 파일 목록은 입장할 때 한 번만 통째로 보내고 이후에는 변경분만 보낸다
+    if (connection.features & Protocol::FeatureFileChannel) {
+        sendFileCatalog(connection, room);
+    }
+
+    if (!subscribed) {
+        QCborMap notification;
+        notification[QLatin1String("text")] = session.username + " has joined the room";
+        publishToRoom(room, MessageType::Message, notification, false);
+    }
+
+    CHAT_LOG(Info, Room) << session.username << "joined room:" << roomName;
+}
+
+void ChatWorker::handleLeaveRoom(ClientConnection& connection, const QCborMap& data) {
+    if (!connection.session.isLoggedIn()) {
+        sendError(connection, "You must be logged in");
+        return;
+    }
+
+    ChatRoom *room = data.contains(QLatin1String("room")) ? targetRoom(connection, data) : nullptr;
+    if (!room) {
+        sendError(connection, "You are not in that room");
+        return;
+    }
+
+    leaveLocalRoom(connection, room);
+    saveSubscriptions(connection);
+
+    QCborMap notification;
+    notification[QLatin1String("text")] = connection.session.username + " has left the room";
+    publishToRoom(room, MessageType::Message, notification, false);
+
+    CHAT_LOG(Info, Room) << connection.session.username << "left room:" << room->name;
+}
+
+void ChatWorker::handleChatMessage(ClientConnection& connection, const QCborMap& data) {
+    if (!connection.session.isLoggedIn()) {
+        sendError(connection, "You must be logged in");
+        return;
+    }
+
+    QString text = data[QLatin1String("text")].toString();
+    if (text.isEmpty()) return;
+
+    ChatRoom *room = targetRoom(connection, data);
+    if (!room) {
+        sendError(connection, "You must join a room first");
+        return;
+    }
+
+    QCborMap chatMsg;
+    chatMsg[QLatin1String("sender")] = connection.session.username;
+    chatMsg[QLatin1String("text")] = text;
+    if (!publishToRoom(room, MessageType::Message, chatMsg, true)) {
+        sendError(connection, "Room is temporarily unavailable");
+        return;
+    }
+
+    // 메시지마다 남는 줄이라 기본 수준(Info)에서는 걸러지고, 본문은 설정할 때만 남긴다
+    CHAT_LOG(Debug, Message) << connection.session.username << "sent message in"
+                             << room->name << ":"
+                             << (Logger::instance()->includeBodies() ? text : QString("<%1 chars>").arg(text.size()));
+}
+
+void ChatWorker::handleFileUploadNotification(ClientConnection& connection, const QCborMap& data) {
+    if (!connection.session.isLoggedIn()) {
+        sendError(connection, "You must be logged in");
+        return;
+    }
+
+    QString filename = data[QLatin1String("filename")].toString();
+
+    // 고른 방(없으면 기본 방)의 모든 사용자에게 파일 업로드 알림 전송
+    ChatRoom *room = targetRoom(connection, data);
+    if (room) {
+        QCborMap notification;
+        notification[QLatin1String("filename")] = filename;
+        notification[QLatin1String("uploader")] = connection.session.username;
+        // 내용 해시를 알려 오면 다른 클라이언트도 같은 파일인지 알 수 있도록 그대로 전한다
+        QByteArray hash = data.value(QLatin1String("hash")).toString().toLatin1();
+        if (FileStore::isValidHash(hash)) notification[QLatin1String("hash")] = QString::fromLatin1(hash);
+        if (!publishToRoom(room, MessageType::FileAvailable, notification, true)) {
+            sendError(connection, "Room is temporarily unavailable");
+            return;
+        }
+
+        CHAT_LOG(Info, File) << connection.session.username << "uploaded file:"
+                             << (Logger::instance()->includeBodies() ? filename : QString("<hidden>"))
+                             << "in room:" << room->name;
+    }
+}
+
+void ChatWorker::handleHistoryRequest(ClientConnection& connection, const QCborMap& data) {
+    ChatRoom *room = targetRoom(connection, data);
+    if (!connection.session.isLoggedIn() || !room) {
+        sendError(connection, "You must join a room first");
+        return;
+    }
+
+    int limit = int(data.value(QLatin1String("limit")).toInteger(config.history.backfillCount));
+
+    // 기준은 seq가 우선이고, 없으면 시각으로 찾는다
+    quint64 beforeSeq = HistoryStore::kNoSeq;
+    QCborValue seqValue = data.value(QLatin1String("beforeSeq"));
+    QCborValue timeValue = data.value(QLatin1String("beforeTime"));
+    if (seqValue.isInteger()) {
+        beforeSeq = quint64(qMax<qint64>(0, seqValue.toInteger()));
+    } else if (timeValue.isInteger() && history) {
+        beforeSeq = history->firstSeqAtOrAfter(room, timeValue.toInteger());
+    }
+
+    sendHistory(connection, room, beforeSeq, limit);
+}
+
+void ChatWorker::handleRoomListRequest(ClientConnection& connection, const QCborMap& data) {
+    // 같은 서버 실행에서 받은 버전이면 그 뒤의 변경분만 보낸다
+    qint64 epoch = data.value(QLatin1String("epoch")).toInteger();
+    qint64 version = data.value(QLatin1String("version")).toInteger();
+    if (epoch == directory->roomListEpoch() && version > 0) {
+        connection.roomListVersion = quint64(version);
+        sendRoomListUpdate(connection);
+    } else {
+        sendRoomList(connection);
+    }
+}
+
+void ChatWorker::handleFileTicketRequest(ClientConnection& connection, const QCborMap& data) {
+    if (!files) {
+        sendError(connection, "File transfer is not available");
+        return;
+    }
+    ChatRoom *room = targetRoom(connection, data);
+    if (!connection.session.isLoggedIn() || !room) {
+        sendError(connection, "You must join a room first");
+        return;
+    }
+
+    FileTicket ticket;
+    ticket.room = room;
+    ticket.filename = data.value(QLatin1String("filename")).toString();
+    ticket.uploader = connection.session.username;
+    ticket.direction = data.value(QLatin1String("direction")).toString() == QLatin1String("upload")
+        ? FileTicket::Upload : FileTicket::Download;
+    if (!FileStore::isValidName(ticket.filename)) {
+        sendError(connection, "Invalid file name");
+        return;
+    }
+
+    if (ticket.direction == FileTicket::Upload) {
+        ticket.size = data.value(QLatin1String("size")).toInteger(-1);
+        if (ticket.size < 0 || ticket.size > files->config().maxFileBytes) {
+            sendError(connection, "File is too large");
+            return;
+        }
+
+        // 해시를 알려 온 클라이언트는 조각으로 올리고 서버에 없는 조각만 보낸다
+        if (data.contains(QLatin1String("hash"))) {
+            ticket.hash = data.value(QLatin1String("hash")).toString().toLatin1();
+            for (const QCborValue& chunk : data.value(QLatin1String("chunks")).toArray()) {
+                ticket.chunks.append(chunk.toString().toLatin1());
+            }
+            bool valid = FileStore::isValidHash(ticket.hash)
+                && ticket.chunks.size() == FileStore::chunkCount(ticket.size);
+            for (const QByteArray& chunk : ticket.chunks) {
+                valid = valid && FileStore::isValidHash(chunk);
+            }
+            if (!valid) {
+                sendError(connection, "Invalid file hash");
+                return;
+            }
+        }
+    } else {
+        FileEntry entry;
+        if (!files->findFile(ticket.room, ticket.filename, entry)) {
+            sendError(connection, "File does not exist");
+            return;
+        }
+        ticket.size = entry.size;
+    }
+
+    QCborMap reply;
+    reply[QLatin1String("ticket")] = QString::fromLatin1(files->issue(ticket));
+    reply[QLatin1String("port")] = int(files->config().port);
+    reply[QLatin1String("room")] = ticket.room->name;
+    reply[QLatin1String("filename")] = ticket.filename;
+    reply[QLatin1String("direction")] = ticket.direction == FileTicket::Upload ? "upload" : "download";
+    reply[QLatin1String("size")] = ticket.size;
+    if (ticket.isChunked()) {
+        QCborArray missing;
+        for (int index : files->missingChunks(ticket.chunks)) {
+            missing.append(index);
+        }
+        reply[QLatin1String("missing")] = missing;
+    }
+    sendToClient(connection, MessageType::FileTicket, reply);
+}
+
+void ChatWorker::handleFileCatalogRequest(ClientConnection& connection, const QCborMap& data) {
+    if (!files) {
+        sendError(connection, "File transfer is not available");
+        return;
+    }
+    ChatRoom *room = targetRoom(connection, data);
+    if (!connection.session.isLoggedIn() || !room) {
+        sendError(connection, "You must join a room first");
+        return;
+    }
+
+    // 같은 서버 실행에서 받은 버전이면 그 뒤의 변경분만 보낸다
+    qint64 epoch = data.value(QLatin1String("epoch")).toInteger();
+    qint64 version = data.value(QLatin1String("version")).toInteger();
+    QVector<FileCatalogChange> changes;
+    if (epoch == files->catalogEpoch() && version > 0
+        && files->catalogChangesSince(room, quint64(version), changes)) {
+        if (changes.isEmpty()) return;
+        WireMessage message = fileCatalogDelta(room, quint64(version), changes);
+        sendToClient(connection, message);
+    } else {
+        sendFileCatalog(connection, room);
+    }
+}
+
+void ChatWorker::handleFileRemove(ClientConnection& connection, const QCborMap& data) {
+    if (!files) {
+        sendError(connection, "File transfer is not available");
+        return;
+    }
+    ChatRoom *room = targetRoom(connection, data);
+    if (!connection.session.isLoggedIn() || !room) {
+        sendError(connection, "You must join a room first");
+        return;
+    }
+
+    QString filename = data.value(QLatin1String("filename")).toString();
+    FileEntry entry;
+    if (!files->findFile(room, filename, entry)) {
+        sendError(connection, "File does not exist");
+        return;
+    }
+    // 올린 사람만 지울 수 있다
+    if (entry.uploader != connection.session.username) {
+        sendError(connection, "Only the uploader can remove a file");
+        return;
+    }
+
+    quint64 version = 0;
+    if (!files->removeFile(room, filename, &version)) return;  // 그 사이 다른 요청이 지웠다
+
+    FileCatalogChange change;
+    change.version = version;
+    change.added = false;
+    change.entry = entry;
+    WireMessage delta = fileCatalogDelta(room, version - 1, QVector<FileCatalogChange>() << change);
+    broadcastToRoom(room, delta);
+
+    CHAT_LOG(Info, File) << connection.session.username << "removed a file from room" << room->name;
+}
+
+void ChatWorker::handlePing(ClientConnection& connection, const QCborMap&) {
+    sendToClient(connection, MessageType::Pong);
+}
+
+void ChatWorker::handlePong(ClientConnection&, const QCborMap&) {
+    // 받은 것만으로 활동 시각이 갱신되었다
+}
+
+void ChatWorker::handleResume(ClientConnection& connection, const QCborMap& data) {
+    QByteArray token = data[QLatin1String("token")].toString().toLatin1();
+    quint64 lastSeq = quint64(qMax<qint64>(0, data[QLatin1String("lastSeq")].toInteger()));
+
+    SessionRegistry::Ticket ticket;
+    if (!(connection.features & Protocol::FeatureResume) || connection.session.isLoggedIn() || token.isEmpty()
+        || !sessions->resume(token, workerIndex, connection.id, &ticket)) {
+        // 클라이언트는 다시 로그인한다
+        metrics.recordResume(ResumeOutcome::Rejected, 0);
+        QCborMap reply;
+        reply[QLatin1String("ok")] = false;
+        sendToClient(connection, MessageType::Resumed, reply);
+        return;
+    }
+
+    // 서버가 아직 끊김을 모르는 이전 연결은 퇴장 알림 없이 닫는다
+    bool wasLive = ticket.worker >= 0;
+    if (wasLive) {
+        ChatWorker *owner = peers.at(ticket.worker);
+        quint64 previous = ticket.connection;
+        QMetaObject::invokeMethod(owner, [owner, previous]() { owner->closeSuperseded(previous); },
+                                  Qt::QueuedConnection);
+    }
+
+    Session& session = connection.session;
+    session.userId = ticket.userId;
+    session.username = directory->username(ticket.userId);
+    session.resumeToken = token;
+    QVector<ChatRoom*> rooms = ticket.rooms;
+    if (rooms.isEmpty()) rooms.append(directory->publicRoom());
+    ChatRoom *current = rooms.contains(ticket.room) ? ticket.room : rooms.last();
+
+    // 방에 먼저 들어간 뒤 보관분을 읽어야 그 사이의 메시지가 어느 한쪽으로는 온다.
+    // 기본 방을 마지막에 넣어 다시 기본 방이 되게 한다.
+    for (ChatRoom *room : rooms) {
+        if (room != current) joinLocalRoom(connection, room);
+    }
+    joinLocalRoom(connection, current);
+
+    // 방마다 클라이언트가 받은 마지막 번호 (방 하나만 아는 클라이언트는 lastSeq만 보낸다)
+    QCborMap seqs = data[QLatin1String("seqs")].toMap();
+    QVector<QVector<ReplayEntry> > missed(rooms.size());
+    QVector<bool> complete(rooms.size());
+    QCborArray roomNames;
+    QCborArray backfilled;
+    int replayed = 0;
+    for (int i = 0; i < rooms.size(); ++i) {
+        ChatRoom *room = rooms.at(i);
+        QCborValue seq = seqs.value(room->name);
+        quint64 after = seq.isInteger() ? quint64(qMax<qint64>(0, seq.toInteger())) : (room == current ? lastSeq : 0);
+        complete[i] = room->replay.since(after, missed[i]);
+        roomNames.append(room->name);
+        if (complete.at(i)) replayed += missed.at(i).size();
+        else backfilled.append(room->name);
+    }
+
+    QCborMap reply;
+    reply[QLatin1String("ok")] = true;
+    reply[QLatin1String("room")] = current->name;
+    reply[QLatin1String("rooms")] = roomNames;
+    reply[QLatin1String("complete")] = backfilled.isEmpty();
+    reply[QLatin1String("backfilled")] = backfilled;
+    sendToClient(connection, MessageType::Resumed, reply);
+
+    for (int i = 0; i < rooms.size(); ++i) {
+        if (complete.at(i)) {
+            for (const ReplayEntry& entry : missed.at(i)) {
+                WireMessage message(entry.type, entry.fields);
+                sendToClient(connection, message);
+            }
+        } else {
+            // 보관분보다 오래 끊겨 있었으면 입장할 때처럼 최근 기록을 보낸다
+            sendHistory(connection, rooms.at(i), HistoryStore::kNoSeq, config.history.backfillCount);
+        }
+    }
+    metrics.recordResume(backfilled.isEmpty() ? ResumeOutcome::Replayed : ResumeOutcome::Backfilled, replayed);
+    if (connection.features & Protocol::FeatureFileChannel) {
+        sendFileCatalog(connection, current);
+    }
+
+    // 끊겼을 때 퇴장을 알렸으면 돌아온 것도 알린다
+    if (!wasLive) {
+        publishNotice(rooms, session.username + " has joined the room");
+    }
+
+    CHAT_LOG(Info, Session) << session.username << "resumed session in" << rooms.size() << "rooms - replayed"
+                            << replayed << "backfilled" << backfilled.size();
+}
+
+void ChatWorker::closeSuperseded(quint64 connectionId) {
+    ClientConnection *connection = connections.value(connectionId, nullptr);
+    if (!connection) return;
+    connection->superseded = true;
+    // transportClosed가 바로 와서 connection을 지운다
+    connection->transport->abort();
+}
+
+void ChatWorker::announceFile(ChatRoom* room, const FileEntry& entry, quint64 version) {
+    QCborMap notification;
+    notification[QLatin1String("filename")] = entry.name;
+    notification[QLatin1String("uploader")] = entry.uploader;
+    notification[QLatin1String("size")] = entry.size;
+    notification[QLatin1String("hash")] = QString::fromLatin1(entry.hash);
+    publishToRoom(room, MessageType::FileAvailable, notification, true);
+
+    FileCatalogChange change;
+    change.version = version;
+    change.entry = entry;
+    WireMessage delta = fileCatalogDelta(room, version - 1, QVector<FileCatalogChange>() << change);
+    broadcastToRoom(room, delta);
+}
+
+void ChatWorker::handleDisconnection(ClientConnection* connection) {
+    connections.remove(connection->id);
+    wheel.cancel(&connection->timer);
+    metrics.connectionClosed();
+    if (connection->flushPending) {
+        pendingFlush.removeOne(connection);
+    }
+    connection->outbound.clear(DropReason::Disconnected, outboundStats);
+
+    const Session& session = connection->session;
+    if (session.isLoggedIn()) {
+        // 토큰을 아직 이 연결이 가지고 있으면 이어 받기를 기다린다.
+        // 새 연결이 이미 이어 받았으면 그 연결이 방에 있으므로 퇴장을 알리지 않는다.
+        bool leaving = !connection->superseded;
+        if (leaving && !session.resumeToken.isEmpty()) {
+            leaving = sessions->suspend(session.resumeToken, workerIndex, connection->id);
+        }
+        QVector<ChatRoom*> rooms = session.subscribedRooms();
+        leaveAllRooms(*connection);
+        if (leaving && !rooms.isEmpty()) {
+            publishNotice(rooms, session.username + " has left the room");
+        }
+
+        CHAT_LOG(Info, Connection) << session.username << "disconnected";
+    }
+
+    connection->transport->release();
+    delete connection;
+}
+
+void ChatWorker::joinLocalRoom(ClientConnection& connection, ChatRoom* room) {
+    if (room->memberCount.fetchAndAddOrdered(1) == 0 && federation) {
+        // 이 노드의 첫 참가자면 소유 노드에 구독을 건다
+        federation->membershipChanged(room);
+    }
+    if (localMembers.join(&connection, room)) {
+        // 이 워커에 첫 참가자가 생기면 다른 워커들이 메시지를 넘겨주도록 표시
+        room->workerMask.fetchAndOrOrdered(quint64(1) << workerIndex);
+    }
+}
+
+void ChatWorker::leaveLocalRoom(ClientConnection& connection, ChatRoom* room) {
+    if (!connection.session.isSubscribed(room)) return;
+    if (!room->memberCount.deref() && federation) {
+        federation->membershipChanged(room);
+    }
+    if (localMembers.leave(&connection, room)) {
+        room->workerMask.fetchAndAndOrdered(~(quint64(1) << workerIndex));
+    }
+}
+
+void ChatWorker::leaveAllRooms(ClientConnection& connection) {
+    while (!connection.session.rooms.isEmpty()) {
+        leaveLocalRoom(connection, connection.session.rooms.last().room);
+    }
+}
+
+ChatRoom* ChatWorker::targetRoom(const ClientConnection& connection, const QCborMap& data) const {
+    const Session& session = connection.session;
+    QCborValue name = data.value(QLatin1String("room"));
+    if (!name.isString()) return session.room;
+    // 구독 목록은 짧으므로 디렉터리 잠금 없이 이름으로 찾는다
+    QString roomName = name.toString();
+    for (const Subscription& subscription : session.rooms) {
+        if (subscription.room->name == roomName) return subscription.room;
+    }
+    return nullptr;
+}
+
+void ChatWorker::saveSubscriptions(const ClientConnection& connection) {
+    const Session& session = connection.session;
+    if (session.resumeToken.isEmpty()) return;
+    sessions->setRooms(session.resumeToken, session.room, session.subscribedRooms());
+}
+
+void ChatWorker::recordMessage(ChatRoom* room, MessageType type, QCborMap& fields) {
+    // 방 안에서 단조 증가하는 번호와 서버 시각을 붙인다
+    quint64 seq = room->lastSeq.fetchAndAddOrdered(1) + 1;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    fields[QLatin1String("seq")] = qint64(seq);
+    fields[QLatin1String("time")] = now;
+
+    if (history) {
+        HistoryRecord record;
+        record.seq = seq;
+        record.timestamp = now;
+        record.type = type;
+        record.fields = fields;
+        history->append(room, record);  // 기록 스레드로 넘기기만 한다
+    }
+    // 방송하면서 workerMask를 읽기 전에 넣는다 (이어 받는 세션은 방에 들어간 뒤 읽는다)
+    if (sessions) {
+        ReplayEntry entry;
+        entry.seq = seq;
+        entry.type = type;
+        entry.fields = fields;
+        room->replay.append(entry, config.resume.replayFrames);
+    }
+}
+
+void ChatWorker::sendHistory(ClientConnection& connection, ChatRoom* room, quint64 beforeSeq, int limit) {
+    if (!history || limit <= 0) return;
+
+    QVector<HistoryEntry> entries = history->before(room, beforeSeq, limit);
+    if (entries.isEmpty() && beforeSeq == HistoryStore::kNoSeq) return;
+
+    QCborArray messages;
+    for (const HistoryEntry& entry : entries) {
+        QCborMap item = QCborValue::fromCbor(entry.payload).toMap();
+        item[QLatin1String("kind")] = Protocol::typeName(entry.type);
+        messages.append(item);
+    }
+
+    QCborMap batch;
+    batch[QLatin1String("room")] = room->name;
+    batch[QLatin1String("messages")] = messages;
+    // 가득 찼으면 더 오래된 기록이 있을 수 있다
+    batch[QLatin1String("hasMore")] = entries.size() == qMin(limit, config.history.maxPageSize);
+    sendToClient(connection, MessageType::HistoryBatch, batch);
+}
+
+bool ChatWorker::publishToRoom(ChatRoom* room, MessageType type, const QCborMap& fields, bool record) {
+    int owner = federation ? federation->ownerOf(room->name) : -1;
+    if (owner >= 0 && owner != federation->nodeId()) {
+        // 순서는 소유 노드가 정하므로 이 노드의 참가자도 소유 노드를 거쳐 돌아온 메시지를 받는다
+        if (!federation->isReachable(owner)) return false;
+        federation->publish(room, type, fields, record);
+        return true;
+    }
+    if (federation) {
+        // 번호 붙이기와 구독 노드 전달이 같은 순서가 되도록 방마다 정해진 워커 하나에서 한다
+        // (다른 노드에서 넘어온 메시지도 Federation이 같은 워커로 보낸다)
+        ChatWorker *worker = peers.at(int(room->id % quint32(peers.size())));
+        if (worker != this) {
+            QCborMap message = fields;
+            QMetaObject::invokeMethod(worker, [worker, room, type, message, record]() {
+                worker->publishAsOwner(room, type, message, record);
+            }, Qt::QueuedConnection);
+            return true;
+        }
+    }
+    publishAsOwner(room, type, fields, record);
+    return true;
+}
+
+void ChatWorker::publishAsOwner(ChatRoom* room, MessageType type, QCborMap fields, bool record) {
+    // 여러 방을 구독한 클라이언트가 어느 방의 메시지인지 알 수 있도록 붙인다
+    fields[QLatin1String("room")] = room->name;
+    if (record) {
+        recordMessage(room, type, fields);
+    }
+    WireMessage message(type, fields);
+    broadcastToRoom(room, message);
+    // 구독한 노드에는 링크마다 한 번만 보낸다
+    if (federation && room->nodeMask.loadAcquire() != 0) {
+        federation->forward(room, type, fields);
+    }
+}
+
+void ChatWorker::broadcastToRoom(ChatRoom* room, WireMessage& message) {
+    deliverLocal(room, message);
+
+    // 참가자가 있는 다른 워커에만 한 번씩 넘긴다
+    quint64 mask = room->workerMask.loadAcquire() & ~(quint64(1) << workerIndex);
+    int remoteWorkers = 0;
+    for (int i = 0; mask != 0; ++i, mask >>= 1) {
+        if (mask & 1) {
+            RoomDelivery delivery;
+            delivery.room = room;
+            delivery.message = message;
+            peers[i]->post(delivery);
+            ++remoteWorkers;
+        }
+    }
+    metrics.recordBroadcast(room->memberCount.loadAcquire(), remoteWorkers);
+}
+
+void ChatWorker::publishNotice(const QVector<ChatRoom*>& rooms, const QString& text) {
+    QCborMap notification;
+    notification[QLatin1String("text")] = text;
+    if (rooms.size() == 1 || federation) {
+        // 페더레이션에서는 방마다 순서를 정하는 노드가 다르므로 방마다 소유 노드를 거친다
+        for (ChatRoom *room : rooms) {
+            publishToRoom(room, MessageType::Message, notification, false);
+        }
+        return;
+    }
+
+    QCborArray names;
+    for (ChatRoom *room : rooms) {
+        names.append(room->name);
+    }
+    notification[QLatin1String("rooms")] = names;
+    WireMessage message(MessageType::Message, notification);
+    broadcastToRooms(rooms, message);
+}
+
+void ChatWorker::broadcastToRooms(const QVector<ChatRoom*>& rooms, WireMessage& message) {
+    deliverLocal(rooms, message);
+
+    // 방 중 하나라도 참가자가 있는 다른 워커에 한 번씩 넘긴다
+    quint64 mask = 0;
+    int recipients = 0;
+    for (ChatRoom *room : rooms) {
+        mask |= room->workerMask.loadAcquire();
+        recipients += room->memberCount.loadAcquire();
+    }
+    mask &= ~(quint64(1) << workerIndex);
+    int remoteWorkers = 0;
+    for (int i = 0; mask != 0; ++i, mask >>= 1) {
+        if (mask & 1) {
+            RoomDelivery delivery;
+            delivery.rooms = rooms;
+            delivery.message = message;
+            peers[i]->post(delivery);
+            ++remoteWorkers;
+        }
+    }
+    metrics.recordBroadcast(recipients, remoteWorkers);
+}
+
+void ChatWorker::deliverLocal(const QVector<ChatRoom*>& rooms, WireMessage& message) {
+    // 여러 방을 구독한 연결은 처음 만났을 때만 보낸다
+    quint64 stamp = ++lastDeliveryStamp;
+    for (ChatRoom *room : rooms) {
+        for (ClientConnection *connection : localMembers.members(room->id)) {
+            if (connection->deliveryStamp == stamp) continue;
+            connection->deliveryStamp = stamp;
+            sendToClient(*connection, message);
+        }
+    }
+}
+
+void ChatWorker::deliverLocal(ChatRoom* room, WireMessage& message) {
+    // 전송 형식별 인코딩은 WireMessage가 한 번만 수행한다
+    for (ClientConnection *connection : localMembers.members(room->id)) {
+        sendToClient(*connection, message);
+    }
+}
+
+void ChatWorker::sendToClient(ClientConnection& connection, WireMessage& message) {
+    QByteArray frame;
+    if (connection.features & Protocol::FeatureCompression) {
+        // 방송은 같은 WireMessage를 공유하므로 압축은 형식별로 처음 한 번만 일어난다
+        Protocol::CompressionStats stats;
+        frame = message.compressedBytes(connection.format, config.compressThreshold, &stats);
+        metrics.recordCompression(stats);
+        qint64 plainSize = message.bytes(connection.format).size();
+        if (frame.size() < plainSize) metrics.recordCompressedSend(plainSize - frame.size());
+    } else {
+        frame = message.bytes(connection.format);
+    }
+
+    if (connection.evicted) {
+        outboundStats.recordDrop(DropReason::Evicted, frame.size());
+        return;
+    }
+    if (!connection.transport->isConnected()) {
+        outboundStats.recordDrop(DropReason::Disconnected, frame.size());
+        return;
+    }
+
+    // 쌓인 것이 없던 연결은 지금부터 송신 정체 시간을 잰다
+    if (!hasPendingWrite(connection)) connection.lastWriteMs = nowMs;
+    bool droppable = message.type() == MessageType::Message;
+    if (!connection.outbound.enqueue(frame, droppable, outboundStats)) {
+        evict(connection);
+        return;
+    }
+
+    if (config.writeCoalesceUs < 0 || isUrgent(message.type())) {
+        flushOutbound(connection);
+    } else {
+        scheduleFlush(connection);
+    }
+}
+
+void ChatWorker::scheduleFlush(ClientConnection& connection) {
+    if (connection.flushPending) return;
+    connection.flushPending = true;
+    pendingFlush.append(&connection);
+
+    if (flushScheduled) return;
+    flushScheduled = true;
+    // 기한이 0이면 이번 틱에 들어온 이벤트를 모두 처리한 다음 차례에 쓴다.
+    // 그 이상은 이벤트 루프 타이머 해상도(ms)로 올려서 기다린다.
+    int delayMs = (config.writeCoalesceUs + 999) / 1000;
+    if (delayMs <= 0) {
+        QMetaObject::invokeMethod(this, [this]() { flushPendingWrites(); }, Qt::QueuedConnection);
+    } else {
+        QTimer::singleShot(delayMs, Qt::PreciseTimer, this, [this]() { flushPendingWrites(); });
+    }
+}
+
+void ChatWorker::flushPendingWrites() {
+    flushScheduled = false;
+    QVector<ClientConnection*> batch;
+    batch.swap(pendingFlush);
+    for (ClientConnection *connection : batch) {
+        connection->flushPending = false;
+        flushOutbound(*connection);
+    }
+}
+
+void ChatWorker::flushOutbound(ClientConnection& connection) {
+    // Qt 내부 버퍼에는 일정량만 두고 나머지는 대기열에서 한계를 관리한다
+    ClientTransport *socket = connection.transport;
+    if (config.writeCoalesceUs < 0) {
+        // 모으지 않는 모드: 프레임마다 따로 쓴다 (비교용)
+        while (!connection.outbound.isEmpty() && socket->bytesToWrite() < kSocketWriteBudget) {
+            QByteArray frame = connection.outbound.takeFirst();
+            socket->write(frame);
+            metrics.recordWriteCall();
+            metrics.recordWrite(frame.size());
+        }
+        return;
+    }
+
+#ifdef Q_OS_UNIX
+    // Qt 버퍼가 비어 있을 때만 커널에 바로 넘겨야 순서가 뒤바뀌지 않는다
+    bool corked = false;
+    while (!connection.outbound.isEmpty() && socket->bytesToWrite() == 0) {
+        if (!corked && connection.outbound.frameCount() > kMaxWriteBatch) {
+            setCork(socket->descriptor(), true);
+            corked = true;
+        }
+        if (!writeBatch(connection)) break;
+    }
+    if (corked) {
+        setCork(socket->descriptor(), false);
+    }
+#endif
+
+    // 남은 프레임은 이어 붙여 소켓 버퍼로 한 번에 넘긴다 (쓰기 가능해지면 백엔드가 보낸다)
+    if (!connection.outbound.isEmpty() && socket->bytesToWrite() < kSocketWriteBudget) {
+        QByteArray chunk;
+        while (!connection.outbound.isEmpty() && socket->bytesToWrite() + chunk.size() < kSocketWriteBudget) {
+            QByteArray frame = connection.outbound.takeFirst();
+            metrics.recordWrite(frame.size());
+            chunk += frame;  // 첫 프레임은 복사 없이 공유된다
+        }
+        socket->write(chunk);
+        metrics.recordWriteCall();
+    }
+}
+
+bool ChatWorker::writeBatch(ClientConnection& connection) {
+#ifdef Q_OS_UNIX
+    // 대기열 앞쪽 프레임들을 writev 한 번으로 넘긴다. 모두 넘어갔으면 true.
+    QByteArray frames[kMaxWriteBatch];
+    struct iovec vectors[kMaxWriteBatch];
+    int count = 0;
+    qint64 total = 0;
+    while (count < kMaxWriteBatch && !connection.outbound.isEmpty() && total < kSocketWriteBudget) {
+        frames[count] = connection.outbound.takeFirst();
+        vectors[count].iov_base = const_cast<char*>(frames[count].constData());
+        vectors[count].iov_len = size_t(frames[count].size());
+        total += frames[count].size();
+        ++count;
+    }
+
+    ssize_t written;
+    do {
+        written = ::writev(int(connection.transport->descriptor()), vectors, count);
+    } while (written < 0 && errno == EINTR);
+    metrics.recordWriteCall();
+    if (written > 0) connection.lastWriteMs = nowMs;
+    // EAGAIN이나 오류면 모두 Qt에 넘긴다 (오류는 Qt가 소켓 오류로 알린다)
+    qint64 offset = qMax<qint64>(0, written);
+
+    QByteArray rest;
+    for (int i = 0; i < count; ++i) {
+        metrics.recordWrite(frames[i].size());
+        if (offset >= frames[i].size()) {
+            offset -= frames[i].size();
+            continue;
+        }
+        rest += offset > 0 ? frames[i].mid(int(offset)) : frames[i];
+        offset = 0;
+    }
+    if (rest.isEmpty()) return true;
+
+    connection.transport->write(rest);
+    return false;
+#else
+    Q_UNUSED(connection);
+    return false;
+#endif
+}
+
+void ChatWorker::evict(ClientConnection& connection) {
+    connection.evicted = true;
+    connection.outbound.clear(DropReason::Evicted, outboundStats);
+    outboundStats.recordEviction();
+
+    OutboundTotals totals = outboundStats.snapshot();
+    CHAT_LOG(Warning, Outbound) << "Evicting slow consumer" << connection.session.username
+                                << "on worker" << workerIndex
+                                << "- dropped frames (slow/disconnected/evicted):"
+                                << totals.droppedFrames[int(DropReason::SlowConsumer)]
+                                << totals.droppedFrames[int(DropReason::Disconnected)]
+                                << totals.droppedFrames[int(DropReason::Evicted)]
+                                << "evictions:" << totals.evictions;
+
+    // 방송 중에 참가자 목록이 바뀌지 않도록 연결 종료는 다음 이벤트로 미룬다
+    quint64 id = connection.id;
+    QMetaObject::invokeMethod(this, [this, id]() {
+        ClientConnection *connection = connections.value(id, nullptr);
+        if (connection) connection->transport->abort();
+    }, Qt::QueuedConnection);
+}
+
+void ChatWorker::sendToClient(ClientConnection& connection, MessageType type, const QCborMap& fields) {
+    WireMessage message(type, fields);
+    sendToClient(connection, message);
+}
+
+void ChatWorker::sendError(ClientConnection& connection, const QString& message) {
+    QCborMap errorMsg;
+    errorMsg[QLatin1String("message")] = message;
+    sendToClient(connection, MessageType::Error, errorMsg);
+}
+
+WireMessage& ChatWorker::cachedRoomList() {
+    // 방이 생길 때만 다시 만든다. 접속 폭주 때도 목록은 형식별로 한 번씩만 인코딩된다.
+    quint64 version = directory->roomListVersion();
+    if (!roomListCached || version != roomListCacheVersion) {
+        QCborArray roomArray;
+        for (const auto& room : directory->roomNames(version)) {
+            roomArray.append(room);
+        }
+        QCborMap roomsMsg;
+        roomsMsg[QLatin1String("rooms")] = roomArray;
+        roomsMsg[QLatin1String("epoch")] = directory->roomListEpoch();
+        roomsMsg[QLatin1String("version")] = qint64(version);
+        roomListMessage = WireMessage(MessageType::RoomList, roomsMsg);
+        roomListCacheVersion = version;
+        roomListCached = true;
+    }
+    return roomListMessage;
+}
+
+void ChatWorker::sendRoomList(ClientConnection& connection) {
+    WireMessage& message = cachedRoomList();
+    connection.roomListVersion = roomListCacheVersion;
+    sendToClient(connection, message);
+}
+
+void ChatWorker::sendRoomListUpdate(ClientConnection& connection) {
+    quint64 current = directory->roomListVersion();
+    if (connection.roomListVersion == current) return;
+
+    // 변경분을 모르는 클라이언트나 아직 목록이 없는 연결에는 전체 목록
+    quint64 from = connection.roomListVersion;
+    if (!(connection.features & Protocol::FeatureRoomDeltas) || from == 0) {
+        sendRoomList(connection);
+        return;
+    }
+
+    QHash<quint64, RoomListDelta>::iterator it = roomDeltaCache.find(from);
+    if (it == roomDeltaCache.end()) {
+        QVector<RoomListChange> changes;
+        if (!directory->roomChangesSince(from, changes)) {
+            sendRoomList(connection);  // 너무 오래된 버전
+            return;
+        }
+
+        QCborArray added;
+        QCborArray removed;
+        RoomListDelta delta;
+        delta.version = from;
+        for (const RoomListChange& change : changes) {
+            (change.added ? added : removed).append(change.name);
+            delta.version = change.version;
+        }
+        QCborMap fields;
+        fields[QLatin1String("epoch")] = directory->roomListEpoch();
+        fields[QLatin1String("from")] = qint64(from);
+        fields[QLatin1String("version")] = qint64(delta.version);
+        fields[QLatin1String("added")] = added;
+        fields[QLatin1String("removed")] = removed;
+        delta.message = WireMessage(MessageType::RoomListDelta, fields);
+        it = roomDeltaCache.insert(from, delta);
+    }
+
+    connection.roomListVersion = it->version;
+    sendToClient(connection, it->message);
+}
+
+void ChatWorker::notifyRoomListChanged() {
+    if (roomListDirty.testAndSetOrdered(0, 1)) {
+        QMetaObject::invokeMethod(this, [this]() { syncRoomLists(); }, Qt::QueuedConnection);
+    }
+}
+
+void ChatWorker::syncRoomLists() {
+    // 연달아 생긴 방은 한 번에 처리된다
+    roomListDirty.storeRelease(0);
+    roomDeltaCache.clear();
+
+    for (ClientConnection *connection : connections) {
+        // 핸드셰이크 중인 연결은 끝날 때 최신 목록을 받는다
+        if (connection->decoder.mode() == FrameDecoder::Detect) continue;
+        sendRoomListUpdate(*connection);
+    }
+}
+
+void ChatWorker::broadcastRoomList() {
+    for (ChatWorker *peer : peers) {
+        peer->notifyRoomListChanged();
+    }
+}
+
+void ChatWorker::sendFileCatalog(ClientConnection& connection, ChatRoom* room) {
+    // 입장이 몰려도 목록이 바뀌지 않았으면 인코딩한 메시지를 재사용한다
+    quint64 version = files->catalogVersion(room);
+    FileCatalogCache& cache = fileCatalogCache[room->id];
+    if (cache.version != version) {
+        QCborArray entries;
+        for (const FileEntry& entry : files->catalog(room, version)) {
+            entries.append(FileStore::toCbor(entry));
+        }
+        QCborMap fields;
+        fields[QLatin1String("room")] = room->name;
+        fields[QLatin1String("epoch")] = files->catalogEpoch();
+        fields[QLatin1String("version")] = qint64(version);
+        fields[QLatin1String("files")] = entries;
+        cache.version = version;
+        cache.message = WireMessage(MessageType::FileCatalog, fields);
+    }
+    sendToClient(connection, cache.message);
+}
+
+WireMessage ChatWorker::fileCatalogDelta(ChatRoom* room, quint64 from, const QVector<FileCatalogChange>& changes) {
+    // 여러 워커가 알리면 도착 순서가 바뀔 수 있지만 클라이언트가 from으로 빈틈을 알아채고 다시 받는다
+    QCborArray added;
+    QCborArray removed;
+    for (const FileCatalogChange& change : changes) {
+        if (change.added) added.append(FileStore::toCbor(change.entry));
+        else removed.append(change.entry.name);
+    }
+    QCborMap fields;
+    fields[QLatin1String("room")] = room->name;
+    fields[QLatin1String("epoch")] = files->catalogEpoch();
+    fields[QLatin1String("from")] = qint64(from);
+    fields[QLatin1String("version")] = qint64(changes.last().version);
+    fields[QLatin1String("added")] = added;
+    fields[QLatin1String("removed")] = removed;
+    return WireMessage(MessageType::FileCatalogDelta, fields);
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QCborMap>
+#include "protocol.h"
+#include "mailbox.h"
+#include "chatdirectory.h"
+#include "clientconnection.h"
+#include "outboundqueue.h"
+#include "historystore.h"
+#include "filestore.h"
+#include "metrics.h"
+#include "serverconfig.h"
+#include "timerwheel.h"
+#include "transport.h"
+
+class EpollPoller;
+
+// 다른 워커에서 넘어온 방송 메시지
+struct RoomDelivery {
+    ChatRoom *room = nullptr;
+    QVector<ChatRoom*> rooms;   // 여러 방에 함께 가는 안내면 room 대신 채운다
+    WireMessage message;
+};
+
+// 방 목록 변경분 메시지 (기준 버전별로 한 번만 만든다)
+struct RoomListDelta {
+    quint64 version = 0;  // 적용한 뒤의 버전
+    WireMessage message;
+};
+
+// 방 파일 목록 스냅샷 캐시 (버전이 바뀔 때만 다시 만든다)
+struct FileCatalogCache {
+    quint64 version = 0;
+    WireMessage message;
+};
+
+// 자신만의 이벤트 루프(스레드)에서 일부 연결을 전담하는 워커
+// 소켓과 방 참가자 목록은 워커 로컬이며, 다른 워커의 참가자에게는
+// 해당 워커의 메일박스로 메시지를 한 번만 넘긴다.
+// 소켓은 ClientTransport로만 다루므로 Qt와 epoll 백엔드가 같은 처리 코드를 쓴다.
+class ChatWorker : public QObject, public TransportEvents {
+    Q_OBJECT
+
+public:
+    // 소켓 내부 버퍼에 한 번에 넘겨 두는 최대 바이트 수
+    static const qint64 kSocketWriteBudget = 64 * 1024;
+    // writev 한 번에 넘기는 최대 프레임 수 (IOV_MAX 이하)
+    static const int kMaxWriteBatch = 256;
+    // 이벤트 루프 지연을 재는 주기
+    static const int kLagProbeMs = 100;
+    // 제한 시간 휠의 틱과 한 번에 검사하는 최대 연결 수
+    static const int kWheelTickMs = 100;
+    static const int kSweepBatch = 256;
+
+    ChatWorker(int index, const ServerConfig& config, ChatDirectory *directory,
+               HistoryStore *history, FileStore *files, QObject *parent = nullptr);
+    ~ChatWorker();
+
+    // 시작 전에 한 번 설정한다
+    void setPeers(const QVector<ChatWorker*>& workers) { peers = workers; }
+    void setOverloadMonitor(OverloadMonitor *monitor) { overload = monitor; }
+    void setFederation(Federation *link) { federation = link; }
+    void setSessions(SessionRegistry *registry) { sessions = registry; }
+
+    // 임의 스레드에서 읽을 수 있다
+    OutboundTotals outboundTotals() const { return outboundStats.snapshot(); }
+    MetricsSnapshot metricsSnapshot() const { return metrics.snapshot(); }
+
+    // 워커 스레드가 시작된 뒤 한 번 호출된다 (타이머 준비)
+    void start();
+
+    // 워커 스레드에서 호출된다 (ChatServer가 큐로 넘긴다)
+    void addConnection(qintptr socketDescriptor);
+    // 임의 스레드에서 호출할 수 있다
+    void post(const RoomDelivery& delivery);
+    // 방 목록이 바뀌었음을 알린다. 여러 번 불려도 한 번만 처리한다. (임의 스레드)
+    void notifyRoomListChanged();
+    // 파일 전송 채널로 올라온 파일을 방에 알린다 (워커 스레드에서 호출된다)
+    // version은 파일을 목록에 넣은 뒤의 방 파일 목록 버전
+    void announceFile(ChatRoom* room, const FileEntry& entry, quint64 version);
+    // 이 노드가 소유한 방에 메시지를 낸다 (번호와 기록, 로컬 방송, 구독 노드 전달)
+    // 노드를 묶으면 방마다 id % 워커 수 번째 워커에서만 불린다 (워커 스레드)
+    void publishAsOwner(ChatRoom* room, MessageType type, QCborMap fields, bool record);
+    // 세션을 다른 연결이 이어 받았으므로 이전 연결을 조용히 닫는다 (워커 스레드)
+    void closeSuperseded(quint64 connectionId);
+
+private:
+    int workerIndex;
+    const ServerConfig& config;
+    ChatDirectory *directory;
+    HistoryStore *history;                                  // 기록을 끄면 nullptr
+    FileStore *files;                                       // 파일 채널을 끄면 nullptr
+    QVector<ChatWorker*> peers;
+    OutboundStats outboundStats;
+    WorkerMetrics metrics;
+    QElapsedTimer lagClock;                                 // 지난 지연 측정 시각
+    QElapsedTimer uptime;                                   // 토큰 버킷 시계
+    OverloadMonitor *overload = nullptr;                    // 서버 전체 과부하 단계 (없으면 보지 않는다)
+    Federation *federation = nullptr;                       // 노드 간 링크 (단일 노드면 nullptr)
+    SessionRegistry *sessions = nullptr;                    // 이어 받기 토큰 (끄면 nullptr)
+    TimerWheel wheel;                                       // 연결별 제한 시간
+    qint64 nowMs = 0;                                       // 휠 틱마다 갱신하는 대략의 uptime 시각
+    bool sweepScheduled = false;                            // 남은 만료 항목 처리가 예약됨
+    WireMessage pingMessage;                                // 형식별 인코딩을 재사용한다
+
+    QHash<quint64, ClientConnection*> connections;         // 이 워커의 연결 (ClientConnection::id)
+    quint64 nextConnectionId = 0;
+    EpollPoller *poller = nullptr;                          // epoll 백엔드 (Qt 백엔드면 nullptr)
+    RoomMembers localMembers;                               // 방별 로컬 참가자
+    quint64 lastDeliveryStamp = 0;                          // 여러 방 전달마다 올린다 (ClientConnection::deliveryStamp)
+    Mailbox<RoomDelivery> mailbox;
+    QAtomicInt roomListDirty;                               // 방 목록 동기화 예약됨
+
+    // 방 목록 캐시 (버전이 바뀔 때만 다시 만들고 형식별 인코딩은 WireMessage가 재사용)
+    WireMessage roomListMessage;
+    quint64 roomListCacheVersion = 0;
+    bool roomListCached = false;
+    QHash<quint64, RoomListDelta> roomDeltaCache;           // 기준 버전 → 변경분
+    QHash<quint32, FileCatalogCache> fileCatalogCache;      // 방 ID → 파일 목록
+
+    // 일괄 쓰기 (틱마다 또는 기한이 되면 연결별로 한 번에 내보낸다)
+    QVector<ClientConnection*> pendingFlush;
+    bool flushScheduled = false;
+
+    // 백엔드가 알리는 소켓 사건
+    void transportWakeup() override { metrics.recordWakeup(); }
+    void transportRead(ClientConnection& connection, const QByteArray& data) override;
+    void transportWritten(ClientConnection& connection) override;
+    void transportClosed(ClientConnection& connection) override;
+    ClientTransport* openTransport(qintptr socketDescriptor, ClientConnection *connection);
+
+    // 수신 처리 함수
+    void readFromClient(ClientConnection& connection, const QByteArray& data);
+    void completeHandshake(ClientConnection& connection);
+    void drainMailbox();
+    void probeLoopLag();
+    void sweepTimeouts();
+    void checkTimeouts(ClientConnection& connection);
+    void scheduleTimeouts(ClientConnection& connection);
+    bool hasPendingWrite(const ClientConnection& connection) const;
+
+    // 메시지 처리 함수
+    typedef void (ChatWorker::*MessageHandler)(ClientConnection& connection, const QCborMap& data);
+    static MessageHandler handlerFor(MessageType type);
+
+    void processMessage(ClientConnection& connection, const QByteArray& data);
+    bool admit(ClientConnection& connection, MessageType type);
+    void handleRegistration(ClientConnection& connection, const QCborMap& data);
+    void handleLogin(ClientConnection& connection, const QCborMap& data);
+    void handleCreateRoom(ClientConnection& connection, const QCborMap& data);
+    void handleJoinRoom(ClientConnection& connection, const QCborMap& data);
+    void handleLeaveRoom(ClientConnection& connection, const QCborMap& data);
+    void handleChatMessage(ClientConnection& connection, const QCborMap& data);
+    void handleFileUploadNotification(ClientConnection& connection, const QCborMap& data);
+    void handleHistoryRequest(ClientConnection& connection, const QCborMap& data);
+    void handleRoomListRequest(ClientConnection& connection, const QCborMap& data);
+    void handleFileTicketRequest(ClientConnection& connection, const QCborMap& data);
+    void handleFileCatalogRequest(ClientConnection& connection, const QCborMap& data);
+    void handleFileRemove(ClientConnection& connection, const QCborMap& data);
+    void handlePing(ClientConnection& connection, const QCborMap& data);
+    void handlePong(ClientConnection& connection, const QCborMap& data);
+    void handleResume(ClientConnection& connection, const QCborMap& data);
+    void handleDisconnection(ClientConnection* connection);
+
+    // 방 참가 관리
+    void joinLocalRoom(ClientConnection& connection, ChatRoom* room);
+    void leaveLocalRoom(ClientConnection& connection, ChatRoom* room);
+    void leaveAllRooms(ClientConnection& connection);
+    // 요청이 room으로 고른 구독 방 (room이 없으면 기본 방). 구독하지 않은 방이면 nullptr.
+    ChatRoom* targetRoom(const ClientConnection& connection, const QCborMap& data) const;
+    // 이어 받기 토큰에 지금의 구독 목록을 적어 둔다
+    void saveSubscriptions(const ClientConnection& connection);
+
+    // 메시지 기록
+    void recordMessage(ChatRoom* room, MessageType type, QCborMap& fields);
+    void sendHistory(ClientConnection& connection, ChatRoom* room, quint64 beforeSeq, int limit);
+
+    // 방 메시지를 소유 노드로 보내거나 직접 낸다. 소유 노드와 끊겨 있으면 false.
+    bool publishToRoom(ChatRoom* room, MessageType type, const QCborMap& fields, bool record);
+    // 여러 방에 같은 안내를 낸다. 여러 방을 구독한 연결도 한 번만 받는다.
+    void publishNotice(const QVector<ChatRoom*>& rooms, const QString& text);
+
+    // 유틸리티 함수
+    void broadcastToRoom(ChatRoom* room, WireMessage& message);
+    void broadcastToRooms(const QVector<ChatRoom*>& rooms, WireMessage& message);
+    void deliverLocal(ChatRoom* room, WireMessage& message);
+    void deliverLocal(const QVector<ChatRoom*>& rooms, WireMessage& message);
+    void sendToClient(ClientConnection& connection, WireMessage& message);
+    void scheduleFlush(ClientConnection& connection);
+    void flushPendingWrites();
+    void flushOutbound(ClientConnection& connection);
+    bool writeBatch(ClientConnection& connection);
+    void evict(ClientConnection& connection);
+    void sendToClient(ClientConnection& connection, MessageType type, const QCborMap& fields = QCborMap());
+    void sendError(ClientConnection& connection, const QString& message);
+    void sendRoomList(ClientConnection& connection);
+    void sendRoomListUpdate(ClientConnection& connection);
+    WireMessage& cachedRoomList();
+    void syncRoomLists();
+    void broadcastRoomList();
+    void sendFileCatalog(ClientConnection& connection, ChatRoom* room);
+    WireMessage fileCatalogDelta(ChatRoom* room, quint64 from, const QVector<FileCatalogChange>& changes);
+};
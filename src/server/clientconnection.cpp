@@ -0,0 +1,65 @@
+#include "clientconnection.h"
+
+int Session::indexOf(const ChatRoom *target) const {
+    for (int i = 0; i < rooms.size(); ++i) {
+        if (rooms.at(i).room == target) return i;
+    }
+    return -1;
+}
+
+QVector<ChatRoom*> Session::subscribedRooms() const {
+    QVector<ChatRoom*> result;
+    result.reserve(rooms.size());
+    for (const Subscription& subscription : rooms) {
+        result.append(subscription.room);
+    }
+    return result;
+}
+
+bool RoomMembers::join(ClientConnection* connection, ChatRoom* room) {
+    if (room->id >= quint32(rooms.size())) {
+        rooms.resize(int(room->id) + 1);
+    }
+
+    QVector<ClientConnection*>& list = rooms[int(room->id)];
+    Subscription subscription;
+    subscription.room = room;
+    subscription.memberIndex = list.size();
+    connection->session.rooms.append(subscription);
+    connection->session.room = room;
+    list.append(connection);
+    return list.size() == 1;
+}
+
+bool RoomMembers::leave(ClientConnection* connection, ChatRoom* room) {
+    Session& session = connection->session;
+    int index = session.indexOf(room);
+    if (index < 0) return false;
+
+    // 마지막 원소를 빈자리로 옮겨 배열을 연속으로 유지한다
+    int memberIndex = session.rooms.at(index).memberIndex;
+    QVector<ClientConnection*>& list = rooms[int(room->id)];
+    ClientConnection *last = list.last();
+    list[memberIndex] = last;
+    Session& moved = last->session;
+    moved.rooms[moved.indexOf(room)].memberIndex = memberIndex;
+    list.removeLast();
+
+    // 구독 목록도 순서가 없으므로 마지막 구독을 빈자리로 옮긴다
+    session.rooms[index] = session.rooms.last();
+    session.rooms.removeLast();
+    if (session.room == room) {
+        session.room = session.rooms.isEmpty() ? nullptr : session.rooms.last().room;
+    }
+
+    if (list.isEmpty()) {
+        list.squeeze();
+        return true;
+    }
+    return false;
+}
+
+const QVector<ClientConnection*>& RoomMembers::members(quint32 roomId) const {
+    static const QVector<ClientConnection*> empty;
+    return roomId < quint32(rooms.size()) ? rooms.at(int(roomId)) : empty;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QVarLengthArray>
+#include <QVector>
+#include <QString>
+#include "protocol.h"
+#include "outboundqueue.h"
+#include "chatdirectory.h"
+#include "ratelimit.h"
+#include "timerwheel.h"
+#include "transport.h"
+
+// 연결이 구독한 방 하나
+struct Subscription {
+    ChatRoom *room = nullptr;
+    int memberIndex = -1;      // RoomMembers 배열 안에서의 위치
+};
+
+// 로그인한 연결에 붙는 세션
+// 사용자 ID와 방 포인터를 미리 풀어 두어 메시지마다 이름으로 찾지 않는다.
+// FeatureMultiRoom을 합의한 연결은 여러 방을 함께 구독한다. 대부분은 방 하나라
+// 구독 목록은 연결 객체 안에 두고, 그보다 많을 때만 힙을 쓴다.
+struct Session {
+    quint32 userId = ChatDirectory::kInvalidId;
+    QString username;          // 디렉터리 문자열을 공유한다 (복사 없음)
+    ChatRoom *room = nullptr;  // 방 이름 없이 보낸 요청의 대상 (마지막으로 들어간 방)
+    QVarLengthArray<Subscription, 1> rooms;  // 구독한 방 (순서 없음)
+    QByteArray resumeToken;    // 이어 받기 토큰 (FeatureResume를 합의하지 않았으면 비어 있다)
+
+    bool isLoggedIn() const { return userId != ChatDirectory::kInvalidId; }
+    int indexOf(const ChatRoom *target) const;
+    bool isSubscribed(const ChatRoom *target) const { return indexOf(target) >= 0; }
+    QVector<ChatRoom*> subscribedRooms() const;
+};
+
+class ClientConnection {
+public:
+    explicit ClientConnection(const OutboundLimits& limits) : outbound(limits) {}
+
+    quint64 id = 0;            // 워커 안에서의 연결 번호 (재사용하지 않는다)
+    ClientTransport *transport = nullptr;  // 소켓 (Qt 또는 epoll 백엔드)
+    FrameDecoder decoder;  // 수신 버퍼
+    Protocol::WireFormat format = Protocol::WireFormat::LegacyJson;  // 합의된 전송 형식
+    quint8 features = 0;       // 핸드셰이크에서 합의된 기능 플래그
+    quint64 roomListVersion = 0;  // 이 연결에 마지막으로 보낸 방 목록 버전 (0이면 아직 없음)
+    Session session;
+    OutboundQueue outbound;    // 송신 대기열
+    bool evicted = false;      // 느린 수신자로 끊기는 중
+    quint64 deliveryStamp = 0; // 여러 방에 함께 가는 메시지를 이미 받았는지 (ChatWorker::deliverLocal)
+    bool superseded = false;   // 세션을 새 연결이 이어 받아 닫는 중 (퇴장 알림 없음)
+    bool flushPending = false; // 이번 틱의 일괄 쓰기 목록에 올라 있음
+    TokenBucket connectionBucket;      // 모든 수신 메시지
+    QVector<TokenBucket> typeBuckets;  // 한도가 있는 메시지 타입별 (RateLimitConfig::bucketFor)
+    TokenBucket throttleBucket;        // 과부하 때의 채팅 한도
+    bool limitNotified = false;        // 이번 초과에 대해 이미 오류를 보냈음
+    // 제한 시간 (워커의 대략적인 시각, ms). 활동 때는 시각만 적고 휠에서 꺼낼 때 판단한다.
+    TimerNode timer;                   // 다음 제한 시간 검사
+    qint64 connectedMs = 0;
+    qint64 lastInboundMs = 0;          // 마지막으로 받은 시각
+    qint64 lastPingMs = -1;            // 마지막으로 ping을 보낸 시각
+    qint64 lastWriteMs = 0;            // 송신이 마지막으로 진척된 시각 (보낼 것이 생긴 시각 포함)
+};
+
+// 워커 로컬 방 참가자 목록
+// 방 ID로 인덱싱하는 연속 배열이라 방송 시 순회가 빠르고,
+// 각 구독이 자기 위치를 기억하므로 입장/퇴장은 연결의 구독 수에만 비례한다.
+class RoomMembers {
+public:
+    // 구독을 더하고 그 방을 기본 방으로 삼는다. 방의 첫 참가자면 true. (이미 구독 중이면 부르지 않는다)
+    bool join(ClientConnection* connection, ChatRoom* room);
+    // 방의 마지막 참가자였으면 true. 기본 방을 떠나면 남은 구독 중 하나가 기본 방이 된다.
+    bool leave(ClientConnection* connection, ChatRoom* room);
+    const QVector<ClientConnection*>& members(quint32 roomId) const;
+
+private:
+    QVector<QVector<ClientConnection*> > rooms;
+};
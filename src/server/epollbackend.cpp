@@ -0,0 +1,202 @@
+#include "epollbackend.h"
+#include <QSocketNotifier>
+#include "logger.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+const int EpollPoller::kMaxEvents;
+const int EpollPoller::kReadBufferSize;
+const qint64 EpollPoller::kReadBudget;
+
+EpollTransport::EpollTransport(EpollPoller *poller, int fd, ClientConnection *connection)
+    : poller(poller), fd(fd), connection(connection) {}
+
+EpollTransport::~EpollTransport() {
+    if (fd >= 0) ::close(fd);
+}
+
+void EpollTransport::write(const QByteArray& data) {
+    if (fd < 0 || data.isEmpty()) return;
+    // 이미 밀려 있으면 순서를 지키도록 뒤에 붙이고 EPOLLOUT을 기다린다
+    if (!pending.isEmpty()) {
+        pending.append(data);
+        return;
+    }
+
+    ssize_t written;
+    do {
+        written = ::send(fd, data.constData(), size_t(data.size()), MSG_NOSIGNAL);
+    } while (written < 0 && errno == EINTR);
+    if (written < 0) {
+        // 그 밖의 오류는 곧 EPOLLERR로 와서 닫힌다
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return;
+        written = 0;
+    }
+    if (written < data.size()) {
+        pending = written > 0 ? data.mid(int(written)) : data;
+    }
+}
+
+bool EpollTransport::flushPending() {
+    qint64 total = 0;
+    while (fd >= 0 && !pending.isEmpty()) {
+        ssize_t written = ::send(fd, pending.constData(), size_t(pending.size()), MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) pending.clear();
+            break;
+        }
+        pending.remove(0, int(written));
+        total += written;
+    }
+    if (pending.isEmpty()) {
+        pending = QByteArray();  // 유휴 연결이 송신 버퍼 메모리를 붙잡지 않도록
+    }
+    return total > 0;
+}
+
+void EpollTransport::abort() {
+    if (fd >= 0) poller->close(this);
+}
+
+void EpollTransport::release() {
+    poller->retire(this);
+}
+
+EpollPoller::EpollPoller(TransportEvents *events, QObject *parent)
+    : QObject(parent), events(events) {
+    epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        CHAT_LOG(Error, Server) << "epoll_create1 failed:" << std::strerror(errno);
+        return;
+    }
+    readBuffer.resize(kReadBufferSize);
+    // epoll fd 자체는 레벨 트리거로 감시하므로 kMaxEvents보다 많이 준비되어 있으면 다시 깨어난다
+    notifier = new QSocketNotifier(epollFd, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &EpollPoller::poll);
+}
+
+EpollPoller::~EpollPoller() {
+    qDeleteAll(retired);
+    if (epollFd >= 0) ::close(epollFd);
+}
+
+EpollTransport* EpollPoller::add(int fd, ClientConnection *connection) {
+    // 프레임은 직접 모아서 쓰므로 Nagle 지연은 끈다
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // 하트비트를 모르는 클라이언트의 반열림 연결은 커널 keepalive에 맡긴다
+    ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+    EpollTransport *transport = new EpollTransport(this, fd, connection);
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = transport;
+    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        CHAT_LOG(Warning, Connection) << "epoll_ctl failed:" << std::strerror(errno);
+        delete transport;
+        return nullptr;
+    }
+    return transport;
+}
+
+void EpollPoller::poll() {
+    events->transportWakeup();
+
+    struct epoll_event ready[kMaxEvents];
+    int count;
+    do {
+        count = ::epoll_wait(epollFd, ready, kMaxEvents, 0);
+    } while (count < 0 && errno == EINTR);
+
+    for (int i = 0; i < count; ++i) {
+        // 닫힌 연결은 retire된 채 다음 reap까지 남아 있으므로 fd로 확인할 수 있다
+        EpollTransport *transport = static_cast<EpollTransport*>(ready[i].data.ptr);
+        quint32 flags = ready[i].events;
+        if (transport->fd < 0) continue;
+
+        if ((flags & EPOLLOUT) && transport->flushPending()) {
+            events->transportWritten(*transport->connection);
+        }
+        if (transport->fd >= 0 && (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            readFrom(transport);
+        }
+        if (transport->fd >= 0 && (flags & (EPOLLHUP | EPOLLERR))) {
+            close(transport);
+        }
+    }
+}
+
+void EpollPoller::readFrom(EpollTransport *transport) {
+    // 엣지 트리거라 EAGAIN까지 읽어야 다음 알림이 온다
+    qint64 budget = kReadBudget;
+    while (transport->fd >= 0) {
+        ssize_t n = ::read(transport->fd, readBuffer.data(), size_t(readBuffer.size()));
+        if (n > 0) {
+            // 수신 디코더가 필요한 만큼만 복사하므로 버퍼는 연결끼리 공유한다
+            events->transportRead(*transport->connection, QByteArray::fromRawData(readBuffer.constData(), int(n)));
+            budget -= n;
+            if (budget <= 0 && transport->fd >= 0) {
+                transport->readQueued = true;
+                readAgain.append(transport);
+                if (!readScheduled) {
+                    readScheduled = true;
+                    QMetaObject::invokeMethod(this, [this]() { readDeferred(); }, Qt::QueuedConnection);
+                }
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        // 0이면 상대가 닫았다
+        close(transport);
+        return;
+    }
+}
+
+void EpollPoller::readDeferred() {
+    readScheduled = false;
+    events->transportWakeup();
+
+    QVector<EpollTransport*> batch;
+    batch.swap(readAgain);
+    for (EpollTransport *transport : batch) {
+        transport->readQueued = false;
+    }
+    for (EpollTransport *transport : batch) {
+        if (transport->fd >= 0) readFrom(transport);
+    }
+}
+
+void EpollPoller::close(EpollTransport *transport) {
+    // fd를 닫으면 epoll에서도 빠진다
+    ::close(transport->fd);
+    transport->fd = -1;
+    transport->pending = QByteArray();
+    if (transport->readQueued) {
+        transport->readQueued = false;
+        readAgain.removeOne(transport);
+    }
+    events->transportClosed(*transport->connection);
+}
+
+void EpollPoller::retire(EpollTransport *transport) {
+    retired.append(transport);
+    if (!reapScheduled) {
+        reapScheduled = true;
+        QMetaObject::invokeMethod(this, [this]() { reap(); }, Qt::QueuedConnection);
+    }
+}
+
+void EpollPoller::reap() {
+    reapScheduled = false;
+    qDeleteAll(retired);
+    retired.clear();
+}
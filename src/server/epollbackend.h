@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QVector>
+#include "transport.h"
+
+class QSocketNotifier;
+class EpollPoller;
+
+// epoll 백엔드의 연결 하나
+// QObject도 자체 수신 버퍼도 없다. 받은 바이트는 워커가 공유하는 읽기 버퍼에서 바로 넘기고,
+// 커널이 받지 못한 송신 바이트만 들고 있는다.
+class EpollTransport : public ClientTransport {
+public:
+    EpollTransport(EpollPoller *poller, int fd, ClientConnection *connection);
+    ~EpollTransport();
+
+    qintptr descriptor() const override { return fd; }
+    bool isConnected() const override { return fd >= 0; }
+    qint64 bytesToWrite() const override { return pending.size(); }
+    void write(const QByteArray& data) override;
+    void abort() override;
+    void release() override;
+
+private:
+    friend class EpollPoller;
+
+    // 들고 있는 바이트를 보낼 수 있는 만큼 보낸다. 조금이라도 보냈으면 true.
+    bool flushPending();
+
+    EpollPoller *poller;
+    int fd;
+    ClientConnection *connection;
+    QByteArray pending;          // 커널이 받지 못한 송신 바이트
+    bool readQueued = false;     // 읽기 예산을 다 써서 다음 차례를 기다린다
+};
+
+// 워커 하나의 epoll (Linux)
+// 연결 fd를 모두 EPOLLIN | EPOLLOUT | EPOLLRDHUP 엣지 트리거로 한 번만 등록하고,
+// epoll fd 하나를 QSocketNotifier로 워커 이벤트 루프에 붙인다. 그래서 연결 수와 관계없이
+// 루프가 한 번 깨어날 때 준비된 연결을 최대 kMaxEvents개씩 한꺼번에 처리한다.
+// 엣지 트리거이므로 읽기는 EAGAIN까지 해야 하고, 한 연결이 루프를 독차지하지 않도록
+// kReadBudget을 넘기면 다음 차례로 미룬다.
+class EpollPoller : public QObject {
+    Q_OBJECT
+
+public:
+    static const int kMaxEvents = 256;
+    static const int kReadBufferSize = 64 * 1024;
+    static const qint64 kReadBudget = 256 * 1024;  // 한 번에 한 연결에서 읽는 최대 바이트
+
+    explicit EpollPoller(TransportEvents *events, QObject *parent = nullptr);
+    ~EpollPoller();
+
+    bool isValid() const { return epollFd >= 0; }
+    // accept한 non-blocking fd를 등록한다. 실패하면 fd를 닫고 nullptr.
+    EpollTransport* add(int fd, ClientConnection *connection);
+
+private:
+    friend class EpollTransport;
+
+    void poll();
+    void readFrom(EpollTransport *transport);
+    void readDeferred();
+    void close(EpollTransport *transport);
+    void retire(EpollTransport *transport);
+    void reap();
+
+    TransportEvents *events;
+    int epollFd = -1;
+    QSocketNotifier *notifier = nullptr;
+    QByteArray readBuffer;                    // 모든 연결이 같이 쓰는 읽기 버퍼
+    QVector<EpollTransport*> readAgain;       // 읽기 예산을 넘겨 미룬 연결
+    QVector<EpollTransport*> retired;         // 처리 중인 호출이 끝난 뒤 지운다
+    bool readScheduled = false;
+    bool reapScheduled = false;
+};
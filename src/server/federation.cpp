@@ -0,0 +1,625 @@
+#include "federation.h"
+#include <QCborArray>
+#include <QCborValue>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QStringList>
+#include <QTimer>
+#include "chatdirectory.h"
+#include "chatworker.h"
+#include "historystore.h"
+#include "logger.h"
+
+const int FederationConfig::kMaxNodes;
+const int Federation::kMaxFrameSize;
+const int Federation::kUsersPerFrame;
+
+namespace {
+    // 모든 노드가 같은 소유 노드를 골라야 하므로 프로세스마다 시드가 다른 qHash 대신 직접 계산한다
+    quint64 rendezvousScore(const QString& name, int node) {
+        quint64 hash = 14695981039346656037ULL ^ (quint64(node + 1) * 0x9e3779b97f4a7c15ULL);
+        for (QChar c : name) {
+            hash ^= c.unicode();
+            hash *= 1099511628211ULL;
+        }
+        // 비슷한 이름이 한 노드로 몰리지 않도록 마지막에 섞는다 (splitmix64)
+        hash ^= hash >> 30;
+        hash *= 0xbf58476d1ce4e5b9ULL;
+        hash ^= hash >> 27;
+        hash *= 0x94d049bb133111ebULL;
+        hash ^= hash >> 31;
+        return hash;
+    }
+
+    quint64 nodeBit(int node) {
+        return quint64(1) << node;
+    }
+}
+
+bool FederationConfig::parse(const QString& spec, QString *error) {
+    nodes.clear();
+    for (const QString& item : spec.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        // 번호=호스트:포트
+        QStringList pair = item.trimmed().split(QLatin1Char('='));
+        QString address = pair.value(1);
+        int colon = address.lastIndexOf(QLatin1Char(':'));
+        bool idOk = false;
+        bool portOk = false;
+        int id = pair.value(0).toInt(&idOk);
+        uint port = address.mid(colon + 1).toUInt(&portOk);
+        if (pair.size() != 2 || !idOk || id < 0 || id >= kMaxNodes || colon <= 0
+            || !portOk || port == 0 || port > 65535) {
+            if (error) *error = QString("Invalid node '%1'").arg(item);
+            return false;
+        }
+        if (node(id)) {
+            if (error) *error = QString("Duplicate node id %1").arg(id);
+            return false;
+        }
+
+        NodeAddress entry;
+        entry.id = id;
+        entry.host = address.left(colon);
+        entry.port = quint16(port);
+        nodes.append(entry);
+    }
+    return true;
+}
+
+const NodeAddress* FederationConfig::node(int id) const {
+    for (const NodeAddress& node : nodes) {
+        if (node.id == id) return &node;
+    }
+    return nullptr;
+}
+
+Federation::Federation(const FederationConfig& config, ChatDirectory *directory, HistoryStore *history,
+                       QObject *parent)
+    : QTcpServer(parent), config(config), directory(directory), history(history),
+      peers(FederationConfig::kMaxNodes, nullptr) {}
+
+Federation::~Federation() {
+    for (Link *link : links) {
+        link->socket->disconnect(this);
+    }
+    qDeleteAll(links);
+}
+
+bool Federation::start() {
+    const NodeAddress *self = config.node(config.nodeId);
+    // 링크는 인증이 없으므로 설정한 주소에만 연다 (이름이면 풀어서 쓰고, 안 풀리면 열지 않는다)
+    QHostAddress address;
+    if (!address.setAddress(self->host)) {
+        QHostInfo info = QHostInfo::fromName(self->host);
+        if (info.error() != QHostInfo::NoError || info.addresses().isEmpty()) {
+            CHAT_LOG(Error, Server) << "Failed to resolve node link host" << self->host << ":" << info.errorString();
+            return false;
+        }
+        address = info.addresses().first();
+    }
+    if (!listen(address, self->port)) {
+        CHAT_LOG(Error, Server) << "Failed to open node link port" << self->port << ":" << errorString();
+        return false;
+    }
+
+    // 링크는 쌍마다 하나만 두도록 번호가 작은 노드에만 이쪽에서 접속한다
+    for (const NodeAddress& node : config.nodes) {
+        if (node.id < config.nodeId) connectTo(node.id);
+    }
+    CHAT_LOG(Info, Server) << "Node" << config.nodeId << "of" << config.nodes.size()
+                           << "listening for node links on port" << self->port;
+    return true;
+}
+
+int Federation::ownerOf(const QString& name) const {
+    // 가장 높은 점수를 받은 노드가 소유한다 (노드가 빠지거나 늘어도 그 노드의 방만 옮겨 간다)
+    int owner = config.nodeId;
+    quint64 best = 0;
+    for (const NodeAddress& node : config.nodes) {
+        quint64 score = rendezvousScore(name, node.id);
+        if (score > best || (score == best && node.id < owner)) {
+            best = score;
+            owner = node.id;
+        }
+    }
+    return owner;
+}
+
+bool Federation::owns(const ChatRoom* room) const {
+    return ownerOf(room->name) == config.nodeId;
+}
+
+FederationTotals Federation::totals() const {
+    FederationTotals totals;
+    totals.framesSent = framesSent.loadAcquire();
+    totals.framesReceived = framesReceived.loadAcquire();
+    totals.bytesSent = bytesSent.loadAcquire();
+    totals.bytesReceived = bytesReceived.loadAcquire();
+    totals.droppedFrames = droppedFrames.loadAcquire();
+    totals.linksUp = linkMask.loadAcquire();
+    return totals;
+}
+
+void Federation::roomCreated(ChatRoom *room) {
+    FederationCommand command;
+    command.kind = FederationCommand::RoomCreated;
+    command.room = room;
+    command.name = room->name;
+    command.password = directory->roomPassword(room);
+    post(command);
+}
+
+void Federation::userRegistered(const QString& username, const QString& password) {
+    FederationCommand command;
+    command.kind = FederationCommand::UserRegistered;
+    command.name = username;
+    command.password = password;
+    post(command);
+}
+
+void Federation::membershipChanged(ChatRoom *room) {
+    FederationCommand command;
+    command.kind = FederationCommand::MembershipChanged;
+    command.room = room;
+    post(command);
+}
+
+void Federation::publish(ChatRoom *room, MessageType type, const QCborMap& fields, bool record) {
+    FederationCommand command;
+    command.kind = FederationCommand::Publish;
+    command.room = room;
+    command.type = type;
+    command.fields = fields;
+    command.record = record;
+    post(command);
+}
+
+void Federation::forward(ChatRoom *room, MessageType type, const QCborMap& fields) {
+    FederationCommand command;
+    command.kind = FederationCommand::Forward;
+    command.room = room;
+    command.type = type;
+    command.fields = fields;
+    post(command);
+}
+
+void Federation::post(const FederationCommand& command) {
+    if (commands.push(command)) {
+        QMetaObject::invokeMethod(this, [this]() { drainCommands(); }, Qt::QueuedConnection);
+    }
+}
+
+void Federation::drainCommands() {
+    commands.drain([this](FederationCommand& command) {
+        handleCommand(command);
+    });
+}
+
+void Federation::handleCommand(FederationCommand& command) {
+    switch (command.kind) {
+    case FederationCommand::RoomCreated:
+        announceRoom(command.name, command.password);
+        break;
+    case FederationCommand::UserRegistered:
+        announceUser(command.name, command.password);
+        break;
+    case FederationCommand::MembershipChanged:
+        syncSubscription(command.room);
+        break;
+    case FederationCommand::Publish: {
+        QCborMap fields;
+        fields[QLatin1String("room")] = command.room->name;
+        fields[QLatin1String("type")] = int(command.type);
+        fields[QLatin1String("fields")] = command.fields;
+        fields[QLatin1String("record")] = command.record;
+        send(ownerOf(command.room->name), encode(Publish, fields));
+        break;
+    }
+    case FederationCommand::Forward: {
+        // 프레임은 한 번만 만들고 구독한 노드의 링크에 같은 바이트를 쓴다
+        quint64 mask = command.room->nodeMask.loadAcquire();
+        if (mask == 0) break;
+        QCborMap fields;
+        fields[QLatin1String("room")] = command.room->name;
+        fields[QLatin1String("type")] = int(command.type);
+        fields[QLatin1String("fields")] = command.fields;
+        QByteArray frame = encode(Deliver, fields);
+        for (int i = 0; mask != 0; ++i, mask >>= 1) {
+            if (mask & 1) send(i, frame);
+        }
+        break;
+    }
+    }
+}
+
+void Federation::connectTo(int peer) {
+    const NodeAddress *address = config.node(peer);
+    QTcpSocket *socket = new QTcpSocket(this);
+    Link *link = openLink(socket, peer);
+    connect(socket, &QTcpSocket::connected, this, [this, link]() {
+        link->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        link->socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+        link->socket->write(helloFrame());
+    });
+    socket->connectToHost(address->host, address->port);
+}
+
+void Federation::incomingConnection(qintptr socketDescriptor) {
+    QTcpSocket *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return;
+    }
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    // 양쪽 모두 먼저 Hello를 보내고, 상대의 Hello를 받은 뒤부터 링크를 쓴다
+    openLink(socket, -1);
+    socket->write(helloFrame());
+}
+
+Federation::Link* Federation::openLink(QTcpSocket *socket, int peer) {
+    Link *link = new Link;
+    link->peer = peer;
+    link->socket = socket;
+    links.append(link);
+
+    connect(socket, &QTcpSocket::readyRead, this, [this, link]() { readLink(link); });
+    connect(socket, &QTcpSocket::disconnected, this, [this, link]() { dropLink(link); });
+    connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error),
+            this, [this, link](QAbstractSocket::SocketError) { dropLink(link); });
+    return link;
+}
+
+void Federation::readLink(Link *link) {
+    QByteArray data = link->socket->readAll();
+    bytesReceived.fetchAndAddRelaxed(quint64(data.size()));
+
+    QList<QByteArray> frames;
+    if (!link->decoder.feed(data, frames)) {
+        CHAT_LOG(Warning, Server) << "Bad frame on link to node" << link->peer << ":" << link->decoder.errorString();
+        dropLink(link);
+        return;
+    }
+    for (const QByteArray& frame : frames) {
+        framesReceived.fetchAndAddRelaxed(1);
+        handleFrame(link, frame);
+        // 처리 중에 링크가 닫혔으면 남은 프레임은 버린다
+        if (!links.contains(link)) return;
+    }
+}
+
+void Federation::dropLink(Link *link) {
+    if (!links.removeOne(link)) return;
+    link->socket->disconnect(this);
+    link->socket->abort();
+    link->socket->deleteLater();
+
+    int peer = link->peer;
+    if (link->ready && peers.at(peer) == link) {
+        peers[peer] = nullptr;
+        linkMask.fetchAndAndOrdered(~nodeBit(peer));
+        // 그 노드의 구독은 지우고, 그 노드가 소유한 방은 다시 이어질 때 구독한다
+        for (ChatRoom *room : directory->allRooms()) {
+            room->nodeMask.fetchAndAndOrdered(~nodeBit(peer));
+            // 끊겨 있는 동안의 메시지는 받지 못하므로 보관분도 버린다
+            if (ownerOf(room->name) == peer && subscribed.remove(room)) room->replay.clear();
+        }
+        CHAT_LOG(Warning, Server) << "Lost link to node" << peer;
+    }
+    delete link;
+
+    // 이쪽에서 접속하는 링크만 다시 잇는다
+    if (peer >= 0 && peer < config.nodeId) {
+        QTimer::singleShot(config.reconnectMs, this, [this, peer]() { connectTo(peer); });
+    }
+}
+
+void Federation::handleFrame(Link *link, const QByteArray& payload) {
+    QCborArray message = QCborValue::fromCbor(payload).toArray();
+    if (message.size() != 2 || !message.at(0).isInteger() || !message.at(1).isMap()) {
+        CHAT_LOG(Warning, Server) << "Undecodable frame on link to node" << link->peer;
+        dropLink(link);
+        return;
+    }
+    int type = int(message.at(0).toInteger());
+    QCborMap fields = message.at(1).toMap();
+    if (!link->ready && type != Hello) {
+        dropLink(link);
+        return;
+    }
+
+    switch (type) {
+    case Hello:
+        handleHello(link, fields);
+        break;
+    case RoomCreated:
+        reconcileRoom(link->peer, fields.value(QLatin1String("room")).toString(),
+                      fields.value(QLatin1String("password")).toString());
+        break;
+    case UserRegistered:
+        reconcileUser(link->peer, fields.value(QLatin1String("username")).toString(),
+                      fields.value(QLatin1String("password")).toString());
+        break;
+    case Users:
+        for (const QCborValue& item : fields.value(QLatin1String("users")).toArray()) {
+            QCborArray user = item.toArray();
+            reconcileUser(link->peer, user.at(0).toString(), user.at(1).toString());
+        }
+        break;
+    case Subscribe:
+    case Unsubscribe:
+        if (ChatRoom *room = directory->findRoom(fields.value(QLatin1String("room")).toString())) {
+            if (type == Subscribe) {
+                room->nodeMask.fetchAndOrOrdered(nodeBit(link->peer));
+            } else {
+                room->nodeMask.fetchAndAndOrdered(~nodeBit(link->peer));
+            }
+        }
+        break;
+    case Publish:
+        handlePublish(link, fields);
+        break;
+    case Deliver:
+        handleDeliver(link, fields);
+        break;
+    default:
+        break;  // 새 버전의 메시지는 무시한다
+    }
+}
+
+void Federation::handleHello(Link *link, const QCborMap& fields) {
+    int peer = int(fields.value(QLatin1String("node")).toInteger(-1));
+    // 들어온 링크는 번호가 큰 노드가 건 것이어야 한다
+    bool expected = link->peer >= 0 ? link->peer == peer : peer > config.nodeId;
+    if (link->ready || !config.node(peer) || peer == config.nodeId || !expected) {
+        CHAT_LOG(Warning, Server) << "Rejected node link hello from node" << peer;
+        dropLink(link);
+        return;
+    }
+    // 다시 시작한 노드의 새 링크가 아직 끊김을 모르는 이전 링크를 대신한다
+    if (Link *previous = peers.at(peer)) {
+        dropLink(previous);
+    }
+
+    link->peer = peer;
+    link->ready = true;
+    peers[peer] = link;
+    linkMask.fetchAndOrOrdered(nodeBit(peer));
+
+    // 끊겨 있는 동안 생긴 방을 맞춘다
+    for (const QCborValue& item : fields.value(QLatin1String("rooms")).toArray()) {
+        QCborArray room = item.toArray();
+        reconcileRoom(peer, room.at(0).toString(), room.at(1).toString());
+    }
+    // 그 노드가 소유한 방 중 이 노드에 참가자가 있는 방을 구독한다
+    for (ChatRoom *room : directory->allRooms()) {
+        if (ownerOf(room->name) != peer) continue;
+        subscribed.remove(room);
+        syncSubscription(room);
+    }
+    // 끊겨 있는 동안 가입한 사용자는 양쪽이 서로 보내 맞춘다
+    sendUsers(peer);
+    CHAT_LOG(Info, Server) << "Linked to node" << peer;
+}
+
+void Federation::handlePublish(Link *link, const QCborMap& fields) {
+    ChatRoom *room = directory->findRoom(fields.value(QLatin1String("room")).toString());
+    qint64 tag = fields.value(QLatin1String("type")).toInteger();
+    if (!room || tag <= 0 || tag >= int(MessageType::Count)) return;
+    if (ownerOf(room->name) != config.nodeId) {
+        // 노드 목록이 서로 다르면 생긴다. 되돌려 보내면 링크 사이를 맴돌므로 여기서 순서를 정한다.
+        CHAT_LOG(Warning, Server) << "Node" << link->peer << "published to" << room->name
+                                  << "which this node does not own";
+    }
+
+    MessageType type = MessageType(tag);
+    QCborMap message = fields.value(QLatin1String("fields")).toMap();
+    bool record = fields.value(QLatin1String("record")).toBool();
+    // 이 노드의 워커가 낸 메시지와 같은 워커가 맡아 번호를 붙인 순서대로 구독 노드에 보낸다
+    ChatWorker *worker = workers.at(int(room->id % quint32(workers.size())));
+    QMetaObject::invokeMethod(worker, [worker, room, type, message, record]() {
+        worker->publishAsOwner(room, type, message, record);
+    }, Qt::QueuedConnection);
+}
+
+void Federation::handleDeliver(Link *link, const QCborMap& fields) {
+    Q_UNUSED(link);
+    ChatRoom *room = directory->findRoom(fields.value(QLatin1String("room")).toString());
+    qint64 tag = fields.value(QLatin1String("type")).toInteger();
+    if (!room || tag <= 0 || tag >= int(MessageType::Count)) return;
+
+    MessageType type = MessageType(tag);
+    QCborMap message = fields.value(QLatin1String("fields")).toMap();
+    // 소유 노드가 붙인 번호 그대로 이 노드의 기록에도 남겨 입장할 때 이전 대화를 보낼 수 있게 한다
+    if (history && message.contains(QLatin1String("seq"))) {
+        HistoryRecord record;
+        record.seq = quint64(message.value(QLatin1String("seq")).toInteger());
+        record.timestamp = message.value(QLatin1String("time")).toInteger();
+        record.type = type;
+        record.fields = message;
+        history->append(room, record);
+    }
+    // 워커와 마찬가지로 workerMask를 읽기 전에 넣어 두어야 이어 받는 세션이 빠뜨리지 않는다
+    if (replayFrames > 0 && message.contains(QLatin1String("seq"))) {
+        ReplayEntry entry;
+        entry.seq = quint64(message.value(QLatin1String("seq")).toInteger());
+        entry.type = type;
+        entry.fields = message;
+        room->replay.append(entry, replayFrames);
+    }
+
+    // 로컬 참가자가 있는 워커에만 넘긴다 (워커끼리 방송할 때와 같은 경로)
+    RoomDelivery delivery;
+    delivery.room = room;
+    delivery.message = WireMessage(type, message);
+    quint64 mask = room->workerMask.loadAcquire();
+    for (int i = 0; mask != 0 && i < workers.size(); ++i, mask >>= 1) {
+        if (mask & 1) workers.at(i)->post(delivery);
+    }
+}
+
+QByteArray Federation::helloFrame() const {
+    QCborArray rooms;
+    for (ChatRoom *room : directory->allRooms()) {
+        QCborArray item;
+        item.append(room->name);
+        item.append(directory->roomPassword(room));
+        rooms.append(item);
+    }
+    QCborMap fields;
+    fields[QLatin1String("node")] = config.nodeId;
+    fields[QLatin1String("rooms")] = rooms;
+    return encode(Hello, fields);
+}
+
+void Federation::sendUsers(int peer) {
+    const QVector<User> users = directory->allUsers();
+    for (int start = 0; start < users.size(); start += kUsersPerFrame) {
+        QCborArray items;
+        for (int i = start; i < qMin(users.size(), start + kUsersPerFrame); ++i) {
+            QCborArray item;
+            item.append(users.at(i).username);
+            item.append(users.at(i).password);
+            items.append(item);
+        }
+        QCborMap fields;
+        fields[QLatin1String("users")] = items;
+        if (!send(peer, encode(Users, fields))) break;
+    }
+}
+
+void Federation::announceUser(const QString& username, const QString& password) {
+    QCborMap fields;
+    fields[QLatin1String("username")] = username;
+    fields[QLatin1String("password")] = password;
+    sendToAll(encode(UserRegistered, fields));
+}
+
+void Federation::reconcileUser(int peer, const QString& username, const QString& password) {
+    if (username.isEmpty() || password.isEmpty()) return;
+
+    QString local;
+    bool known = directory->findUser(username, &local);
+    if (known && local == password) return;
+
+    int owner = ownerOf(username);
+    if (known && owner != peer) {
+        // 양쪽에서 따로 가입했다. 소유 노드가 아니면 소유 노드가 알려 올 때까지 이 노드의 것을 둔다.
+        if (owner == config.nodeId) {
+            CHAT_LOG(Warning, Server) << "Node" << peer << "has a different password for user" << username
+                                      << "; keeping this node's as its owner";
+            announceUser(username, local);
+        }
+        return;
+    }
+    if (known) {
+        CHAT_LOG(Warning, Server) << "User" << username << "has a different password on its owner node" << peer
+                                  << "; taking the owner's";
+    }
+    if (directory->storeUser(username, password) != ChatDirectory::Ok) {
+        CHAT_LOG(Warning, Server) << "Failed to store user" << username << "from node" << peer;
+        return;
+    }
+    // 소유 노드가 처음 받은 것으로 정했으니 다른 것을 들고 있을 수 있는 노드에 알린다
+    if (owner == config.nodeId) {
+        announceUser(username, password);
+    }
+}
+
+void Federation::announceRoom(const QString& name, const QString& password) {
+    QCborMap fields;
+    fields[QLatin1String("room")] = name;
+    fields[QLatin1String("password")] = password;
+    sendToAll(encode(RoomCreated, fields));
+}
+
+void Federation::reconcileRoom(int peer, const QString& name, const QString& password) {
+    if (name.isEmpty()) return;
+
+    int owner = ownerOf(name);
+    ChatRoom *room = directory->findRoom(name);
+    if (!room) {
+        room = ensureRoom(name, password);
+        if (!room) return;
+        // 사용자와 같이 소유 노드는 처음 받은 것으로 정하고 다시 알린다
+        // (그 사이 이 노드에서 같은 방을 만들었으면 이 노드의 것이 남는다)
+        if (owner == config.nodeId) announceRoom(name, directory->roomPassword(room));
+    }
+
+    QString local = directory->roomPassword(room);
+    if (local == password) return;
+    if (owner == peer) {
+        // 이미 들어온 참가자는 그대로 두고 이후의 입장부터 소유 노드의 비밀번호로 확인한다
+        CHAT_LOG(Warning, Room) << "Room" << name << "has a different password on its owner node" << peer
+                                << "; taking the owner's";
+        if (directory->setRoomPassword(room, password) != ChatDirectory::Ok) {
+            CHAT_LOG(Warning, Room) << "Failed to store the password of room" << name << "from node" << peer;
+        }
+    } else if (owner == config.nodeId) {
+        CHAT_LOG(Warning, Room) << "Node" << peer << "has a different password for room" << name
+                                << "; keeping this node's as its owner";
+        announceRoom(name, local);
+    }
+    // 둘 다 소유 노드가 아니면 소유 노드가 알려 올 때까지 이 노드의 것을 둔다
+}
+
+QByteArray Federation::encode(NodeMessage type, const QCborMap& fields) const {
+    QCborArray message;
+    message.append(int(type));
+    message.append(fields);
+    return Protocol::encodeFrame(QCborValue(message).toCbor());
+}
+
+bool Federation::send(int peer, const QByteArray& frame) {
+    Link *link = peers.value(peer);
+    // 끊겼거나 상대가 너무 밀렸으면 버린다 (구독과 방 목록은 다시 이어질 때 맞춘다)
+    if (!link || link->socket->bytesToWrite() > config.maxLinkBacklog) {
+        droppedFrames.fetchAndAddRelaxed(1);
+        return false;
+    }
+    link->socket->write(frame);
+    framesSent.fetchAndAddRelaxed(1);
+    bytesSent.fetchAndAddRelaxed(quint64(frame.size()));
+    return true;
+}
+
+void Federation::sendToAll(const QByteArray& frame) {
+    for (Link *link : peers) {
+        if (link) send(link->peer, frame);
+    }
+}
+
+void Federation::syncSubscription(ChatRoom *room) {
+    int owner = ownerOf(room->name);
+    if (owner == config.nodeId) return;
+
+    // 참가와 퇴장 알림이 워커마다 따로 와서 순서가 뒤바뀔 수 있으므로 지금의 참가자 수를 보고 정한다
+    bool wanted = room->memberCount.loadAcquire() > 0;
+    if (wanted == subscribed.contains(room) || !peers.at(owner)) return;
+
+    QCborMap fields;
+    fields[QLatin1String("room")] = room->name;
+    if (!send(owner, encode(wanted ? Subscribe : Unsubscribe, fields))) return;
+    if (wanted) {
+        subscribed.insert(room);
+    } else {
+        subscribed.remove(room);
+        room->replay.clear();
+    }
+}
+
+ChatRoom* Federation::ensureRoom(const QString& name, const QString& password) {
+    if (name.isEmpty()) return nullptr;
+
+    ChatRoom *room = directory->createRoom(name, password);
+    if (!room) return directory->findRoom(name);
+
+    if (history) {
+        history->attach(room);
+    }
+    for (ChatWorker *worker : workers) {
+        worker->notifyRoomListChanged();
+    }
+    CHAT_LOG(Info, Room) << "Room created on another node:" << name;
+    return room;
+}
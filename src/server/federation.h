@@ -0,0 +1,185 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QCborMap>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QVector>
+#include "protocol.h"
+#include "mailbox.h"
+
+class ChatDirectory;
+class ChatRoom;
+class ChatWorker;
+class HistoryStore;
+
+// 노드 하나의 노드 간 링크 주소
+struct NodeAddress {
+    int id = -1;
+    QString host;
+    quint16 port = 0;
+};
+
+// 여러 서버 프로세스를 하나의 채팅 서비스로 묶는 설정
+struct FederationConfig {
+    static const int kMaxNodes = 64;   // ChatRoom::nodeMask 비트 수
+
+    int nodeId = -1;                   // 이 프로세스의 노드 번호 (-1이면 끈다)
+    QVector<NodeAddress> nodes;        // 자신을 포함한 모든 노드 (모든 노드가 같은 목록을 써야 한다)
+    int reconnectMs = 1000;            // 끊긴 링크를 다시 잇는 간격
+    qint64 maxLinkBacklog = 64 * 1024 * 1024;  // 링크 하나에 쌓아 두는 최대 송신 바이트
+
+    // "0=127.0.0.1:13000,1=127.0.0.1:13001,..." 형식
+    bool parse(const QString& spec, QString *error);
+    bool isEnabled() const { return nodeId >= 0 && nodes.size() > 1; }
+    const NodeAddress* node(int id) const;
+};
+
+// 노드 간 링크 계측 값 (임의 스레드에서 읽는다)
+struct FederationTotals {
+    quint64 framesSent = 0;
+    quint64 framesReceived = 0;
+    quint64 bytesSent = 0;
+    quint64 bytesReceived = 0;
+    quint64 droppedFrames = 0;   // 링크가 끊겼거나 밀려서 보내지 못한 프레임
+    quint64 linksUp = 0;         // Hello를 주고받은 링크 비트
+};
+
+// 워커가 페더레이션 스레드에 넘기는 일
+struct FederationCommand {
+    enum Kind {
+        RoomCreated,        // 방을 다른 노드에 알린다
+        UserRegistered,     // 가입을 다른 노드에 알린다
+        MembershipChanged,  // 이 노드의 방 참가자 유무가 바뀌었을 수 있다
+        Publish,            // 방 소유 노드에 메시지를 넘긴다
+        Forward             // 소유 노드가 순서를 정한 메시지를 구독 노드에 보낸다
+    };
+
+    Kind kind = Publish;
+    ChatRoom *room = nullptr;
+    MessageType type = MessageType::Unknown;
+    QCborMap fields;
+    bool record = false;   // Publish: 소유 노드가 번호를 붙여 기록한다
+    QString name;          // RoomCreated/UserRegistered
+    QString password;
+};
+
+// 노드 간 링크 (룸 페더레이션)
+// 방은 이름으로 같은 방이 되고, 방마다 이름의 해시로 정해지는 소유 노드가 하나 있다.
+// 소유 노드만 메시지 번호를 붙이고 기록하므로 방의 순서는 노드와 관계없이 하나다.
+// 다른 노드는 로컬 참가자가 생기면 소유 노드에 구독을 걸고, 방의 메시지를 소유 노드로 보낸다.
+// 소유 노드는 순서를 정한 메시지를 구독한 노드마다 링크로 한 번만 보내고,
+// 받은 노드는 자기 워커들에 나눠 전한다. 그래서 메시지는 노드 간 링크마다 한 번만 건넌다.
+// 방 생성과 가입은 모든 노드에 알리고, 링크가 이어질 때마다 방과 사용자 목록을 맞춘다.
+// 방과 사용자의 비밀번호가 노드마다 다르면 그 이름의 소유 노드 것을 따른다.
+// 링크는 노드 쌍마다 하나이며 번호가 큰 노드가 작은 노드에 접속한다.
+class Federation : public QTcpServer {
+    Q_OBJECT
+
+public:
+    Federation(const FederationConfig& config, ChatDirectory *directory, HistoryStore *history,
+               QObject *parent = nullptr);
+    ~Federation();
+
+    // 시작 전에 한 번 설정한다
+    void setWorkers(const QVector<ChatWorker*>& chatWorkers) { workers = chatWorkers; }
+    // 받은 방 메시지를 세션 이어 받기용으로 방마다 몇 개 보관할지 (0이면 보관하지 않는다)
+    void setReplayFrames(int frames) { replayFrames = frames; }
+    // 페더레이션 스레드에서 호출된다
+    bool start();
+
+    int nodeId() const { return config.nodeId; }
+    // 방의 순서와 사용자 비밀번호를 정하는 노드 (이름만으로 정해지므로 모든 노드가 같은 답을 낸다)
+    int ownerOf(const QString& name) const;
+    bool owns(const ChatRoom* room) const;
+    // 노드와 링크가 이어져 있는지 (임의 스레드)
+    bool isReachable(int node) const { return (linkMask.loadAcquire() >> node) & 1; }
+    FederationTotals totals() const;
+
+    // 워커 스레드에서 호출할 수 있다
+    void roomCreated(ChatRoom *room);
+    void userRegistered(const QString& username, const QString& password);
+    void membershipChanged(ChatRoom *room);
+    void publish(ChatRoom *room, MessageType type, const QCborMap& fields, bool record);
+    void forward(ChatRoom *room, MessageType type, const QCborMap& fields);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    // 노드 간 링크 메시지 ([태그, 필드 맵] CBOR 배열을 길이 접두 프레임에 담는다)
+    enum NodeMessage {
+        Hello = 1,       // {node, rooms: [[이름, 비밀번호], ...]}
+        RoomCreated,     // {room, password}
+        UserRegistered,  // {username, password}
+        Subscribe,       // {room}
+        Unsubscribe,     // {room}
+        Publish,         // {room, type, fields, record}
+        Deliver,         // {room, type, fields}
+        Users            // {users: [[이름, 비밀번호], ...]} (Hello 뒤에 나눠 보낸다)
+    };
+
+    // 방 목록을 통째로 담는 Hello가 있으므로 클라이언트 프레임보다 크게 받는다
+    static const int kMaxFrameSize = 64 * 1024 * 1024;
+    static const int kUsersPerFrame = 1024;
+
+    struct Link {
+        Link() : decoder(FrameDecoder::Framed, kMaxFrameSize) {}
+
+        int peer = -1;           // 들어온 링크는 Hello를 받기 전까지 모른다
+        bool ready = false;      // Hello를 받았다
+        QTcpSocket *socket = nullptr;
+        FrameDecoder decoder;
+    };
+
+    void post(const FederationCommand& command);
+    void drainCommands();
+    void handleCommand(FederationCommand& command);
+
+    void connectTo(int peer);
+    Link* openLink(QTcpSocket *socket, int peer);
+    void readLink(Link *link);
+    void dropLink(Link *link);
+    void handleFrame(Link *link, const QByteArray& payload);
+    void handleHello(Link *link, const QCborMap& fields);
+    void handlePublish(Link *link, const QCborMap& fields);
+    void handleDeliver(Link *link, const QCborMap& fields);
+
+    QByteArray helloFrame() const;
+    // 링크가 이어지면 이 노드의 사용자 목록을 그 노드에 보낸다
+    void sendUsers(int peer);
+    void announceUser(const QString& username, const QString& password);
+    // 다른 노드가 알려 온 사용자를 반영한다 (다르면 사용자 이름의 소유 노드 것을 따른다)
+    void reconcileUser(int peer, const QString& username, const QString& password);
+    void announceRoom(const QString& name, const QString& password);
+    // 다른 노드가 알려 온 방을 반영한다 (비밀번호가 다르면 방 소유 노드 것을 따른다)
+    void reconcileRoom(int peer, const QString& name, const QString& password);
+    QByteArray encode(NodeMessage type, const QCborMap& fields) const;
+    bool send(int peer, const QByteArray& frame);
+    void sendToAll(const QByteArray& frame);
+    // 소유 노드와의 구독 상태를 로컬 참가자 유무에 맞춘다
+    void syncSubscription(ChatRoom *room);
+    ChatRoom* ensureRoom(const QString& name, const QString& password);
+
+    const FederationConfig& config;
+    ChatDirectory *directory;
+    HistoryStore *history;                     // 기록을 끄면 nullptr
+    QVector<ChatWorker*> workers;
+    int replayFrames = 0;
+    Mailbox<FederationCommand> commands;
+
+    QList<Link*> links;                        // 모든 링크 (Hello 전 포함)
+    QVector<Link*> peers;                      // 노드 번호 → 준비된 링크
+    QSet<ChatRoom*> subscribed;                // 소유 노드에 구독을 걸어 둔 방
+
+    QAtomicInteger<quint64> linkMask;
+    QAtomicInteger<quint64> framesSent;
+    QAtomicInteger<quint64> framesReceived;
+    QAtomicInteger<quint64> bytesSent;
+    QAtomicInteger<quint64> bytesReceived;
+    QAtomicInteger<quint64> droppedFrames;
+};
@@ -0,0 +1,407 @@
+#include "filestore.h"
+#include "chatdirectory.h"
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <algorithm>
+#include <unistd.h>
+#include "logger.h"
+#include "protocol.h"
+
+const int FileStore::kMaxCatalogChanges;
+
+namespace {
+    const char kCatalogFile[] = ".catalog";
+    const char kChunkDirectory[] = ".chunks";
+    const qint64 kStagingMaxAgeMs = 24LL * 60 * 60 * 1000;  // 합쳐지지 않은 조각을 두는 기간
+
+    bool entryLessThan(const FileEntry& a, const FileEntry& b) {
+        return a.name < b.name;
+    }
+}
+
+FileStore::FileStore(const FileConfig& config)
+    : settings(config), epoch(QDateTime::currentMSecsSinceEpoch()) {}
+
+FileStore::~FileStore() {
+    qDeleteAll(catalogs);
+}
+
+bool FileStore::open() {
+    QDir root(settings.directory);
+    if (!root.mkpath(kChunkDirectory)) {
+        CHAT_LOG(Warning, Server) << "Cannot create file store directory" << settings.directory;
+        return false;
+    }
+    loadChunkIndex();
+    sweepStaging();
+    return true;
+}
+
+QCborMap FileStore::toCbor(const FileEntry& entry, bool withChunks) {
+    QCborMap map;
+    map[QLatin1String("filename")] = entry.name;
+    map[QLatin1String("size")] = entry.size;
+    map[QLatin1String("hash")] = QString::fromLatin1(entry.hash);
+    map[QLatin1String("uploader")] = entry.uploader;
+    map[QLatin1String("time")] = entry.time;
+    if (withChunks && !entry.chunks.isEmpty()) {
+        QCborArray chunks;
+        for (const QByteArray& chunk : entry.chunks) {
+            chunks.append(QString::fromLatin1(chunk));
+        }
+        map[QLatin1String("chunks")] = chunks;
+    }
+    return map;
+}
+
+FileEntry FileStore::fromCbor(const QCborMap& map) {
+    FileEntry entry;
+    entry.name = map.value(QLatin1String("filename")).toString();
+    entry.size = map.value(QLatin1String("size")).toInteger();
+    entry.hash = map.value(QLatin1String("hash")).toString().toLatin1();
+    entry.uploader = map.value(QLatin1String("uploader")).toString();
+    entry.time = map.value(QLatin1String("time")).toInteger();
+    for (const QCborValue& chunk : map.value(QLatin1String("chunks")).toArray()) {
+        entry.chunks.append(chunk.toString().toLatin1());
+    }
+    return entry;
+}
+
+bool FileStore::isValidName(const QString& filename) {
+    if (filename.isEmpty() || filename.size() > 255) return false;
+    if (filename.startsWith(QLatin1Char('.'))) return false;
+    if (filename.endsWith(QLatin1String(".part"))) return false;
+    for (QChar c : filename) {
+        if (c == QLatin1Char('/') || c == QLatin1Char('\\') || c.unicode() < 0x20) return false;
+    }
+    return true;
+}
+
+QString FileStore::roomDirectory(const ChatRoom *room) const {
+    // 방 이름에 어떤 문자가 와도 안전하도록 기록 저장소와 같이 hex로 쓴다
+    return QDir(settings.directory).filePath(QString::fromLatin1(room->name.toUtf8().toHex()));
+}
+
+QString FileStore::filePath(const ChatRoom *room, const QString& filename) const {
+    return QDir(roomDirectory(room)).filePath(filename);
+}
+
+QString FileStore::partialPath(const ChatRoom *room, const QString& filename) const {
+    return filePath(room, filename) + QLatin1String(".part");
+}
+
+QByteArray FileStore::issue(FileTicket ticket) {
+    quint32 random[4];
+    QRandomGenerator::system()->fillRange(random);
+    QByteArray id = QByteArray(reinterpret_cast<const char*>(random), sizeof(random)).toHex();
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    ticket.expiresAt = now + qint64(settings.ticketTtlSecs) * 1000;
+
+    QMutexLocker locker(&ticketMutex);
+    expireTickets(now);
+    tickets.insert(id, ticket);
+    return id;
+}
+
+bool FileStore::lookup(const QByteArray& ticket, FileTicket& out) {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&ticketMutex);
+    QHash<QByteArray, FileTicket>::const_iterator it = tickets.constFind(ticket);
+    if (it == tickets.constEnd() || it->expiresAt < now) return false;
+    out = *it;
+    return true;
+}
+
+void FileStore::expireTickets(qint64 now) {
+    // 발급할 때 가끔씩만 훑는다
+    if (now < nextExpiry) return;
+    nextExpiry = now + 10000;
+    for (QHash<QByteArray, FileTicket>::iterator it = tickets.begin(); it != tickets.end();) {
+        if (it->expiresAt < now) it = tickets.erase(it);
+        else ++it;
+    }
+}
+
+FileStore::RoomCatalog* FileStore::roomCatalog(const ChatRoom *room) {
+    RoomCatalog *catalog = catalogs.value(room);
+    if (catalog) return catalog;
+
+    catalog = new RoomCatalog;
+    catalogs.insert(room, catalog);
+
+    QFile file(QDir(roomDirectory(room)).filePath(kCatalogFile));
+    if (!file.open(QIODevice::ReadOnly)) return catalog;
+    for (const QCborValue& value : QCborValue::fromCbor(file.readAll()).toArray()) {
+        FileEntry entry = fromCbor(value.toMap());
+        // 목록에 있어도 파일이 지워졌으면 뺀다
+        if (isValidName(entry.name) && QFileInfo(filePath(room, entry.name)).isFile()) {
+            catalog->files.insert(entry.name, entry);
+        }
+    }
+    return catalog;
+}
+
+void FileStore::recordChange(RoomCatalog *catalog, const ChatRoom *room, bool added, const FileEntry& entry) {
+    FileCatalogChange change;
+    change.version = ++catalog->version;
+    change.added = added;
+    change.entry = entry;
+    if (catalog->changes.size() >= kMaxCatalogChanges) {
+        catalog->changes.remove(0, catalog->changes.size() / 2);
+    }
+    catalog->changes.append(change);
+    saveCatalog(room, catalog);
+}
+
+void FileStore::saveCatalog(const ChatRoom *room, const RoomCatalog *catalog) {
+    // 목록은 작아서 바뀔 때마다 통째로 다시 쓴다 (QSaveFile이 이름 바꾸기로 원자적으로 교체)
+    QCborArray entries;
+    for (const FileEntry& entry : catalog->files) {
+        entries.append(toCbor(entry, true));
+    }
+    QSaveFile file(QDir(roomDirectory(room)).filePath(kCatalogFile));
+    if (!file.open(QIODevice::WriteOnly) || file.write(QCborValue(entries).toCbor()) < 0 || !file.commit()) {
+        CHAT_LOG(Warning, Server) << "Cannot save file catalog for room" << room->name << file.errorString();
+    }
+}
+
+quint64 FileStore::addFile(const ChatRoom *room, const FileEntry& entry) {
+    QMutexLocker locker(&catalogMutex);
+    RoomCatalog *catalog = roomCatalog(room);
+    QString path = filePath(room, entry.name);
+    QHash<QString, FileEntry>::const_iterator previous = catalog->files.constFind(entry.name);
+    if (previous != catalog->files.constEnd()) unindexChunks(path, *previous);
+    catalog->files.insert(entry.name, entry);
+    indexChunks(path, entry);
+    recordChange(catalog, room, true, entry);
+    return catalog->version;
+}
+
+bool FileStore::removeFile(const ChatRoom *room, const QString& name, quint64 *version) {
+    QMutexLocker locker(&catalogMutex);
+    RoomCatalog *catalog = roomCatalog(room);
+    QHash<QString, FileEntry>::iterator it = catalog->files.find(name);
+    if (it == catalog->files.end()) return false;
+
+    FileEntry entry = *it;
+    catalog->files.erase(it);
+    unindexChunks(filePath(room, name), entry);
+    QFile::remove(filePath(room, name));
+    recordChange(catalog, room, false, entry);
+    if (version) *version = catalog->version;
+    return true;
+}
+
+bool FileStore::findFile(const ChatRoom *room, const QString& name, FileEntry& out) {
+    QMutexLocker locker(&catalogMutex);
+    RoomCatalog *catalog = roomCatalog(room);
+    QHash<QString, FileEntry>::const_iterator it = catalog->files.constFind(name);
+    if (it == catalog->files.constEnd()) return false;
+    out = *it;
+    return true;
+}
+
+QVector<FileEntry> FileStore::catalog(const ChatRoom *room, quint64& version) {
+    QMutexLocker locker(&catalogMutex);
+    RoomCatalog *catalog = roomCatalog(room);
+    QVector<FileEntry> entries;
+    entries.reserve(catalog->files.size());
+    for (const FileEntry& entry : catalog->files) {
+        entries.append(entry);
+    }
+    version = catalog->version;
+    locker.unlock();
+
+    std::sort(entries.begin(), entries.end(), entryLessThan);
+    return entries;
+}
+
+quint64 FileStore::catalogVersion(const ChatRoom *room) {
+    QMutexLocker locker(&catalogMutex);
+    return roomCatalog(room)->version;
+}
+
+bool FileStore::catalogChangesSince(const ChatRoom *room, quint64 version, QVector<FileCatalogChange>& changes) {
+    QMutexLocker locker(&catalogMutex);
+    RoomCatalog *catalog = roomCatalog(room);
+    if (version > catalog->version) return false;
+    if (version == catalog->version) return true;
+    if (catalog->changes.isEmpty() || catalog->changes.first().version > version + 1) return false;
+
+    // 버전은 1씩 오르므로 위치를 바로 계산한다
+    int start = int(version + 1 - catalog->changes.first().version);
+    for (int i = start; i < catalog->changes.size(); ++i) {
+        changes.append(catalog->changes.at(i));
+    }
+    return true;
+}
+
+bool FileStore::isValidHash(const QByteArray& hash) {
+    if (hash.size() != 64) return false;
+    for (char c : hash) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+    }
+    return true;
+}
+
+int FileStore::chunkCount(qint64 size) {
+    return int((size + Protocol::kFileChunkBytes - 1) / Protocol::kFileChunkBytes);
+}
+
+qint64 FileStore::chunkLength(qint64 size, int index) {
+    return qMin(Protocol::kFileChunkBytes, size - qint64(index) * Protocol::kFileChunkBytes);
+}
+
+QString FileStore::chunkPath(const QByteArray& hash) const {
+    return QDir(settings.directory).filePath(QString::fromLatin1(kChunkDirectory) + '/' + QString::fromLatin1(hash));
+}
+
+QString FileStore::stagingPath(const QByteArray& hash, const QByteArray& ticket) const {
+    // 같은 조각을 여러 업로드가 동시에 받아도 서로 덮어쓰지 않는다
+    return chunkPath(hash) + '.' + QString::fromLatin1(ticket);
+}
+
+bool FileStore::hasChunk(const QByteArray& hash) {
+    QMutexLocker locker(&chunkMutex);
+    return chunkIndex.contains(hash) || QFileInfo::exists(chunkPath(hash));
+}
+
+QVector<int> FileStore::missingChunks(const QVector<QByteArray>& chunks) {
+    QVector<int> missing;
+    QMutexLocker locker(&chunkMutex);
+    for (int i = 0; i < chunks.size(); ++i) {
+        if (!chunkIndex.contains(chunks.at(i)) && !QFileInfo::exists(chunkPath(chunks.at(i)))) {
+            missing.append(i);
+        }
+    }
+    return missing;
+}
+
+bool FileStore::chunkSource(const QByteArray& hash, QString& path, qint64& offset) {
+    QMutexLocker locker(&chunkMutex);
+    QHash<QByteArray, ChunkLocation>::const_iterator it = chunkIndex.constFind(hash);
+    if (it != chunkIndex.constEnd()) {
+        path = it->path;
+        offset = it->offset;
+        return true;
+    }
+    path = chunkPath(hash);
+    offset = 0;
+    return QFileInfo::exists(path);
+}
+
+void FileStore::indexChunks(const QString& path, const FileEntry& entry) {
+    // 완성된 파일 안에 든 조각은 따로 둘 필요가 없다
+    QMutexLocker locker(&chunkMutex);
+    for (int i = 0; i < entry.chunks.size(); ++i) {
+        ChunkLocation location;
+        location.path = path;
+        location.offset = qint64(i) * Protocol::kFileChunkBytes;
+        chunkIndex.insert(entry.chunks.at(i), location);
+        QFile::remove(chunkPath(entry.chunks.at(i)));
+    }
+}
+
+void FileStore::unindexChunks(const QString& path, const FileEntry& entry) {
+    // 다른 파일에도 같은 조각이 있을 수 있지만 그 위치는 모른다. 다음 업로드가 다시 보낼 뿐이다.
+    QMutexLocker locker(&chunkMutex);
+    for (const QByteArray& chunk : entry.chunks) {
+        QHash<QByteArray, ChunkLocation>::iterator it = chunkIndex.find(chunk);
+        if (it != chunkIndex.end() && it->path == path) chunkIndex.erase(it);
+    }
+}
+
+void FileStore::loadChunkIndex() {
+    // 방 목록은 처음 쓸 때 읽지만 조각 색인은 모든 방에 걸치므로 시작할 때 한 번 모은다
+    QDir root(settings.directory);
+    for (const QString& roomDir : root.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QDir dir(root.filePath(roomDir));
+        QFile file(dir.filePath(kCatalogFile));
+        if (!file.open(QIODevice::ReadOnly)) continue;
+        for (const QCborValue& value : QCborValue::fromCbor(file.readAll()).toArray()) {
+            FileEntry entry = fromCbor(value.toMap());
+            QString path = dir.filePath(entry.name);
+            if (entry.chunks.isEmpty() || !QFileInfo(path).isFile()) continue;
+            for (int i = 0; i < entry.chunks.size(); ++i) {
+                ChunkLocation location;
+                location.path = path;
+                location.offset = qint64(i) * Protocol::kFileChunkBytes;
+                chunkIndex.insert(entry.chunks.at(i), location);
+            }
+        }
+    }
+}
+
+void FileStore::sweepStaging() {
+    // 끝내 합쳐지지 않은 업로드의 조각과 받다 만 조각을 지운다
+    QDir dir(QDir(settings.directory).filePath(kChunkDirectory));
+    qint64 cutoff = QDateTime::currentMSecsSinceEpoch() - kStagingMaxAgeMs;
+    for (const QFileInfo& info : dir.entryInfoList(QDir::Files)) {
+        bool partial = info.fileName().contains(QLatin1Char('.'));
+        if (partial || info.lastModified().toMSecsSinceEpoch() < cutoff) {
+            QFile::remove(info.filePath());
+        }
+    }
+}
+
+bool FileStore::assemble(const FileTicket& ticket, QByteArray& error) {
+    QDir().mkpath(roomDirectory(ticket.room));
+    QString partial = partialPath(ticket.room, ticket.filename);
+    QFile out(partial);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        error = "cannot store file";
+        return false;
+    }
+
+    // 조각을 차례로 복사하면서 전체 해시를 다시 계산한다
+    QCryptographicHash hasher(QCryptographicHash::Sha256);
+    QByteArray buffer;
+    for (int i = 0; i < ticket.chunks.size(); ++i) {
+        QString path;
+        qint64 offset = 0;
+        QFile source;
+        if (chunkSource(ticket.chunks.at(i), path, offset)) source.setFileName(path);
+        if (source.fileName().isEmpty() || !source.open(QIODevice::ReadOnly) || !source.seek(offset)) {
+            error = "missing chunks";
+            out.remove();
+            return false;
+        }
+        qint64 remaining = chunkLength(ticket.size, i);
+        while (remaining > 0) {
+            buffer = source.read(qMin<qint64>(remaining, 1024 * 1024));
+            if (buffer.isEmpty() || out.write(buffer) != buffer.size()) {
+                error = "cannot store file";
+                out.remove();
+                return false;
+            }
+            hasher.addData(buffer);
+            remaining -= buffer.size();
+        }
+    }
+
+    if (hasher.result().toHex() != ticket.hash) {
+        error = "hash mismatch";
+        out.remove();
+        return false;
+    }
+    out.flush();
+    ::fdatasync(out.handle());
+    out.close();
+
+    QString path = filePath(ticket.room, ticket.filename);
+    if (::rename(QFile::encodeName(partial).constData(), QFile::encodeName(path).constData()) != 0) {
+        error = "cannot store file";
+        out.remove();
+        return false;
+    }
+    return true;
+}
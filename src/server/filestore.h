@@ -0,0 +1,154 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCborMap>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+class ChatRoom;
+
+struct FileConfig {
+    QString directory;                           // 비어 있으면 파일 채널을 끈다
+    quint16 port = 12346;                        // 전송 채널 포트
+    qint64 maxFileBytes = 1024LL * 1024 * 1024;  // 업로드 최대 크기
+    int ticketTtlSecs = 300;                     // 티켓 유효 시간
+    int chunkBytes = 256 * 1024;                 // 연결 하나가 한 번에 보내거나 받는 최대 바이트
+};
+
+// 채팅 연결에서 발급해 전송 채널에서 확인하는 일회성 권한
+struct FileTicket {
+    enum Direction {
+        Upload,
+        Download
+    };
+
+    Direction direction = Download;
+    ChatRoom *room = nullptr;
+    QString filename;
+    QString uploader;     // 업로드한(할) 사용자
+    qint64 size = 0;      // 업로드는 선언한 크기, 다운로드는 발급 시점의 파일 크기
+    qint64 expiresAt = 0; // ms since epoch
+    // 조각 업로드: 파일 전체와 조각별 SHA-256 hex (비어 있으면 한 번에 받는 업로드)
+    QByteArray hash;
+    QVector<QByteArray> chunks;
+
+    bool isChunked() const { return !hash.isEmpty(); }
+};
+
+// 방 파일 목록의 항목
+struct FileEntry {
+    QString name;
+    qint64 size = 0;
+    QByteArray hash;      // SHA-256 hex
+    QString uploader;
+    qint64 time = 0;      // 올라온 시각 (ms since epoch)
+    QVector<QByteArray> chunks;  // 조각별 SHA-256 hex (조각으로 올라온 파일만, 클라이언트에는 보내지 않는다)
+};
+
+// 파일 목록 변경 하나 (version은 이 변경을 적용한 뒤의 방 목록 버전)
+struct FileCatalogChange {
+    quint64 version = 0;
+    bool added = true;    // false면 entry.name만 의미가 있다
+    FileEntry entry;
+};
+
+// 방별 파일 저장소
+// <directory>/<방 이름 hex>/<파일 이름>에 저장하고 받는 중인 파일은 .part로 둔다.
+// 방마다 파일 목록(카탈로그)을 들고 있으며 <방 디렉터리>/.catalog에 함께 저장한다.
+// 목록은 바뀔 때마다 버전이 1씩 오르고 최근 변경을 남겨 두어 클라이언트에 변경분만 보낸다.
+// 조각으로 올라온 파일은 조각 해시의 위치를 색인해 두어, 같은 내용의 조각은 어느 방에 있든
+// 다시 받지 않는다. 받았지만 아직 파일로 합치지 않은 조각은 <directory>/.chunks/<해시>에 둔다.
+// 티켓 표와 목록, 조각 색인은 잠금으로 보호하며 워커와 전송 스레드가 함께 쓴다.
+class FileStore {
+public:
+    explicit FileStore(const FileConfig& config);
+    ~FileStore();
+
+    bool open();
+    const FileConfig& config() const { return settings; }
+
+    // 경로 구분자나 숨김 파일 이름 등은 받지 않는다
+    static bool isValidName(const QString& filename);
+    // 카탈로그 파일과 클라이언트 메시지에 쓰는 항목 형식
+    static QCborMap toCbor(const FileEntry& entry, bool withChunks = false);
+    static FileEntry fromCbor(const QCborMap& map);
+
+    QString roomDirectory(const ChatRoom *room) const;
+    QString filePath(const ChatRoom *room, const QString& filename) const;
+    QString partialPath(const ChatRoom *room, const QString& filename) const;
+
+    // 티켓 문자열을 돌려준다
+    QByteArray issue(FileTicket ticket);
+    // 유효한 티켓이면 내용을 담아 true (유효 시간 동안 재사용할 수 있다: 이어받기, 구간 다운로드)
+    bool lookup(const QByteArray& ticket, FileTicket& out);
+
+    // 파일 목록. epoch는 서버 실행마다 달라서 재시작 전의 버전과 구별된다.
+    qint64 catalogEpoch() const { return epoch; }
+    // 다 받은 파일을 목록에 넣는다 (같은 이름은 바꾼다). 새 버전을 돌려준다.
+    quint64 addFile(const ChatRoom *room, const FileEntry& entry);
+    // 파일과 목록 항목을 지운다. 없으면 false.
+    bool removeFile(const ChatRoom *room, const QString& name, quint64 *version = nullptr);
+    bool findFile(const ChatRoom *room, const QString& name, FileEntry& out);
+    // 이름순 목록과 그 버전을 함께 읽는다
+    QVector<FileEntry> catalog(const ChatRoom *room, quint64& version);
+    quint64 catalogVersion(const ChatRoom *room);
+    // version 이후의 변경을 순서대로 담는다. 너무 오래되어 남아 있지 않으면 false.
+    bool catalogChangesSince(const ChatRoom *room, quint64 version, QVector<FileCatalogChange>& changes);
+
+    // 조각 업로드
+    static bool isValidHash(const QByteArray& hash);
+    // 파일 크기에 맞는 조각 수와 index번째 조각의 길이
+    static int chunkCount(qint64 size);
+    static qint64 chunkLength(qint64 size, int index);
+    // 서버에 아직 없는 조각 번호
+    QVector<int> missingChunks(const QVector<QByteArray>& chunks);
+    bool hasChunk(const QByteArray& hash);
+    // 받는 중인 조각과 다 받은 조각의 경로
+    QString stagingPath(const QByteArray& hash, const QByteArray& ticket) const;
+    QString chunkPath(const QByteArray& hash) const;
+    // 조각들을 이어 붙여 .part를 만들고 전체 해시를 확인한 뒤 원래 이름으로 바꾼다.
+    // 큰 파일을 복사하므로 전송 스레드가 아닌 다른 스레드에서 호출한다.
+    bool assemble(const FileTicket& ticket, QByteArray& error);
+
+private:
+    struct RoomCatalog {
+        QHash<QString, FileEntry> files;
+        quint64 version = 1;                 // 0은 "목록 없음"으로 쓴다
+        QVector<FileCatalogChange> changes;  // 최근 변경
+    };
+
+    static const int kMaxCatalogChanges = 256;
+
+    // 조각이 들어 있는 완성된 파일의 위치
+    struct ChunkLocation {
+        QString path;
+        qint64 offset = 0;
+    };
+
+    void expireTickets(qint64 now);
+    // catalogMutex를 잡은 채로 호출한다. 처음 찾을 때 디스크에서 읽는다.
+    RoomCatalog* roomCatalog(const ChatRoom *room);
+    void recordChange(RoomCatalog *catalog, const ChatRoom *room, bool added, const FileEntry& entry);
+    void saveCatalog(const ChatRoom *room, const RoomCatalog *catalog);
+    void indexChunks(const QString& path, const FileEntry& entry);
+    void unindexChunks(const QString& path, const FileEntry& entry);
+    void loadChunkIndex();
+    void sweepStaging();
+    bool chunkSource(const QByteArray& hash, QString& path, qint64& offset);
+
+    FileConfig settings;
+    QMutex ticketMutex;
+    QHash<QByteArray, FileTicket> tickets;
+    qint64 nextExpiry = 0;  // 만료 정리를 할 시각
+
+    const qint64 epoch;
+    QMutex catalogMutex;
+    QHash<const ChatRoom*, RoomCatalog*> catalogs;
+
+    QMutex chunkMutex;
+    QHash<QByteArray, ChunkLocation> chunkIndex;  // 조각 해시 → 완성된 파일 안의 위치
+
+    Q_DISABLE_COPY(FileStore)
+};
@@ -0,0 +1,436 @@
+#include "filetransfer.h"
+#include "chatdirectory.h"
+#include "logger.h"
+#include "protocol.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QtConcurrent>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#endif
+
+const int FileTransferServer::kIdleTimeoutMs;
+
+FileTransferServer::FileTransferServer(FileStore *store, QObject *parent)
+    : QTcpServer(parent), store(store) {}
+
+FileTransferServer::~FileTransferServer() {
+    // 합치는 중인 파일이 저장소를 쓰고 있을 수 있다
+    assemblers.waitForDone();
+    for (Transfer *transfer : transfers) {
+        delete transfer->readNotifier;
+        delete transfer->writeNotifier;
+        if (transfer->file >= 0) ::close(transfer->file);
+        ::close(transfer->socket);
+        delete transfer;
+    }
+}
+
+bool FileTransferServer::start(const QHostAddress& address, quint16 port) {
+    if (!listen(address, port)) return false;
+
+    idleTimer = new QTimer(this);
+    connect(idleTimer, &QTimer::timeout, this, &FileTransferServer::sweepIdle);
+    idleTimer->start(kIdleTimeoutMs / 4);
+    return true;
+}
+
+void FileTransferServer::incomingConnection(qintptr socketDescriptor) {
+    // QTcpSocket 버퍼를 거치지 않고 sendfile을 쓰려고 디스크립터를 직접 다룬다
+    int fd = int(socketDescriptor);
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    Transfer *transfer = new Transfer;
+    transfer->socket = fd;
+    transfer->lastActivity = QDateTime::currentMSecsSinceEpoch();
+    transfer->readNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    transfer->writeNotifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+    transfer->writeNotifier->setEnabled(false);
+    connect(transfer->readNotifier, &QSocketNotifier::activated, this, [this, transfer]() { onReadable(transfer); });
+    connect(transfer->writeNotifier, &QSocketNotifier::activated, this, [this, transfer]() { onWritable(transfer); });
+    transfers.insert(transfer);
+}
+
+void FileTransferServer::onReadable(Transfer *transfer) {
+    transfer->lastActivity = QDateTime::currentMSecsSinceEpoch();
+    if (transfer->state == Transfer::Receiving) {
+        receiveChunk(transfer);
+        return;
+    }
+
+    char buffer[Protocol::kFileChannelMaxLine];
+    ssize_t received = ::recv(transfer->socket, buffer, sizeof(buffer), MSG_PEEK);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EINTR)) {
+        close(transfer);
+        return;
+    }
+    if (received < 0) return;
+    if (transfer->state != Transfer::ReadingRequest) {
+        // 요청 뒤에 오는 바이트는 받을 이유가 없다
+        if (::recv(transfer->socket, buffer, sizeof(buffer), 0) <= 0) close(transfer);
+        return;
+    }
+
+    // 요청 줄까지만 소비하고 뒤따르는 업로드 본문은 소켓에 남겨 둔다
+    int newline = QByteArray::fromRawData(buffer, int(received)).indexOf('\n');
+    int take = newline >= 0 ? newline + 1 : int(received);
+    ::recv(transfer->socket, buffer, size_t(take), 0);
+    transfer->request.append(buffer, take);
+
+    if (newline < 0) {
+        if (transfer->request.size() >= Protocol::kFileChannelMaxLine) fail(transfer, "request too long");
+        return;
+    }
+    QByteArray line = transfer->request.trimmed();
+    transfer->request.clear();
+    handleRequest(transfer, line);
+}
+
+void FileTransferServer::handleRequest(Transfer *transfer, const QByteArray& line) {
+    // QTCF <ticket> <offset> <length> 또는 QTCF <ticket> COMMIT
+    QList<QByteArray> parts = line.split(' ');
+    bool commit = parts.size() == 3 && parts.at(2) == Protocol::kFileChannelCommit;
+    if ((parts.size() != 4 && !commit) || parts.at(0) != Protocol::kFileChannelMagic) {
+        fail(transfer, "bad request");
+        return;
+    }
+
+    FileTicket& ticket = transfer->ticket;
+    if (!store->lookup(parts.at(1), ticket)) {
+        fail(transfer, "invalid or expired ticket");
+        return;
+    }
+    if (commit && !(ticket.direction == FileTicket::Upload && ticket.isChunked())) {
+        fail(transfer, "bad request");
+        return;
+    }
+    if (commit) {
+        commitUpload(transfer);
+        return;
+    }
+    qint64 offset = qMax<qint64>(0, parts.at(2).toLongLong());
+    qint64 length = qMax<qint64>(0, parts.at(3).toLongLong());
+
+    if (ticket.direction == FileTicket::Download) {
+        QByteArray path = QFile::encodeName(store->filePath(ticket.room, ticket.filename));
+        transfer->file = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (transfer->file < 0 || ::fstat(transfer->file, &info) != 0) {
+            fail(transfer, "file not found");
+            return;
+        }
+        qint64 size = qint64(info.st_size);
+        transfer->position = qMin(offset, size);
+        transfer->end = length > 0 ? qMin(size, transfer->position + length) : size;
+        transfer->state = Transfer::Sending;
+        respond(transfer, "OK " + QByteArray::number(size));
+        return;
+    }
+
+    if (ticket.isChunked()) {
+        startChunk(transfer, parts.at(1), offset, length);
+        return;
+    }
+
+    // 업로드: 같은 티켓으로 다시 오면 받아 둔 부분 뒤부터 이어 받는다
+    QDir().mkpath(store->roomDirectory(ticket.room));
+    QByteArray path = QFile::encodeName(store->partialPath(ticket.room, ticket.filename));
+    transfer->file = ::open(path.constData(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    struct stat info;
+    if (transfer->file < 0 || ::fstat(transfer->file, &info) != 0) {
+        fail(transfer, "cannot store file");
+        return;
+    }
+    qint64 have = qint64(info.st_size);
+    if (have > ticket.size && ::ftruncate(transfer->file, 0) == 0) {
+        have = 0;
+    }
+    transfer->position = have;
+    transfer->end = ticket.size;
+    transfer->hashing = have == 0;
+    transfer->state = Transfer::Receiving;
+    respond(transfer, "OK " + QByteArray::number(have));
+    if (transfer->position == transfer->end) {
+        completeUpload(transfer);
+    }
+}
+
+void FileTransferServer::receiveChunk(Transfer *transfer) {
+    // 알림 한 번에 chunkBytes까지만 받아 다른 전송에 차례를 넘긴다
+    static const int kBufferSize = 64 * 1024;
+    char buffer[kBufferSize];
+    qint64 budget = store->config().chunkBytes;
+
+    while (budget > 0 && transfer->position < transfer->end) {
+        size_t want = size_t(qMin<qint64>(qMin<qint64>(budget, kBufferSize), transfer->end - transfer->position));
+        ssize_t received = ::recv(transfer->socket, buffer, want, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && errno == EAGAIN) return;
+        if (received <= 0) {
+            // 끊겨도 .part는 남겨 두어 같은 티켓으로 이어 받을 수 있다
+            close(transfer);
+            return;
+        }
+
+        if (transfer->hashing) transfer->hasher.addData(buffer, int(received));
+        const char *data = buffer;
+        ssize_t remaining = received;
+        while (remaining > 0) {
+            ssize_t written = ::pwrite(transfer->file, data, size_t(remaining), off_t(transfer->position));
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) {
+                fail(transfer, "write failed");
+                return;
+            }
+            data += written;
+            remaining -= written;
+            transfer->position += written;
+        }
+        budget -= received;
+    }
+
+    if (transfer->position >= transfer->end) {
+        completeUpload(transfer);
+    }
+}
+
+void FileTransferServer::startChunk(Transfer *transfer, const QByteArray& ticketId, qint64 offset, qint64 length) {
+    // 조각 하나를 받는다. 이미 가진 조각이면 받지 않고 바로 끝낸다.
+    const FileTicket& ticket = transfer->ticket;
+    int index = int(offset / Protocol::kFileChunkBytes);
+    if (offset % Protocol::kFileChunkBytes != 0 || index >= ticket.chunks.size()
+        || length != FileStore::chunkLength(ticket.size, index)) {
+        fail(transfer, "bad chunk");
+        return;
+    }
+
+    const QByteArray& hash = ticket.chunks.at(index);
+    if (store->hasChunk(hash)) {
+        transfer->reply += "OK " + QByteArray::number(length) + '\n';
+        transfer->state = Transfer::Closing;
+        respond(transfer, "DONE " + QByteArray::number(length));
+        return;
+    }
+
+    // 조각은 작으므로 이어 받지 않고 처음부터 다시 받는다
+    transfer->stagingPath = store->stagingPath(hash, ticketId);
+    transfer->file = ::open(QFile::encodeName(transfer->stagingPath).constData(),
+                            O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (transfer->file < 0) {
+        fail(transfer, "cannot store chunk");
+        return;
+    }
+    transfer->chunkIndex = index;
+    transfer->position = 0;
+    transfer->end = length;
+    transfer->hashing = true;
+    transfer->state = Transfer::Receiving;
+    respond(transfer, "OK 0");
+}
+
+void FileTransferServer::completeChunk(Transfer *transfer) {
+    ::close(transfer->file);
+    transfer->file = -1;
+
+    // 해시가 맞는 조각만 저장소에 넣는다
+    const QByteArray& hash = transfer->ticket.chunks.at(transfer->chunkIndex);
+    QString path = store->chunkPath(hash);
+    if (transfer->hasher.result().toHex() != hash
+        || ::rename(QFile::encodeName(transfer->stagingPath).constData(), QFile::encodeName(path).constData()) != 0) {
+        QFile::remove(transfer->stagingPath);
+        fail(transfer, "chunk hash mismatch");
+        return;
+    }
+
+    transfer->state = Transfer::Closing;
+    respond(transfer, "DONE " + QByteArray::number(transfer->end));
+}
+
+void FileTransferServer::commitUpload(Transfer *transfer) {
+    // 수 GB를 복사할 수 있으므로 전송 스레드를 막지 않도록 다른 스레드에서 합친다
+    transfer->state = Transfer::Committing;
+    updateNotifiers(transfer);
+
+    FileStore *files = store;
+    FileTicket ticket = transfer->ticket;
+    QFutureWatcher<QByteArray> *watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcher<QByteArray>::finished, this, [this, watcher, transfer]() {
+        watcher->deleteLater();
+        if (!transfers.contains(transfer)) return;
+        transfer->lastActivity = QDateTime::currentMSecsSinceEpoch();
+        QByteArray error = watcher->result();
+        if (!error.isEmpty()) {
+            fail(transfer, error);
+            return;
+        }
+        const FileTicket& ticket = transfer->ticket;
+        publish(transfer, ticket.hash, ticket.chunks);
+    });
+    watcher->setFuture(QtConcurrent::run(&assemblers, [files, ticket]() {
+        QByteArray error;
+        files->assemble(ticket, error);
+        return error;
+    }));
+}
+
+void FileTransferServer::completeUpload(Transfer *transfer) {
+    if (transfer->chunkIndex >= 0) {
+        completeChunk(transfer);
+        return;
+    }
+
+    const FileTicket& ticket = transfer->ticket;
+    ::fdatasync(transfer->file);
+    ::close(transfer->file);
+    transfer->file = -1;
+
+    // 다 받은 뒤에만 원래 이름으로 보이게 한다
+    QString partial = store->partialPath(ticket.room, ticket.filename);
+    QString path = store->filePath(ticket.room, ticket.filename);
+    if (::rename(QFile::encodeName(partial).constData(), QFile::encodeName(path).constData()) != 0) {
+        fail(transfer, "cannot store file");
+        return;
+    }
+
+    QByteArray hash;
+    if (transfer->hashing) {
+        hash = transfer->hasher.result().toHex();
+    } else {
+        QFile file(path);
+        QCryptographicHash hasher(QCryptographicHash::Sha256);
+        if (file.open(QIODevice::ReadOnly) && hasher.addData(&file)) hash = hasher.result().toHex();
+    }
+    publish(transfer, hash, QVector<QByteArray>());
+}
+
+void FileTransferServer::publish(Transfer *transfer, const QByteArray& hash, const QVector<QByteArray>& chunks) {
+    // 파일이 제 이름으로 자리 잡은 뒤에 목록에 넣고 방에 알린다
+    const FileTicket& ticket = transfer->ticket;
+    FileEntry entry;
+    entry.name = ticket.filename;
+    entry.size = ticket.size;
+    entry.hash = hash;
+    entry.uploader = ticket.uploader;
+    entry.time = QDateTime::currentMSecsSinceEpoch();
+    entry.chunks = chunks;
+    quint64 version = store->addFile(ticket.room, entry);
+
+    CHAT_LOG(Info, File) << ticket.uploader << "uploaded" << ticket.size << "bytes to room" << ticket.room->name;
+    emit uploadFinished(ticket.room, entry, version);
+
+    transfer->state = Transfer::Closing;
+    respond(transfer, "DONE " + QByteArray::number(ticket.size));
+}
+
+void FileTransferServer::onWritable(Transfer *transfer) {
+    transfer->lastActivity = QDateTime::currentMSecsSinceEpoch();
+    if (!flushReply(transfer)) return;
+
+    if (transfer->state == Transfer::Closing) {
+        close(transfer);
+    } else if (transfer->state == Transfer::Sending) {
+        sendChunk(transfer);
+    } else {
+        updateNotifiers(transfer);
+    }
+}
+
+void FileTransferServer::sendChunk(Transfer *transfer) {
+    qint64 budget = store->config().chunkBytes;
+    while (budget > 0 && transfer->position < transfer->end) {
+        size_t want = size_t(qMin(budget, transfer->end - transfer->position));
+#ifdef Q_OS_LINUX
+        // 페이지 캐시에서 소켓으로 바로 보낸다
+        off_t offset = off_t(transfer->position);
+        ssize_t sent = ::sendfile(transfer->socket, transfer->file, &offset, want);
+#else
+        char buffer[64 * 1024];
+        ssize_t sent = ::pread(transfer->file, buffer, qMin(want, sizeof(buffer)), off_t(transfer->position));
+        if (sent > 0) sent = ::send(transfer->socket, buffer, size_t(sent), 0);
+#endif
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && errno == EAGAIN) break;
+        if (sent <= 0) {
+            close(transfer);
+            return;
+        }
+        transfer->position += sent;
+        budget -= sent;
+    }
+
+    if (transfer->position >= transfer->end) {
+        // 다 보냈으면 닫는다 (클라이언트는 길이로 끝을 안다)
+        ::shutdown(transfer->socket, SHUT_WR);
+        close(transfer);
+        return;
+    }
+    updateNotifiers(transfer);
+}
+
+void FileTransferServer::fail(Transfer *transfer, const QByteArray& reason) {
+    if (transfer->file >= 0) {
+        ::close(transfer->file);
+        transfer->file = -1;
+    }
+    transfer->state = Transfer::Closing;
+    respond(transfer, "ERR " + reason);
+}
+
+void FileTransferServer::respond(Transfer *transfer, const QByteArray& line) {
+    transfer->reply += line + '\n';
+    if (flushReply(transfer) && transfer->state == Transfer::Closing) {
+        close(transfer);
+        return;
+    }
+    updateNotifiers(transfer);
+}
+
+bool FileTransferServer::flushReply(Transfer *transfer) {
+    while (!transfer->reply.isEmpty()) {
+        ssize_t sent = ::send(transfer->socket, transfer->reply.constData(), size_t(transfer->reply.size()),
+                              MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0) return false;  // EAGAIN이면 쓰기 가능 알림을 기다린다
+        transfer->reply.remove(0, int(sent));
+    }
+    return true;
+}
+
+void FileTransferServer::updateNotifiers(Transfer *transfer) {
+    bool sending = transfer->state == Transfer::Sending || !transfer->reply.isEmpty();
+    transfer->writeNotifier->setEnabled(sending);
+    transfer->readNotifier->setEnabled(transfer->state == Transfer::ReadingRequest
+                                       || transfer->state == Transfer::Receiving);
+}
+
+void FileTransferServer::close(Transfer *transfer) {
+    if (!transfers.remove(transfer)) return;
+    // 알림 객체는 자기 시그널을 처리하는 중일 수 있으므로 나중에 지운다
+    transfer->readNotifier->setEnabled(false);
+    transfer->writeNotifier->setEnabled(false);
+    transfer->readNotifier->deleteLater();
+    transfer->writeNotifier->deleteLater();
+    if (transfer->file >= 0) ::close(transfer->file);
+    ::close(transfer->socket);
+    delete transfer;
+}
+
+void FileTransferServer::sweepIdle() {
+    qint64 cutoff = QDateTime::currentMSecsSinceEpoch() - kIdleTimeoutMs;
+    QList<Transfer*> idle;
+    for (Transfer *transfer : transfers) {
+        if (transfer->lastActivity < cutoff && transfer->state != Transfer::Committing) idle.append(transfer);
+    }
+    for (Transfer *transfer : idle) {
+        close(transfer);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QHostAddress>
+#include <QSet>
+#include <QString>
+#include <QTcpServer>
+#include <QThreadPool>
+#include "filestore.h"
+
+class QSocketNotifier;
+class QTimer;
+
+// 파일 전송 채널 서버
+// 전용 스레드의 이벤트 루프에서 돌아서 큰 전송이 채팅 워커를 막지 않는다.
+// 연결마다 알림 한 번에 chunkBytes까지만 옮기므로 여러 전송이 번갈아 진행된다.
+// 다운로드는 sendfile로 페이지 캐시에서 소켓으로 바로 보내 사용자 공간을 거치지 않고,
+// 업로드는 받는 대로 .part 파일에 쓰다가 다 받으면 이름을 바꾼다.
+// 조각 업로드는 조각마다 해시를 확인해 저장소에 모았다가 COMMIT 요청 때 파일로 합친다.
+class FileTransferServer : public QTcpServer {
+    Q_OBJECT
+
+public:
+    static const int kIdleTimeoutMs = 30000;
+
+    explicit FileTransferServer(FileStore *store, QObject *parent = nullptr);
+    ~FileTransferServer();
+
+    // 전송 스레드에서 호출된다
+    bool start(const QHostAddress& address, quint16 port);
+
+signals:
+    // 업로드가 끝나 파일이 방 목록에 올라갔다 (전송 스레드에서 발생)
+    // version은 이 파일을 넣은 뒤의 방 파일 목록 버전
+    void uploadFinished(ChatRoom *room, const FileEntry& entry, quint64 version);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    struct Transfer {
+        enum State {
+            ReadingRequest,  // 요청 줄을 기다림
+            Receiving,       // 업로드 본문
+            Sending,         // 다운로드 본문
+            Committing,      // 조각을 합치는 중 (다른 스레드)
+            Closing          // 남은 응답만 보내고 닫는다
+        };
+
+        int socket = -1;
+        int file = -1;
+        State state = ReadingRequest;
+        QSocketNotifier *readNotifier = nullptr;
+        QSocketNotifier *writeNotifier = nullptr;
+        QByteArray request;   // 요청 줄 버퍼
+        QByteArray reply;     // 아직 못 보낸 응답
+        FileTicket ticket;
+        qint64 position = 0;  // 다음에 읽거나 쓸 파일 위치
+        qint64 end = 0;       // 이 위치까지 옮기면 끝
+        qint64 lastActivity = 0;
+        // 업로드를 처음부터 받으면 받는 대로 해시한다 (이어 받으면 끝나고 파일 전체를 읽는다)
+        QCryptographicHash hasher{QCryptographicHash::Sha256};
+        bool hashing = false;
+        // 조각 업로드면 받는 조각 번호와 임시 파일
+        int chunkIndex = -1;
+        QString stagingPath;
+    };
+
+    void onReadable(Transfer *transfer);
+    void onWritable(Transfer *transfer);
+    void handleRequest(Transfer *transfer, const QByteArray& line);
+    void receiveChunk(Transfer *transfer);
+    void sendChunk(Transfer *transfer);
+    void completeUpload(Transfer *transfer);
+    void startChunk(Transfer *transfer, const QByteArray& ticketId, qint64 offset, qint64 length);
+    void completeChunk(Transfer *transfer);
+    void commitUpload(Transfer *transfer);
+    void publish(Transfer *transfer, const QByteArray& hash, const QVector<QByteArray>& chunks);
+    void fail(Transfer *transfer, const QByteArray& reason);
+    void respond(Transfer *transfer, const QByteArray& line);
+    // 응답을 다 보냈으면 true
+    bool flushReply(Transfer *transfer);
+    void updateNotifiers(Transfer *transfer);
+    void close(Transfer *transfer);
+    void sweepIdle();
+
+    FileStore *store;
+    QSet<Transfer*> transfers;
+    QTimer *idleTimer = nullptr;
+    QThreadPool assemblers;  // 조각 합치기 전용
+};
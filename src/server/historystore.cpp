@@ -0,0 +1,610 @@
+#include "historystore.h"
+#include "chatdirectory.h"
+#include <QCborValue>
+#include <QDateTime>
+#include <QDir>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+const quint64 HistoryStore::kNoSeq;
+
+namespace {
+    const qint64 kRecordHeaderSize = 4 + 4 + 8 + 8 + 1;  // 길이, CRC32, seq, 시각, 타입
+    const qint64 kReorderWindowMs = 200;             // 앞 번호를 기다리는 최대 시간
+
+    // 매핑 안의 레코드 하나
+    struct RecordView {
+        quint64 seq;
+        qint64 timestamp;
+        MessageType type;
+        qint64 payloadOffset;
+        qint64 payloadSize;
+        qint64 next;
+    };
+
+    struct Crc32Table {
+        quint32 entries[256];
+        Crc32Table() {
+            for (quint32 i = 0; i < 256; ++i) {
+                quint32 c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+
+    quint32 crc32(quint32 crc, const uchar *data, qint64 size) {
+        static const Crc32Table table;  // 함수 안 정적 변수는 처음 부를 때 한 번만 만들어진다
+        crc = ~crc;
+        for (qint64 i = 0; i < size; ++i) {
+            crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    // 길이와 CRC 뒤의 모든 바이트에 대한 CRC32
+    quint32 recordChecksum(const uchar *p, quint32 length) {
+        return crc32(crc32(0, p, 4), p + 8, qint64(length) - 4);
+    }
+
+    bool readRecord(const uchar *data, qint64 pos, qint64 end, RecordView& record) {
+        if (end - pos < kRecordHeaderSize) return false;
+        const uchar *p = data + pos;
+        quint32 length = qFromLittleEndian<quint32>(p);
+        if (length < kRecordHeaderSize - 4 || end - pos - 4 < qint64(length)) return false;
+
+        record.seq = qFromLittleEndian<quint64>(p + 8);
+        record.timestamp = qFromLittleEndian<qint64>(p + 16);
+        record.type = MessageType(p[24]);
+        record.payloadOffset = pos + kRecordHeaderSize;
+        record.payloadSize = qint64(length) - (kRecordHeaderSize - 4);
+        record.next = pos + 4 + length;
+        return true;
+    }
+
+    QString segmentFileName(quint64 firstSeq) {
+        return QString("%1.log").arg(firstSeq, 20, 10, QChar('0'));
+    }
+}
+
+LogSegment::LogSegment(const QString& path, quint64 firstSeq)
+    : path(path), firstSeq(firstSeq) {}
+
+LogSegment::~LogSegment() {
+    if (data) file.unmap(data);
+    file.close();
+}
+
+bool LogSegment::create(qint64 size) {
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate)) return false;
+#ifdef Q_OS_LINUX
+    // 희소 파일이면 매핑에 쓰다가 디스크가 차는 순간 SIGBUS가 나므로 미리 할당한다
+    if (::posix_fallocate(file.handle(), 0, size) != 0) return false;
+#endif
+    if (!file.resize(size)) return false;
+    data = file.map(0, size);
+    if (!data) return false;
+    capacity = size;
+    return true;
+}
+
+bool LogSegment::load(int indexStride) {
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadWrite)) return false;
+    capacity = file.size();
+    if (capacity > 0) {
+        data = file.map(0, capacity);
+        if (!data) return false;
+    }
+    rebuild(indexStride);
+    return true;
+}
+
+void LogSegment::rebuild(int indexStride) {
+    index.clear();
+    recordCount = 0;
+    lastSeq = 0;
+
+    qint64 pos = 0;
+    RecordView record;
+    while (data && readRecord(data, pos, capacity, record)) {
+        // 길이가 0이면 기록된 끝이다. 매핑의 페이지는 순서 없이 디스크에 내려가므로
+        // CRC가 맞지 않거나 번호가 거꾸로 가면 끊긴 쓰기로 보고 거기까지만 쓴다.
+        const uchar *p = data + pos;
+        if (qFromLittleEndian<quint32>(p + 4) != recordChecksum(p, qFromLittleEndian<quint32>(p))) break;
+        if (record.seq < firstSeq || (recordCount > 0 && record.seq <= lastSeq)) break;
+        if (recordCount % indexStride == 0) {
+            IndexPoint point = { record.seq, record.timestamp, pos };
+            index.append(point);
+        }
+        if (recordCount == 0) firstTime = record.timestamp;
+        lastTime = record.timestamp;
+        lastSeq = record.seq;
+        ++recordCount;
+        pos = record.next;
+    }
+    end.storeRelease(pos);
+    syncedEnd = pos;
+}
+
+bool LogSegment::sync() {
+    qint64 e = end.loadAcquire();
+    if (e == syncedEnd) return true;
+#ifdef Q_OS_UNIX
+    static const qint64 pageSize = ::sysconf(_SC_PAGESIZE);
+    qint64 from = syncedEnd - syncedEnd % pageSize;
+    if (::msync(data + from, size_t(e - from), MS_SYNC) != 0) return false;
+#endif
+    syncedEnd = e;
+    return true;
+}
+
+void LogSegment::seal() {
+    sync();
+    qint64 e = end.loadAcquire();
+    // 매핑은 그대로 두고 파일만 줄인다 (end 뒤는 아무도 읽지 않는다)
+    if (e < capacity && file.resize(e)) capacity = e;
+}
+
+void LogSegment::discard() {
+    QFile::remove(path);
+}
+
+HistoryStore::HistoryStore(const HistoryConfig& config, QObject *parent)
+    : QObject(parent), settings(config),
+      rollSpanMs(config.maxAgeSecs > 0 ? config.maxAgeSecs * 1000 / 8 : 0) {}
+
+HistoryStore::~HistoryStore() {
+    // 남은 레코드는 순서를 더 기다리지 않고 모두 쓴 뒤 디스크에 내린다
+    drain();
+    releaseWaiting(true);
+    syncLogs();
+    qDeleteAll(logs);
+}
+
+bool HistoryStore::open() {
+    QDir root(settings.directory);
+    if (!root.mkpath(".")) {
+        qWarning() << "Cannot create history directory" << settings.directory;
+        return false;
+    }
+
+    const QFileInfoList rooms = root.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QFileInfo& info : rooms) {
+        loadRoom(info.absoluteFilePath());
+    }
+    return true;
+}
+
+void HistoryStore::loadRoom(const QString& roomDirectory) {
+    QDir dir(roomDirectory);
+
+    // 병합 도중 중단된 임시 파일
+    const QStringList leftovers = dir.entryList(QStringList() << "*.tmp", QDir::Files);
+    for (const QString& name : leftovers) {
+        dir.remove(name);
+    }
+
+    RoomLog *log = new RoomLog;
+    log->name = QString::fromUtf8(QByteArray::fromHex(dir.dirName().toLatin1()));
+    log->directory = dir.absolutePath();
+
+    const QStringList files = dir.entryList(QStringList() << "*.log", QDir::Files, QDir::Name);
+    for (const QString& name : files) {
+        bool ok = false;
+        quint64 firstSeq = name.left(name.size() - 4).toULongLong(&ok);
+        if (!ok) continue;
+
+        QSharedPointer<LogSegment> segment(new LogSegment(dir.filePath(name), firstSeq));
+        if (!segment->load(settings.indexStride)) {
+            qWarning() << "Cannot open history segment" << segment->path;
+            continue;
+        }
+        // 비어 있거나, 병합이 끝난 뒤 지우지 못해 앞 세그먼트와 겹치는 파일
+        if (segment->recordCount == 0 || segment->firstSeq <= log->lastSeq) {
+            segment->discard();
+            continue;
+        }
+        log->segments.append(segment);
+        log->lastSeq = segment->lastSeq;
+    }
+    log->recoveredSeq = log->lastSeq;
+
+    QWriteLocker locker(&logsLock);
+    logs.insert(log->name, log);
+}
+
+void HistoryStore::start() {
+    syncTimer = new QTimer(this);
+    connect(syncTimer, &QTimer::timeout, this, &HistoryStore::syncDirty);
+    syncTimer->start(qMax(1, settings.syncIntervalMs));
+
+    maintenanceTimer = new QTimer(this);
+    connect(maintenanceTimer, &QTimer::timeout, this, &HistoryStore::maintain);
+    maintenanceTimer->start(settings.compactIntervalMs);
+}
+
+RoomLog* HistoryStore::logFor(const QString& roomName) {
+    QWriteLocker locker(&logsLock);
+    RoomLog *log = logs.value(roomName, nullptr);
+    if (log) return log;
+
+    // 방 이름에 어떤 문자가 와도 되도록 디렉토리 이름은 UTF-8의 16진수로 한다
+    QDir root(settings.directory);
+    QString dirName = QString::fromLatin1(roomName.toUtf8().toHex());
+    if (!root.mkpath(dirName)) {
+        qWarning() << "Cannot create history directory for room" << roomName;
+        return nullptr;
+    }
+
+    log = new RoomLog;
+    log->name = roomName;
+    log->directory = root.filePath(dirName);
+    logs.insert(roomName, log);
+    return log;
+}
+
+void HistoryStore::attach(ChatRoom* room) {
+    RoomLog *log = logFor(room->name);
+    if (!log) return;
+
+    // 이전 실행의 마지막 번호 뒤로 이어서 매긴다
+    quint64 current = room->lastSeq.loadAcquire();
+    while (current < log->recoveredSeq
+           && !room->lastSeq.testAndSetOrdered(current, log->recoveredSeq, current)) {}
+    room->historyLog.storeRelease(log);
+}
+
+void HistoryStore::append(ChatRoom* room, const HistoryRecord& record) {
+    RoomLog *log = room->historyLog.loadAcquire();
+    if (!log) return;
+
+    PendingRecord item;
+    item.log = log;
+    item.record = record;
+    if (pending.push(item)) {
+        QMetaObject::invokeMethod(this, [this]() { drain(); }, Qt::QueuedConnection);
+    }
+}
+
+void HistoryStore::drain() {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QVector<RoomLog*> touched;
+
+    // 여러 워커가 번호를 받은 순서와 도착 순서가 다를 수 있으므로
+    // 번호순으로 모아 두었다가 이어지는 만큼만 쓴다
+    pending.drain([now, &touched](PendingRecord& item) {
+        RoomLog *log = item.log;
+        if (item.record.seq <= log->lastSeq) return;  // 이미 건너뛴 번호
+        if (log->held.isEmpty()) {
+            log->heldSince = now;
+            touched.append(log);
+        }
+        log->held.insert(item.record.seq, item.record);
+    });
+
+    for (RoomLog *log : touched) {
+        release(log, false);
+        if (!log->held.isEmpty() && !waitingLogs.contains(log)) {
+            waitingLogs.append(log);
+        }
+    }
+}
+
+void HistoryStore::release(RoomLog* log, bool force) {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    bool progressed = false;
+
+    while (!log->held.isEmpty()) {
+        QMap<quint64, HistoryRecord>::iterator it = log->held.begin();
+        // 빠진 번호는 잠시 기다리고, 그래도 오지 않으면 건너뛴다
+        if (it.key() != log->lastSeq + 1 && !force && now - log->heldSince < kReorderWindowMs) break;
+        writeRecord(log, it.value());
+        log->held.erase(it);
+        progressed = true;
+    }
+    if (progressed) log->heldSince = now;
+}
+
+void HistoryStore::releaseWaiting(bool force) {
+    for (int i = 0; i < waitingLogs.size();) {
+        RoomLog *log = waitingLogs.at(i);
+        release(log, force);
+        if (log->held.isEmpty()) waitingLogs.remove(i);
+        else ++i;
+    }
+}
+
+QSharedPointer<LogSegment> HistoryStore::createSegment(RoomLog* log, quint64 firstSeq, qint64 capacity) {
+    QString path = QDir(log->directory).filePath(segmentFileName(firstSeq));
+    QSharedPointer<LogSegment> segment(new LogSegment(path, firstSeq));
+    if (!segment->create(capacity)) {
+        qWarning() << "Cannot create history segment" << path;
+        segment->discard();
+        return QSharedPointer<LogSegment>();
+    }
+
+    QWriteLocker locker(&log->lock);
+    log->segments.append(segment);
+    return segment;
+}
+
+void HistoryStore::writeRecord(RoomLog* log, const HistoryRecord& record) {
+    QByteArray payload = QCborValue(record.fields).toCbor();
+    qint64 size = kRecordHeaderSize + payload.size();
+
+    LogSegment *active = log->segments.isEmpty() ? nullptr : log->segments.last().data();
+    bool roll = !active
+        || active->end.loadAcquire() + size > active->capacity
+        || (rollSpanMs > 0 && active->recordCount > 0 && record.timestamp - active->firstTime > rollSpanMs);
+    if (roll) {
+        if (active) active->seal();
+        QSharedPointer<LogSegment> segment = createSegment(log, record.seq, qMax(settings.segmentSize, size));
+        log->lastSeq = record.seq;
+        if (!segment) return;  // 디스크 오류: 이 레코드는 기록하지 못한다
+        active = segment.data();
+    }
+
+    appendToSegment(log, active, record, payload);
+    log->lastSeq = record.seq;
+    if (!log->dirty) {
+        log->dirty = true;
+        dirtyLogs.append(log);
+    }
+}
+
+void HistoryStore::appendToSegment(RoomLog* log, LogSegment* segment, const HistoryRecord& record,
+                                   const QByteArray& payload) {
+    qint64 pos = segment->end.loadAcquire();
+    uchar *p = segment->data + pos;
+
+    // 끊긴 쓰기는 복구할 때 CRC로 걸러 낸다 (읽는 쪽은 end까지만 보므로 쓰는 순서는 상관없다)
+    quint32 length = quint32(kRecordHeaderSize - 4 + payload.size());
+    qToLittleEndian<quint32>(length, p);
+    qToLittleEndian<quint64>(record.seq, p + 8);
+    qToLittleEndian<qint64>(record.timestamp, p + 16);
+    p[24] = uchar(record.type);
+    std::memcpy(p + kRecordHeaderSize, payload.constData(), size_t(payload.size()));
+    qToLittleEndian<quint32>(recordChecksum(p, length), p + 4);
+
+    if (segment->recordCount % settings.indexStride == 0) {
+        LogSegment::IndexPoint point = { record.seq, record.timestamp, pos };
+        QWriteLocker locker(&log->lock);
+        segment->index.append(point);
+    }
+    if (segment->recordCount == 0) segment->firstTime = record.timestamp;
+    segment->lastTime = record.timestamp;
+    segment->lastSeq = record.seq;
+    ++segment->recordCount;
+
+    // 읽는 쪽은 end까지만 보므로 여기서 공개된다
+    segment->end.storeRelease(pos + kRecordHeaderSize + payload.size());
+}
+
+void HistoryStore::syncDirty() {
+    drain();
+    releaseWaiting(false);
+    syncLogs();
+}
+
+void HistoryStore::syncLogs() {
+    // 그룹 커밋: 이번 주기에 쓰인 방마다 한 번만 디스크에 내린다
+    for (RoomLog *log : dirtyLogs) {
+        if (!log->segments.isEmpty() && !log->segments.last()->sync()) {
+            qWarning() << "Failed to sync history for room" << log->name;
+        }
+        log->dirty = false;
+    }
+    dirtyLogs.clear();
+}
+
+void HistoryStore::maintain() {
+    syncDirty();
+
+    QVector<RoomLog*> all;
+    {
+        QReadLocker locker(&logsLock);
+        all.reserve(logs.size());
+        for (RoomLog *log : logs) all.append(log);
+    }
+    for (RoomLog *log : all) {
+        enforceRetention(log);
+        compact(log);
+    }
+}
+
+void HistoryStore::enforceRetention(RoomLog* log) {
+    // 보관 정책은 세그먼트 단위로 적용하고 기록 중인 마지막 세그먼트는 남긴다
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 total = 0;
+    for (const QSharedPointer<LogSegment>& segment : log->segments) {
+        total += segment->end.loadAcquire();
+    }
+
+    int sealed = log->segments.size() - 1;
+    int drop = 0;
+    while (drop < sealed) {
+        LogSegment *segment = log->segments.at(drop).data();
+        bool expired = settings.maxAgeSecs > 0 && now - segment->lastTime > settings.maxAgeSecs * 1000;
+        bool oversize = settings.maxRoomBytes > 0 && total > settings.maxRoomBytes;
+        if (!expired && !oversize) break;
+        total -= segment->end.loadAcquire();
+        ++drop;
+    }
+    if (drop == 0) return;
+
+    QVector<QSharedPointer<LogSegment> > removed;
+    {
+        QWriteLocker locker(&log->lock);
+        removed = log->segments.mid(0, drop);
+        log->segments.remove(0, drop);
+    }
+    // 읽는 중인 쪽은 자기 참조로 매핑을 유지한다
+    for (const QSharedPointer<LogSegment>& segment : removed) {
+        segment->discard();
+    }
+}
+
+void HistoryStore::compact(RoomLog* log) {
+    // 조용한 방은 시간 폭 때문에 작은 세그먼트가 많이 생긴다.
+    // 연달아 있는 작은 봉인 세그먼트를 하나로 합쳐 파일과 매핑 수를 줄인다.
+    const qint64 smallSize = settings.segmentSize / 4;
+    int first = 0;
+    while (first < log->segments.size() - 1) {
+        const LogSegment *head = log->segments.at(first).data();
+        int last = first;
+        qint64 bytes = 0;
+        while (last < log->segments.size() - 1) {
+            const LogSegment *segment = log->segments.at(last).data();
+            qint64 size = segment->end.loadAcquire();
+            if (size >= smallSize || bytes + size > settings.segmentSize) break;
+            if (rollSpanMs > 0 && segment->lastTime - head->firstTime > rollSpanMs) break;
+            bytes += size;
+            ++last;
+        }
+
+        if (last - first >= 2) {
+            merge(log, first, last, bytes);
+            ++first;
+        } else {
+            first = qMax(last, first + 1);
+        }
+    }
+}
+
+void HistoryStore::merge(RoomLog* log, int first, int last, qint64 bytes) {
+    QSharedPointer<LogSegment> head = log->segments.at(first);
+    QString finalPath = head->path;
+    QSharedPointer<LogSegment> merged(new LogSegment(finalPath + ".tmp", head->firstSeq));
+    if (!merged->create(bytes)) {
+        merged->discard();
+        return;
+    }
+
+    qint64 offset = 0;
+    for (int i = first; i < last; ++i) {
+        const LogSegment *segment = log->segments.at(i).data();
+        qint64 size = segment->end.loadAcquire();
+        std::memcpy(merged->data + offset, segment->data, size_t(size));
+        offset += size;
+    }
+    merged->rebuild(settings.indexStride);
+    if (!merged->sync()) {
+        merged->discard();
+        return;
+    }
+
+    // 첫 파일을 원자적으로 덮어쓴다. 나머지를 지우기 전에 멈추면
+    // 다음 시작 때 겹치는 세그먼트로 보고 지운다.
+    if (std::rename(QFile::encodeName(merged->path).constData(),
+                    QFile::encodeName(finalPath).constData()) != 0) {
+        merged->discard();
+        return;
+    }
+    merged->path = finalPath;
+
+    QVector<QSharedPointer<LogSegment> > replaced;
+    {
+        QWriteLocker locker(&log->lock);
+        replaced = log->segments.mid(first, last - first);
+        log->segments.remove(first, last - first);
+        log->segments.insert(first, merged);
+    }
+    for (int i = 1; i < replaced.size(); ++i) {
+        replaced.at(i)->discard();
+    }
+}
+
+QVector<HistoryEntry> HistoryStore::latest(ChatRoom* room, int limit) const {
+    return before(room, kNoSeq, limit);
+}
+
+QVector<HistoryEntry> HistoryStore::before(ChatRoom* room, quint64 beforeSeq, int limit) const {
+    QVector<HistoryEntry> result;
+    RoomLog *log = room->historyLog.loadAcquire();
+    limit = qMin(limit, settings.maxPageSize);
+    if (!log || limit <= 0) return result;
+
+    QReadLocker locker(&log->lock);
+    for (int i = log->segments.size() - 1; i >= 0 && result.size() < limit; --i) {
+        const QSharedPointer<LogSegment>& segment = log->segments.at(i);
+        if (segment->firstSeq >= beforeSeq) continue;
+        collectTail(segment, beforeSeq, limit - result.size(), result);
+    }
+    std::reverse(result.begin(), result.end());
+    return result;
+}
+
+void HistoryStore::collectTail(const QSharedPointer<LogSegment>& segment, quint64 beforeSeq,
+                               int need, QVector<HistoryEntry>& newestFirst) const {
+    const QVector<LogSegment::IndexPoint>& index = segment->index;
+    if (index.isEmpty()) return;
+    qint64 end = segment->end.loadAcquire();
+
+    // beforeSeq 앞의 마지막 인덱스 지점에서 need개가 들어갈 만큼 물러나서 훑는다
+    QVector<LogSegment::IndexPoint>::const_iterator it = std::lower_bound(
+        index.begin(), index.end(), beforeSeq,
+        [](const LogSegment::IndexPoint& point, quint64 seq) { return point.seq < seq; });
+    int anchor = int(it - index.begin()) - 1;
+    if (anchor < 0) return;
+    int stride = settings.indexStride;
+    int start = qMax(0, anchor - (need + stride - 1) / stride);
+
+    // 최근 need개만 남기는 고리 버퍼. payload는 매핑을 그대로 가리킨다.
+    QVector<HistoryEntry> ring(need);
+    int count = 0;
+    qint64 pos = index.at(start).offset;
+    RecordView record;
+    while (readRecord(segment->data, pos, end, record) && record.seq < beforeSeq) {
+        HistoryEntry& entry = ring[count % need];
+        entry.seq = record.seq;
+        entry.timestamp = record.timestamp;
+        entry.type = record.type;
+        entry.payload = QByteArray::fromRawData(
+            reinterpret_cast<const char*>(segment->data + record.payloadOffset), int(record.payloadSize));
+        ++count;
+        pos = record.next;
+    }
+
+    for (int i = count - 1; i >= qMax(0, count - need); --i) {
+        HistoryEntry entry = ring.at(i % need);
+        entry.segment = segment;
+        newestFirst.append(entry);
+    }
+}
+
+quint64 HistoryStore::firstSeqAtOrAfter(ChatRoom* room, qint64 timestamp) const {
+    RoomLog *log = room->historyLog.loadAcquire();
+    if (!log) return kNoSeq;
+
+    QReadLocker locker(&log->lock);
+    for (const QSharedPointer<LogSegment>& segment : log->segments) {
+        const QVector<LogSegment::IndexPoint>& index = segment->index;
+        if (index.isEmpty()) continue;
+        qint64 end = segment->end.loadAcquire();
+
+        QVector<LogSegment::IndexPoint>::const_iterator it = std::lower_bound(
+            index.begin(), index.end(), timestamp,
+            [](const LogSegment::IndexPoint& point, qint64 time) { return point.timestamp < time; });
+        int start = qMax(0, int(it - index.begin()) - 1);
+
+        qint64 pos = index.at(start).offset;
+        RecordView record;
+        while (readRecord(segment->data, pos, end, record)) {
+            if (record.timestamp >= timestamp) return record.seq;
+            pos = record.next;
+        }
+    }
+    return kNoSeq;
+}
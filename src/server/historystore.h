@@ -0,0 +1,177 @@
+#pragma once
+
+#include <QObject>
+#include <QAtomicInteger>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+#include <QCborMap>
+#include "protocol.h"
+#include "mailbox.h"
+
+class ChatRoom;
+
+struct HistoryConfig {
+    QString directory;                          // 비어 있으면 기록하지 않는다
+    int backfillCount = 50;                     // 입장 시 보내는 최근 메시지 수
+    int maxPageSize = 200;                      // 한 번에 요청할 수 있는 최대 개수
+    qint64 segmentSize = 8 * 1024 * 1024;       // 세그먼트 파일 크기
+    int syncIntervalMs = 20;                    // 그룹 커밋(fsync) 간격
+    qint64 maxRoomBytes = 256LL * 1024 * 1024;  // 방별 최대 보관 크기 (0이면 무제한)
+    qint64 maxAgeSecs = 30LL * 24 * 3600;       // 최대 보관 기간 (0이면 무제한)
+    int compactIntervalMs = 60 * 1000;          // 보관 정책 적용/압축 주기
+    int indexStride = 64;                       // 희소 인덱스 간격 (레코드 수)
+};
+
+struct HistoryRecord {
+    quint64 seq = 0;
+    qint64 timestamp = 0;  // ms since epoch
+    MessageType type = MessageType::Unknown;
+    QCborMap fields;
+};
+
+// 세그먼트 파일 하나
+// 생성할 때 전체 크기를 잡아 두고 통째로 매핑한다. 기록 스레드만 end 뒤에 쓰고,
+// 읽는 쪽은 end까지의 바이트를 잠금 없이 매핑에서 바로 읽는다.
+// 레코드: [u32 길이][u32 CRC32][u64 seq][i64 시각][u8 타입][CBOR 필드] (리틀 엔디언)
+// CRC는 길이와 그 뒤 바이트에 대한 것이고 복구할 때 훑으며 확인한다.
+class LogSegment {
+public:
+    struct IndexPoint {
+        quint64 seq;
+        qint64 timestamp;
+        qint64 offset;
+    };
+
+    LogSegment(const QString& path, quint64 firstSeq);
+    ~LogSegment();
+
+    bool create(qint64 capacity);
+    bool load(int indexStride);
+    // 매핑된 내용을 처음부터 훑어 끝 위치와 인덱스를 다시 만든다
+    void rebuild(int indexStride);
+    bool sync();
+    // 더 쓰지 않을 세그먼트를 디스크에 내리고 남은 공간을 잘라낸다
+    void seal();
+    // 파일을 지금 지운다. 매핑은 마지막 참조가 사라질 때까지 유효하다.
+    void discard();
+
+    QString path;
+    const quint64 firstSeq;
+    qint64 capacity = 0;
+    QAtomicInteger<qint64> end;     // 읽을 수 있는 마지막 위치
+    QVector<IndexPoint> index;      // RoomLog::lock 으로 보호
+
+    // 기록 스레드 전용
+    quint64 lastSeq = 0;
+    qint64 firstTime = 0;
+    qint64 lastTime = 0;
+    int recordCount = 0;
+    qint64 syncedEnd = 0;
+    uchar *data = nullptr;
+
+private:
+    QFile file;
+
+    Q_DISABLE_COPY(LogSegment)
+};
+
+// 방 하나의 세그먼트 목록 (오래된 순)
+class RoomLog {
+public:
+    QString name;
+    QString directory;
+    mutable QReadWriteLock lock;               // segments와 각 index 보호
+    QVector<QSharedPointer<LogSegment> > segments;
+
+    quint64 recoveredSeq = 0;                  // 시작할 때 디스크에서 읽은 마지막 seq
+
+    // 기록 스레드 전용
+    quint64 lastSeq = 0;
+    bool dirty = false;                        // fsync 대기 중
+    QMap<quint64, HistoryRecord> held;         // 앞 번호를 기다리는 레코드
+    qint64 heldSince = 0;                      // held가 비어 있지 않게 된 시각
+};
+
+// 읽기 결과. payload는 매핑된 세그먼트를 복사 없이 가리키고,
+// segment 참조가 그 매핑을 살려 둔다.
+struct HistoryEntry {
+    quint64 seq = 0;
+    qint64 timestamp = 0;
+    MessageType type = MessageType::Unknown;
+    QByteArray payload;  // CBOR 인코딩된 필드 맵
+    QSharedPointer<LogSegment> segment;
+};
+
+// 방별 메시지 기록 저장소
+// 워커는 append로 메일박스에 넣기만 하고, 전용 스레드가 모아서 세그먼트에 쓰고
+// 주기적으로 한 번에 fsync 한다. 보관 기간/크기 정책과 작은 세그먼트 병합도
+// 이 스레드에서 처리한다. 읽기는 어느 스레드에서나 가능하다.
+class HistoryStore : public QObject {
+    Q_OBJECT
+
+public:
+    static const quint64 kNoSeq = ~quint64(0);
+
+    explicit HistoryStore(const HistoryConfig& config, QObject *parent = nullptr);
+    ~HistoryStore();
+
+    const HistoryConfig& config() const { return settings; }
+
+    // 기존 세그먼트를 읽어 들인다 (기록 스레드를 시작하기 전에 호출)
+    bool open();
+    // 기록 스레드에서 타이머를 시작한다
+    void start();
+
+    // 방에 기록을 연결하고 마지막 seq를 이어받는다 (임의 스레드)
+    void attach(ChatRoom* room);
+    // 막지 않는다 (임의 스레드)
+    void append(ChatRoom* room, const HistoryRecord& record);
+
+    // 오래된 것부터 정렬된 결과를 돌려준다 (임의 스레드)
+    QVector<HistoryEntry> latest(ChatRoom* room, int limit) const;
+    QVector<HistoryEntry> before(ChatRoom* room, quint64 beforeSeq, int limit) const;
+    // timestamp 이후 첫 메시지의 seq (없으면 kNoSeq)
+    quint64 firstSeqAtOrAfter(ChatRoom* room, qint64 timestamp) const;
+
+private:
+    struct PendingRecord {
+        RoomLog *log = nullptr;
+        HistoryRecord record;
+    };
+
+    RoomLog* logFor(const QString& roomName);
+    void loadRoom(const QString& roomDirectory);
+    QSharedPointer<LogSegment> createSegment(RoomLog* log, quint64 firstSeq, qint64 capacity);
+
+    void drain();
+    void release(RoomLog* log, bool force);
+    void releaseWaiting(bool force);
+    void writeRecord(RoomLog* log, const HistoryRecord& record);
+    void appendToSegment(RoomLog* log, LogSegment* segment, const HistoryRecord& record,
+                         const QByteArray& payload);
+    void syncDirty();
+    void syncLogs();
+    void maintain();
+    void enforceRetention(RoomLog* log);
+    void compact(RoomLog* log);
+    void merge(RoomLog* log, int first, int last, qint64 bytes);
+
+    void collectTail(const QSharedPointer<LogSegment>& segment,
+                     quint64 beforeSeq, int need, QVector<HistoryEntry>& newestFirst) const;
+
+    const HistoryConfig settings;
+    qint64 rollSpanMs;                   // 세그먼트 하나가 담는 최대 시간 폭 (0이면 무제한)
+    mutable QReadWriteLock logsLock;
+    QHash<QString, RoomLog*> logs;       // 방 이름 → 기록
+    Mailbox<PendingRecord> pending;
+    QVector<RoomLog*> dirtyLogs;         // fsync를 기다리는 기록
+    QVector<RoomLog*> waitingLogs;       // 순서가 빈 레코드를 붙잡고 있는 기록
+    QTimer *syncTimer = nullptr;
+    QTimer *maintenanceTimer = nullptr;
+};
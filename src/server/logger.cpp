@@ -0,0 +1,291 @@
+#include "logger.h"
+#include <QDateTime>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+const quint32 Logger::Ring::kCapacity;
+
+namespace {
+    const char* levelName(LogLevel level) {
+        switch (level) {
+        case LogLevel::Debug: return "DEBUG";
+        case LogLevel::Info: return "INFO ";
+        case LogLevel::Warning: return "WARN ";
+        case LogLevel::Error: return "ERROR";
+        default: return "";
+        }
+    }
+
+    // 직접 쓰는 qDebug/qWarning(저장소 코드 등)도 같은 링으로 보낸다
+    void routeQtMessage(QtMsgType type, const QMessageLogContext&, const QString& message) {
+        LogLevel level = LogLevel::Debug;
+        switch (type) {
+        case QtDebugMsg: level = LogLevel::Debug; break;
+        case QtInfoMsg: level = LogLevel::Info; break;
+        case QtWarningMsg: level = LogLevel::Warning; break;
+        case QtCriticalMsg:
+        case QtFatalMsg: level = LogLevel::Error; break;
+        }
+
+        if (type == QtFatalMsg) {
+            Logger::instance()->stop();
+            std::fprintf(stderr, "%s\n", message.toLocal8Bit().constData());
+            std::abort();
+        }
+        if (Logger::instance()->shouldLog(level, LogEvent::Server)) {
+            Logger::instance()->write(level, LogEvent::Server, message);
+        }
+    }
+}
+
+Logger* Logger::instance() {
+    static Logger logger;
+    return &logger;
+}
+
+Logger::~Logger() {
+    stop();
+    qDeleteAll(rings);
+}
+
+void Logger::configure(const LogConfig& config) {
+    settings = config;
+    settings.maxFiles = qMax(0, settings.maxFiles);
+    settings.flushIntervalMs = qMax(1, settings.flushIntervalMs);
+    settings.messageSampleEvery = qMax(1, settings.messageSampleEvery);
+}
+
+bool Logger::start() {
+    if (running.loadAcquire()) return true;
+    if (!openOutput()) return false;
+
+    writerThread = new QThread;
+    writerThread->setObjectName("chat-log");
+
+    QTimer *timer = new QTimer;
+    timer->setInterval(settings.flushIntervalMs);
+    timer->moveToThread(writerThread);
+    QObject::connect(timer, &QTimer::timeout, timer, [this]() { flush(); });
+    QObject::connect(writerThread, &QThread::started, timer, QOverload<>::of(&QTimer::start));
+    QObject::connect(writerThread, &QThread::finished, timer, &QObject::deleteLater);
+
+    running.storeRelease(1);
+    writerThread->start();
+    qInstallMessageHandler(routeQtMessage);
+    return true;
+}
+
+void Logger::stop() {
+    if (!running.loadAcquire()) return;
+    qInstallMessageHandler(nullptr);
+
+    writerThread->quit();
+    writerThread->wait();
+    delete writerThread;
+    writerThread = nullptr;
+
+    // 기록 스레드가 멈췄으니 남은 줄은 여기서 쓴다
+    flush();
+    running.storeRelease(0);
+    output.close();
+}
+
+Logger::Ring* Logger::localRing() {
+    // 스레드 풀 스레드는 쉬면 끝났다가 다시 생기므로 스레드가 끝날 때 링을 넘겨 지우게 한다
+    struct Owner {
+        Ring *ring = nullptr;
+        ~Owner() {
+            if (ring) Logger::instance()->retire(ring);
+        }
+    };
+    static thread_local Owner owner;
+    if (!owner.ring) {
+        Ring *ring = new Ring;
+        QString name = QThread::currentThread()->objectName();
+        QMutexLocker locker(&ringMutex);
+        int number = ringsCreated++;
+        ring->threadName = name.isEmpty() ? QString("thread-%1").arg(number) : name;
+        rings.append(ring);
+        owner.ring = ring;
+    }
+    return owner.ring;
+}
+
+void Logger::retire(Ring *ring) {
+    QMutexLocker locker(&ringMutex);
+    if (running.loadAcquire()) {
+        // 남은 줄은 다음 flush가 쓰고 링을 지운다
+        ring->retired.storeRelease(1);
+        return;
+    }
+    rings.removeOne(ring);
+    delete ring;
+}
+
+bool Logger::shouldLog(LogLevel level, LogEvent event) {
+    if (level < settings.level) return false;
+
+    Ring *ring = localRing();
+    if (event == LogEvent::Message && settings.messageSampleEvery > 1
+        && ring->sampleCounter++ % quint64(settings.messageSampleEvery) != 0) {
+        return false;
+    }
+
+    // 오류는 한도와 관계없이 남긴다
+    if (settings.ratePerSecond > 0 && level < LogLevel::Error) {
+        int e = int(event);
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+        if (now - ring->windowStart[e] >= 1000) {
+            ring->windowStart[e] = now;
+            ring->windowCount[e] = 0;
+        }
+        if (ring->windowCount[e] >= settings.ratePerSecond) {
+            ring->suppressed.fetchAndAddRelaxed(1);
+            return false;
+        }
+        ++ring->windowCount[e];
+    }
+    return true;
+}
+
+void Logger::write(LogLevel level, LogEvent, const QString& text) {
+    if (!running.loadAcquire()) {
+        // 시작 전(또는 로거를 쓰지 않는 도구)에는 바로 쓴다
+        std::fprintf(stderr, "%s %s\n", levelName(level), text.trimmed().toLocal8Bit().constData());
+        return;
+    }
+
+    Ring *ring = localRing();
+    quint32 head = ring->head.loadAcquire();
+    if (head - ring->tail.loadAcquire() >= Ring::kCapacity) {
+        ring->dropped.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    Record& slot = ring->slots[head % Ring::kCapacity];
+    slot.time = QDateTime::currentMSecsSinceEpoch();
+    slot.level = level;
+    slot.text = text;
+    ring->head.storeRelease(head + 1);
+}
+
+void Logger::flush() {
+    QVector<Ring*> current;
+    {
+        QMutexLocker locker(&ringMutex);
+        current = rings;
+    }
+
+    QVector<Record> batch;
+    QVector<Ring*> finished;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (int i = 0; i < current.size(); ++i) {
+        Ring *ring = current.at(i);
+        // retired를 먼저 읽어야 그 전에 넣은 줄까지 모두 본다
+        if (ring->retired.loadAcquire()) finished.append(ring);
+        quint32 tail = ring->tail.loadAcquire();
+        quint32 head = ring->head.loadAcquire();
+        for (; tail != head; ++tail) {
+            Record& slot = ring->slots[tail % Ring::kCapacity];
+            Record record;
+            record.time = slot.time;
+            record.level = slot.level;
+            record.thread = i;
+            record.text.swap(slot.text);
+            batch.append(record);
+        }
+        ring->tail.storeRelease(tail);
+
+        quint64 dropped = ring->dropped.fetchAndStoreRelaxed(0);
+        quint64 suppressed = ring->suppressed.fetchAndStoreRelaxed(0);
+        if (dropped || suppressed) {
+            Record summary;
+            summary.time = now;
+            summary.level = LogLevel::Warning;
+            summary.thread = i;
+            summary.text = QString("%1 log lines dropped (buffer full), %2 suppressed (rate limit)")
+                               .arg(dropped).arg(suppressed);
+            batch.append(summary);
+        }
+    }
+    if (!finished.isEmpty()) {
+        QMutexLocker locker(&ringMutex);
+        for (Ring *ring : finished) {
+            rings.removeOne(ring);
+        }
+    }
+    if (batch.isEmpty()) {
+        qDeleteAll(finished);
+        return;
+    }
+
+    // 스레드별로 모은 줄을 시각순으로 섞는다
+    std::stable_sort(batch.begin(), batch.end(), [](const Record& a, const Record& b) {
+        return a.time < b.time;
+    });
+
+    QByteArray out;
+    out.reserve(batch.size() * 96);
+    qint64 cachedSecond = -1;
+    QByteArray secondText;
+    for (const Record& record : batch) {
+        // 초 단위 시각 문자열은 바뀔 때만 만든다
+        qint64 second = record.time / 1000;
+        if (second != cachedSecond) {
+            cachedSecond = second;
+            secondText = QDateTime::fromMSecsSinceEpoch(second * 1000).toString("yyyy-MM-dd HH:mm:ss").toLatin1();
+        }
+        out += secondText;
+        out += '.';
+        out += QByteArray::number(record.time % 1000).rightJustified(3, '0');
+        out += ' ';
+        out += levelName(record.level);
+        out += " [";
+        out += current.at(record.thread)->threadName.toUtf8();
+        out += "] ";
+        out += record.text.trimmed().toUtf8();
+        out += '\n';
+    }
+
+    qDeleteAll(finished);  // 스레드 이름을 다 쓴 뒤에 지운다
+
+    output.write(out);
+    output.flush();
+    outputBytes += out.size();
+    if (!settings.path.isEmpty() && outputBytes >= settings.maxFileBytes) {
+        rotate();
+    }
+}
+
+bool Logger::openOutput() {
+    if (settings.path.isEmpty()) {
+        return output.open(stderr, QIODevice::WriteOnly);
+    }
+    output.setFileName(settings.path);
+    if (!output.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        std::fprintf(stderr, "Cannot open log file %s\n", settings.path.toLocal8Bit().constData());
+        return false;
+    }
+    outputBytes = output.size();
+    return true;
+}
+
+void Logger::rotate() {
+    // path → path.1 → path.2 ... 가장 오래된 파일은 지운다
+    output.close();
+    QString base = settings.path;
+    if (settings.maxFiles == 0) {
+        QFile::remove(base);
+    } else {
+        QFile::remove(QString("%1.%2").arg(base).arg(settings.maxFiles));
+        for (int i = settings.maxFiles - 1; i >= 1; --i) {
+            QFile::rename(QString("%1.%2").arg(base).arg(i), QString("%1.%2").arg(base).arg(i + 1));
+        }
+        QFile::rename(base, base + ".1");
+    }
+    outputBytes = 0;
+    openOutput();
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QDebug>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+class QThread;
+
+enum class LogLevel {
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off
+};
+
+// 로그 종류. 종류마다 스레드별 초당 한도를 따로 센다.
+enum class LogEvent {
+    Server,      // 시작, 복구, 저장소 오류
+    Connection,  // 연결, 끊김, 프로토콜 오류
+    Session,     // 등록, 로그인
+    Room,        // 방 생성, 입장
+    Message,     // 채팅 메시지 (가장 잦다)
+    File,        // 파일 업로드 알림
+    Outbound,    // 느린 수신자
+    Count
+};
+
+struct LogConfig {
+    LogLevel level = LogLevel::Info;
+    QString path;                          // 비어 있으면 stderr
+    qint64 maxFileBytes = 64 * 1024 * 1024;  // 넘으면 파일을 돌린다
+    int maxFiles = 5;                      // 보관하는 이전 파일 수 (path.1 ~ path.N)
+    int flushIntervalMs = 50;              // 기록 스레드가 모아 쓰는 주기
+    int ratePerSecond = 200;               // 종류별, 스레드별 초당 최대 줄 수 (0이면 무제한)
+    int messageSampleEvery = 1;            // 채팅 메시지 로그는 N개 중 하나만 남긴다
+    bool includeBodies = false;            // 채팅 본문과 파일 이름을 남길지
+};
+
+// 비동기 로거
+// 각 스레드는 자기 전용 링 버퍼(단일 생산자/단일 소비자)에 기록만 하고 곧바로 돌아간다.
+// 잠금도 시스템 호출도 없어서 메시지 처리 경로에서 써도 된다.
+// 기록 스레드가 주기적으로 모든 링을 비워 시각순으로 모아 한 번에 쓰고 파일을 돌린다.
+// 링이 가득 차거나 한도를 넘은 줄은 버리고 개수만 센 뒤 요약 한 줄로 남긴다.
+class Logger {
+public:
+    static Logger* instance();
+
+    // 시작 전에 한 번 설정한다
+    void configure(const LogConfig& config);
+    // 기록 스레드를 띄우고 qDebug/qWarning도 이쪽으로 돌린다
+    bool start();
+    // 남은 줄을 모두 쓰고 기록 스레드를 멈춘다
+    void stop();
+
+    // 이 줄을 남길지 (수준, 표본, 초당 한도). 통과하면 한도를 하나 쓴다.
+    bool shouldLog(LogLevel level, LogEvent event);
+    bool includeBodies() const { return settings.includeBodies; }
+    void write(LogLevel level, LogEvent event, const QString& text);
+
+private:
+    struct Record {
+        qint64 time = 0;       // ms since epoch
+        LogLevel level = LogLevel::Info;
+        QString text;
+        int thread = 0;        // flush가 모은 링 목록에서의 위치
+    };
+
+    // 스레드 하나의 링. 그 스레드만 head를 올리고 기록 스레드만 tail을 올린다.
+    // 스레드가 끝나면 retired가 서고, 기록 스레드가 남은 줄을 마저 쓴 뒤 지운다.
+    struct Ring {
+        static const quint32 kCapacity = 4096;
+
+        Record slots[kCapacity];
+        QAtomicInteger<quint32> head;
+        QAtomicInteger<quint32> tail;
+        QAtomicInteger<quint64> dropped;     // 링이 가득 차 버린 줄
+        QAtomicInteger<quint64> suppressed;  // 초당 한도로 버린 줄
+        QAtomicInt retired;                  // 소유 스레드가 끝났다
+        QString threadName;
+
+        // 아래는 소유 스레드만 쓴다
+        qint64 windowStart[int(LogEvent::Count)] = {};
+        int windowCount[int(LogEvent::Count)] = {};
+        quint64 sampleCounter = 0;
+    };
+
+    Logger() {}
+    ~Logger();
+
+    Ring* localRing();
+    // 스레드가 끝날 때 그 스레드의 링을 넘긴다
+    void retire(Ring *ring);
+    void flush();
+    bool openOutput();
+    void rotate();
+
+    LogConfig settings;
+    QMutex ringMutex;          // rings 등록만 보호한다
+    QVector<Ring*> rings;
+    int ringsCreated = 0;      // 이름 없는 스레드 번호 (ringMutex)
+    QThread *writerThread = nullptr;
+    QFile output;
+    qint64 outputBytes = 0;
+    QAtomicInt running;        // 기록 스레드가 돌고 있다 (모든 스레드가 읽는다)
+
+    Q_DISABLE_COPY(Logger)
+};
+
+// 로그 한 줄을 qDebug처럼 이어 붙여 만든다. 소멸할 때 링에 넣는다.
+class LogLine {
+public:
+    LogLine(LogLevel level, LogEvent event) : level(level), event(event), stream(&text) {
+        stream.noquote();
+    }
+    ~LogLine() { Logger::instance()->write(level, event, text); }
+
+    QDebug& operator()() { return stream; }
+
+private:
+    LogLevel level;
+    LogEvent event;
+    QString text;
+    QDebug stream;
+};
+
+// 걸러지는 줄은 인자를 계산하지도 않는다
+#define CHAT_LOG(level, event) \
+    if (!Logger::instance()->shouldLog(LogLevel::level, LogEvent::event)) {} else LogLine(LogLevel::level, LogEvent::event)()
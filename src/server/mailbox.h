@@ -0,0 +1,96 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QThread>
+
+// 워커 간 메시지 전달용 lock-free MPSC 큐 (Vyukov 방식)
+// push는 어느 스레드에서나 호출할 수 있고, drain은 소유 워커 스레드만 호출한다.
+// push가 true를 반환하면 수신 측을 깨우는 이벤트를 한 번 보내야 한다.
+// 이미 깨우기가 예약되어 있으면 false이므로 이벤트가 메시지 수만큼 쌓이지 않는다.
+template <typename T>
+class Mailbox {
+public:
+    Mailbox() : head(&stub), tail(&stub) {}
+
+    ~Mailbox() {
+        T value;
+        while (pop(value)) {}
+    }
+
+    bool push(const T& value) {
+        Node *node = new Node(value);
+        Node *prev = head.fetchAndStoreOrdered(node);
+        prev->next.storeRelease(node);
+        return wakeScheduled.testAndSetOrdered(0, 1);
+    }
+
+    // 쌓인 항목을 모두 꺼내 handler에 넘긴다. 처리한 개수를 반환한다.
+    template <typename Handler>
+    int drain(Handler handler) {
+        // 먼저 플래그를 내려야 이후의 push가 새 깨우기를 예약한다
+        wakeScheduled.storeRelease(0);
+
+        int count = 0;
+        T value;
+        while (pop(value)) {
+            handler(value);
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    struct Node {
+        Node() : next(nullptr) {}
+        explicit Node(const T& v) : next(nullptr), value(v) {}
+        QAtomicPointer<Node> next;
+        T value;
+    };
+
+    bool pop(T& value) {
+        for (;;) {
+            Node *t = tail;
+            Node *next = t->next.loadAcquire();
+
+            if (t == &stub) {
+                if (!next) return false;
+                tail = next;
+                t = next;
+                next = next->next.loadAcquire();
+            }
+
+            if (next) {
+                tail = next;
+                value = t->value;
+                delete t;
+                return true;
+            }
+
+            if (t != head.loadAcquire()) {
+                // 생산자가 head 교체와 next 연결 사이에 있다. 곧 연결된다.
+                QThread::yieldCurrentThread();
+                continue;
+            }
+
+            // 마지막 노드를 꺼내기 위해 stub을 다시 넣는다
+            stub.next.storeRelease(nullptr);
+            Node *prev = head.fetchAndStoreOrdered(&stub);
+            prev->next.storeRelease(&stub);
+
+            next = t->next.loadAcquire();
+            if (next) {
+                tail = next;
+                value = t->value;
+                delete t;
+                return true;
+            }
+            QThread::yieldCurrentThread();
+        }
+    }
+
+    Node stub;
+    QAtomicPointer<Node> head;  // 생산자 쪽
+    Node *tail;                 // 소비자 쪽
+    QAtomicInt wakeScheduled;
+};
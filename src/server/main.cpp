@@ -1,18 +1,249 @@
 #include <QCoreApplication>
+#include <QCommandLineParser>
 #include <QHostAddress>
-#include <QDebug>
+#include <QThread>
 #include "server.h"
+#include "logger.h"
+#ifdef Q_OS_UNIX
+#include <csignal>
+#endif
 
-int main(int argc, char *argv[]) {
-    QCoreApplication app(argc, argv);
-    
-    ChatServer server;
-    if (server.listen(QHostAddress::Any, 12345)) {
-        qDebug() << "Server is running on port 12345";
+static int runServer(QCoreApplication& app, const ServerConfig& config) {
+    ChatServer server(config);
+    if (!server.startupError().isEmpty()) {
+        CHAT_LOG(Error, Server) << server.startupError();
+        return 1;
+    }
+    if (const RecoveryStats *stats = server.recoveryStats()) {
+        CHAT_LOG(Info, Server) << "Recovered" << stats->users << "users and" << stats->rooms << "rooms in"
+                               << stats->totalMs << "ms (snapshot" << stats->snapshotMs << "ms, replayed"
+                               << stats->replayedRecords << "WAL records in" << stats->replayMs << "ms)";
+    }
+    if (server.listenForClients(QHostAddress::Any, config.port)) {
+        CHAT_LOG(Info, Server) << "Server is running on port" << config.port << "with" << server.workerCount()
+                               << "workers";
+        if (!config.files.directory.isEmpty()) {
+            CHAT_LOG(Info, Server) << "File channel on port" << config.files.port << "storing in"
+                                   << config.files.directory;
+        }
     } else {
-        qDebug() << "Failed to start server:" << server.errorString();
+        CHAT_LOG(Error, Server) << "Failed to start server:" << server.errorString();
         return 1;
     }
-    
+
     return app.exec();
-}
\ No newline at end of file
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    // writev/sendfile에는 MSG_NOSIGNAL을 줄 수 없으므로 끊긴 소켓에 써도 죽지 않게 한다
+#ifdef Q_OS_UNIX
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption portOption("port", "Chat port", "port", "12345");
+    QCommandLineOption jsonOnlyOption("json-only", "Do not negotiate the CBOR encoding (debugging)");
+    QCommandLineOption workersOption("workers", "Number of worker event loops", "n",
+                                     QString::number(QThread::idealThreadCount()));
+    QCommandLineOption ioBackendOption("io-backend", "Client socket backend: qt|epoll (epoll is Linux only)",
+                                       "backend", "qt");
+    QCommandLineOption highWatermarkOption("outbound-high", "Per-connection outbound high watermark (KiB)",
+                                           "kib", "1024");
+    QCommandLineOption lowWatermarkOption("outbound-low", "Per-connection outbound low watermark (KiB)",
+                                          "kib", "256");
+    QCommandLineOption slowPolicyOption("slow-consumer", "Policy for clients over the limit: drop|disconnect",
+                                        "policy", "drop");
+    QCommandLineOption slowGraceOption("slow-grace-ms", "How long a client may stay over the limit",
+                                       "ms", "2000");
+    QCommandLineOption historyDirOption("history-dir", "Directory for per-room message history (disabled if empty)",
+                                        "path");
+    QCommandLineOption historyBackfillOption("history-backfill", "Messages sent to a client joining a room",
+                                             "n", "50");
+    QCommandLineOption historyMaxSizeOption("history-max-mb", "Per-room history size limit (0 = unlimited)",
+                                            "mb", "256");
+    QCommandLineOption historyMaxAgeOption("history-max-age-days", "History retention (0 = unlimited)",
+                                           "days", "30");
+    QCommandLineOption historySegmentOption("history-segment-mb", "History segment file size", "mb", "8");
+    QCommandLineOption historySyncOption("history-sync-ms", "History group commit interval", "ms", "20");
+    QCommandLineOption dataDirOption("data-dir", "Directory for the user/room snapshot and WAL (in-memory if empty)",
+                                     "path");
+    QCommandLineOption snapshotIntervalOption("snapshot-interval", "Seconds between state snapshots",
+                                              "secs", "300");
+    QCommandLineOption filesDirOption("files-dir", "Directory for the per-room file store (file channel off if empty)",
+                                      "path");
+    QCommandLineOption filesPortOption("files-port", "File transfer channel port", "port", "12346");
+    QCommandLineOption filesMaxSizeOption("files-max-mb", "Largest accepted upload", "mb", "1024");
+    QCommandLineOption coalesceOption("write-coalesce-us",
+                                      "Batch outbound frames per connection for up to this long "
+                                      "(0 = until the end of the event loop tick, -1 = write each frame immediately)",
+                                      "us", "0");
+    QCommandLineOption compressOption("compress-threshold",
+                                      "Compress outbound frames of at least this many bytes for clients "
+                                      "that negotiate it (0 = never)",
+                                      "bytes", QString::number(Protocol::kDefaultCompressThreshold));
+    QCommandLineOption rateLimitsOption("rate-limits",
+                                        "Per-connection limits as type=rate:burst,... "
+                                        "(e.g. connection=50:100,message=20:40; off = unlimited)",
+                                        "spec");
+    QCommandLineOption overloadLagOption("overload-lag-ms", "Event loop lag that counts as full load (0 = ignore)",
+                                         "ms", "100");
+    QCommandLineOption overloadQueueOption("overload-queue-mb",
+                                           "Server-wide outbound backlog that counts as full load (0 = ignore)",
+                                           "mb", "256");
+    QCommandLineOption heartbeatOption("heartbeat-ms", "Ping connections that have been quiet this long (0 = off)",
+                                       "ms", "30000");
+    QCommandLineOption idleTimeoutOption("idle-timeout-ms", "Close heartbeat connections quiet this long (0 = off)",
+                                         "ms", "90000");
+    QCommandLineOption loginDeadlineOption("login-deadline-ms", "Close connections that do not log in within this time "
+                                           "(0 = off)", "ms", "300000");
+    QCommandLineOption writeStallOption("write-stall-ms", "Close connections whose pending output makes no progress "
+                                        "for this long (0 = off)", "ms", "30000");
+    QCommandLineOption maxRoomsOption("max-rooms", "Rooms one multi-room connection may subscribe to", "n", "32");
+    QCommandLineOption resumeWindowOption("resume-window-ms", "Keep a dropped session resumable this long (0 = off)",
+                                          "ms", "120000");
+    QCommandLineOption replayFramesOption("replay-frames", "Recent messages kept per room for resumed sessions "
+                                          "(0 = off)", "n", "256");
+    QCommandLineOption nodesOption("nodes", "All federated server processes as id=host:port,... where the address "
+                                   "is each node's node link (the same list on every node)", "spec");
+    QCommandLineOption nodeIdOption("node-id", "This process's id in --nodes (federation is off without it)", "id");
+    QCommandLineOption metricsPortOption("metrics-port", "Serve Prometheus metrics on localhost:<port>/metrics (0 = off)",
+                                         "port", "0");
+    QCommandLineOption logLevelOption("log-level", "debug|info|warning|error|off", "level", "info");
+    QCommandLineOption logFileOption("log-file", "Write the log to this file instead of stderr", "path");
+    QCommandLineOption logMaxSizeOption("log-max-mb", "Rotate the log file at this size", "mb", "64");
+    QCommandLineOption logFilesOption("log-files", "Rotated log files to keep", "n", "5");
+    QCommandLineOption logRateOption("log-rate", "Max log lines per second per event kind and thread (0 = unlimited)",
+                                     "n", "200");
+    QCommandLineOption logSampleOption("log-sample", "Log one of every N chat messages (at debug level)", "n", "1");
+    QCommandLineOption logBodiesOption("log-bodies", "Include chat text and file names in the log");
+    parser.addOption(portOption);
+    parser.addOption(jsonOnlyOption);
+    parser.addOption(workersOption);
+    parser.addOption(ioBackendOption);
+    parser.addOption(highWatermarkOption);
+    parser.addOption(lowWatermarkOption);
+    parser.addOption(slowPolicyOption);
+    parser.addOption(slowGraceOption);
+    parser.addOption(dataDirOption);
+    parser.addOption(snapshotIntervalOption);
+    parser.addOption(historyDirOption);
+    parser.addOption(historyBackfillOption);
+    parser.addOption(historyMaxSizeOption);
+    parser.addOption(historyMaxAgeOption);
+    parser.addOption(historySegmentOption);
+    parser.addOption(historySyncOption);
+    parser.addOption(filesDirOption);
+    parser.addOption(filesPortOption);
+    parser.addOption(filesMaxSizeOption);
+    parser.addOption(coalesceOption);
+    parser.addOption(compressOption);
+    parser.addOption(rateLimitsOption);
+    parser.addOption(overloadLagOption);
+    parser.addOption(overloadQueueOption);
+    parser.addOption(heartbeatOption);
+    parser.addOption(idleTimeoutOption);
+    parser.addOption(loginDeadlineOption);
+    parser.addOption(writeStallOption);
+    parser.addOption(maxRoomsOption);
+    parser.addOption(resumeWindowOption);
+    parser.addOption(replayFramesOption);
+    parser.addOption(nodesOption);
+    parser.addOption(nodeIdOption);
+    parser.addOption(metricsPortOption);
+    parser.addOption(logLevelOption);
+    parser.addOption(logFileOption);
+    parser.addOption(logMaxSizeOption);
+    parser.addOption(logFilesOption);
+    parser.addOption(logRateOption);
+    parser.addOption(logSampleOption);
+    parser.addOption(logBodiesOption);
+    parser.process(app);
+
+    LogConfig logConfig;
+    static const char *const levelNames[] = { "debug", "info", "warning", "error", "off" };
+    for (int i = 0; i <= int(LogLevel::Off); ++i) {
+        if (parser.value(logLevelOption) == levelNames[i]) logConfig.level = LogLevel(i);
+    }
+    logConfig.path = parser.value(logFileOption);
+    logConfig.maxFileBytes = qMax(1LL, parser.value(logMaxSizeOption).toLongLong()) * 1024 * 1024;
+    logConfig.maxFiles = parser.value(logFilesOption).toInt();
+    logConfig.ratePerSecond = parser.value(logRateOption).toInt();
+    logConfig.messageSampleEvery = parser.value(logSampleOption).toInt();
+    logConfig.includeBodies = parser.isSet(logBodiesOption);
+    Logger::instance()->configure(logConfig);
+    if (!Logger::instance()->start()) {
+        return 1;
+    }
+
+    ServerConfig config;
+    config.port = quint16(parser.value(portOption).toUInt());
+    config.workers = parser.value(workersOption).toInt();
+    config.binaryEncoding = !parser.isSet(jsonOnlyOption);
+    if (parser.value(ioBackendOption) == "epoll") {
+#ifdef Q_OS_LINUX
+        config.ioBackend = IoBackend::Epoll;
+#else
+        CHAT_LOG(Warning, Server) << "The epoll backend is Linux only, using the Qt backend";
+#endif
+    }
+    config.outbound.highWatermark = parser.value(highWatermarkOption).toLongLong() * 1024;
+    config.outbound.lowWatermark = qMin(parser.value(lowWatermarkOption).toLongLong() * 1024,
+                                        config.outbound.highWatermark);
+    config.outbound.overLimitGraceMs = parser.value(slowGraceOption).toInt();
+    config.outbound.policy = parser.value(slowPolicyOption) == "disconnect"
+        ? SlowConsumerPolicy::Disconnect : SlowConsumerPolicy::DropOldest;
+    config.state.directory = parser.value(dataDirOption);
+    config.state.snapshotIntervalSecs = parser.value(snapshotIntervalOption).toInt();
+    config.history.directory = parser.value(historyDirOption);
+    config.history.backfillCount = parser.value(historyBackfillOption).toInt();
+    config.history.maxRoomBytes = parser.value(historyMaxSizeOption).toLongLong() * 1024 * 1024;
+    config.history.maxAgeSecs = parser.value(historyMaxAgeOption).toLongLong() * 24 * 3600;
+    config.history.segmentSize = qMax(1LL, parser.value(historySegmentOption).toLongLong()) * 1024 * 1024;
+    config.history.syncIntervalMs = parser.value(historySyncOption).toInt();
+    config.files.directory = parser.value(filesDirOption);
+    config.files.port = quint16(parser.value(filesPortOption).toUInt());
+    config.files.maxFileBytes = parser.value(filesMaxSizeOption).toLongLong() * 1024 * 1024;
+    config.writeCoalesceUs = parser.value(coalesceOption).toInt();
+    config.compressThreshold = qMax(0, parser.value(compressOption).toInt());
+    if (parser.isSet(rateLimitsOption)) {
+        QString error;
+        if (!config.rateLimits.parse(parser.value(rateLimitsOption), &error)) {
+            CHAT_LOG(Error, Server) << error;
+            Logger::instance()->stop();
+            return 1;
+        }
+    }
+    config.overload.lagLimitMs = qMax(0, parser.value(overloadLagOption).toInt());
+    config.overload.queueLimitBytes = qMax(0LL, parser.value(overloadQueueOption).toLongLong()) * 1024 * 1024;
+    config.timeouts.heartbeatIntervalMs = qMax(0, parser.value(heartbeatOption).toInt());
+    config.timeouts.idleTimeoutMs = qMax(0, parser.value(idleTimeoutOption).toInt());
+    config.timeouts.loginDeadlineMs = qMax(0, parser.value(loginDeadlineOption).toInt());
+    config.timeouts.writeStallMs = qMax(0, parser.value(writeStallOption).toInt());
+    config.maxRoomsPerConnection = qMax(1, parser.value(maxRoomsOption).toInt());
+    config.resume.windowMs = qMax(0, parser.value(resumeWindowOption).toInt());
+    config.resume.replayFrames = qMax(0, parser.value(replayFramesOption).toInt());
+    config.metricsPort = quint16(parser.value(metricsPortOption).toUInt());
+    if (parser.isSet(nodeIdOption)) {
+        // 한 머신에서 여러 노드를 띄울 때는 --port, --nodes의 링크 포트, 데이터 디렉터리를 노드마다 달리 준다
+        QString error;
+        bool idOk = false;
+        config.federation.nodeId = parser.value(nodeIdOption).toInt(&idOk);
+        if (!config.federation.parse(parser.value(nodesOption), &error)) {
+            CHAT_LOG(Error, Server) << error;
+            Logger::instance()->stop();
+            return 1;
+        }
+        if (!idOk || !config.federation.node(config.federation.nodeId)) {
+            CHAT_LOG(Error, Server) << "--node-id must be one of the ids in --nodes";
+            Logger::instance()->stop();
+            return 1;
+        }
+    }
+
+    // 서버(와 워커 스레드)가 모두 끝난 뒤에 남은 로그를 내린다
+    int result = runServer(app, config);
+    Logger::instance()->stop();
+    return result;
+}
@@ -0,0 +1,220 @@
+#include "metrics.h"
+#include <QTcpSocket>
+#include <QtAlgorithms>
+#include <QTimer>
+
+const int HistogramSnapshot::kBuckets;
+const int MetricsEndpoint::kMaxRequestSize;
+const int MetricsEndpoint::kRequestTimeoutMs;
+
+HistogramSnapshot& HistogramSnapshot::operator+=(const HistogramSnapshot& other) {
+    for (int i = 0; i <= kBuckets; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    return *this;
+}
+
+void MetricHistogram::record(quint64 value) {
+    // 값 이상인 가장 작은 2의 거듭제곱 칸
+    int bucket = value <= 1 ? 0 : 64 - qCountLeadingZeroBits(value - 1);
+    buckets[qMin(bucket, int(HistogramSnapshot::kBuckets))].fetchAndAddRelaxed(1);
+    count.fetchAndAddRelaxed(1);
+    sum.fetchAndAddRelaxed(value);
+}
+
+HistogramSnapshot MetricHistogram::snapshot() const {
+    HistogramSnapshot result;
+    for (int i = 0; i <= HistogramSnapshot::kBuckets; ++i) {
+        result.buckets[i] = buckets[i].loadAcquire();
+    }
+    result.count = count.loadAcquire();
+    result.sum = sum.loadAcquire();
+    return result;
+}
+
+MetricsSnapshot& MetricsSnapshot::operator+=(const MetricsSnapshot& other) {
+    for (int i = 0; i < int(MessageType::Count); ++i) {
+        messageTime[i] += other.messageTime[i];
+    }
+    decodeErrors += other.decodeErrors;
+    unhandledMessages += other.unhandledMessages;
+    fanout += other.fanout;
+    crossWorkerPosts += other.crossWorkerPosts;
+    outboundFrames += other.outboundFrames;
+    outboundBytes += other.outboundBytes;
+    outboundWrites += other.outboundWrites;
+    compressedFrames += other.compressedFrames;
+    compressionBytesIn += other.compressionBytesIn;
+    compressionBytesOut += other.compressionBytesOut;
+    compressionNanos += other.compressionNanos;
+    compressionSaved += other.compressionSaved;
+    for (int i = 0; i < int(MessageType::Count); ++i) {
+        rateLimited[i] += other.rateLimited[i];
+    }
+    for (int i = 0; i < int(TimeoutKind::Count); ++i) {
+        timeouts[i] += other.timeouts[i];
+    }
+    heartbeatPings += other.heartbeatPings;
+    for (int i = 0; i < int(ResumeOutcome::Count); ++i) {
+        resumes[i] += other.resumes[i];
+    }
+    replayedFrames += other.replayedFrames;
+    ioWakeups += other.ioWakeups;
+    loopLag += other.loopLag;
+    connections += other.connections;
+    return *this;
+}
+
+void WorkerMetrics::recordMessage(MessageType type, qint64 nanos) {
+    messageTime[int(type)].record(quint64(qMax<qint64>(0, nanos)) / 1000);
+}
+
+void WorkerMetrics::recordBroadcast(int recipients, int remoteWorkers) {
+    fanout.record(quint64(qMax(0, recipients)));
+    if (remoteWorkers > 0) {
+        crossWorkerPosts.fetchAndAddRelaxed(quint64(remoteWorkers));
+    }
+}
+
+void WorkerMetrics::recordResume(ResumeOutcome outcome, int replayed) {
+    resumes[int(outcome)].fetchAndAddRelaxed(1);
+    if (replayed > 0) {
+        replayedFrames.fetchAndAddRelaxed(quint64(replayed));
+    }
+}
+
+void WorkerMetrics::recordWrite(qint64 bytes) {
+    outboundFrames.fetchAndAddRelaxed(1);
+    outboundBytes.fetchAndAddRelaxed(quint64(bytes));
+}
+
+void WorkerMetrics::recordCompression(const Protocol::CompressionStats& stats) {
+    if (stats.bytesIn == 0) return;
+    compressedFrames.fetchAndAddRelaxed(quint64(stats.frames));
+    compressionBytesIn.fetchAndAddRelaxed(quint64(stats.bytesIn));
+    compressionBytesOut.fetchAndAddRelaxed(quint64(stats.bytesOut));
+    compressionNanos.fetchAndAddRelaxed(quint64(stats.nanos));
+}
+
+MetricsSnapshot WorkerMetrics::snapshot() const {
+    MetricsSnapshot result;
+    for (int i = 0; i < int(MessageType::Count); ++i) {
+        result.messageTime[i] = messageTime[i].snapshot();
+    }
+    result.decodeErrors = decodeErrors.loadAcquire();
+    result.unhandledMessages = unhandledMessages.loadAcquire();
+    result.fanout = fanout.snapshot();
+    result.crossWorkerPosts = crossWorkerPosts.loadAcquire();
+    result.outboundFrames = outboundFrames.loadAcquire();
+    result.outboundBytes = outboundBytes.loadAcquire();
+    result.outboundWrites = outboundWrites.loadAcquire();
+    result.compressedFrames = compressedFrames.loadAcquire();
+    result.compressionBytesIn = compressionBytesIn.loadAcquire();
+    result.compressionBytesOut = compressionBytesOut.loadAcquire();
+    result.compressionNanos = compressionNanos.loadAcquire();
+    result.compressionSaved = compressionSaved.loadAcquire();
+    for (int i = 0; i < int(MessageType::Count); ++i) {
+        result.rateLimited[i] = rateLimited[i].loadAcquire();
+    }
+    for (int i = 0; i < int(TimeoutKind::Count); ++i) {
+        result.timeouts[i] = timeouts[i].loadAcquire();
+    }
+    result.heartbeatPings = heartbeatPings.loadAcquire();
+    for (int i = 0; i < int(ResumeOutcome::Count); ++i) {
+        result.resumes[i] = resumes[i].loadAcquire();
+    }
+    result.replayedFrames = replayedFrames.loadAcquire();
+    result.ioWakeups = ioWakeups.loadAcquire();
+    result.loopLag = loopLag.snapshot();
+    result.connections = connections.loadAcquire();
+    return result;
+}
+
+void PrometheusWriter::header(const char *name, const char *type, const char *help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void PrometheusWriter::sample(const char *name, double value, const QString& labels) {
+    out += name;
+    if (!labels.isEmpty()) {
+        out += '{';
+        out += labels.toUtf8();
+        out += '}';
+    }
+    out += ' ';
+    out += QByteArray::number(value, 'g', 15);
+    out += '\n';
+}
+
+void PrometheusWriter::histogram(const char *name, const HistogramSnapshot& histogram, double scale,
+                                 const QString& labels) {
+    QByteArray base(name);
+    QByteArray bucketName = base + "_bucket";
+    QString prefix = labels.isEmpty() ? QString() : labels + QLatin1Char(',');
+
+    // Prometheus 칸은 누적 개수다
+    quint64 cumulative = 0;
+    for (int i = 0; i < HistogramSnapshot::kBuckets; ++i) {
+        cumulative += histogram.buckets[i];
+        double bound = double(quint64(1) << i) / scale;
+        sample(bucketName.constData(), double(cumulative),
+               prefix + QString("le=\"%1\"").arg(bound, 0, 'g', 15));
+    }
+    sample(bucketName.constData(), double(histogram.count), prefix + QLatin1String("le=\"+Inf\""));
+    sample((base + "_sum").constData(), double(histogram.sum) / scale, labels);
+    sample((base + "_count").constData(), double(histogram.count), labels);
+}
+
+MetricsEndpoint::MetricsEndpoint(std::function<QByteArray()> render, QObject *parent)
+    : QTcpServer(parent), render(render) {}
+
+void MetricsEndpoint::incomingConnection(qintptr socketDescriptor) {
+    QTcpSocket *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return;
+    }
+
+    connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    QTimer::singleShot(kRequestTimeoutMs, socket, [socket]() { socket->abort(); });
+
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+        // 요청 헤더가 끝날 때까지 모은다
+        if (!socket->property("request").isNull()) return;  // 이미 응답함
+        QByteArray request = socket->peek(kMaxRequestSize);
+        if (!request.contains("\r\n\r\n") && !request.contains("\n\n")) {
+            if (request.size() >= kMaxRequestSize) socket->abort();
+            return;
+        }
+        socket->setProperty("request", true);
+
+        QList<QByteArray> line = request.left(request.indexOf('\n')).trimmed().split(' ');
+        QByteArray path = line.size() >= 2 ? line.at(1) : QByteArray();
+        QByteArray status = "200 OK";
+        QByteArray body;
+        if (line.at(0) != "GET") {
+            status = "405 Method Not Allowed";
+        } else if (path != "/metrics" && path != "/") {
+            status = "404 Not Found";
+        } else {
+            body = render();
+        }
+
+        QByteArray response = "HTTP/1.0 " + status + "\r\n"
+                              "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                              "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                              "Connection: close\r\n\r\n" + body;
+        socket->write(response);
+        socket->disconnectFromHost();
+    });
+}
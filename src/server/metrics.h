@@ -0,0 +1,154 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QString>
+#include <QTcpServer>
+#include <functional>
+#include "protocol.h"
+
+// 2의 거듭제곱 경계를 쓰는 히스토그램 (경계: 1, 2, 4, ... 2^(kBuckets-1), 마지막 칸은 +Inf)
+// 한 스레드만 기록하고, 다른 스레드는 아무 때나 snapshot으로 읽는다.
+struct HistogramSnapshot {
+    static const int kBuckets = 22;  // 마이크로초 기준 약 2초까지
+
+    quint64 buckets[kBuckets + 1] = {};  // 칸별 개수 (누적 아님)
+    quint64 count = 0;
+    quint64 sum = 0;
+
+    HistogramSnapshot& operator+=(const HistogramSnapshot& other);
+};
+
+class MetricHistogram {
+public:
+    void record(quint64 value);
+    HistogramSnapshot snapshot() const;
+
+private:
+    QAtomicInteger<quint64> buckets[HistogramSnapshot::kBuckets + 1];
+    QAtomicInteger<quint64> count;
+    QAtomicInteger<quint64> sum;
+};
+
+// 연결을 끊은 제한 시간 종류
+enum class TimeoutKind {
+    Idle,           // 하트비트에도 응답이 없다
+    LoginDeadline,  // 로그인하지 않았다
+    WriteStall,     // 송신이 진척되지 않는다
+    Count
+};
+
+// 세션 이어 받기 결과
+enum class ResumeOutcome {
+    Replayed,    // 놓친 메시지를 보관분에서 모두 다시 보냈다
+    Backfilled,  // 보관분이 모자라 최근 기록으로 대신했다
+    Rejected,    // 모르거나 만료된 토큰
+    Count
+};
+
+// 워커 하나의 계측 값을 모은 사본. 합산해서 출력한다.
+struct MetricsSnapshot {
+    HistogramSnapshot messageTime[int(MessageType::Count)];  // 타입별 processMessage 시간 (us)
+    quint64 decodeErrors = 0;        // 해석하지 못한 프레임
+    quint64 unhandledMessages = 0;   // 처리 함수가 없는 타입
+    HistogramSnapshot fanout;        // 방송 한 번의 수신자 수
+    quint64 crossWorkerPosts = 0;    // 다른 워커로 넘긴 방송
+    quint64 outboundFrames = 0;      // 소켓에 넘긴 프레임
+    quint64 outboundBytes = 0;       // 소켓에 넘긴 바이트
+    quint64 outboundWrites = 0;      // 쓰기 호출 (writev 또는 QTcpSocket::write)
+    quint64 compressedFrames = 0;    // 압축해서 보낸 (공유) 프레임
+    quint64 compressionBytesIn = 0;  // 압축을 시도한 페이로드 바이트
+    quint64 compressionBytesOut = 0; // 압축 뒤 페이로드 바이트 (줄지 않아 원본을 보낸 경우 포함)
+    quint64 compressionNanos = 0;    // 압축에 쓴 시간
+    quint64 compressionSaved = 0;    // 압축 프레임을 보내 줄어든 송신 바이트 (수신자마다 센다)
+    quint64 rateLimited[int(MessageType::Count)] = {};  // 수신 한도를 넘어 버린 메시지 (타입별)
+    quint64 timeouts[int(TimeoutKind::Count)] = {};  // 제한 시간으로 끊은 연결 (종류별)
+    quint64 heartbeatPings = 0;      // 보낸 ping
+    quint64 resumes[int(ResumeOutcome::Count)] = {};  // 세션 이어 받기 (결과별)
+    quint64 replayedFrames = 0;      // 이어 받기로 다시 보낸 방 메시지
+    quint64 ioWakeups = 0;           // 소켓 때문에 이벤트 루프가 깨어난 횟수
+    HistogramSnapshot loopLag;       // 이벤트 루프 지연 (us)
+    qint64 connections = 0;          // 현재 연결 수
+
+    MetricsSnapshot& operator+=(const MetricsSnapshot& other);
+};
+
+// 워커별 계측. 워커 스레드만 쓰므로 캐시 라인을 두고 다툴 일이 없고
+// 읽는 쪽은 relaxed 원자 연산으로 값을 모은다. 항상 켜 두어도 부담이 없다.
+class WorkerMetrics {
+public:
+    void recordMessage(MessageType type, qint64 nanos);
+    void recordDecodeError() { decodeErrors.fetchAndAddRelaxed(1); }
+    void recordUnhandled() { unhandledMessages.fetchAndAddRelaxed(1); }
+    void recordBroadcast(int recipients, int remoteWorkers);
+    void recordWrite(qint64 bytes);
+    void recordWriteCall() { outboundWrites.fetchAndAddRelaxed(1); }
+    void recordCompression(const Protocol::CompressionStats& stats);
+    void recordCompressedSend(qint64 saved) { compressionSaved.fetchAndAddRelaxed(quint64(saved)); }
+    void recordRateLimited(MessageType type) { rateLimited[int(type)].fetchAndAddRelaxed(1); }
+    void recordTimeout(TimeoutKind kind) { timeouts[int(kind)].fetchAndAddRelaxed(1); }
+    void recordPing() { heartbeatPings.fetchAndAddRelaxed(1); }
+    void recordResume(ResumeOutcome outcome, int replayed);
+    void recordWakeup() { ioWakeups.fetchAndAddRelaxed(1); }
+    void recordLoopLag(qint64 micros) { loopLag.record(quint64(qMax<qint64>(0, micros))); }
+    void connectionOpened() { connections.fetchAndAddRelaxed(1); }
+    void connectionClosed() { connections.fetchAndSubRelaxed(1); }
+
+    MetricsSnapshot snapshot() const;
+
+private:
+    MetricHistogram messageTime[int(MessageType::Count)];
+    QAtomicInteger<quint64> decodeErrors;
+    QAtomicInteger<quint64> unhandledMessages;
+    MetricHistogram fanout;
+    QAtomicInteger<quint64> crossWorkerPosts;
+    QAtomicInteger<quint64> outboundFrames;
+    QAtomicInteger<quint64> outboundBytes;
+    QAtomicInteger<quint64> outboundWrites;
+    QAtomicInteger<quint64> compressedFrames;
+    QAtomicInteger<quint64> compressionBytesIn;
+    QAtomicInteger<quint64> compressionBytesOut;
+    QAtomicInteger<quint64> compressionNanos;
+    QAtomicInteger<quint64> compressionSaved;
+    QAtomicInteger<quint64> rateLimited[int(MessageType::Count)];
+    QAtomicInteger<quint64> timeouts[int(TimeoutKind::Count)];
+    QAtomicInteger<quint64> heartbeatPings;
+    QAtomicInteger<quint64> resumes[int(ResumeOutcome::Count)];
+    QAtomicInteger<quint64> replayedFrames;
+    QAtomicInteger<quint64> ioWakeups;
+    MetricHistogram loopLag;
+    QAtomicInteger<qint64> connections;
+};
+
+// Prometheus 텍스트 형식(0.0.4) 작성기
+class PrometheusWriter {
+public:
+    void header(const char *name, const char *type, const char *help);
+    void sample(const char *name, double value, const QString& labels = QString());
+    // scale로 나눠 단위를 바꾼다 (예: 마이크로초 → 초는 1e6)
+    void histogram(const char *name, const HistogramSnapshot& histogram, double scale,
+                   const QString& labels = QString());
+
+    QByteArray text() const { return out; }
+
+private:
+    QByteArray out;
+};
+
+// 계측 값을 읽어 가는 로컬 HTTP 엔드포인트 (GET /metrics)
+// 요청마다 render를 메인 스레드에서 불러 응답하고 연결을 닫는다.
+class MetricsEndpoint : public QTcpServer {
+    Q_OBJECT
+
+public:
+    explicit MetricsEndpoint(std::function<QByteArray()> render, QObject *parent = nullptr);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    static const int kMaxRequestSize = 8 * 1024;
+    static const int kRequestTimeoutMs = 5000;
+
+    std::function<QByteArray()> render;
+};
@@ -0,0 +1,103 @@
+#include "outboundqueue.h"
+
+OutboundTotals& OutboundTotals::operator+=(const OutboundTotals& other) {
+    for (int i = 0; i < int(DropReason::Count); ++i) {
+        droppedFrames[i] += other.droppedFrames[i];
+        droppedBytes[i] += other.droppedBytes[i];
+    }
+    evictions += other.evictions;
+    return *this;
+}
+
+void OutboundStats::recordDrop(DropReason reason, qint64 size) {
+    frames[int(reason)].fetchAndAddRelaxed(1);
+    bytes[int(reason)].fetchAndAddRelaxed(quint64(size));
+}
+
+OutboundTotals OutboundStats::snapshot() const {
+    OutboundTotals totals;
+    for (int i = 0; i < int(DropReason::Count); ++i) {
+        totals.droppedFrames[i] = frames[i].loadAcquire();
+        totals.droppedBytes[i] = bytes[i].loadAcquire();
+    }
+    totals.evictions = evictionCount.loadAcquire();
+    return totals;
+}
+
+bool OutboundQueue::enqueue(const QByteArray& frame, bool droppable, OutboundStats& stats) {
+    Frame entry;
+    entry.data = frame;
+    entry.droppable = droppable;
+    frames.append(entry);
+    bytes += frame.size();
+
+    if (bytes <= limits.highWatermark) return true;
+
+    if (!overLimitSince.isValid()) {
+        overLimitSince.start();
+    }
+    if (overLimitSince.elapsed() < limits.overLimitGraceMs && bytes <= limits.hardLimit()) {
+        return true;  // 잠깐의 폭주는 흡수한다
+    }
+
+    if (limits.policy == SlowConsumerPolicy::Disconnect) {
+        return false;
+    }
+
+    dropOldest(stats);
+    // 버릴 수 있는 프레임이 없어 계속 커지면 끊는다
+    return bytes <= limits.hardLimit();
+}
+
+QByteArray OutboundQueue::takeFirst() {
+    QByteArray data;
+    data.swap(frames[head].data);
+    ++head;
+    bytes -= data.size();
+
+    if (head == frames.size()) {
+        frames.clear();
+        if (frames.capacity() > 64) frames.squeeze();
+        head = 0;
+    } else if (head >= 64 && head * 2 >= frames.size()) {
+        frames.remove(0, head);  // 꺼낸 자리가 절반을 넘으면 앞으로 당긴다
+        head = 0;
+    }
+
+    if (bytes <= limits.lowWatermark) {
+        overLimitSince.invalidate();
+    }
+    return data;
+}
+
+void OutboundQueue::clear(DropReason reason, OutboundStats& stats) {
+    for (int i = head; i < frames.size(); ++i) {
+        stats.recordDrop(reason, frames.at(i).data.size());
+    }
+    frames.clear();
+    frames.squeeze();
+    head = 0;
+    bytes = 0;
+    overLimitSince.invalidate();
+}
+
+void OutboundQueue::dropOldest(OutboundStats& stats) {
+    // 오래된 채팅 프레임부터 낮은 워터마크 아래로 내려갈 때까지 버린다
+    QVector<Frame> kept;
+    kept.reserve(frames.size() - head);
+    for (int i = head; i < frames.size(); ++i) {
+        const Frame& entry = frames.at(i);
+        if (entry.droppable && bytes > limits.lowWatermark) {
+            bytes -= entry.data.size();
+            stats.recordDrop(DropReason::SlowConsumer, entry.data.size());
+        } else {
+            kept.append(entry);
+        }
+    }
+    frames.swap(kept);
+    head = 0;
+
+    if (bytes <= limits.lowWatermark) {
+        overLimitSince.invalidate();
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QVector>
+
+// 한계를 계속 넘는 느린 수신자에 대한 처리 방식
+enum class SlowConsumerPolicy {
+    DropOldest,  // 가장 오래된 채팅 프레임부터 버린다
+    Disconnect   // 연결을 끊는다
+};
+
+struct OutboundLimits {
+    qint64 highWatermark = 1024 * 1024;  // 이 이상 쌓이면 한계 초과
+    qint64 lowWatermark = 256 * 1024;    // 이 아래로 내려가면 정상으로 복귀
+    int overLimitGraceMs = 2000;         // 한계 초과가 이만큼 지속되면 정책 적용
+    SlowConsumerPolicy policy = SlowConsumerPolicy::DropOldest;
+
+    // 이 크기를 넘으면 유예 시간과 관계없이 정책을 적용한다
+    qint64 hardLimit() const { return highWatermark * 2; }
+};
+
+// 프레임을 버린 이유
+enum class DropReason {
+    SlowConsumer,  // 느린 수신자 큐에서 오래된 채팅 프레임을 버림
+    Disconnected,  // 이미 끊긴 연결로 보내려 함
+    Evicted,       // 느린 수신자를 끊으면서 큐에 남은 프레임을 버림
+    Count
+};
+
+struct OutboundTotals {
+    quint64 droppedFrames[int(DropReason::Count)] = {};
+    quint64 droppedBytes[int(DropReason::Count)] = {};
+    quint64 evictions = 0;
+
+    OutboundTotals& operator+=(const OutboundTotals& other);
+};
+
+// 워커별 송신 카운터. 워커 스레드만 쓰고 다른 스레드는 snapshot으로 읽는다.
+class OutboundStats {
+public:
+    void recordDrop(DropReason reason, qint64 bytes);
+    void recordEviction() { evictionCount.fetchAndAddRelaxed(1); }
+    OutboundTotals snapshot() const;
+
+private:
+    QAtomicInteger<quint64> frames[int(DropReason::Count)];
+    QAtomicInteger<quint64> bytes[int(DropReason::Count)];
+    QAtomicInteger<quint64> evictionCount;
+};
+
+// 연결별 송신 대기열
+// 프레임은 QByteArray(참조 카운트 공유)로 보관하므로 방송 시 수신자마다 복사하지 않는다.
+// 소켓 내부 버퍼에는 일정량만 넘기고 나머지는 여기 두어 쌓인 양을 직접 제한한다.
+// 빈 대기열은 힙을 쓰지 않으므로 유휴 연결의 메모리 부담이 없다.
+class OutboundQueue {
+public:
+    explicit OutboundQueue(const OutboundLimits& limits) : limits(limits) {}
+
+    // 프레임을 추가하고 필요하면 정책을 적용한다. 연결을 끊어야 하면 false.
+    bool enqueue(const QByteArray& frame, bool droppable, OutboundStats& stats);
+    bool isEmpty() const { return head == frames.size(); }
+    int frameCount() const { return frames.size() - head; }
+    qint64 queuedBytes() const { return bytes; }
+    QByteArray takeFirst();
+    // 남은 프레임을 모두 버린다
+    void clear(DropReason reason, OutboundStats& stats);
+
+private:
+    struct Frame {
+        QByteArray data;
+        bool droppable;  // 채팅 프레임처럼 버려도 되는 프레임
+    };
+
+    void dropOldest(OutboundStats& stats);
+
+    const OutboundLimits& limits;
+    QVector<Frame> frames;  // head 앞쪽은 이미 꺼낸 자리
+    int head = 0;
+    qint64 bytes = 0;
+    QElapsedTimer overLimitSince;  // 한계를 넘은 시점 (정상이면 무효)
+};
@@ -0,0 +1,142 @@
+#include "ratelimit.h"
+#include "logger.h"
+#include <QStringList>
+
+const int OverloadMonitor::kMaxWorkers;
+
+bool TokenBucket::take(const RateLimit& limit, qint64 nowMs) {
+    if (!limit.isEnabled()) return true;
+
+    double capacity = qMax(1.0, limit.burst);
+    if (tokens < 0) {
+        tokens = capacity;
+    } else {
+        tokens = qMin(capacity, tokens + limit.rate * double(nowMs - lastMs) / 1000);
+    }
+    lastMs = nowMs;
+
+    if (tokens < 1) return false;
+    tokens -= 1;
+    return true;
+}
+
+RateLimitConfig::RateLimitConfig() {
+    // 사람이 치는 속도보다 넉넉하고 봇의 폭주는 막는 기본값
+    connection = RateLimit(50, 100);
+    perType[int(MessageType::Register)] = RateLimit(1, 3);
+    perType[int(MessageType::Login)] = RateLimit(2, 5);
+    perType[int(MessageType::CreateRoom)] = RateLimit(1, 5);
+    perType[int(MessageType::JoinRoom)] = RateLimit(5, 10);
+    perType[int(MessageType::Message)] = RateLimit(20, 40);
+    perType[int(MessageType::HistoryRequest)] = RateLimit(5, 10);
+    perType[int(MessageType::FileTicketRequest)] = RateLimit(10, 20);
+    assignBuckets();
+}
+
+bool RateLimitConfig::parse(const QString& spec, QString *error) {
+    if (spec.trimmed() == QLatin1String("off")) {
+        connection = RateLimit();
+        for (RateLimit& limit : perType) {
+            limit = RateLimit();
+        }
+        assignBuckets();
+        return true;
+    }
+
+    for (const QString& item : spec.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        // 이름=초당:버스트 (버스트를 빼면 초당 값의 두 배)
+        QStringList pair = item.trimmed().split(QLatin1Char('='));
+        QStringList numbers = pair.value(1).split(QLatin1Char(':'));
+        bool rateOk = false;
+        bool burstOk = true;
+        double rate = numbers.value(0).toDouble(&rateOk);
+        double burst = numbers.size() > 1 ? numbers.at(1).toDouble(&burstOk) : rate * 2;
+        if (pair.size() != 2 || !rateOk || !burstOk || rate < 0 || burst < 0) {
+            if (error) *error = QString("Invalid rate limit '%1'").arg(item);
+            return false;
+        }
+
+        RateLimit limit(rate, burst);
+        if (pair.at(0) == QLatin1String("connection")) {
+            connection = limit;
+            continue;
+        }
+        MessageType type = Protocol::typeFromName(pair.at(0));
+        if (type == MessageType::Unknown) {
+            if (error) *error = QString("Unknown message type '%1'").arg(pair.at(0));
+            return false;
+        }
+        perType[int(type)] = limit;
+    }
+    assignBuckets();
+    return true;
+}
+
+void RateLimitConfig::assignBuckets() {
+    buckets = 0;
+    for (int i = 0; i < int(MessageType::Count); ++i) {
+        bucketIndex[i] = perType[i].isEnabled() ? buckets++ : -1;
+    }
+}
+
+OverloadMonitor::OverloadMonitor(const OverloadConfig& config) : config(config) {}
+
+void OverloadMonitor::report(int worker, qint64 lag, qint64 queuedBytes) {
+    lagUs[worker].storeRelease(lag);
+    queued[worker].storeRelease(queuedBytes);
+
+    QMutexLocker lock(&mutex);
+
+    // 루프 지연은 가장 느린 워커, 송신 대기는 서버 전체 합으로 본다
+    qint64 worstLag = 0;
+    qint64 totalQueued = 0;
+    for (int i = 0; i < kMaxWorkers; ++i) {
+        worstLag = qMax(worstLag, lagUs[i].loadAcquire());
+        totalQueued += queued[i].loadAcquire();
+    }
+    double pressure = 0;
+    if (config.lagLimitMs > 0) pressure = qMax(pressure, double(worstLag) / (config.lagLimitMs * 1000.0));
+    if (config.queueLimitBytes > 0) pressure = qMax(pressure, double(totalQueued) / config.queueLimitBytes);
+    lastPressure.storeRelease(qint64(pressure * 1000));
+
+    int target = Normal;
+    while (target < RefuseConnections && pressure >= threshold(target + 1)) {
+        ++target;
+    }
+
+    int level = currentLevel.loadAcquire();
+    if (target > level) {
+        // 올릴 때는 바로 올린다
+        for (int next = level + 1; next <= target; ++next) {
+            entered[next].fetchAndAddRelaxed(1);
+        }
+        currentLevel.storeRelease(target);
+        calmSince.invalidate();
+        CHAT_LOG(Warning, Server) << "Overload level" << levelName(Level(target))
+                                  << "pressure" << pressure << "lag_us" << worstLag << "queued" << totalQueued;
+        return;
+    }
+    if (target == level) {
+        calmSince.invalidate();
+        return;
+    }
+
+    // 내릴 때는 잠깐 낮아진 것에 흔들리지 않도록 recoverMs 동안 지켜본 뒤 한 단계씩 내린다
+    if (!calmSince.isValid()) {
+        calmSince.start();
+    } else if (calmSince.elapsed() >= config.recoverMs) {
+        currentLevel.storeRelease(level - 1);
+        calmSince.start();
+        CHAT_LOG(Info, Server) << "Overload level" << levelName(Level(level - 1)) << "pressure" << pressure;
+    }
+}
+
+const char* OverloadMonitor::levelName(Level level) {
+    static const char *const names[] = { "normal", "reject_registrations", "throttle_chat", "refuse_connections" };
+    return names[level];
+}
+
+const char* OverloadMonitor::policyName(ShedPolicy policy) {
+    static const char *const names[] = { "registration", "chat", "connection" };
+    return names[policy];
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include "protocol.h"
+
+// 초당 rate개씩 채워지고 burst개까지 모이는 토큰 (rate 0이면 제한 없음)
+struct RateLimit {
+    RateLimit() {}
+    RateLimit(double rate, double burst) : rate(rate), burst(burst) {}
+
+    double rate = 0;
+    double burst = 0;
+
+    bool isEnabled() const { return rate > 0; }
+};
+
+// 토큰 버킷 하나. 꺼낼 때만 지난 시간만큼 채우므로 타이머가 필요 없다.
+class TokenBucket {
+public:
+    bool take(const RateLimit& limit, qint64 nowMs);
+
+private:
+    double tokens = -1;   // 음수면 처음 쓰는 버킷 (가득 찬 상태로 시작)
+    qint64 lastMs = 0;
+};
+
+// 연결별 수신 한도
+struct RateLimitConfig {
+    RateLimit connection;                          // 모든 메시지를 합친 한도
+    RateLimit perType[int(MessageType::Count)];    // 메시지 타입별 한도
+
+    RateLimitConfig();
+    // "connection=50:100,message=20:40,createRoom=1:5" 형식 (off면 모두 끈다)
+    bool parse(const QString& spec, QString *error);
+    // 한도가 있는 타입만 연결마다 버킷을 둔다. 없으면 -1.
+    int bucketFor(MessageType type) const { return bucketIndex[int(type)]; }
+    int bucketCount() const { return buckets; }
+
+private:
+    void assignBuckets();
+
+    int bucketIndex[int(MessageType::Count)];
+    int buckets = 0;
+};
+
+// 과부하 판단 기준과 과부하 때 쓰는 채팅 한도
+struct OverloadConfig {
+    int lagLimitMs = 100;                 // 워커 이벤트 루프 지연 한계 (0이면 보지 않는다)
+    qint64 queueLimitBytes = 256 * 1024 * 1024;  // 서버 전체 송신 대기 바이트 한계 (0이면 보지 않는다)
+    int recoverMs = 3000;                 // 이만큼 압력이 낮게 유지되어야 한 단계 내려간다
+    RateLimit throttledChat = RateLimit(1, 3);  // ThrottleChat 단계의 연결별 채팅 한도
+};
+
+// 서버 전체 과부하 감지와 단계별 차단
+// 워커들이 자기 루프 지연과 송신 대기량을 주기적으로 알리면 가장 나쁜 값을 한계로 나눈 압력으로
+// 단계를 정한다. 압력이 1, 2, 4를 넘을 때마다 한 단계씩 올리고(바로), 내릴 때는 recoverMs 동안
+// 아래 단계 기준 밑에 머물러야 한 단계씩 내린다. 단계가 높을수록 앞 단계의 차단도 함께 한다.
+class OverloadMonitor {
+public:
+    enum Level {
+        Normal,
+        RejectRegistrations,   // 새 가입을 거절한다
+        ThrottleChat,          // 채팅을 throttledChat 한도로 줄인다
+        RefuseConnections,     // 새 연결을 받자마자 닫는다
+        LevelCount
+    };
+
+    enum ShedPolicy {
+        ShedRegistration,
+        ShedChat,
+        ShedConnection,
+        ShedPolicyCount
+    };
+
+    static const int kMaxWorkers = 64;
+
+    explicit OverloadMonitor(const OverloadConfig& config);
+
+    // 워커 스레드에서 주기적으로 호출한다
+    void report(int worker, qint64 lagUs, qint64 queuedBytes);
+    // 임의 스레드에서 읽는다
+    Level level() const { return Level(currentLevel.loadAcquire()); }
+    bool atLeast(Level threshold) const { return currentLevel.loadAcquire() >= int(threshold); }
+
+    void recordShed(ShedPolicy policy) { shed[policy].fetchAndAddRelaxed(1); }
+    quint64 shedCount(ShedPolicy policy) const { return shed[policy].loadAcquire(); }
+    quint64 levelEntries(Level level) const { return entered[level].loadAcquire(); }
+    double pressure() const { return double(lastPressure.loadAcquire()) / 1000; }
+
+    static const char* levelName(Level level);
+    static const char* policyName(ShedPolicy policy);
+
+private:
+    static double threshold(int level) { return double(1 << (level - 1)); }
+
+    const OverloadConfig& config;
+    QAtomicInteger<qint64> lagUs[kMaxWorkers];
+    QAtomicInteger<qint64> queued[kMaxWorkers];
+    QAtomicInt currentLevel;
+    QAtomicInteger<qint64> lastPressure;            // 압력 x 1000 (계측용)
+    QAtomicInteger<quint64> shed[ShedPolicyCount];
+    QAtomicInteger<quint64> entered[LevelCount];
+
+    QMutex mutex;                 // 단계 계산은 한 번에 하나만
+    QElapsedTimer calmSince;      // 현재 단계보다 낮은 압력이 시작된 시각 (무효면 아직 높다)
+};
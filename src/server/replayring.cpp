@@ -0,0 +1,59 @@
+#include "replayring.h"
+#include <algorithm>
+
+void ReplayRing::append(const ReplayEntry& entry, int capacity) {
+    if (capacity <= 0) return;
+
+    QMutexLocker locker(&mutex);
+    if (ring.size() != capacity) {
+        // 처음 쓸 때만 자리를 잡는다 (메시지가 없는 방은 메모리를 쓰지 않는다)
+        QVector<ReplayEntry> resized(capacity);
+        int kept = qMin(count, capacity);
+        for (int i = 0; i < kept; ++i) {
+            resized[i] = ring[(head + count - kept + i) % ring.size()];
+        }
+        ring.swap(resized);
+        head = 0;
+        count = kept;
+    }
+
+    if (count < capacity) {
+        ring[(head + count) % capacity] = entry;
+        ++count;
+    } else {
+        ring[head] = entry;
+        head = (head + 1) % capacity;
+    }
+    newestSeq = qMax(newestSeq, entry.seq);
+    stale = false;
+}
+
+void ReplayRing::clear() {
+    QMutexLocker locker(&mutex);
+    ring = QVector<ReplayEntry>();
+    head = 0;
+    count = 0;
+    stale = true;
+}
+
+bool ReplayRing::since(quint64 afterSeq, QVector<ReplayEntry>& entries) const {
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < count; ++i) {
+        const ReplayEntry& entry = ring[(head + i) % ring.size()];
+        if (entry.seq > afterSeq) entries.append(entry);
+    }
+    bool upToDate = !stale && afterSeq >= newestSeq;
+    locker.unlock();
+
+    if (entries.isEmpty()) return upToDate;
+    // 여러 워커가 번호를 붙이므로 넣은 순서는 번호순과 조금 다를 수 있다
+    std::sort(entries.begin(), entries.end(), [](const ReplayEntry& a, const ReplayEntry& b) {
+        return a.seq < b.seq;
+    });
+    quint64 expected = afterSeq + 1;
+    for (const ReplayEntry& entry : entries) {
+        if (entry.seq != expected) return false;
+        ++expected;
+    }
+    return true;
+}
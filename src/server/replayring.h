@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QCborMap>
+#include <QMutex>
+#include <QVector>
+#include "protocol.h"
+
+// 번호가 붙은 방 메시지 하나
+struct ReplayEntry {
+    quint64 seq = 0;
+    MessageType type = MessageType::Unknown;
+    QCborMap fields;    // seq와 time이 들어 있는 그대로
+};
+
+// 방의 최근 메시지 (세션을 이어 받을 때 놓친 부분만 다시 보낸다)
+// 번호를 붙인 워커나 페더레이션 스레드가 바로 넣으므로 잠금은 항목 하나를 넣거나
+// 빈 구간을 복사할 때만 잡는다. 넣는 쪽은 workerMask를 읽기 전에 넣으므로, 이어 받는 쪽이
+// 방에 들어간 뒤 읽으면 여기서 찾지 못한 메시지는 실시간으로 받는다.
+class ReplayRing {
+public:
+    // capacity개를 넘으면 가장 오래된 항목을 밀어낸다
+    void append(const ReplayEntry& entry, int capacity);
+    // 이 노드가 방 메시지를 더 받지 못하게 되었다 (페더레이션 구독 해제)
+    void clear();
+    // afterSeq 뒤의 항목을 번호순으로 담는다. afterSeq 바로 다음부터 빠짐없이 가지고 있으면 true.
+    bool since(quint64 afterSeq, QVector<ReplayEntry>& entries) const;
+
+private:
+    mutable QMutex mutex;
+    QVector<ReplayEntry> ring;   // 원형 버퍼
+    int head = 0;                // 가장 오래된 항목 위치
+    int count = 0;
+    quint64 newestSeq = 0;       // 지금까지 넣은 가장 큰 번호
+    bool stale = false;          // 비운 뒤 아직 아무것도 받지 못했다 (그 사이를 모른다)
+};
@@ -1,288 +1,432 @@
 #include "server.h"
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QJsonArray>
+#include <QHostAddress>
 #include <QDebug>
-
-ChatServer::ChatServer(QObject *parent) : QTcpServer(parent) {
-    
-    ChatRoom publicRoom;
-    publicRoom.name = "Public";
-    chatRooms["Public"] = publicRoom;
-}
-
-void ChatServer::incomingConnection(qintptr socketDescriptor) {
-    QTcpSocket *clientSocket = new QTcpSocket(this);
-    if (clientSocket->setSocketDescriptor(socketDescriptor)) {
-        connect(clientSocket, &QTcpSocket::readyRead, this, [this, clientSocket]() {
-            processMessage(clientSocket, clientSocket->readAll());
-        });
-
-        connect(clientSocket, &QTcpSocket::disconnected, this, [this, clientSocket]() {
-            handleDisconnection(clientSocket);
-        });
-
-        
-        QJsonObject roomsMsg;
-        roomsMsg["type"] = "roomList";
-        QJsonArray roomArray;
-        for (const auto& room : chatRooms.keys()) {
-            roomArray.append(room);
+#include "logger.h"
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+const int ChatServer::kMaxWorkers;
+const int ChatServer::kAcceptBatch;
+
+ChatServer::ChatServer(const ServerConfig& serverConfig, QObject *parent)
+    : QTcpServer(parent), config(serverConfig), overload(config.overload) {
+    config.workers = qBound(1, config.workers, kMaxWorkers);
+    int workerCount = config.workers;
+
+    // 워커가 연결을 받기 전에 사용자/방 목록을 복구한다
+    if (!config.state.directory.isEmpty()) {
+        state = new StateStore(config.state, this);
+        if (!state->open(&directory)) {
+            errorMessage = "Failed to recover state: " + state->errorString();
+            return;
         }
-        roomsMsg["rooms"] = roomArray;
-        sendToClient(clientSocket, roomsMsg);
-
-        qDebug() << "New client connected";
-    } else {
-        clientSocket->deleteLater();
-        qDebug() << "Failed to set socket descriptor";
+        directory.setJournal(state);
+        state->start();
     }
-}
-
-void ChatServer::processMessage(QTcpSocket* socket, const QByteArray& data) {
-    QJsonDocument doc = QJsonDocument::fromJson(data);
-    if (!doc.isObject()) return;
 
-    QJsonObject msg = doc.object();
-    QString type = msg["type"].toString();
-
-    if (type == "register") {
-        handleRegistration(socket, msg);
-    }
-    else if (type == "login") {
-        handleLogin(socket, msg);
-    }
-    else if (type == "createRoom") {
-        handleCreateRoom(socket, msg);
-    }
-    else if (type == "joinRoom") {
-        handleJoinRoom(socket, msg);
-    }
-    else if (type == "message") {
-        handleChatMessage(socket, msg);
-    }
-    else if (type == "fileUploaded") {
-        // 새로 추가된 부분: 파일 업로드 알림 처리
-        handleFileUploadNotification(socket, msg);
+    // 기록은 디스크 대기가 방송 경로를 막지 않도록 별도 스레드에서 쓴다
+    if (!config.history.directory.isEmpty()) {
+        history = new HistoryStore(config.history);
+        if (history->open()) {
+            for (ChatRoom *room : directory.allRooms()) {
+                history->attach(room);
+            }
+
+            historyThread = new QThread(this);
+            historyThread->setObjectName("chat-history");
+            history->moveToThread(historyThread);
+            connect(historyThread, &QThread::finished, history, &QObject::deleteLater);
+            historyThread->start();
+
+            HistoryStore *store = history;
+            QMetaObject::invokeMethod(store, [store]() { store->start(); }, Qt::QueuedConnection);
+        } else {
+            delete history;
+            history = nullptr;
+        }
     }
-}
 
-void ChatServer::handleRegistration(QTcpSocket* socket, const QJsonObject& data) {
-    QString username = data["username"].toString();
-    QString password = data["password"].toString();
-
-    if (username.isEmpty() || password.isEmpty()) {
-        sendError(socket, "Invalid username or password");
-        return;
+    // 파일 전송은 큰 디스크/소켓 작업이 채팅 워커를 막지 않도록 전용 스레드에서 처리한다
+    if (!config.files.directory.isEmpty()) {
+        files = new FileStore(config.files);
+        if (files->open()) {
+            filesThread = new QThread(this);
+            filesThread->setObjectName("chat-files");
+            transfers = new FileTransferServer(files);
+            transfers->moveToThread(filesThread);
+            connect(filesThread, &QThread::finished, transfers, &QObject::deleteLater);
+            filesThread->start();
+
+            bool listening = false;
+            FileTransferServer *server = transfers;
+            quint16 port = config.files.port;
+            QMetaObject::invokeMethod(server, [server, port, &listening]() {
+                listening = server->start(QHostAddress::Any, port);
+            }, Qt::BlockingQueuedConnection);
+            if (!listening) {
+                errorMessage = QString("Failed to start file transfer channel on port %1").arg(port);
+                return;
+            }
+        } else {
+            delete files;
+            files = nullptr;
+        }
     }
 
-    if (registeredUsers.contains(username)) {
-        sendError(socket, "Username already exists");
-        return;
+    // 노드 간 링크는 워커의 방송 경로와 떨어진 전용 스레드에서 읽고 쓴다
+    if (config.federation.isEnabled()) {
+        federation = new Federation(config.federation, &directory, history);
     }
 
-    User newUser;
-    newUser.username = username;
-    newUser.password = password;
-    registeredUsers[username] = newUser;
-
-    QJsonObject response;
-    response["type"] = "registrationSuccess";
-    sendToClient(socket, response);
-
-    qDebug() << "New user registered:" << username;
-}
-
-void ChatServer::handleLogin(QTcpSocket* socket, const QJsonObject& data) {
-    QString username = data["username"].toString();
-    QString password = data["password"].toString();
-
-    if (!registeredUsers.contains(username) || 
-        registeredUsers[username].password != password) {
-        sendError(socket, "Invalid username or password");
-        return;
+    if (config.resume.isEnabled()) {
+        sessions = new SessionRegistry(config.resume);
     }
 
-    activeUsers[socket] = username;
-
-    QJsonObject response;
-    response["type"] = "loginSuccess";
-    sendToClient(socket, response);
-
-    chatRooms["Public"].participants.insert(socket);
-
-    qDebug() << username << "logged in";
-}
-
-void ChatServer::handleCreateRoom(QTcpSocket* socket, const QJsonObject& data) {
-    if (!activeUsers.contains(socket)) {
-        sendError(socket, "You must be logged in");
-        return;
+    for (int i = 0; i < workerCount; ++i) {
+        workers.append(new ChatWorker(i, config, &directory, history, files));
     }
 
-    QString roomName = data["room"].toString();
-    if (roomName.isEmpty()) {
-        sendError(socket, "Invalid room name");
-        return;
+    if (transfers) {
+        // 업로드 완료 알림은 워커에 차례로 나눠 맡긴다 (인자는 람다로 복사해 넘긴다)
+        connect(transfers, &FileTransferServer::uploadFinished, transfers,
+                [this](ChatRoom *room, const FileEntry& entry, quint64 version) {
+            ChatWorker *worker = workers.at(nextAnnouncer.fetchAndAddRelaxed(1) % workers.size());
+            QMetaObject::invokeMethod(worker, [worker, room, entry, version]() {
+                worker->announceFile(room, entry, version);
+            }, Qt::QueuedConnection);
+        }, Qt::DirectConnection);
     }
 
-    if (chatRooms.contains(roomName)) {
-        sendError(socket, "Room already exists");
-        return;
+    for (int i = 0; i < workerCount; ++i) {
+        ChatWorker *worker = workers[i];
+        worker->setPeers(workers);
+        worker->setOverloadMonitor(&overload);
+        worker->setFederation(federation);
+        worker->setSessions(sessions);
+
+        QThread *thread = new QThread(this);
+        thread->setObjectName(QString("chat-worker-%1").arg(i));
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        threads.append(thread);
+        thread->start();
+
+        QMetaObject::invokeMethod(worker, [worker]() { worker->start(); }, Qt::QueuedConnection);
     }
 
-    ChatRoom newRoom;
-    newRoom.name = roomName;
-    newRoom.password = data["password"].toString();
-    chatRooms[roomName] = newRoom;
-
-    broadcastRoomList();
+    if (federation) {
+        federation->setWorkers(workers);
+        federation->setReplayFrames(sessions ? config.resume.replayFrames : 0);
+        federationThread = new QThread(this);
+        federationThread->setObjectName("chat-federation");
+        federation->moveToThread(federationThread);
+        federationThread->start();
+
+        bool linked = false;
+        Federation *link = federation;
+        QMetaObject::invokeMethod(link, [link, &linked]() { linked = link->start(); },
+                                  Qt::BlockingQueuedConnection);
+        if (!linked) {
+            errorMessage = QString("Failed to start node link for node %1").arg(config.federation.nodeId);
+            return;
+        }
+    }
 
-    qDebug() << "New room created:" << roomName;
+    // 계측 값은 외부에 노출하지 않도록 루프백에서만 받는다
+    if (config.metricsPort != 0) {
+        metricsEndpoint = new MetricsEndpoint([this]() { return renderMetrics(); }, this);
+        if (!metricsEndpoint->listen(QHostAddress::LocalHost, config.metricsPort)) {
+            errorMessage = "Failed to start metrics endpoint: " + metricsEndpoint->errorString();
+        }
+    }
 }
 
-void ChatServer::handleJoinRoom(QTcpSocket* socket, const QJsonObject& data) {
-    if (!activeUsers.contains(socket)) {
-        sendError(socket, "You must be logged in");
-        return;
+ChatServer::~ChatServer() {
+    close();
+    // 업로드 완료 알림이 더 생기지 않도록 파일 채널부터 멈춘다
+    if (filesThread) {
+        filesThread->quit();
+        filesThread->wait();
     }
-
-    QString roomName = data["room"].toString();
-    if (!chatRooms.contains(roomName)) {
-        sendError(socket, "Room does not exist");
-        return;
+    // 링크 스레드가 워커 메일박스에 더 넣지 않도록 먼저 멈춘다.
+    // 워커는 멈출 때까지 링크에 일을 넘길 수 있으므로 객체는 워커가 끝난 뒤에 지운다.
+    if (federationThread) {
+        federationThread->quit();
+        federationThread->wait();
     }
-
-    ChatRoom& room = chatRooms[roomName];
-
-    if (!room.password.isEmpty() && data["password"].toString() != room.password) {
-        sendError(socket, "Invalid room password");
-        return;
+    for (QThread *thread : threads) {
+        thread->quit();
     }
-
-    QString username = activeUsers[socket];
-    QString currentRoom = registeredUsers[username].currentRoom;
-    if (!currentRoom.isEmpty()) {
-        chatRooms[currentRoom].participants.remove(socket);
+    for (QThread *thread : threads) {
+        thread->wait();
     }
 
-    room.participants.insert(socket);
-    registeredUsers[username].currentRoom = roomName;
-
-    QJsonObject notification;
-    notification["type"] = "message";
-    notification["text"] = username + " has joined the room";
-    broadcastToRoom(roomName, notification);
-
-    qDebug() << username << "joined room:" << roomName;
+    // 워커가 모두 멈춘 뒤에 남은 기록을 내리고 닫는다
+    if (historyThread) {
+        historyThread->quit();
+        historyThread->wait();
+    }
+    delete federation;
+    delete files;
+    delete sessions;
 }
 
-void ChatServer::handleChatMessage(QTcpSocket* socket, const QJsonObject& data) {
-    if (!activeUsers.contains(socket)) {
-        sendError(socket, "You must be logged in");
-        return;
+OutboundTotals ChatServer::outboundTotals() const {
+    OutboundTotals totals;
+    for (ChatWorker *worker : workers) {
+        totals += worker->outboundTotals();
     }
+    return totals;
+}
 
-    QString text = data["text"].toString();
-    if (text.isEmpty()) return;
+QByteArray ChatServer::renderMetrics() const {
+    PrometheusWriter out;
 
-    QString username = activeUsers[socket];
-    QString room = registeredUsers[username].currentRoom;
+    MetricsSnapshot total;
+    QVector<MetricsSnapshot> perWorker;
+    for (ChatWorker *worker : workers) {
+        perWorker.append(worker->metricsSnapshot());
+        total += perWorker.last();
+    }
 
-    if (room.isEmpty()) {
-        sendError(socket, "You must join a room first");
-        return;
+    out.header("chat_connections", "gauge", "Open client connections.");
+    for (int i = 0; i < perWorker.size(); ++i) {
+        out.sample("chat_connections", double(perWorker.at(i).connections), QString("worker=\"%1\"").arg(i));
+    }
+    out.header("chat_users", "gauge", "Registered users.");
+    out.sample("chat_users", directory.userCount());
+
+    out.header("chat_message_duration_seconds", "histogram", "Time spent in processMessage by message type.");
+    for (int i = 0; i < int(MessageType::Count); ++i) {
+        if (total.messageTime[i].count == 0) continue;
+        out.histogram("chat_message_duration_seconds", total.messageTime[i], 1e6,
+                      QString("type=\"%1\"").arg(Protocol::typeName(MessageType(i))));
+    }
+    out.header("chat_decode_errors_total", "counter", "Frames that could not be decoded.");
+    out.sample("chat_decode_errors_total", double(total.decodeErrors));
+    out.header("chat_unhandled_messages_total", "counter", "Messages of a type the server does not accept.");
+    out.sample("chat_unhandled_messages_total", double(total.unhandledMessages));
+
+    out.header("chat_broadcast_recipients", "histogram", "Room members reached by one broadcast.");
+    out.histogram("chat_broadcast_recipients", total.fanout, 1);
+    out.header("chat_cross_worker_posts_total", "counter", "Broadcasts handed to another worker.");
+    out.sample("chat_cross_worker_posts_total", double(total.crossWorkerPosts));
+
+    out.header("chat_outbound_frames_total", "counter", "Frames written to client sockets.");
+    out.sample("chat_outbound_frames_total", double(total.outboundFrames));
+    out.header("chat_outbound_bytes_total", "counter", "Bytes written to client sockets.");
+    out.sample("chat_outbound_bytes_total", double(total.outboundBytes));
+    out.header("chat_outbound_write_calls_total", "counter", "Write calls made to hand frames to the kernel.");
+    out.sample("chat_outbound_write_calls_total", double(total.outboundWrites));
+
+    out.header("chat_compressed_frames_total", "counter", "Outbound frames sent zlib-compressed (counted once per shared encoding).");
+    out.sample("chat_compressed_frames_total", double(total.compressedFrames));
+    out.header("chat_compression_bytes_in_total", "counter", "Payload bytes offered to the compressor.");
+    out.sample("chat_compression_bytes_in_total", double(total.compressionBytesIn));
+    out.header("chat_compression_bytes_out_total", "counter", "Payload bytes after compression.");
+    out.sample("chat_compression_bytes_out_total", double(total.compressionBytesOut));
+    out.header("chat_compression_seconds_total", "counter", "CPU time spent compressing outbound frames.");
+    out.sample("chat_compression_seconds_total", double(total.compressionNanos) / 1e9);
+    out.header("chat_compression_saved_bytes_total", "counter", "Egress bytes saved by sending compressed frames.");
+    out.sample("chat_compression_saved_bytes_total", double(total.compressionSaved));
+
+    out.header("chat_rate_limited_total", "counter", "Messages dropped for exceeding a per-connection rate limit.");
+    for (int i = 0; i < int(MessageType::Count); ++i) {
+        if (total.rateLimited[i] == 0) continue;
+        out.sample("chat_rate_limited_total", double(total.rateLimited[i]),
+                   QString("type=\"%1\"").arg(Protocol::typeName(MessageType(i))));
+    }
+    out.header("chat_overload_level", "gauge", "Current overload level (0 = normal).");
+    out.sample("chat_overload_level", int(overload.level()));
+    out.header("chat_overload_pressure", "gauge", "Worst of event loop lag and outbound backlog relative to their limits.");
+    out.sample("chat_overload_pressure", overload.pressure());
+    out.header("chat_overload_level_entries_total", "counter", "Times the server entered each overload level.");
+    for (int i = OverloadMonitor::RejectRegistrations; i < OverloadMonitor::LevelCount; ++i) {
+        OverloadMonitor::Level level = OverloadMonitor::Level(i);
+        out.sample("chat_overload_level_entries_total", double(overload.levelEntries(level)),
+                   QString("level=\"%1\"").arg(OverloadMonitor::levelName(level)));
+    }
+    out.header("chat_shed_total", "counter", "Requests refused by overload shedding.");
+    for (int i = 0; i < OverloadMonitor::ShedPolicyCount; ++i) {
+        OverloadMonitor::ShedPolicy policy = OverloadMonitor::ShedPolicy(i);
+        out.sample("chat_shed_total", double(overload.shedCount(policy)),
+                   QString("policy=\"%1\"").arg(OverloadMonitor::policyName(policy)));
     }
 
-    QJsonObject chatMsg;
-    chatMsg["type"] = "message";
-    chatMsg["sender"] = username;
-    chatMsg["text"] = text;
-    broadcastToRoom(room, chatMsg);
+    static const char *const timeoutKinds[] = { "idle", "login_deadline", "write_stall" };
+    out.header("chat_connection_timeouts_total", "counter", "Connections closed by a timeout.");
+    for (int i = 0; i < int(TimeoutKind::Count); ++i) {
+        out.sample("chat_connection_timeouts_total", double(total.timeouts[i]),
+                   QString("kind=\"%1\"").arg(timeoutKinds[i]));
+    }
+    out.header("chat_io_wakeups_total", "counter", "Event loop dispatches caused by client socket readiness.");
+    for (int i = 0; i < perWorker.size(); ++i) {
+        out.sample("chat_io_wakeups_total", double(perWorker.at(i).ioWakeups), QString("worker=\"%1\"").arg(i));
+    }
+    out.header("chat_heartbeat_pings_total", "counter", "Heartbeat pings sent to quiet connections.");
+    out.sample("chat_heartbeat_pings_total", double(total.heartbeatPings));
+
+    static const char *const resumeResults[] = { "replayed", "backfilled", "rejected" };
+    out.header("chat_session_resumes_total", "counter", "Session resume attempts by result.");
+    for (int i = 0; i < int(ResumeOutcome::Count); ++i) {
+        out.sample("chat_session_resumes_total", double(total.resumes[i]),
+                   QString("result=\"%1\"").arg(resumeResults[i]));
+    }
+    out.header("chat_session_replayed_frames_total", "counter", "Room messages replayed to resumed sessions.");
+    out.sample("chat_session_replayed_frames_total", double(total.replayedFrames));
+    if (sessions) {
+        out.header("chat_resumable_sessions", "gauge", "Issued resume tokens, live or waiting for a reconnect.");
+        out.sample("chat_resumable_sessions", sessions->size());
+    }
 
-    qDebug() << username << "sent message in" << room << ":" << text;
-}
+    if (federation) {
+        FederationTotals links = federation->totals();
+        int linksUp = 0;
+        for (quint64 mask = links.linksUp; mask != 0; mask &= mask - 1) ++linksUp;
+        out.header("chat_federation_links_up", "gauge", "Node links that completed the hello exchange.");
+        out.sample("chat_federation_links_up", linksUp);
+        out.header("chat_federation_frames_total", "counter", "Frames exchanged over node links.");
+        out.sample("chat_federation_frames_total", double(links.framesSent), QLatin1String("direction=\"sent\""));
+        out.sample("chat_federation_frames_total", double(links.framesReceived),
+                   QLatin1String("direction=\"received\""));
+        out.header("chat_federation_bytes_total", "counter", "Bytes exchanged over node links.");
+        out.sample("chat_federation_bytes_total", double(links.bytesSent), QLatin1String("direction=\"sent\""));
+        out.sample("chat_federation_bytes_total", double(links.bytesReceived),
+                   QLatin1String("direction=\"received\""));
+        out.header("chat_federation_dropped_frames_total", "counter",
+                   "Frames not sent because the node link was down or backed up.");
+        out.sample("chat_federation_dropped_frames_total", double(links.droppedFrames));
+        int owned = 0;
+        for (ChatRoom *room : directory.allRooms()) {
+            if (federation->owns(room)) ++owned;
+        }
+        out.header("chat_federation_rooms_owned", "gauge", "Rooms whose message order this node decides.");
+        out.sample("chat_federation_rooms_owned", owned);
+    }
 
-void ChatServer::handleFileUploadNotification(QTcpSocket* socket, const QJsonObject& data) {
-    if (!activeUsers.contains(socket)) {
-        sendError(socket, "You must be logged in");
-        return;
-    }
-
-    QString username = activeUsers[socket];
-    QString filename = data["filename"].toString();
-    
-    // 현재 방의 모든 사용자에게 파일 업로드 알림 전송
-    QString currentRoom = registeredUsers[username].currentRoom;
-    if (!currentRoom.isEmpty() && chatRooms.contains(currentRoom)) {
-        QJsonObject notification;
-        notification["type"] = "fileAvailable";
-        notification["filename"] = filename;
-        notification["uploader"] = username;
-        broadcastToRoom(currentRoom, notification);
-        
-        qDebug() << username << "uploaded file:" << filename << "in room:" << currentRoom;
+    static const char *const dropReasons[] = { "slow_consumer", "disconnected", "evicted" };
+    OutboundTotals outbound = outboundTotals();
+    out.header("chat_outbound_dropped_frames_total", "counter", "Frames dropped before reaching the socket.");
+    for (int i = 0; i < int(DropReason::Count); ++i) {
+        out.sample("chat_outbound_dropped_frames_total", double(outbound.droppedFrames[i]),
+                   QString("reason=\"%1\"").arg(dropReasons[i]));
     }
-}
+    out.header("chat_outbound_dropped_bytes_total", "counter", "Bytes dropped before reaching the socket.");
+    for (int i = 0; i < int(DropReason::Count); ++i) {
+        out.sample("chat_outbound_dropped_bytes_total", double(outbound.droppedBytes[i]),
+                   QString("reason=\"%1\"").arg(dropReasons[i]));
+    }
+    out.header("chat_slow_consumer_evictions_total", "counter", "Connections closed as slow consumers.");
+    out.sample("chat_slow_consumer_evictions_total", double(outbound.evictions));
 
+    out.header("chat_event_loop_lag_seconds", "histogram", "How late each worker's event loop ran a timer.");
+    for (int i = 0; i < perWorker.size(); ++i) {
+        out.histogram("chat_event_loop_lag_seconds", perWorker.at(i).loopLag, 1e6,
+                      QString("worker=\"%1\"").arg(i));
+    }
 
-void ChatServer::handleDisconnection(QTcpSocket* socket) {
-    if (activeUsers.contains(socket)) {
-        QString username = activeUsers[socket];
-        QString room = registeredUsers[username].currentRoom;
+    // 방 크기 분포는 읽을 때 방마다 참가자 수를 세어 만든다 (누적, 경계 0, 1, 2, 4 ...)
+    const int kSizeBuckets = 18;
+    int roomsBySize[kSizeBuckets + 1] = {};
+    int largest = 0;
+    QVector<ChatRoom*> rooms = directory.allRooms();
+    for (ChatRoom *room : rooms) {
+        int members = qMax(0, room->memberCount.loadAcquire());
+        int bucket = 0;
+        while (bucket < kSizeBuckets && members > (bucket == 0 ? 0 : 1 << (bucket - 1))) ++bucket;
+        ++roomsBySize[bucket];
+        largest = qMax(largest, members);
+    }
+    out.header("chat_rooms", "gauge", "Rooms.");
+    out.sample("chat_rooms", rooms.size());
+    out.header("chat_rooms_by_members", "gauge", "Rooms with at most le members.");
+    int cumulative = 0;
+    for (int i = 0; i < kSizeBuckets; ++i) {
+        cumulative += roomsBySize[i];
+        out.sample("chat_rooms_by_members", cumulative,
+                   QString("le=\"%1\"").arg(i == 0 ? 0 : 1 << (i - 1)));
+    }
+    out.sample("chat_rooms_by_members", rooms.size(), QLatin1String("le=\"+Inf\""));
+    out.header("chat_room_members_max", "gauge", "Members in the largest room.");
+    out.sample("chat_room_members_max", largest);
 
-        if (!room.isEmpty() && chatRooms.contains(room)) {
-            chatRooms[room].participants.remove(socket);
+    return out.text();
+}
 
-            QJsonObject notification;
-            notification["type"] = "message";
-            notification["text"] = username + " has left the room";
-            broadcastToRoom(room, notification);
-        }
+bool ChatServer::listenForClients(const QHostAddress& address, quint16 port) {
+    if (!listen(address, port)) return false;
 
-        activeUsers.remove(socket);
-        qDebug() << username << "disconnected";
+#ifdef Q_OS_LINUX
+    if (config.ioBackend == IoBackend::Epoll) {
+        // QTcpServer는 소켓만 열어 두고 수락은 직접 한다
+        pauseAccepting();
+        acceptNotifier = new QSocketNotifier(socketDescriptor(), QSocketNotifier::Read, this);
+        connect(acceptNotifier, &QSocketNotifier::activated, this, &ChatServer::acceptBatch);
     }
-
-    socket->deleteLater();
+#endif
+    return true;
 }
 
-void ChatServer::broadcastToRoom(const QString& room, const QJsonObject& message) {
-    if (!chatRooms.contains(room)) return;
-
-    QJsonDocument doc(message);
-    QByteArray data = doc.toJson();
+bool ChatServer::shedConnection(qintptr socketDescriptor) {
+    // 가장 높은 과부하 단계에서는 워커에 넘기지 않고 바로 닫는다
+    if (!overload.atLeast(OverloadMonitor::RefuseConnections)) return false;
+
+    overload.recordShed(OverloadMonitor::ShedConnection);
+#ifdef Q_OS_UNIX
+    ::close(int(socketDescriptor));
+#else
+    QTcpSocket socket;
+    socket.setSocketDescriptor(socketDescriptor);
+    socket.abort();
+#endif
+    return true;
+}
 
-    for (QTcpSocket* socket : chatRooms[room].participants) {
-        if (socket->state() == QAbstractSocket::ConnectedState) {
-            socket->write(data);
+void ChatServer::acceptBatch() {
+#ifdef Q_OS_LINUX
+    // 받은 연결을 워커별로 모아 워커마다 이벤트 하나로 넘긴다
+    QVector<QVector<qintptr> > batches(workers.size());
+    for (int i = 0; i < kAcceptBatch; ++i) {
+        int fd = ::accept4(int(socketDescriptor()), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                CHAT_LOG(Warning, Connection) << "accept4 failed:" << std::strerror(errno);
+            }
+            break;
         }
+        if (shedConnection(fd)) continue;
+        batches[nextWorker].append(fd);
+        nextWorker = (nextWorker + 1) % workers.size();
     }
-}
 
-void ChatServer::sendToClient(QTcpSocket* socket, const QJsonObject& message) {
-    if (socket->state() == QAbstractSocket::ConnectedState) {
-        socket->write(QJsonDocument(message).toJson());
+    for (int i = 0; i < batches.size(); ++i) {
+        if (batches.at(i).isEmpty()) continue;
+        ChatWorker *worker = workers[i];
+        QVector<qintptr> descriptors = batches.at(i);
+        QMetaObject::invokeMethod(worker, [worker, descriptors]() {
+            for (qintptr descriptor : descriptors) {
+                worker->addConnection(descriptor);
+            }
+        }, Qt::QueuedConnection);
     }
+#endif
 }
 
-void ChatServer::sendError(QTcpSocket* socket, const QString& message) {
-    QJsonObject errorMsg;
-    errorMsg["type"] = "error";
-    errorMsg["message"] = message;
-    sendToClient(socket, errorMsg);
-}
+void ChatServer::incomingConnection(qintptr socketDescriptor) {
+    if (shedConnection(socketDescriptor)) return;
 
-void ChatServer::broadcastRoomList() {
-    QJsonObject roomsMsg;
-    roomsMsg["type"] = "roomList";
-    QJsonArray roomArray;
-    for (const auto& room : chatRooms.keys()) {
-        roomArray.append(room);
-    }
-    roomsMsg["rooms"] = roomArray;
+    // 소켓 객체는 담당 워커 스레드에서 만들어야 그 이벤트 루프에서 동작한다
+    ChatWorker *worker = workers[nextWorker];
+    nextWorker = (nextWorker + 1) % workers.size();
 
-    for (QTcpSocket* socket : activeUsers.keys()) {
-        sendToClient(socket, roomsMsg);
-    }
+    QMetaObject::invokeMethod(worker, [worker, socketDescriptor]() {
+        worker->addConnection(socketDescriptor);
+    }, Qt::QueuedConnection);
 }
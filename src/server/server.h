@@ -1,58 +1,72 @@
 #pragma once
 
 #include <QTcpServer>
-#include <QTcpSocket>
-#include <QMap>
-#include <QSet>
-#include <QString>
-
-class ChatRoom {
-public:
-    QString name;                         // 방 이름
-    QString password;                     // 방 비밀번호
-    QSet<QTcpSocket*> participants;       // 방 참가자
-
-    ChatRoom() {} // 기본 생성자
-    ChatRoom(const QString &roomName, const QString &roomPassword)
-        : name(roomName), password(roomPassword) {}
-};
-
-class User {
-public:
-    QString username;  // 사용자 이름
-    QString password;  // 사용자 비밀번호
-    QString currentRoom;  // 현재 참가 중인 방
-};
+#include <QThread>
+#include <QHostAddress>
+#include <QSocketNotifier>
+#include <QVector>
+#include "chatdirectory.h"
+#include "chatworker.h"
+#include "historystore.h"
+#include "statestore.h"
+#include "metrics.h"
+#include "filestore.h"
+#include "filetransfer.h"
+#include "serverconfig.h"
+#include "ratelimit.h"
+#include "federation.h"
 
+// 연결을 받아 워커 스레드들에 나눠 주는 서버
+// 수락만 메인 스레드에서 하고, 읽기/처리/방송은 각 워커의 이벤트 루프가 맡는다.
 class ChatServer : public QTcpServer {
     Q_OBJECT
 
 public:
-    explicit ChatServer(QObject *parent = nullptr);
+    static const int kMaxWorkers = 64;  // ChatRoom::workerMask 비트 수
+
+    explicit ChatServer(const ServerConfig& config, QObject *parent = nullptr);
+    ~ChatServer();
+
+    // 채팅 포트를 연다. epoll 백엔드면 QTcpServer 대신 accept4로 한 번에 여러 연결을 받는다.
+    bool listenForClients(const QHostAddress& address, quint16 port);
+
+    int workerCount() const { return workers.size(); }
+    // 시작하지 못한 이유 (비어 있으면 정상)
+    QString startupError() const { return errorMessage; }
+    // 상태 복구 결과 (상태 저장을 끄면 nullptr)
+    const RecoveryStats* recoveryStats() const { return state ? &state->recoveryStats() : nullptr; }
+    // 모든 워커의 송신 카운터 합계
+    OutboundTotals outboundTotals() const;
+    // 모든 워커의 계측 값을 Prometheus 텍스트 형식으로 만든다 (임의 스레드)
+    QByteArray renderMetrics() const;
 
 protected:
     void incomingConnection(qintptr socketDescriptor) override;
 
 private:
-    QMap<QString, ChatRoom> chatRooms;      // 방 목록
-    QMap<QTcpSocket*, QString> activeUsers; // 활성 사용자
-    QMap<QString, User> registeredUsers;   // 등록된 사용자
-
-    // 메시지 처리 함수
-    void processMessage(QTcpSocket* socket, const QByteArray& data);
-    void handleRegistration(QTcpSocket* socket, const QJsonObject& data);
-    void handleLogin(QTcpSocket* socket, const QJsonObject& data);
-    void handleCreateRoom(QTcpSocket* socket, const QJsonObject& data);
-    void handleJoinRoom(QTcpSocket* socket, const QJsonObject& data);
-    void handleChatMessage(QTcpSocket* socket, const QJsonObject& data);
-    void handleFileUploadNotification(QTcpSocket* socket, const QJsonObject& data);
-    void handleDisconnection(QTcpSocket* socket);
-
-    // 유틸리티 함수
-    void broadcastToRoom(const QString& room, const QJsonObject& message);
-    void sendToClient(QTcpSocket* socket, const QJsonObject& message);
-    void sendError(QTcpSocket* socket, const QString& message);
-    void broadcastRoomList();
-};
+    // 한 번에 accept하는 최대 연결 수 (리스닝 소켓이 아직 읽기 가능하면 다시 불린다)
+    static const int kAcceptBatch = 64;
 
+    bool shedConnection(qintptr socketDescriptor);
+    void acceptBatch();
 
+    ServerConfig config;               // 실행 설정 (워커가 참조)
+    OverloadMonitor overload;          // 서버 전체 과부하 단계 (워커가 보고한다)
+    ChatDirectory directory;           // 사용자/방 목록
+    StateStore *state = nullptr;       // 사용자/방 목록 영속화 (끄면 nullptr)
+    QString errorMessage;
+    QVector<QThread*> threads;         // 워커 스레드
+    QVector<ChatWorker*> workers;      // 각 스레드의 워커
+    HistoryStore *history = nullptr;   // 메시지 기록 (끄면 nullptr)
+    QThread *historyThread = nullptr;  // 기록 전용 스레드
+    MetricsEndpoint *metricsEndpoint = nullptr;  // 계측 엔드포인트 (끄면 nullptr)
+    FileStore *files = nullptr;                  // 방별 파일 저장소 (끄면 nullptr)
+    FileTransferServer *transfers = nullptr;     // 파일 전송 채널 (files 스레드에서 동작)
+    QThread *filesThread = nullptr;
+    QAtomicInt nextAnnouncer;                    // 업로드 알림을 맡길 워커 (전송 스레드에서 쓴다)
+    QSocketNotifier *acceptNotifier = nullptr;   // accept4 일괄 수락 (epoll 백엔드)
+    Federation *federation = nullptr;            // 노드 간 링크 (단일 노드면 nullptr)
+    QThread *federationThread = nullptr;
+    SessionRegistry *sessions = nullptr;         // 이어 받기 토큰 (끄면 nullptr)
+    int nextWorker = 0;                // 라운드 로빈 분배 위치
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "outboundqueue.h"
+#include "historystore.h"
+#include "statestore.h"
+#include "filestore.h"
+#include "protocol.h"
+#include "ratelimit.h"
+#include "transport.h"
+#include "federation.h"
+#include "sessionregistry.h"
+
+// 연결 제한 시간 (0이면 끈다)
+struct TimeoutConfig {
+    int heartbeatIntervalMs = 30000;   // 이만큼 조용하면 ping을 보낸다 (FeatureHeartbeat 연결만)
+    int idleTimeoutMs = 90000;         // 이만큼 아무것도 받지 못하면 끊는다 (FeatureHeartbeat 연결만)
+    int loginDeadlineMs = 300000;      // 접속 후 이 안에 로그인하지 않으면 끊는다
+    int writeStallMs = 30000;          // 보낼 것이 있는데 이만큼 한 바이트도 나가지 않으면 끊는다
+};
+
+// 서버 실행 설정. 시작할 때 정해지고 이후 모든 워커가 읽기만 한다.
+struct ServerConfig {
+    quint16 port = 12345;         // 채팅 포트
+    int workers = 1;              // 워커 이벤트 루프 수
+    IoBackend ioBackend = IoBackend::Qt;  // 클라이언트 소켓 처리 방식
+    bool binaryEncoding = true;   // false면 CBOR를 협상하지 않는다 (디버깅용)
+    OutboundLimits outbound;      // 연결별 송신 대기열 한계
+    int writeCoalesceUs = 0;      // 송신 프레임을 모아 쓰는 기한 (0이면 이번 틱 끝, 음수면 바로 쓴다)
+    int compressThreshold = Protocol::kDefaultCompressThreshold;  // 이 크기 이상 프레임을 압축 (0이면 협상하지 않는다)
+    HistoryConfig history;        // 방별 메시지 기록
+    StateConfig state;            // 사용자/방 목록 스냅샷 + WAL
+    FileConfig files;             // 방별 파일 저장소와 전송 채널
+    RateLimitConfig rateLimits;   // 연결별/메시지 타입별 수신 한도
+    OverloadConfig overload;      // 과부하 단계 기준
+    TimeoutConfig timeouts;       // 유휴/반열림 연결 정리
+    int maxRoomsPerConnection = 32;  // FeatureMultiRoom 연결 하나가 구독할 수 있는 방 수
+    ResumeConfig resume;          // 끊긴 세션 이어 받기와 방별 최근 메시지 보관
+    FederationConfig federation;  // 여러 서버 프로세스를 묶는 노드 간 링크 (기본은 끔)
+    quint16 metricsPort = 0;      // 계측 엔드포인트 포트 (localhost, 0이면 끈다)
+};
@@ -0,0 +1,76 @@
+#include "sessionregistry.h"
+#include <QDateTime>
+#include <QRandomGenerator>
+
+QByteArray SessionRegistry::issue(quint32 userId, ChatRoom *room, int worker, quint64 connection) {
+    quint32 random[4];
+    QRandomGenerator::system()->fillRange(random);
+    QByteArray token = QByteArray(reinterpret_cast<const char*>(random), sizeof(random)).toHex();
+
+    Ticket ticket;
+    ticket.userId = userId;
+    ticket.room = room;
+    ticket.rooms.append(room);
+    ticket.worker = worker;
+    ticket.connection = connection;
+
+    QMutexLocker locker(&mutex);
+    expire(QDateTime::currentMSecsSinceEpoch());
+    tickets.insert(token, ticket);
+    return token;
+}
+
+void SessionRegistry::revoke(const QByteArray& token) {
+    QMutexLocker locker(&mutex);
+    tickets.remove(token);
+}
+
+void SessionRegistry::setRooms(const QByteArray& token, ChatRoom *current, const QVector<ChatRoom*>& rooms) {
+    QMutexLocker locker(&mutex);
+    QHash<QByteArray, Ticket>::iterator it = tickets.find(token);
+    if (it == tickets.end()) return;
+    it->room = current;
+    it->rooms = rooms;
+}
+
+bool SessionRegistry::suspend(const QByteArray& token, int worker, quint64 connection) {
+    QMutexLocker locker(&mutex);
+    QHash<QByteArray, Ticket>::iterator it = tickets.find(token);
+    // 이미 다른 연결이 넘겨받았으면 그대로 둔다
+    if (it == tickets.end() || it->worker != worker || it->connection != connection) return false;
+    it->worker = -1;
+    it->expiresAt = QDateTime::currentMSecsSinceEpoch() + config.windowMs;
+    return true;
+}
+
+bool SessionRegistry::resume(const QByteArray& token, int worker, quint64 connection, Ticket *previous) {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QMutexLocker locker(&mutex);
+    expire(now);
+    QHash<QByteArray, Ticket>::iterator it = tickets.find(token);
+    if (it == tickets.end()) return false;
+    if (it->worker < 0 && it->expiresAt < now) {
+        tickets.erase(it);
+        return false;
+    }
+    *previous = *it;
+    it->worker = worker;
+    it->connection = connection;
+    return true;
+}
+
+int SessionRegistry::size() const {
+    QMutexLocker locker(&mutex);
+    return tickets.size();
+}
+
+void SessionRegistry::expire(qint64 now) {
+    // 발급하거나 이어 받을 때 가끔씩만 훑는다
+    if (now < nextExpiry) return;
+    nextExpiry = now + 10000;
+    for (QHash<QByteArray, Ticket>::iterator it = tickets.begin(); it != tickets.end();) {
+        if (it->worker < 0 && it->expiresAt < now) it = tickets.erase(it);
+        else ++it;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include "chatdirectory.h"
+
+// 세션 이어 받기 설정
+struct ResumeConfig {
+    int windowMs = 120000;    // 끊긴 세션을 이어 받을 수 있는 시간 (0이면 끈다)
+    int replayFrames = 256;   // 방마다 다시 보낼 수 있도록 보관하는 최근 메시지 수
+
+    bool isEnabled() const { return windowMs > 0 && replayFrames > 0; }
+};
+
+// 로그인한 세션의 이어 받기 토큰
+// 연결이 살아 있는 동안 토큰은 그 연결(워커, 연결 번호)에 묶여 있고, 끊기면 windowMs 동안 보관한다.
+// 클라이언트가 끊김을 먼저 알아채고 다시 오면 서버는 아직 이전 연결을 들고 있을 수 있으므로
+// 이어 받기는 살아 있는 세션도 넘겨받는다. 모든 워커가 함께 쓰며 로그인, 방 입장, 끊김,
+// 이어 받기 때만 잠금을 잡는다.
+class SessionRegistry {
+public:
+    struct Ticket {
+        quint32 userId = ChatDirectory::kInvalidId;
+        ChatRoom *room = nullptr;   // 기본 방 (방 이름 없이 보낸 요청의 대상)
+        QVector<ChatRoom*> rooms;   // 구독한 방 (room 포함)
+        int worker = -1;            // 토큰을 가진 연결 (-1이면 끊긴 채 기다린다)
+        quint64 connection = 0;
+        qint64 expiresAt = 0;       // 끊긴 세션이 사라지는 시각 (ms)
+    };
+
+    explicit SessionRegistry(const ResumeConfig& config) : config(config) {}
+
+    QByteArray issue(quint32 userId, ChatRoom *room, int worker, quint64 connection);
+    void revoke(const QByteArray& token);
+    void setRooms(const QByteArray& token, ChatRoom *current, const QVector<ChatRoom*>& rooms);
+    // 연결이 끊겼다. 그 연결이 아직 토큰을 가지고 있을 때만 기다리기 시작하고 true.
+    bool suspend(const QByteArray& token, int worker, quint64 connection);
+    // 새 연결로 옮긴다. 모르는 토큰이거나 만료되었으면 false. previous에 옮기기 전 상태를 담는다.
+    bool resume(const QByteArray& token, int worker, quint64 connection, Ticket *previous);
+    int size() const;
+
+private:
+    void expire(qint64 now);
+
+    const ResumeConfig& config;
+    mutable QMutex mutex;
+    QHash<QByteArray, Ticket> tickets;
+    qint64 nextExpiry = 0;
+};
@@ -0,0 +1,390 @@
+#include "statestore.h"
+#include "chatdirectory.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QtEndian>
+#include <QDebug>
+#include <cstdio>
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const quint32 kSnapshotMagic = 0x51544353;  // "QTCS"
+    const quint16 kSnapshotVersion = 1;
+    const int kRecordHeaderSize = 4 + 2;        // 길이 + 체크섬
+    const int kMaxRecordSize = 64 * 1024;
+    const int kSnapshotCheckMs = 10 * 1000;
+
+    bool syncFile(int fd) {
+#if defined(Q_OS_LINUX)
+        return ::fdatasync(fd) == 0;
+#elif defined(Q_OS_UNIX)
+        return ::fsync(fd) == 0;
+#else
+        Q_UNUSED(fd);
+        return true;
+#endif
+    }
+
+    // rename 결과가 디스크에 남도록 디렉토리 자체도 내린다
+    void syncDirectory(const QString& path) {
+#ifdef Q_OS_UNIX
+        int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+        if (fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+#else
+        Q_UNUSED(path);
+#endif
+    }
+
+    quint64 walFileSeq(const QString& fileName) {
+        // wal-<첫 번호>.log
+        bool ok = false;
+        quint64 seq = fileName.mid(4, fileName.size() - 8).toULongLong(&ok);
+        return ok ? seq : 0;
+    }
+}
+
+// 캡처한 목록을 스레드 풀에서 파일로 쓴다
+class SnapshotTask : public QRunnable {
+public:
+    SnapshotTask(StateStore *store, const DirectoryState& state) : store(store), state(state) {}
+
+    void run() override {
+        if (store->writeSnapshot(state)) {
+            store->snapshotSeq.storeRelease(state.seq);
+            store->removeWalBefore(state.seq);
+        }
+        store->snapshotRunning.storeRelease(0);
+    }
+
+private:
+    StateStore *store;
+    DirectoryState state;
+};
+
+StateStore::StateStore(const StateConfig& config, QObject *parent)
+    : QObject(parent), settings(config) {}
+
+StateStore::~StateStore() {
+    // 쓰는 중인 스냅샷이 끝나기를 기다린 뒤 WAL을 닫는다
+    QThreadPool::globalInstance()->waitForDone();
+    if (wal.isOpen()) {
+        syncFile(wal.handle());
+        wal.close();
+    }
+}
+
+QString StateStore::walPath(quint64 firstSeq) const {
+    return QDir(settings.directory).filePath(QString("wal-%1.log").arg(firstSeq, 20, 10, QChar('0')));
+}
+
+QString StateStore::snapshotPath() const {
+    return QDir(settings.directory).filePath("snapshot.bin");
+}
+
+bool StateStore::open(ChatDirectory* dir) {
+    QElapsedTimer total;
+    total.start();
+
+    if (!QDir().mkpath(settings.directory)) {
+        lastError = "Cannot create state directory " + settings.directory;
+        return false;
+    }
+
+    QElapsedTimer step;
+    step.start();
+    if (!loadSnapshot(dir)) return false;
+    stats.snapshotMs = step.restart();
+
+    if (!replayWal(dir)) return false;
+    stats.replayMs = step.elapsed();
+
+    // 이후의 변경은 새 파일에 쓴다 (이전 실행의 잘린 꼬리와 섞이지 않도록)
+    if (!openWal(lastSeq + 1)) return false;
+    syncedSeq.storeRelease(lastSeq);
+    snapshotSeq.storeRelease(stats.snapshotSeq);
+    lastSnapshotTime = QDateTime::currentMSecsSinceEpoch();
+    directory = dir;
+
+    DirectoryState state = dir->capture();
+    stats.users = state.users.size();
+    stats.rooms = state.rooms.size();
+    stats.totalMs = total.elapsed();
+    return true;
+}
+
+bool StateStore::loadSnapshot(ChatDirectory* dir) {
+    QFile file(snapshotPath());
+    if (!file.exists()) return true;
+    if (!file.open(QIODevice::ReadOnly)) {
+        lastError = "Cannot open " + file.fileName();
+        return false;
+    }
+
+    // 한 번에 읽어 메모리에서 푼다
+    QByteArray bytes = file.readAll();
+    if (bytes.size() < 2) {
+        lastError = "Snapshot is truncated";
+        return false;
+    }
+    int bodySize = bytes.size() - 2;
+    quint16 stored = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(bytes.constData() + bodySize));
+    if (qChecksum(bytes.constData(), uint(bodySize)) != stored) {
+        lastError = "Snapshot checksum mismatch";
+        return false;
+    }
+
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint32 magic;
+    quint16 version;
+    quint64 seq;
+    quint32 userCount;
+    in >> magic >> version >> seq >> userCount;
+    if (magic != kSnapshotMagic || version != kSnapshotVersion) {
+        lastError = "Unknown snapshot format";
+        return false;
+    }
+
+    dir->reserveUsers(int(userCount));
+    QString name, password;
+    for (quint32 i = 0; i < userCount && in.status() == QDataStream::Ok; ++i) {
+        in >> name >> password;
+        dir->registerUser(name, password);
+    }
+
+    quint32 roomCount = 0;
+    in >> roomCount;
+    for (quint32 i = 0; i < roomCount && in.status() == QDataStream::Ok; ++i) {
+        in >> name >> password;
+        dir->createRoom(name, password);  // Public은 이미 있으므로 건너뛴다
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        lastError = "Snapshot is corrupted";
+        return false;
+    }
+    stats.snapshotSeq = seq;
+    lastSeq = seq;
+    return true;
+}
+
+bool StateStore::replayWal(ChatDirectory* dir) {
+    QDir root(settings.directory);
+    const QStringList files = root.entryList(QStringList() << "wal-*.log", QDir::Files, QDir::Name);
+
+    for (const QString& fileName : files) {
+        QFile file(root.filePath(fileName));
+        if (!file.open(QIODevice::ReadOnly)) {
+            lastError = "Cannot open " + file.fileName();
+            return false;
+        }
+        QByteArray bytes = file.readAll();
+
+        int pos = 0;
+        while (bytes.size() - pos >= kRecordHeaderSize) {
+            const uchar *p = reinterpret_cast<const uchar*>(bytes.constData() + pos);
+            quint32 length = qFromBigEndian<quint32>(p);
+            quint16 checksum = qFromBigEndian<quint16>(p + 4);
+            if (length > quint32(kMaxRecordSize) || bytes.size() - pos - kRecordHeaderSize < int(length)) break;
+            const char *payload = bytes.constData() + pos + kRecordHeaderSize;
+            // 쓰다가 끊긴 마지막 레코드는 여기서 걸러진다
+            if (qChecksum(payload, length) != checksum) break;
+            pos += kRecordHeaderSize + int(length);
+
+            QDataStream in(QByteArray::fromRawData(payload, int(length)));
+            in.setVersion(QDataStream::Qt_5_12);
+            quint64 seq;
+            quint8 type;
+            QString name, password;
+            in >> seq >> type >> name >> password;
+            if (in.status() != QDataStream::Ok) break;
+            if (seq <= lastSeq) continue;  // 이미 스냅샷에 들어 있다
+
+            if (type == RegisterUser) dir->registerUser(name, password);
+            else if (type == CreateRoom) dir->createRoom(name, password);
+            else if (type == UpdateUser) dir->storeUser(name, password);
+            else if (type == SetRoomPassword) {
+                if (ChatRoom *room = dir->findRoom(name)) dir->setRoomPassword(room, password);
+            }
+            lastSeq = seq;
+            ++stats.replayedRecords;
+        }
+    }
+    return true;
+}
+
+bool StateStore::openWal(quint64 firstSeq) {
+    wal.setFileName(walPath(firstSeq));
+    // 버퍼 없이 열어 write 한 번이 레코드 하나가 되게 한다
+    if (!wal.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        lastError = "Cannot open " + wal.fileName();
+        return false;
+    }
+    walFirstSeq = firstSeq;
+    syncDirectory(settings.directory);
+    return true;
+}
+
+void StateStore::start() {
+    snapshotTimer = new QTimer(this);
+    connect(snapshotTimer, &QTimer::timeout, this, &StateStore::maybeSnapshot);
+    snapshotTimer->start(qBound(1000, settings.snapshotIntervalSecs * 1000, kSnapshotCheckMs));
+}
+
+quint64 StateStore::append(RecordType type, const QString& name, const QString& password) {
+    QMutexLocker locker(&writeMutex);
+    if (!wal.isOpen()) return 0;
+
+    quint64 seq = lastSeq + 1;
+    QByteArray payload;
+    {
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_12);
+        out << seq << quint8(type) << name << password;
+    }
+
+    QByteArray record(kRecordHeaderSize, Qt::Uninitialized);
+    qToBigEndian<quint32>(quint32(payload.size()), reinterpret_cast<uchar*>(record.data()));
+    qToBigEndian<quint16>(qChecksum(payload.constData(), uint(payload.size())),
+                          reinterpret_cast<uchar*>(record.data() + 4));
+    record.append(payload);
+
+    if (wal.write(record) != record.size()) {
+        // 꼬리가 깨진 파일에 더 붙이면 복구할 때 뒤의 레코드를 잃는다
+        qWarning() << "WAL write failed:" << wal.errorString();
+        wal.close();
+        return 0;
+    }
+    lastSeq = seq;
+    return seq;
+}
+
+bool StateStore::sync(quint64 seq) {
+    if (syncedSeq.loadAcquire() >= seq) return true;
+
+    QMutexLocker locker(&syncMutex);
+    // 기다리는 동안 앞선 스레드의 fsync에 함께 실렸을 수 있다
+    if (syncedSeq.loadAcquire() >= seq) return true;
+
+    quint64 target;
+    int fd;
+    {
+        QMutexLocker writeLocker(&writeMutex);
+        target = lastSeq;
+        fd = wal.isOpen() ? wal.handle() : -1;
+    }
+    // 파일 교체는 syncMutex를 잡아야 하므로 fd는 여기서 닫히지 않는다.
+    // fsync하는 동안에도 다른 스레드는 계속 WAL에 붙일 수 있다.
+    if (fd < 0 || !syncFile(fd)) return false;
+    syncedSeq.storeRelease(target);
+    return true;
+}
+
+quint64 StateStore::rotate() {
+    QMutexLocker syncLocker(&syncMutex);
+    QMutexLocker writeLocker(&writeMutex);
+    quint64 cut = lastSeq;
+    if (wal.isOpen() && walFirstSeq == cut + 1) return cut;  // 새 레코드가 없었다
+
+    if (wal.isOpen()) {
+        if (syncFile(wal.handle())) syncedSeq.storeRelease(cut);
+        wal.close();
+    }
+    if (!openWal(cut + 1)) {
+        qWarning() << "Cannot rotate WAL:" << lastError;
+    }
+    return cut;
+}
+
+void StateStore::removeWalBefore(quint64 seq) {
+    // seq 이하만 담은 파일 (파일은 항상 스냅샷 경계에서 바뀐다)
+    QDir root(settings.directory);
+    const QStringList files = root.entryList(QStringList() << "wal-*.log", QDir::Files, QDir::Name);
+    for (const QString& fileName : files) {
+        quint64 firstSeq = walFileSeq(fileName);
+        if (firstSeq != 0 && firstSeq <= seq) {
+            root.remove(fileName);
+        }
+    }
+}
+
+bool StateStore::writeSnapshot(const DirectoryState& state) {
+    QByteArray body;
+    {
+        QDataStream out(&body, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_12);
+        out << kSnapshotMagic << kSnapshotVersion << quint64(state.seq) << quint32(state.users.size());
+        for (const User& user : state.users) {
+            out << user.username << user.password;
+        }
+        out << quint32(state.rooms.size());
+        for (const QPair<QString, QString>& room : state.rooms) {
+            out << room.first << room.second;
+        }
+    }
+    char checksum[2];
+    qToBigEndian<quint16>(qChecksum(body.constData(), uint(body.size())), reinterpret_cast<uchar*>(checksum));
+
+    // 임시 파일에 다 쓰고 내린 뒤 이름을 바꿔 원자적으로 교체한다
+    QString path = snapshotPath();
+    QString tmpPath = path + ".tmp";
+    QFile file(tmpPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || file.write(body) != body.size() || file.write(checksum, 2) != 2 || !file.flush()
+        || !syncFile(file.handle())) {
+        qWarning() << "Failed to write snapshot:" << file.errorString();
+        file.close();
+        QFile::remove(tmpPath);
+        return false;
+    }
+    file.close();
+
+    if (std::rename(QFile::encodeName(tmpPath).constData(), QFile::encodeName(path).constData()) != 0) {
+        qWarning() << "Failed to replace snapshot";
+        QFile::remove(tmpPath);
+        return false;
+    }
+    syncDirectory(settings.directory);
+    return true;
+}
+
+bool StateStore::snapshotNow() {
+    if (!directory || !snapshotRunning.testAndSetOrdered(0, 1)) return false;
+
+    DirectoryState state = directory->capture();
+    bool ok = writeSnapshot(state);
+    if (ok) {
+        snapshotSeq.storeRelease(state.seq);
+        removeWalBefore(state.seq);
+        lastSnapshotTime = QDateTime::currentMSecsSinceEpoch();
+    }
+    snapshotRunning.storeRelease(0);
+    return ok;
+}
+
+void StateStore::maybeSnapshot() {
+    quint64 synced = syncedSeq.loadAcquire();
+    quint64 covered = snapshotSeq.loadAcquire();
+    if (synced <= covered) return;
+    quint64 pending = synced - covered;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    bool due = pending >= quint64(settings.snapshotEveryRecords)
+        || now - lastSnapshotTime >= qint64(settings.snapshotIntervalSecs) * 1000;
+    if (!due || !snapshotRunning.testAndSetOrdered(0, 1)) return;
+
+    // 잠금 안에서는 목록을 복사하고 WAL만 넘긴다. 파일 쓰기는 스레드 풀에서 한다.
+    lastSnapshotTime = now;
+    QThreadPool::globalInstance()->start(new SnapshotTask(this, directory->capture()));
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <QObject>
+#include <QAtomicInteger>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+class ChatDirectory;
+struct DirectoryState;
+
+struct StateConfig {
+    QString directory;                 // 비어 있으면 메모리에만 둔다
+    int snapshotIntervalSecs = 300;    // 변경이 있을 때 스냅샷을 찍는 주기
+    int snapshotEveryRecords = 50000;  // WAL이 이만큼 쌓이면 주기를 기다리지 않는다
+};
+
+// 시작할 때의 복구 결과
+struct RecoveryStats {
+    int users = 0;
+    int rooms = 0;
+    quint64 snapshotSeq = 0;     // 스냅샷에 포함된 마지막 WAL 번호
+    int replayedRecords = 0;     // 스냅샷 뒤에서 다시 적용한 WAL 레코드 수
+    qint64 snapshotMs = 0;
+    qint64 replayMs = 0;
+    qint64 totalMs = 0;
+};
+
+// 사용자/방 목록의 스냅샷 + WAL(write-ahead log)
+// 등록과 방 생성은 ChatDirectory가 쓰기 잠금을 잡은 채 WAL에 한 줄씩 붙이고,
+// 응답하기 전에 sync로 디스크에 내린다. 동시에 기다리는 스레드들은 한 번의
+// fdatasync를 나눠 쓴다 (group commit). 스냅샷은 잠금 안에서 목록을 복사하고
+// WAL을 새 파일로 넘긴 뒤, 파일 쓰기는 스레드 풀에서 한다. 스냅샷이 디스크에
+// 내려가면 그 앞의 WAL 파일은 지운다.
+class StateStore : public QObject {
+    Q_OBJECT
+
+public:
+    enum RecordType : quint8 {
+        RegisterUser = 1,
+        CreateRoom = 2,
+        UpdateUser = 3,     // 다른 노드에서 정한 비밀번호로 바꾼다
+        SetRoomPassword = 4
+    };
+
+    explicit StateStore(const StateConfig& config, QObject *parent = nullptr);
+    ~StateStore();
+
+    // 최신 스냅샷을 읽고 그 뒤의 WAL만 다시 적용한 다음 새 WAL 파일을 연다
+    bool open(ChatDirectory* directory);
+    const RecoveryStats& recoveryStats() const { return stats; }
+    QString errorString() const { return lastError; }
+
+    // 주기적인 스냅샷을 시작한다
+    void start();
+
+    // ChatDirectory가 쓰기 잠금 안에서 호출한다. 레코드 번호를 반환하고 실패하면 0.
+    quint64 append(RecordType type, const QString& name, const QString& password);
+    // seq까지 디스크에 내려갈 때까지 기다린다 (잠금 밖에서 호출)
+    bool sync(quint64 seq);
+    // ChatDirectory가 목록을 복사하는 잠금 안에서 호출한다.
+    // 지금까지의 WAL을 닫고 새 파일로 넘긴 뒤 마지막 번호를 반환한다.
+    quint64 rotate();
+
+    // 스냅샷을 지금 찍는다 (호출한 스레드에서 파일까지 쓴다)
+    bool snapshotNow();
+
+private:
+    friend class SnapshotTask;
+
+    bool loadSnapshot(ChatDirectory* directory);
+    bool replayWal(ChatDirectory* directory);
+    bool openWal(quint64 firstSeq);
+    bool writeSnapshot(const DirectoryState& state);
+    void removeWalBefore(quint64 seq);
+    void maybeSnapshot();
+
+    QString walPath(quint64 firstSeq) const;
+    QString snapshotPath() const;
+
+    const StateConfig settings;
+    ChatDirectory *directory = nullptr;
+    RecoveryStats stats;
+    QString lastError;
+
+    QMutex syncMutex;                    // fdatasync와 WAL 교체 (writeMutex보다 먼저 잡는다)
+    QMutex writeMutex;                   // WAL 파일과 번호
+    QFile wal;
+    quint64 walFirstSeq = 0;
+    quint64 lastSeq = 0;
+    QAtomicInteger<quint64> syncedSeq;
+    QAtomicInteger<quint64> snapshotSeq;   // 마지막 스냅샷에 포함된 번호
+    QAtomicInt snapshotRunning;
+    QTimer *snapshotTimer = nullptr;
+    qint64 lastSnapshotTime = 0;
+};
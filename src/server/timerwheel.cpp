@@ -0,0 +1,88 @@
+#include "timerwheel.h"
+
+const int TimerWheel::kLevels;
+const int TimerWheel::kSlotBits;
+const int TimerWheel::kSlots;
+
+TimerWheel::TimerWheel(int tickMs) : tick(qMax(1, tickMs)) {
+    for (int level = 0; level < kLevels; ++level) {
+        for (int slot = 0; slot < kSlots; ++slot) {
+            slots[level][slot].prev = slots[level][slot].next = &slots[level][slot];
+        }
+    }
+    due.prev = due.next = &due;
+}
+
+void TimerWheel::link(TimerNode *list, TimerNode *node) {
+    node->prev = list->prev;
+    node->next = list;
+    list->prev->next = node;
+    list->prev = node;
+}
+
+void TimerWheel::unlink(TimerNode *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+}
+
+void TimerWheel::schedule(TimerNode *node, qint64 nowMs, qint64 delayMs) {
+    if (node->isScheduled()) unlink(node);
+    // 휠이 아직 따라오지 못했어도 현재 시각을 기준으로 잡는다
+    quint64 base = qMax(current, quint64(qMax<qint64>(0, nowMs)) / quint64(tick));
+    quint64 ticks = quint64(qMax<qint64>(1, (delayMs + tick - 1) / tick));
+    node->expires = base + ticks;
+    place(node);
+}
+
+void TimerWheel::cancel(TimerNode *node) {
+    if (node->isScheduled()) unlink(node);
+}
+
+void TimerWheel::place(TimerNode *node) {
+    // 맨 위 바퀴보다 먼 항목은 끝 칸에 두었다가 내려올 때 다시 잰다
+    const quint64 span = quint64(1) << (kSlotBits * kLevels);
+    if (node->expires - current >= span) node->expires = current + span - 1;
+
+    quint64 diff = node->expires - current;
+    int level = 0;
+    while (level < kLevels - 1 && diff >= (quint64(1) << (kSlotBits * (level + 1)))) {
+        ++level;
+    }
+    int slot = int((node->expires >> (kSlotBits * level)) & (kSlots - 1));
+    link(&slots[level][slot], node);
+}
+
+void TimerWheel::cascade(int level) {
+    TimerNode *head = &slots[level][(current >> (kSlotBits * level)) & (kSlots - 1)];
+    while (head->next != head) {
+        TimerNode *node = head->next;
+        unlink(node);
+        place(node);
+    }
+}
+
+void TimerWheel::advance(qint64 nowMs) {
+    quint64 target = quint64(qMax<qint64>(0, nowMs)) / quint64(tick);
+    while (current < target) {
+        ++current;
+        // 아래 바퀴가 한 바퀴를 다 돌았으면 위 바퀴의 이번 칸을 풀어 내린다
+        for (int level = kLevels - 1; level > 0; --level) {
+            if ((current & ((quint64(1) << (kSlotBits * level)) - 1)) == 0) cascade(level);
+        }
+
+        TimerNode *head = &slots[0][current & (kSlots - 1)];
+        while (head->next != head) {
+            TimerNode *node = head->next;
+            unlink(node);
+            link(&due, node);
+        }
+    }
+}
+
+TimerNode* TimerWheel::takeDue() {
+    if (!hasDue()) return nullptr;
+    TimerNode *node = due.next;
+    unlink(node);
+    return node;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QtGlobal>
+
+// 타이머 휠에 거는 항목. 소유자 안에 넣어 두므로 예약/취소에 할당이 없다.
+struct TimerNode {
+    TimerNode *prev = nullptr;
+    TimerNode *next = nullptr;
+    quint64 expires = 0;      // 만료 틱
+    void *owner = nullptr;    // 만료됐을 때 되찾을 객체
+
+    bool isScheduled() const { return next != nullptr; }
+};
+
+// 계층형 타이머 휠 (워커 스레드 전용)
+// 64칸짜리 바퀴 4단으로 틱 수의 6비트씩을 맡는다. 틱이 100ms면 첫 바퀴는 6.4초,
+// 넷째 바퀴는 약 19일까지 담는다. 예약/취소는 O(1)이고, 위 바퀴의 칸은 아래 바퀴가
+// 한 바퀴 돌 때만 한 번 풀어 내린다. 연결 수만큼 QTimer를 만들지 않고도 제한 시간을 건다.
+// 만료된 항목은 바로 콜백하지 않고 due 목록에 모아 두므로 호출하는 쪽이 나눠서 처리할 수 있다.
+class TimerWheel {
+public:
+    static const int kLevels = 4;
+    static const int kSlotBits = 6;
+    static const int kSlots = 1 << kSlotBits;
+
+    explicit TimerWheel(int tickMs);
+
+    int tickMs() const { return tick; }
+
+    // nowMs + delayMs 뒤에 만료되도록 건다 (이미 걸려 있으면 옮긴다)
+    void schedule(TimerNode *node, qint64 nowMs, qint64 delayMs);
+    // 어느 칸이나 due 목록에 있어도 뺀다
+    void cancel(TimerNode *node);
+
+    // nowMs까지의 틱을 돌려 만료된 항목을 due 목록으로 옮긴다
+    void advance(qint64 nowMs);
+    // due 목록에서 하나 꺼낸다 (없으면 nullptr)
+    TimerNode* takeDue();
+    bool hasDue() const { return due.next != &due; }
+
+private:
+    static void link(TimerNode *list, TimerNode *node);
+    static void unlink(TimerNode *node);
+    void place(TimerNode *node);
+    void cascade(int level);
+
+    int tick;
+    quint64 current = 0;                // 마지막으로 처리한 틱
+    TimerNode slots[kLevels][kSlots];   // 칸마다 원형 이중 연결 리스트의 머리
+    TimerNode due;                      // 만료되어 처리를 기다리는 항목
+};
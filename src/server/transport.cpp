@@ -0,0 +1,27 @@
+#include "transport.h"
+
+QtTransport::QtTransport(QTcpSocket *socket, ClientConnection *connection, TransportEvents *events)
+    : socket(socket) {
+    // 연결 객체를 직접 붙잡아 두어 이벤트마다 맵을 찾지 않는다.
+    // release에서 시그널을 끊은 뒤에 연결 객체가 지워진다.
+    QObject::connect(socket, &QTcpSocket::readyRead, socket, [socket, connection, events]() {
+        events->transportWakeup();
+        events->transportRead(*connection, socket->readAll());
+    });
+
+    // 소켓 버퍼가 비워지는 만큼 대기열에서 더 넘긴다
+    QObject::connect(socket, &QTcpSocket::bytesWritten, socket, [connection, events]() {
+        events->transportWakeup();
+        events->transportWritten(*connection);
+    });
+
+    QObject::connect(socket, &QTcpSocket::disconnected, socket, [connection, events]() {
+        events->transportClosed(*connection);
+    });
+}
+
+void QtTransport::release() {
+    socket->disconnect();
+    socket->deleteLater();
+    delete this;
+}
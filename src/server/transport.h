@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QByteArray>
+#include <QTcpSocket>
+
+class ClientConnection;
+
+// 클라이언트 소켓을 다루는 방식
+enum class IoBackend {
+    Qt,     // 연결마다 QTcpSocket (기본, 모든 플랫폼)
+    Epoll   // 워커마다 epoll 하나, 엣지 트리거 (Linux)
+};
+
+// 백엔드가 워커에 알리는 소켓 사건 (모두 워커 스레드에서 불린다)
+class TransportEvents {
+public:
+    virtual ~TransportEvents() {}
+    // 이벤트 루프가 소켓 때문에 한 번 깨어났다 (계측용)
+    virtual void transportWakeup() = 0;
+    // 받은 바이트. data는 이 호출 안에서만 유효할 수 있다.
+    virtual void transportRead(ClientConnection& connection, const QByteArray& data) = 0;
+    // 들고 있던 바이트 일부가 커널로 넘어갔다
+    virtual void transportWritten(ClientConnection& connection) = 0;
+    // 연결이 끊겼다. 워커는 정리한 뒤 release를 부른다.
+    virtual void transportClosed(ClientConnection& connection) = 0;
+};
+
+// 연결 하나의 소켓
+// 워커는 이 인터페이스로만 쓰고 닫으므로 처리 로직은 백엔드와 무관하다.
+class ClientTransport {
+public:
+    virtual ~ClientTransport() {}
+
+    virtual qintptr descriptor() const = 0;
+    virtual bool isConnected() const = 0;
+    // 커널에 아직 넘기지 못하고 들고 있는 바이트
+    virtual qint64 bytesToWrite() const = 0;
+    // 들고 있는 바이트 뒤에 붙인다. 쓸 수 있게 되면 백엔드가 마저 보낸다.
+    virtual void write(const QByteArray& data) = 0;
+    // 바로 닫는다. transportClosed가 이 호출 안에서 불린다.
+    virtual void abort() = 0;
+    // transportClosed를 처리한 뒤 워커가 부른다. 이후 이 객체를 쓰면 안 된다.
+    virtual void release() = 0;
+};
+
+// QTcpSocket 백엔드
+class QtTransport : public ClientTransport {
+public:
+    QtTransport(QTcpSocket *socket, ClientConnection *connection, TransportEvents *events);
+
+    qintptr descriptor() const override { return socket->socketDescriptor(); }
+    bool isConnected() const override { return socket->state() == QAbstractSocket::ConnectedState; }
+    qint64 bytesToWrite() const override { return socket->bytesToWrite(); }
+    void write(const QByteArray& data) override { socket->write(data); }
+    void abort() override { socket->abort(); }
+    void release() override;
+
+private:
+    QTcpSocket *socket;
+};
@@ -0,0 +1,28 @@
+QT += core network
+QT -= gui
+
+TARGET = session_bench
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# 빌드 디렉토리 설정
+DESTDIR = $$PWD/build/bench
+OBJECTS_DIR = $$PWD/build/bench/session/.obj
+MOC_DIR = $$PWD/build/bench/session/.moc
+
+INCLUDEPATH += $$PWD/common $$PWD/server
+
+SOURCES += \
+    bench/session_bench.cpp \
+    server/clientconnection.cpp \
+    server/chatdirectory.cpp \
+    server/statestore.cpp \
+    server/outboundqueue.cpp \
+    common/protocol.cpp
+
+HEADERS += \
+    server/clientconnection.h \
+    server/chatdirectory.h \
+    server/statestore.h \
+    server/outboundqueue.h \
+    common/protocol.h
@@ -0,0 +1,22 @@
+QT += core
+QT -= gui
+
+TARGET = state_bench
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# 빌드 디렉토리 설정
+DESTDIR = $$PWD/build/bench
+OBJECTS_DIR = $$PWD/build/bench/state/.obj
+MOC_DIR = $$PWD/build/bench/state/.moc
+
+INCLUDEPATH += $$PWD/common $$PWD/server
+
+SOURCES += \
+    bench/state_bench.cpp \
+    server/chatdirectory.cpp \
+    server/statestore.cpp
+
+HEADERS += \
+    server/chatdirectory.h \
+    server/statestore.h
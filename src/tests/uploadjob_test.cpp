@@ -0,0 +1,112 @@
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryFile>
+#include "protocol.h"
+#include "uploadjob.h"
+
+// 서버 파일 채널 흉내. 정해 둔 조각은 처음 한 번 실패시키고, 받은 조각이 다 모여야 합쳐 준다.
+class FakeFileChannel : public QObject {
+    Q_OBJECT
+
+public:
+    explicit FakeFileChannel(int chunkCount, QObject *parent = nullptr)
+        : QObject(parent), chunkCount(chunkCount) {
+        connect(&server, &QTcpServer::newConnection, this, &FakeFileChannel::accept);
+        server.listen(QHostAddress::LocalHost);
+    }
+
+    quint16 port() const { return server.serverPort(); }
+
+    QSet<qint64> failOnce;         // 처음 요청에 ERR로 답할 조각 위치
+    QSet<qint64> received;         // 끝까지 받은 조각 위치
+    int earlyCommits = 0;          // 조각이 다 모이기 전에 온 COMMIT
+
+private:
+    struct Upload {
+        bool headerDone = false;
+        qint64 offset = 0;
+        qint64 remaining = 0;
+    };
+
+    void accept() {
+        while (QTcpSocket *socket = server.nextPendingConnection()) {
+            Upload *upload = new Upload;
+            connect(socket, &QTcpSocket::readyRead, this, [this, socket, upload]() { read(socket, upload); });
+            connect(socket, &QTcpSocket::disconnected, this, [socket, upload]() {
+                delete upload;
+                socket->deleteLater();
+            });
+        }
+    }
+
+    void read(QTcpSocket *socket, Upload *upload) {
+        if (!upload->headerDone) {
+            if (!socket->canReadLine()) return;
+            QList<QByteArray> parts = socket->readLine().trimmed().split(' ');
+            upload->headerDone = true;
+            if (parts.size() == 3 && parts.at(2) == Protocol::kFileChannelCommit) {
+                if (received.size() == chunkCount) {
+                    socket->write("DONE 0\n");
+                } else {
+                    ++earlyCommits;
+                    socket->write("ERR Missing chunks\n");
+                }
+                return;
+            }
+            upload->offset = parts.value(2).toLongLong();
+            upload->remaining = parts.value(3).toLongLong();
+            if (failOnce.remove(upload->offset)) {
+                socket->write("ERR Busy\n");
+                return;
+            }
+            socket->write("OK 0\n");
+        }
+        upload->remaining -= socket->readAll().size();
+        if (upload->remaining <= 0) {
+            received.insert(upload->offset);
+            socket->write("DONE " + QByteArray::number(upload->offset) + '\n');
+        }
+    }
+
+    QTcpServer server;
+    int chunkCount;
+};
+
+class UploadJobTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void commitWaitsForRetries();
+};
+
+void UploadJobTest::commitWaitsForRetries() {
+    // 조각 셋 중 첫 조각만 실패하고, 나머지 둘은 그 조각의 재시도 대기 중에 끝난다
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QByteArray block(1024 * 1024, 'x');
+    for (qint64 written = 0; written < 2 * Protocol::kFileChunkBytes; written += block.size()) {
+        file.write(block);
+    }
+    file.write("tail");
+    file.flush();
+
+    FakeFileChannel channel(3);
+    channel.failOnce.insert(0);
+
+    UploadJob job("127.0.0.1", file.fileName());
+    job.setConnections(3);
+    connect(&job, &UploadJob::ticketNeeded, &job, [&job, &channel]() {
+        job.setTicket(channel.port(), "ticket", QVector<int>() << 0 << 1 << 2);
+    });
+    QSignalSpy finished(&job, &UploadJob::finished);
+    job.start();
+
+    QVERIFY(finished.wait(15000));
+    QCOMPARE(finished.first().at(0).toBool(), true);
+    QCOMPARE(channel.earlyCommits, 0);
+    QCOMPARE(channel.received.size(), 3);
+}
+
+QTEST_GUILESS_MAIN(UploadJobTest)
+#include "uploadjob_test.moc"
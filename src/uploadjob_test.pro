@@ -0,0 +1,25 @@
+QT += core network concurrent testlib
+QT -= gui
+
+# 조각 업로드 테스트 (로컬 가짜 파일 채널에 올린다)
+TARGET = uploadjob_test
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+# 빌드 디렉토리 설정
+DESTDIR = $$PWD/build/tests
+OBJECTS_DIR = $$PWD/build/tests/upload/.obj
+MOC_DIR = $$PWD/build/tests/upload/.moc
+
+INCLUDEPATH += $$PWD/common $$PWD/client
+
+SOURCES += \
+    tests/uploadjob_test.cpp \
+    client/filetransfer.cpp \
+    client/uploadjob.cpp \
+    common/protocol.cpp
+
+HEADERS += \
+    client/filetransfer.h \
+    client/uploadjob.h \
+    common/protocol.h